@@ -3,6 +3,8 @@
  * Copyright (c) 2011 The Chromium OS Authors.
  */
 
+#define _GNU_SOURCE
+
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -19,6 +21,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <linux/falloc.h>
 #include <linux/types.h>
 
 #include <asm/getopt.h>
@@ -56,6 +59,12 @@ off_t os_lseek(int fd, off_t offset, int whence)
 	return lseek(fd, offset, whence);
 }
 
+int os_punch_hole(int fd, off_t offset, off_t len)
+{
+	return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			 offset, len);
+}
+
 int os_open(const char *pathname, int os_flags)
 {
 	int flags;
@@ -17,26 +17,29 @@ static int blkc_show(cmd_tbl_t *cmdtp, int flag,
 
 	printf("hits: %u\n"
 	       "misses: %u\n"
+	       "blocks read ahead: %lu\n"
 	       "entries: %u\n"
-	       "max blocks/entry: %u\n"
-	       "max cache entries: %u\n",
-	       stats.hits, stats.misses, stats.entries,
-	       stats.max_blocks_per_entry, stats.max_entries);
+	       "blocks/entry: %u\n"
+	       "cache bytes: %lu\n"
+	       "max cache bytes: %lu\n",
+	       stats.hits, stats.misses, stats.read_ahead, stats.entries,
+	       stats.max_blocks_per_entry, stats.bytes, stats.max_bytes);
 	return 0;
 }
 
 static int blkc_configure(cmd_tbl_t *cmdtp, int flag,
 			  int argc, char * const argv[])
 {
-	unsigned blocks_per_entry, max_entries;
+	unsigned blocks_per_entry;
+	unsigned long max_bytes;
 	if (argc != 3)
 		return CMD_RET_USAGE;
 
 	blocks_per_entry = simple_strtoul(argv[1], 0, 0);
-	max_entries = simple_strtoul(argv[2], 0, 0);
-	blkcache_configure(blocks_per_entry, max_entries);
-	printf("changed to max of %u entries of %u blocks each\n",
-	       max_entries, blocks_per_entry);
+	max_bytes = simple_strtoul(argv[2], 0, 0);
+	blkcache_configure(blocks_per_entry, max_bytes);
+	printf("changed to max of %lu bytes in entries of %u blocks each\n",
+	       max_bytes, blocks_per_entry);
 	return 0;
 }
 
@@ -82,5 +85,5 @@ U_BOOT_CMD(
 	blkcache, 4, 0, do_blkcache,
 	"block cache diagnostics and control",
 	"show - show and reset statistics\n"
-	"blkcache configure blocks entries\n"
+	"blkcache configure blocks bytes\n"
 );
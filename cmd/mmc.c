@@ -332,6 +332,17 @@ static lbaint_t mmc_sparse_reserve(struct sparse_storage *info,
 	return blkcnt;
 }
 
+static lbaint_t mmc_sparse_discard(struct sparse_storage *info,
+				   lbaint_t blk, lbaint_t blkcnt)
+{
+	struct blk_desc *dev_desc = info->priv;
+
+	if (blk_ddiscard(dev_desc, blk, blkcnt) != blkcnt)
+		return 0;
+
+	return blkcnt;
+}
+
 static int do_mmc_sparse_write(cmd_tbl_t *cmdtp, int flag,
 			       int argc, char * const argv[])
 {
@@ -372,6 +383,8 @@ static int do_mmc_sparse_write(cmd_tbl_t *cmdtp, int flag,
 	sparse.size = dev_desc->lba - blk;
 	sparse.write = mmc_sparse_write;
 	sparse.reserve = mmc_sparse_reserve;
+	sparse.discard = mmc_sparse_discard;
+	sparse.discard_zeroes = dev_desc->discard_zeroes;
 	sparse.mssg = NULL;
 	sprintf(dest, "0x" LBAF, sparse.start * sparse.blksz);
 
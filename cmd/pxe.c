@@ -8,6 +8,7 @@
 #include <command.h>
 #include <fs.h>
 #include <net.h>
+#include <net/tftp.h>
 
 #include "pxe_utils.h"
 
@@ -38,66 +39,53 @@ static int do_get_tftp(cmd_tbl_t *cmdtp, const char *file_path, char *file_addr)
 }
 
 /*
- * Looks for a pxe file with a name based on the pxeuuid environment variable.
+ * Names pxelinux looks for a config file under, most specific first
  *
- * Returns 1 on success or < 0 on error.
+ * mac - buffer for the name based on the MAC address
+ * ip - buffers for the names based on the IP address
+ * names - the names, of which there are count
  */
-static int pxe_uuid_path(cmd_tbl_t *cmdtp, unsigned long pxefile_addr_r)
-{
-	char *uuid_str;
-
-	uuid_str = from_env("pxeuuid");
-
-	if (!uuid_str)
-		return -ENOENT;
-
-	return get_pxelinux_path(cmdtp, uuid_str, pxefile_addr_r);
-}
+struct pxe_config_names {
+	char mac[21];
+	char ip[8][9];
+	const char *names[2 + 8 + ARRAY_SIZE(pxe_default_paths) - 1];
+	int count;
+};
 
 /*
- * Looks for a pxe file with a name based on the 'ethaddr' environment
- * variable.
- *
- * Returns 1 on success or < 0 on error.
+ * Lists the names to look for a pxe file under, in order: one based on the
+ * pxeuuid environment variable, if defined, one based on the 'ethaddr'
+ * environment variable, if defined, then ones based on our IP address, and
+ * finally the default ones. See pxelinux documentation for details on what
+ * these file names look like. We match that exactly.
  */
-static int pxe_mac_path(cmd_tbl_t *cmdtp, unsigned long pxefile_addr_r)
+static void pxe_get_config_names(struct pxe_config_names *cfg)
 {
-	char mac_str[21];
-	int err;
-
-	err = format_mac_pxe(mac_str, sizeof(mac_str));
-
-	if (err < 0)
-		return err;
+	char *uuid_str;
+	int mask_pos, i;
 
-	return get_pxelinux_path(cmdtp, mac_str, pxefile_addr_r);
-}
+	cfg->count = 0;
 
-/*
- * Looks for pxe files with names based on our IP address. See pxelinux
- * documentation for details on what these file names look like.  We match
- * that exactly.
- *
- * Returns 1 on success or < 0 on error.
- */
-static int pxe_ipaddr_paths(cmd_tbl_t *cmdtp, unsigned long pxefile_addr_r)
-{
-	char ip_addr[9];
-	int mask_pos, err;
+	uuid_str = from_env("pxeuuid");
 
-	sprintf(ip_addr, "%08X", ntohl(net_ip.s_addr));
+	if (uuid_str)
+		cfg->names[cfg->count++] = uuid_str;
 
-	for (mask_pos = 7; mask_pos >= 0;  mask_pos--) {
-		err = get_pxelinux_path(cmdtp, ip_addr, pxefile_addr_r);
+	if (format_mac_pxe(cfg->mac, sizeof(cfg->mac)) > 0)
+		cfg->names[cfg->count++] = cfg->mac;
 
-		if (err > 0)
-			return err;
+	for (mask_pos = 8; mask_pos > 0; mask_pos--) {
+		char *ip_addr = cfg->ip[mask_pos - 1];
 
+		sprintf(ip_addr, "%08X", ntohl(net_ip.s_addr));
 		ip_addr[mask_pos] = '\0';
+		cfg->names[cfg->count++] = ip_addr;
 	}
 
-	return -ENOENT;
+	for (i = 0; pxe_default_paths[i]; i++)
+		cfg->names[cfg->count++] = pxe_default_paths[i];
 }
+
 /*
  * Entry point for the 'pxe get' command.
  * This Follows pxelinux's rules to download a config file from a tftp server.
@@ -115,11 +103,13 @@ static int pxe_ipaddr_paths(cmd_tbl_t *cmdtp, unsigned long pxefile_addr_r)
 static int
 do_pxe_get(cmd_tbl_t *cmdtp, int flag, int argc, char * const argv[])
 {
+	struct pxe_config_names cfg;
 	char *pxefile_addr_str;
 	unsigned long pxefile_addr_r;
-	int err, i = 0;
+	int err;
 
 	do_getfile = do_get_tftp;
+	do_getfiles = IS_ENABLED(CONFIG_TFTP_PARALLEL) ? tftp_get_files : NULL;
 
 	if (argc != 1)
 		return CMD_RET_USAGE;
@@ -138,23 +128,15 @@ do_pxe_get(cmd_tbl_t *cmdtp, int flag, int argc, char * const argv[])
 	 * Keep trying paths until we successfully get a file we're looking
 	 * for.
 	 */
-	if (pxe_uuid_path(cmdtp, pxefile_addr_r) > 0 ||
-	    pxe_mac_path(cmdtp, pxefile_addr_r) > 0 ||
-	    pxe_ipaddr_paths(cmdtp, pxefile_addr_r) > 0) {
+	pxe_get_config_names(&cfg);
+
+	if (get_pxelinux_first(cmdtp, cfg.names, cfg.count,
+			       pxefile_addr_r) > 0) {
 		printf("Config file found\n");
 
 		return 0;
 	}
 
-	while (pxe_default_paths[i]) {
-		if (get_pxelinux_path(cmdtp, pxe_default_paths[i],
-				      pxefile_addr_r) > 0) {
-			printf("Config file found\n");
-			return 0;
-		}
-		i++;
-	}
-
 	printf("Config file not found\n");
 
 	return 1;
@@ -173,6 +155,7 @@ do_pxe_boot(cmd_tbl_t *cmdtp, int flag, int argc, char * const argv[])
 	char *pxefile_addr_str;
 
 	do_getfile = do_get_tftp;
+	do_getfiles = IS_ENABLED(CONFIG_TFTP_PARALLEL) ? tftp_get_files : NULL;
 
 	if (argc == 1) {
 		pxefile_addr_str = from_env("pxefile_addr_r");
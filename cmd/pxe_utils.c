@@ -14,6 +14,8 @@
 #include <linux/ctype.h>
 #include <errno.h>
 #include <linux/list.h>
+#include <net.h>
+#include <net/tftp.h>
 
 #include <splash.h>
 #include <asm/io.h>
@@ -100,24 +102,23 @@ static int get_bootfile_path(const char *file_path, char *bootfile_path,
 }
 
 int (*do_getfile)(cmd_tbl_t *cmdtp, const char *file_path, char *file_addr);
+int (*do_getfiles)(struct tftp_file *files, int count, bool first);
 
 /*
  * As in pxelinux, paths to files referenced from files we retrieve are
- * relative to the location of bootfile. get_relfile takes such a path and
- * joins it with the bootfile path to get the full path to the target file. If
- * the bootfile path is NULL, we use file_path as is.
+ * relative to the location of bootfile. get_relpath takes such a path and
+ * joins it with the bootfile path to get the full path to the target file,
+ * stored in relfile, which must hold MAX_TFTP_PATH_LEN + 1 bytes. If the
+ * bootfile path is NULL, we use file_path as is.
  *
  * Returns 1 for success, or < 0 on error.
  */
-static int get_relfile(cmd_tbl_t *cmdtp, const char *file_path,
-		       unsigned long file_addr)
+static int get_relpath(const char *file_path, char *relfile)
 {
 	size_t path_len;
-	char relfile[MAX_TFTP_PATH_LEN + 1];
-	char addr_buf[18];
 	int err;
 
-	err = get_bootfile_path(file_path, relfile, sizeof(relfile));
+	err = get_bootfile_path(file_path, relfile, MAX_TFTP_PATH_LEN + 1);
 
 	if (err < 0)
 		return err;
@@ -133,6 +134,27 @@ static int get_relfile(cmd_tbl_t *cmdtp, const char *file_path,
 
 	strcat(relfile, file_path);
 
+	return 1;
+}
+
+/*
+ * Retrieves the file at file_path, joined with the bootfile path as
+ * described for get_relpath, to file_addr.
+ *
+ * Returns 1 for success, or < 0 on error.
+ */
+static int get_relfile(cmd_tbl_t *cmdtp, const char *file_path,
+		       unsigned long file_addr)
+{
+	char relfile[MAX_TFTP_PATH_LEN + 1];
+	char addr_buf[18];
+	int err;
+
+	err = get_relpath(file_path, relfile);
+
+	if (err < 0)
+		return err;
+
 	printf("Retrieving file: %s\n", relfile);
 
 	sprintf(addr_buf, "%lx", file_addr);
@@ -140,6 +162,57 @@ static int get_relfile(cmd_tbl_t *cmdtp, const char *file_path,
 	return do_getfile(cmdtp, relfile, addr_buf);
 }
 
+/*
+ * Retrieves several files at once using do_getfiles. The name of each file
+ * is joined with the bootfile path as described for get_relpath. If 'first'
+ * is set, only the first of the files that exists is retrieved.
+ *
+ * Returns the index of the file retrieved if 'first' is set, or 0 if all the
+ * files were retrieved; < 0 on error.
+ */
+static int get_relfiles(struct tftp_file *files, int count, bool first)
+{
+	const char *names[TFTP_MAX_FILES];
+	char (*relfiles)[MAX_TFTP_PATH_LEN + 1];
+	int i, err = 0;
+
+	if (count > TFTP_MAX_FILES)
+		return -E2BIG;
+
+	relfiles = malloc(count * sizeof(*relfiles));
+
+	if (!relfiles)
+		return -ENOMEM;
+
+	/* Files after one whose path is bad are not looked for at all */
+	for (i = 0; i < count; i++) {
+		names[i] = files[i].name;
+		files[i].name = relfiles[i];
+		files[i].err = -ECANCELED;
+		relfiles[i][0] = '\0';
+	}
+
+	for (i = 0; i < count && err >= 0; i++) {
+		err = get_relpath(names[i], relfiles[i]);
+		files[i].err = err < 0 ? err : 0;
+		if (err >= 0 && !first)
+			printf("Retrieving file: %s\n", relfiles[i]);
+	}
+
+	if (err >= 0)
+		err = do_getfiles(files, count, first);
+
+	if (err >= 0 && first)
+		printf("Retrieved file: %s\n", relfiles[err]);
+
+	for (i = 0; i < count; i++)
+		files[i].name = names[i];
+
+	free(relfiles);
+
+	return err;
+}
+
 /*
  * Retrieve the file at 'file_path' to the locate given by 'file_addr'. If
  * 'bootfile' was specified in the environment, the path to bootfile will be
@@ -205,6 +278,66 @@ int get_pxelinux_path(cmd_tbl_t *cmdtp, const char *file,
 	return get_pxe_file(cmdtp, path, pxefile_addr_r);
 }
 
+/*
+ * Retrieves the first of 'files' that exists in the 'pxelinux.cfg' folder,
+ * trying them in order. When do_getfiles is available, the server is asked
+ * about all of them at once, so that we don't wait for each "file not found"
+ * in turn.
+ *
+ * Returns 1 on success or < 0 on error.
+ */
+int get_pxelinux_first(cmd_tbl_t *cmdtp, const char *const files[], int count,
+		       unsigned long pxefile_addr_r)
+{
+	char (*paths)[MAX_TFTP_PATH_LEN + 1];
+	struct tftp_file tfiles[TFTP_MAX_FILES];
+	int i, n = 0, ret;
+	char *buf;
+
+	if (!do_getfiles || count > TFTP_MAX_FILES) {
+		for (i = 0; i < count; i++) {
+			if (get_pxelinux_path(cmdtp, files[i],
+					      pxefile_addr_r) > 0)
+				return 1;
+		}
+
+		return -ENOENT;
+	}
+
+	paths = malloc(count * sizeof(*paths));
+
+	if (!paths)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		if (strlen(PXELINUX_DIR) + strlen(files[i]) >
+		    MAX_TFTP_PATH_LEN) {
+			printf("path (%s%s) too long, skipping\n",
+			       PXELINUX_DIR, files[i]);
+			continue;
+		}
+
+		sprintf(paths[n], PXELINUX_DIR "%s", files[i]);
+		tfiles[n].name = paths[n];
+		tfiles[n].addr = pxefile_addr_r;
+		n++;
+	}
+
+	ret = get_relfiles(tfiles, n, true);
+
+	if (ret >= 0) {
+		/* the file comes without a NUL byte at the end */
+		buf = map_sysmem(pxefile_addr_r + tfiles[ret].size, 1);
+		*buf = '\0';
+		unmap_sysmem(buf);
+		ret = 1;
+	}
+
+	free(paths);
+
+	return ret;
+}
+
 /*
  * Wrapper to make it easier to store the file at file_path in the location
  * specified by envaddr_name. file_path will be joined to the bootfile path,
@@ -327,6 +460,71 @@ static int label_localboot(struct pxe_label *label)
 	return run_command_list(localcmd, strlen(localcmd), 0);
 }
 
+/*
+ * Retrieves the initrd, kernel and fdt of a label, to the locations given by
+ * the 'ramdisk_addr_r', 'kernel_addr_r' and 'fdt_addr_r' environment
+ * variables. The initrd and fdt are skipped if their paths are NULL. When
+ * do_getfiles is available, all the files are retrieved at once.
+ *
+ * Returns 1 on success, with initrd_size set to the size of the initrd, or
+ * < 0 on error.
+ */
+static int label_get_files(cmd_tbl_t *cmdtp, struct pxe_label *label,
+			   const char *fdtfile, ulong *initrd_size)
+{
+	const struct {
+		const char *path;
+		const char *envaddr;
+		const char *what;
+	} list[] = {
+		{ label->initrd, "ramdisk_addr_r", "initrd" },
+		{ label->kernel, "kernel_addr_r", "kernel" },
+		{ fdtfile, "fdt_addr_r", "fdt" },
+	};
+	struct tftp_file files[ARRAY_SIZE(list)];
+	int which[ARRAY_SIZE(list)];
+	int i, count = 0, err = 0;
+	char *envaddr;
+
+	for (i = 0; i < ARRAY_SIZE(list) && err >= 0; i++) {
+		if (!list[i].path)
+			continue;
+
+		if (!do_getfiles) {
+			err = get_relfile_envaddr(cmdtp, list[i].path,
+						  list[i].envaddr);
+			files[count].size = env_get_hex("filesize", 0);
+		} else {
+			envaddr = from_env(list[i].envaddr);
+			if (!envaddr)
+				err = -ENOENT;
+			else if (strict_strtoul(envaddr, 16,
+						&files[count].addr) < 0)
+				err = -EINVAL;
+			files[count].name = list[i].path;
+		}
+
+		files[count].err = err < 0 ? err : 0;
+		which[count++] = i;
+	}
+
+	if (err >= 0 && do_getfiles)
+		err = get_relfiles(files, count, false);
+
+	for (i = 0; i < count; i++) {
+		if (files[i].err < 0) {
+			printf("Skipping %s for failure retrieving %s\n",
+			       label->name, list[which[i]].what);
+			return files[i].err;
+		}
+
+		if (which[i] == 0)
+			*initrd_size = files[i].size;
+	}
+
+	return err < 0 ? err : 1;
+}
+
 /*
  * Boot according to the contents of a pxe_label.
  *
@@ -349,10 +547,14 @@ static int label_boot(cmd_tbl_t *cmdtp, struct pxe_label *label)
 	char mac_str[29] = "";
 	char ip_str[68] = "";
 	char *fit_addr = NULL;
+	char *fdtfile = NULL;
+	char *fdtfilefree = NULL;
 	int bootm_argc = 2;
 	int len = 0;
 	ulong kernel_addr;
+	ulong initrd_size = 0;
 	void *buf;
+	int err;
 
 	label_print(label);
 
@@ -370,81 +572,6 @@ static int label_boot(cmd_tbl_t *cmdtp, struct pxe_label *label)
 		return 1;
 	}
 
-	if (label->initrd) {
-		if (get_relfile_envaddr(cmdtp, label->initrd, "ramdisk_addr_r") < 0) {
-			printf("Skipping %s for failure retrieving initrd\n",
-			       label->name);
-			return 1;
-		}
-
-		bootm_argv[2] = initrd_str;
-		strncpy(bootm_argv[2], env_get("ramdisk_addr_r"), 18);
-		strcat(bootm_argv[2], ":");
-		strncat(bootm_argv[2], env_get("filesize"), 9);
-		bootm_argc = 3;
-	}
-
-	if (get_relfile_envaddr(cmdtp, label->kernel, "kernel_addr_r") < 0) {
-		printf("Skipping %s for failure retrieving kernel\n",
-		       label->name);
-		return 1;
-	}
-
-	if (label->ipappend & 0x1) {
-		sprintf(ip_str, " ip=%s:%s:%s:%s",
-			env_get("ipaddr"), env_get("serverip"),
-			env_get("gatewayip"), env_get("netmask"));
-	}
-
-#ifdef CONFIG_CMD_NET
-	if (label->ipappend & 0x2) {
-		int err;
-
-		strcpy(mac_str, " BOOTIF=");
-		err = format_mac_pxe(mac_str + 8, sizeof(mac_str) - 8);
-		if (err < 0)
-			mac_str[0] = '\0';
-	}
-#endif
-
-	if ((label->ipappend & 0x3) || label->append) {
-		char bootargs[CONFIG_SYS_CBSIZE] = "";
-		char finalbootargs[CONFIG_SYS_CBSIZE];
-
-		if (strlen(label->append ?: "") +
-		    strlen(ip_str) + strlen(mac_str) + 1 > sizeof(bootargs)) {
-			printf("bootarg overflow %zd+%zd+%zd+1 > %zd\n",
-			       strlen(label->append ?: ""),
-			       strlen(ip_str), strlen(mac_str),
-			       sizeof(bootargs));
-			return 1;
-		}
-
-		if (label->append)
-			strncpy(bootargs, label->append, sizeof(bootargs));
-
-		strcat(bootargs, ip_str);
-		strcat(bootargs, mac_str);
-
-		cli_simple_process_macros(bootargs, finalbootargs);
-		env_set("bootargs", finalbootargs);
-		printf("append: %s\n", finalbootargs);
-	}
-
-	bootm_argv[1] = env_get("kernel_addr_r");
-	/* for FIT, append the configuration identifier */
-	if (label->config) {
-		int len = strlen(bootm_argv[1]) + strlen(label->config) + 1;
-
-		fit_addr = malloc(len);
-		if (!fit_addr) {
-			printf("malloc fail (FIT address)\n");
-			return 1;
-		}
-		snprintf(fit_addr, len, "%s%s", bootm_argv[1], label->config);
-		bootm_argv[1] = fit_addr;
-	}
-
 	/*
 	 * fdt usage is optional:
 	 * It handles the following scenarios. All scenarios are exclusive
@@ -462,9 +589,6 @@ static int label_boot(cmd_tbl_t *cmdtp, struct pxe_label *label)
 
 	/* if fdt label is defined then get fdt from server */
 	if (bootm_argv[3]) {
-		char *fdtfile = NULL;
-		char *fdtfilefree = NULL;
-
 		if (label->fdt) {
 			fdtfile = label->fdt;
 		} else if (label->fdtdir) {
@@ -503,7 +627,7 @@ static int label_boot(cmd_tbl_t *cmdtp, struct pxe_label *label)
 			fdtfilefree = malloc(len);
 			if (!fdtfilefree) {
 				printf("malloc fail (FDT filename)\n");
-				goto cleanup;
+				return 1;
 			}
 
 			snprintf(fdtfilefree, len, "%s%s%s%s%s%s",
@@ -511,19 +635,73 @@ static int label_boot(cmd_tbl_t *cmdtp, struct pxe_label *label)
 			fdtfile = fdtfilefree;
 		}
 
-		if (fdtfile) {
-			int err = get_relfile_envaddr(cmdtp, fdtfile,
-						      "fdt_addr_r");
-
-			free(fdtfilefree);
-			if (err < 0) {
-				printf("Skipping %s for failure retrieving fdt\n",
-				       label->name);
-				goto cleanup;
-			}
-		} else {
+		if (!fdtfile)
 			bootm_argv[3] = NULL;
+	}
+
+	err = label_get_files(cmdtp, label, fdtfile, &initrd_size);
+	free(fdtfilefree);
+	if (err < 0)
+		return 1;
+
+	if (label->initrd) {
+		bootm_argv[2] = initrd_str;
+		snprintf(initrd_str, sizeof(initrd_str), "%s:%lx",
+			 env_get("ramdisk_addr_r"), initrd_size);
+		bootm_argc = 3;
+	}
+
+	if (label->ipappend & 0x1) {
+		sprintf(ip_str, " ip=%s:%s:%s:%s",
+			env_get("ipaddr"), env_get("serverip"),
+			env_get("gatewayip"), env_get("netmask"));
+	}
+
+#ifdef CONFIG_CMD_NET
+	if (label->ipappend & 0x2) {
+		strcpy(mac_str, " BOOTIF=");
+		err = format_mac_pxe(mac_str + 8, sizeof(mac_str) - 8);
+		if (err < 0)
+			mac_str[0] = '\0';
+	}
+#endif
+
+	if ((label->ipappend & 0x3) || label->append) {
+		char bootargs[CONFIG_SYS_CBSIZE] = "";
+		char finalbootargs[CONFIG_SYS_CBSIZE];
+
+		if (strlen(label->append ?: "") +
+		    strlen(ip_str) + strlen(mac_str) + 1 > sizeof(bootargs)) {
+			printf("bootarg overflow %zd+%zd+%zd+1 > %zd\n",
+			       strlen(label->append ?: ""),
+			       strlen(ip_str), strlen(mac_str),
+			       sizeof(bootargs));
+			return 1;
 		}
+
+		if (label->append)
+			strncpy(bootargs, label->append, sizeof(bootargs));
+
+		strcat(bootargs, ip_str);
+		strcat(bootargs, mac_str);
+
+		cli_simple_process_macros(bootargs, finalbootargs);
+		env_set("bootargs", finalbootargs);
+		printf("append: %s\n", finalbootargs);
+	}
+
+	bootm_argv[1] = env_get("kernel_addr_r");
+	/* for FIT, append the configuration identifier */
+	if (label->config) {
+		int len = strlen(bootm_argv[1]) + strlen(label->config) + 1;
+
+		fit_addr = malloc(len);
+		if (!fit_addr) {
+			printf("malloc fail (FIT address)\n");
+			return 1;
+		}
+		snprintf(fit_addr, len, "%s%s", bootm_argv[1], label->config);
+		bootm_argv[1] = fit_addr;
 	}
 
 	if (!bootm_argv[3])
@@ -551,7 +729,6 @@ static int label_boot(cmd_tbl_t *cmdtp, struct pxe_label *label)
 #endif
 	unmap_sysmem(buf);
 
-cleanup:
 	if (fit_addr)
 		free(fit_addr);
 	return 1;
@@ -76,11 +76,21 @@ extern bool is_pxe;
 
 extern int (*do_getfile)(cmd_tbl_t *cmdtp, const char *file_path,
 			 char *file_addr);
+
+struct tftp_file;
+
+/*
+ * If set, retrieves several files at once, as tftp_get_files() does. Several
+ * files are retrieved with do_getfile one after the other otherwise.
+ */
+extern int (*do_getfiles)(struct tftp_file *files, int count, bool first);
 void destroy_pxe_menu(struct pxe_menu *cfg);
 int get_pxe_file(cmd_tbl_t *cmdtp, const char *file_path,
 		 unsigned long file_addr);
 int get_pxelinux_path(cmd_tbl_t *cmdtp, const char *file,
 		      unsigned long pxefile_addr_r);
+int get_pxelinux_first(cmd_tbl_t *cmdtp, const char *const files[], int count,
+		       unsigned long pxefile_addr_r);
 void handle_pxe_menu(cmd_tbl_t *cmdtp, struct pxe_menu *cfg);
 struct pxe_menu *parse_pxefile(cmd_tbl_t *cmdtp, unsigned long menucfg);
 int format_mac_pxe(char *outbuf, size_t outbuf_len);
@@ -61,6 +61,7 @@ static int do_sysboot(cmd_tbl_t *cmdtp, int flag, int argc, char * const argv[])
 	int prompt = 0;
 
 	is_pxe = false;
+	do_getfiles = NULL;
 
 	if (argc > 1 && strstr(argv[1], "-p")) {
 		prompt = 1;
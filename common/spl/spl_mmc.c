@@ -351,6 +351,12 @@ int spl_mmc_load(struct spl_image_info *spl_image,
 #endif
 			return err;
 		}
+#if CONFIG_IS_ENABLED(MMC_HANDOFF)
+		/* Let U-Boot proper carry on with the card */
+		err = mmc_write_handoff(mmc);
+		if (err)
+			debug("spl: mmc handoff failed with error: %d\n", err);
+#endif
 	}
 
 	boot_mode = spl_boot_mode(bootdev->boot_device);
@@ -7,6 +7,7 @@
 #include <common.h>
 #include <blk.h>
 #include <dm.h>
+#include <fs.h>
 #include <dm/device-internal.h>
 #include <dm/lists.h>
 #include <dm/uclass-internal.h>
@@ -337,12 +338,16 @@ ulong blk_write_devnum(enum if_type if_type, int devnum, lbaint_t start,
 int blk_select_hwpart(struct udevice *dev, int hwpart)
 {
 	const struct blk_ops *ops = blk_get_ops(dev);
+	struct blk_desc *desc = dev_get_uclass_platdata(dev);
 
 	if (!ops)
 		return -ENOSYS;
 	if (!ops->select_hwpart)
 		return 0;
 
+	if (desc->hwpart != hwpart)
+		fs_invalidate(desc);
+
 	return ops->select_hwpart(dev, hwpart);
 }
 
@@ -431,7 +436,9 @@ unsigned long blk_dread(struct blk_desc *block_dev, lbaint_t start,
 {
 	struct udevice *dev = block_dev->bdev;
 	const struct blk_ops *ops = blk_get_ops(dev);
+	lbaint_t first, count;
 	ulong blks_read;
+	char *buf;
 
 	if (!ops->read)
 		return -ENOSYS;
@@ -439,6 +446,19 @@ unsigned long blk_dread(struct blk_desc *block_dev, lbaint_t start,
 	if (blkcache_read(block_dev->if_type, block_dev->devnum,
 			  start, blkcnt, block_dev->blksz, buffer))
 		return blkcnt;
+
+	/* read the blocks around as well, for the next reads to hit */
+	buf = blkcache_read_ahead(block_dev->if_type, block_dev->devnum,
+				  start, blkcnt, block_dev->blksz,
+				  block_dev->lba, &first, &count);
+	if (buf && ops->read(dev, first, count, buf) == count) {
+		blkcache_fill(block_dev->if_type, block_dev->devnum,
+			      first, count, block_dev->blksz, buf);
+		memcpy(buffer, buf + (start - first) * block_dev->blksz,
+		       blkcnt * block_dev->blksz);
+		return blkcnt;
+	}
+
 	blks_read = ops->read(dev, start, blkcnt, buffer);
 	if (blks_read == blkcnt)
 		blkcache_fill(block_dev->if_type, block_dev->devnum,
@@ -457,6 +477,7 @@ unsigned long blk_dwrite(struct blk_desc *block_dev, lbaint_t start,
 		return -ENOSYS;
 
 	blkcache_invalidate(block_dev->if_type, block_dev->devnum);
+	fs_invalidate(block_dev);
 	return ops->write(dev, start, blkcnt, buffer);
 }
 
@@ -470,9 +491,73 @@ unsigned long blk_derase(struct blk_desc *block_dev, lbaint_t start,
 		return -ENOSYS;
 
 	blkcache_invalidate(block_dev->if_type, block_dev->devnum);
+	fs_invalidate(block_dev);
 	return ops->erase(dev, start, blkcnt);
 }
 
+unsigned long blk_ddiscard(struct blk_desc *block_dev, lbaint_t start,
+			   lbaint_t blkcnt)
+{
+	struct udevice *dev = block_dev->bdev;
+	const struct blk_ops *ops = blk_get_ops(dev);
+
+	if (!ops->discard)
+		return -ENOSYS;
+
+	blkcache_invalidate(block_dev->if_type, block_dev->devnum);
+	fs_invalidate(block_dev);
+	return ops->discard(dev, start, blkcnt);
+}
+
+int blk_submit_read(struct blk_desc *block_dev, lbaint_t start,
+		    lbaint_t blkcnt, void *buffer, struct blk_req *req)
+{
+	struct udevice *dev = block_dev->bdev;
+	const struct blk_ops *ops = blk_get_ops(dev);
+
+	req->start = start;
+	req->blkcnt = blkcnt;
+	req->buffer = buffer;
+	req->done = false;
+
+	if (ops->submit_read &&
+	    !blkcache_read(block_dev->if_type, block_dev->devnum,
+			   start, blkcnt, block_dev->blksz, buffer))
+		return ops->submit_read(dev, req);
+
+	/* the blocks are cached or the driver can only read them at once */
+	req->result = blk_dread(block_dev, start, blkcnt, buffer);
+	req->done = true;
+
+	return 0;
+}
+
+long blk_poll(struct blk_desc *block_dev, struct blk_req *req)
+{
+	struct udevice *dev = block_dev->bdev;
+	const struct blk_ops *ops = blk_get_ops(dev);
+	int ret;
+
+	if (!req->done && ops->poll) {
+		ret = ops->poll(dev);
+		if (ret)
+			return ret;
+	}
+
+	return req->done ? req->result : -EINPROGRESS;
+}
+
+long blk_wait(struct blk_desc *block_dev, struct blk_req *req)
+{
+	long ret;
+
+	do {
+		ret = blk_poll(block_dev, req);
+	} while (ret == -EINPROGRESS);
+
+	return ret;
+}
+
 int blk_get_from_parent(struct udevice *parent, struct udevice **devp)
 {
 	struct udevice *dev;
@@ -640,18 +725,29 @@ int blk_unbind_all(int if_type)
 
 static int blk_post_probe(struct udevice *dev)
 {
-#if defined(CONFIG_PARTITIONS) && defined(CONFIG_HAVE_BLOCK_DEVICE)
 	struct blk_desc *desc = dev_get_uclass_platdata(dev);
 
+	/* reads made at once only ever hold one request */
+	if (!desc->queue_depth)
+		desc->queue_depth = 1;
+#if defined(CONFIG_PARTITIONS) && defined(CONFIG_HAVE_BLOCK_DEVICE)
 	part_init(desc);
 #endif
 
 	return 0;
 }
 
+static int blk_pre_remove(struct udevice *dev)
+{
+	fs_invalidate(dev_get_uclass_platdata(dev));
+
+	return 0;
+}
+
 UCLASS_DRIVER(blk) = {
 	.id		= UCLASS_BLK,
 	.name		= "blk",
 	.post_probe	= blk_post_probe,
+	.pre_remove	= blk_pre_remove,
 	.per_device_platdata_auto_alloc_size = sizeof(struct blk_desc),
 };
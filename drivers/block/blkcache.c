@@ -6,19 +6,32 @@
  */
 #include <config.h>
 #include <common.h>
+#include <div64.h>
 #include <malloc.h>
+#include <memalign.h>
 #include <part.h>
 #include <linux/ctype.h>
 #include <linux/list.h>
 
+/*
+ * The cache holds entries of max_blocks_per_entry blocks, each starting at a
+ * multiple of that number. Entries are found through a hash table and the
+ * least recently used ones are dropped when the memory budget is reached.
+ */
+#define BLKCACHE_HASH_SIZE	256
+
+/* Most entries read ahead of a sequential read */
+#define BLKCACHE_MAX_AHEAD	16
+
 struct block_cache_node {
 	struct list_head lh;
+	struct hlist_node hash;
 	int iftype;
 	int devnum;
 	lbaint_t start;
 	lbaint_t blkcnt;
 	unsigned long blksz;
-	char *cache;
+	char cache[];
 };
 
 #ifndef CONFIG_M68K
@@ -26,12 +39,28 @@ static LIST_HEAD(block_cache);
 #else
 static struct list_head block_cache;
 #endif
+static struct hlist_head block_cache_hash[BLKCACHE_HASH_SIZE];
 
 static struct block_cache_stats _stats = {
 	.max_blocks_per_entry = 8,
-	.max_entries = 32
+	.max_bytes = CONFIG_BLOCK_CACHE_SIZE * 1024,
 };
 
+/*
+ * The last read, to spot sequential ones, and the number of entries to read
+ * ahead of the next one which misses
+ */
+static struct {
+	int iftype;
+	int devnum;
+	lbaint_t next;
+	lbaint_t ahead;
+} stream;
+
+/* Where reads covering several entries are made */
+static void *read_buf;
+static ulong read_buf_size;
+
 #ifdef CONFIG_M68K
 int blkcache_init(void)
 {
@@ -41,18 +70,35 @@ int blkcache_init(void)
 }
 #endif
 
+/* The first block of the entry holding @blk */
+static lbaint_t entry_start(lbaint_t blk)
+{
+	u64 n = blk;
+
+	return blk - do_div(n, _stats.max_blocks_per_entry);
+}
+
+static struct hlist_head *cache_bucket(int iftype, int devnum, lbaint_t start)
+{
+	ulong hash = (ulong)lldiv(start, _stats.max_blocks_per_entry);
+
+	hash ^= (ulong)(iftype << 4 ^ devnum) * 0x9e37;
+
+	return &block_cache_hash[hash % BLKCACHE_HASH_SIZE];
+}
+
 static struct block_cache_node *cache_find(int iftype, int devnum,
-					   lbaint_t start, lbaint_t blkcnt,
-					   unsigned long blksz)
+					   lbaint_t start, unsigned long blksz)
 {
 	struct block_cache_node *node;
+	struct hlist_node *pos;
 
-	list_for_each_entry(node, &block_cache, lh)
+	hlist_for_each_entry(node, pos, cache_bucket(iftype, devnum, start),
+			     hash)
 		if ((node->iftype == iftype) &&
 		    (node->devnum == devnum) &&
 		    (node->blksz == blksz) &&
-		    (node->start <= start) &&
-		    (node->start + node->blkcnt >= start + blkcnt)) {
+		    (node->start == start)) {
 			if (block_cache.next != &node->lh) {
 				/* maintain MRU ordering */
 				list_del(&node->lh);
@@ -63,79 +109,182 @@ static struct block_cache_node *cache_find(int iftype, int devnum,
 	return 0;
 }
 
+static void cache_drop(struct block_cache_node *node)
+{
+	debug("drop: start " LBAF ", count " LBAFU "\n",
+	      node->start, node->blkcnt);
+	list_del(&node->lh);
+	hlist_del(&node->hash);
+	_stats.bytes -= node->blkcnt * node->blksz;
+	_stats.entries--;
+	free(node);
+}
+
+static void cache_drop_all(void)
+{
+	while (!list_empty(&block_cache))
+		cache_drop(list_first_entry(&block_cache,
+					    struct block_cache_node, lh));
+}
+
+/*
+ * Check whether a read goes through the cache. Bulk reads of more than an
+ * entry do not, so that they do not evict the metadata kept there.
+ */
+static bool cache_wanted(lbaint_t blkcnt, unsigned long blksz)
+{
+	lbaint_t per_entry = _stats.max_blocks_per_entry;
+
+	return per_entry && blkcnt <= per_entry &&
+		per_entry * blksz <= _stats.max_bytes;
+}
+
 int blkcache_read(int iftype, int devnum,
 		  lbaint_t start, lbaint_t blkcnt,
 		  unsigned long blksz, void *buffer)
 {
-	struct block_cache_node *node = cache_find(iftype, devnum, start,
-						   blkcnt, blksz);
-	if (node) {
-		const char *src = node->cache + (start - node->start) * blksz;
-		memcpy(buffer, src, blksz * blkcnt);
-		debug("hit: start " LBAF ", count " LBAFU "\n",
-		      start, blkcnt);
-		++_stats.hits;
-		return 1;
+	lbaint_t per_entry = _stats.max_blocks_per_entry;
+	struct block_cache_node *node;
+	lbaint_t blk, first, count;
+	char *dst = buffer;
+
+	if (!cache_wanted(blkcnt, blksz))
+		return 0;
+
+	/* a read starting where the last one ended looks sequential */
+	if (stream.iftype != iftype || stream.devnum != devnum ||
+	    stream.next != start)
+		stream.ahead = 0;
+	stream.iftype = iftype;
+	stream.devnum = devnum;
+	stream.next = start + blkcnt;
+
+	/* all the entries covering the blocks must be there */
+	for (blk = start; blk < start + blkcnt; blk += count) {
+		first = entry_start(blk);
+		count = min(first + per_entry, start + blkcnt) - blk;
+		if (!cache_find(iftype, devnum, first, blksz)) {
+			debug("miss: start " LBAF ", count " LBAFU "\n",
+			      start, blkcnt);
+			++_stats.misses;
+			return 0;
+		}
+	}
+
+	for (blk = start; blk < start + blkcnt; blk += count) {
+		first = entry_start(blk);
+		count = min(first + per_entry, start + blkcnt) - blk;
+		node = cache_find(iftype, devnum, first, blksz);
+		memcpy(dst, node->cache + (blk - first) * blksz,
+		       count * blksz);
+		dst += count * blksz;
 	}
 
-	debug("miss: start " LBAF ", count " LBAFU "\n",
+	debug("hit: start " LBAF ", count " LBAFU "\n",
 	      start, blkcnt);
-	++_stats.misses;
-	return 0;
+	++_stats.hits;
+	return 1;
+}
+
+void *blkcache_read_ahead(int iftype, int devnum,
+			  lbaint_t start, lbaint_t blkcnt,
+			  unsigned long blksz, lbaint_t lba,
+			  lbaint_t *firstp, lbaint_t *countp)
+{
+	lbaint_t per_entry = _stats.max_blocks_per_entry;
+	lbaint_t first, end, ahead;
+	ulong bytes;
+
+	if (!cache_wanted(blkcnt, blksz))
+		return NULL;
+
+	/* round out to whole entries, then add the read-ahead */
+	first = entry_start(start);
+	end = entry_start(start + blkcnt + per_entry - 1);
+	/* leave room in the cache for other things */
+	ahead = min(stream.ahead * per_entry,
+		    (lbaint_t)(_stats.max_bytes / 4 / blksz));
+	ahead = entry_start(ahead);
+	end += ahead;
+	if (end > lba) {
+		/* the last entry of the device would not be whole */
+		end = entry_start(lba);
+		if (end < start + blkcnt)
+			return NULL;
+		ahead = 0;
+	}
+
+	/* read more ahead next time if the reads go on in sequence */
+	stream.ahead = stream.ahead ? stream.ahead * 2 : 1;
+	stream.ahead = min(stream.ahead, (lbaint_t)BLKCACHE_MAX_AHEAD);
+
+	if (first == start && end == start + blkcnt)
+		return NULL;
+
+	bytes = (end - first) * blksz;
+	if (bytes > read_buf_size) {
+		free(read_buf);
+		read_buf_size = 0;
+		read_buf = malloc_cache_aligned(bytes);
+		if (!read_buf)
+			return NULL;
+		read_buf_size = bytes;
+	}
+
+	_stats.read_ahead += ahead;
+	*firstp = first;
+	*countp = end - first;
+
+	return read_buf;
 }
 
 void blkcache_fill(int iftype, int devnum,
 		   lbaint_t start, lbaint_t blkcnt,
 		   unsigned long blksz, void const *buffer)
 {
-	lbaint_t bytes;
+	lbaint_t per_entry = _stats.max_blocks_per_entry;
+	const char *src = buffer;
 	struct block_cache_node *node;
+	lbaint_t first, bytes;
 
-	/* don't cache big stuff */
-	if (blkcnt > _stats.max_blocks_per_entry)
+	/* don't cache big stuff, unless read around a small read on purpose */
+	if (buffer != read_buf && !cache_wanted(blkcnt, blksz))
 		return;
 
-	if (_stats.max_entries == 0)
-		return;
+	bytes = blksz * per_entry;
+
+	/* only whole entries are kept */
+	for (first = entry_start(start + per_entry - 1);
+	     first + per_entry <= start + blkcnt; first += per_entry) {
+		if (cache_find(iftype, devnum, first, blksz))
+			continue;
 
-	bytes = blksz * blkcnt;
-	if (_stats.max_entries <= _stats.entries) {
 		/* pop LRU */
-		node = (struct block_cache_node *)block_cache.prev;
-		list_del(&node->lh);
-		_stats.entries--;
-		debug("drop: start " LBAF ", count " LBAFU "\n",
-		      node->start, node->blkcnt);
-		if (node->blkcnt * node->blksz < bytes) {
-			free(node->cache);
-			node->cache = 0;
-		}
-	} else {
-		node = malloc(sizeof(*node));
-		if (!node)
-			return;
-		node->cache = 0;
-	}
+		while (_stats.entries &&
+		       _stats.bytes + bytes > _stats.max_bytes)
+			cache_drop(list_last_entry(&block_cache,
+						   struct block_cache_node,
+						   lh));
 
-	if (!node->cache) {
-		node->cache = malloc(bytes);
-		if (!node->cache) {
-			free(node);
+		node = malloc(sizeof(*node) + bytes);
+		if (!node)
 			return;
-		}
-	}
 
-	debug("fill: start " LBAF ", count " LBAFU "\n",
-	      start, blkcnt);
+		debug("fill: start " LBAF ", count " LBAFU "\n",
+		      first, per_entry);
 
-	node->iftype = iftype;
-	node->devnum = devnum;
-	node->start = start;
-	node->blkcnt = blkcnt;
-	node->blksz = blksz;
-	memcpy(node->cache, buffer, bytes);
-	list_add(&node->lh, &block_cache);
-	_stats.entries++;
+		node->iftype = iftype;
+		node->devnum = devnum;
+		node->start = first;
+		node->blkcnt = per_entry;
+		node->blksz = blksz;
+		memcpy(node->cache, src + (first - start) * blksz, bytes);
+		list_add(&node->lh, &block_cache);
+		hlist_add_head(&node->hash,
+			       cache_bucket(iftype, devnum, first));
+		_stats.bytes += bytes;
+		_stats.entries++;
+	}
 }
 
 void blkcache_invalidate(int iftype, int devnum)
@@ -146,35 +295,32 @@ void blkcache_invalidate(int iftype, int devnum)
 	list_for_each_safe(entry, n, &block_cache) {
 		node = (struct block_cache_node *)entry;
 		if ((node->iftype == iftype) &&
-		    (node->devnum == devnum)) {
-			list_del(entry);
-			free(node->cache);
-			free(node);
-			--_stats.entries;
-		}
+		    (node->devnum == devnum))
+			cache_drop(node);
 	}
+
+	if (stream.iftype == iftype && stream.devnum == devnum)
+		stream.ahead = 0;
 }
 
-void blkcache_configure(unsigned blocks, unsigned entries)
+void blkcache_configure(unsigned blocks, unsigned long bytes)
 {
-	struct block_cache_node *node;
 	if ((blocks != _stats.max_blocks_per_entry) ||
-	    (entries != _stats.max_entries)) {
+	    (bytes < _stats.max_bytes)) {
 		/* invalidate cache */
-		while (!list_empty(&block_cache)) {
-			node = (struct block_cache_node *)block_cache.next;
-			list_del(&node->lh);
-			free(node->cache);
-			free(node);
-		}
-		_stats.entries = 0;
+		cache_drop_all();
+		free(read_buf);
+		read_buf = NULL;
+		read_buf_size = 0;
 	}
 
 	_stats.max_blocks_per_entry = blocks;
-	_stats.max_entries = entries;
+	_stats.max_bytes = bytes;
 
 	_stats.hits = 0;
 	_stats.misses = 0;
+	_stats.read_ahead = 0;
+	stream.ahead = 0;
 }
 
 void blkcache_stats(struct block_cache_stats *stats)
@@ -182,4 +328,5 @@ void blkcache_stats(struct block_cache_stats *stats)
 	memcpy(stats, &_stats, sizeof(*stats));
 	_stats.hits = 0;
 	_stats.misses = 0;
+	_stats.read_ahead = 0;
 }
@@ -87,6 +87,64 @@ static unsigned long host_block_write(struct blk_desc *block_dev,
 }
 
 #ifdef CONFIG_BLK
+/* Blocks are discarded by punching a hole in the file, which reads as zero */
+static unsigned long host_block_discard(struct udevice *dev,
+					unsigned long start, lbaint_t blkcnt)
+{
+	struct host_block_dev *host_dev = dev_get_platdata(dev);
+	struct blk_desc *block_dev = dev_get_uclass_platdata(dev);
+
+	if (os_punch_hole(host_dev->fd, start * block_dev->blksz,
+			  blkcnt * block_dev->blksz))
+		return -1;
+
+	return blkcnt;
+}
+
+static int host_block_submit_read(struct udevice *dev, struct blk_req *req)
+{
+	struct host_block_dev *host_dev = dev_get_platdata(dev);
+
+	if (host_dev->queued == HOST_QUEUE_DEPTH)
+		return -EBUSY;
+	host_dev->queue[host_dev->queued++] = req;
+
+	return 0;
+}
+
+/*
+ * The host reads synchronously, so this makes the oldest read on each call,
+ * to behave like a device which is slower than its callers
+ */
+static int host_block_poll(struct udevice *dev)
+{
+	struct host_block_dev *host_dev = dev_get_platdata(dev);
+	struct blk_req *req;
+
+	if (!host_dev->queued)
+		return 0;
+
+	req = host_dev->queue[0];
+	host_dev->queued--;
+	memmove(host_dev->queue, host_dev->queue + 1,
+		host_dev->queued * sizeof(req));
+	req->result = host_block_read(dev, req->start, req->blkcnt,
+				      req->buffer);
+	req->done = true;
+
+	return 0;
+}
+
+static int host_block_probe(struct udevice *dev)
+{
+	struct blk_desc *desc = dev_get_uclass_platdata(dev);
+
+	desc->queue_depth = HOST_QUEUE_DEPTH;
+	desc->discard_zeroes = true;
+
+	return 0;
+}
+
 int host_dev_bind(int devnum, char *filename)
 {
 	struct host_block_dev *host_dev;
@@ -221,12 +279,16 @@ int host_get_dev_err(int devnum, struct blk_desc **blk_devp)
 static const struct blk_ops sandbox_host_blk_ops = {
 	.read	= host_block_read,
 	.write	= host_block_write,
+	.discard	= host_block_discard,
+	.submit_read	= host_block_submit_read,
+	.poll	= host_block_poll,
 };
 
 U_BOOT_DRIVER(sandbox_host_blk) = {
 	.name		= "sandbox_host_blk",
 	.id		= UCLASS_BLK,
 	.ops		= &sandbox_host_blk_ops,
+	.probe		= host_block_probe,
 	.platdata_auto_alloc_size = sizeof(struct host_block_dev),
 };
 #else
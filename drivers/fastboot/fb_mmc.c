@@ -18,6 +18,8 @@
 #include <android_image.h>
 
 #define FASTBOOT_MAX_BLK_WRITE 16384
+/* 1GiB of 512-byte blocks, to report progress between discards */
+#define FASTBOOT_MAX_BLK_DISCARD (1 << 21)
 
 #define BOOT_PARTITION_NAME "boot"
 
@@ -82,6 +84,35 @@ static lbaint_t fb_mmc_blk_write(struct blk_desc *block_dev, lbaint_t start,
 	return blks;
 }
 
+/**
+ * fb_mmc_blk_discard() - Discard MMC in chunks of FASTBOOT_MAX_BLK_DISCARD
+ *
+ * @block_dev: Pointer to block device
+ * @start: First block to discard
+ * @blkcnt: Count of blocks
+ * @return number of blocks discarded, which is less than @blkcnt if the
+ * device cannot discard them
+ */
+static lbaint_t fb_mmc_blk_discard(struct blk_desc *block_dev, lbaint_t start,
+				   lbaint_t blkcnt)
+{
+	lbaint_t blks = 0;
+	lbaint_t cur_blkcnt;
+	ulong ret;
+
+	while (blks < blkcnt) {
+		cur_blkcnt = min(blkcnt - blks,
+				 (lbaint_t)FASTBOOT_MAX_BLK_DISCARD);
+		if (fastboot_progress_callback)
+			fastboot_progress_callback("discarding");
+		ret = blk_ddiscard(block_dev, start + blks, cur_blkcnt);
+		if (ret != cur_blkcnt)
+			break;
+		blks += cur_blkcnt;
+	}
+	return blks;
+}
+
 static lbaint_t fb_mmc_sparse_write(struct sparse_storage *info,
 		lbaint_t blk, lbaint_t blkcnt, const void *buffer)
 {
@@ -97,10 +128,19 @@ static lbaint_t fb_mmc_sparse_reserve(struct sparse_storage *info,
 	return blkcnt;
 }
 
+static lbaint_t fb_mmc_sparse_discard(struct sparse_storage *info,
+		lbaint_t blk, lbaint_t blkcnt)
+{
+	struct fb_mmc_sparse *sparse = info->priv;
+
+	return fb_mmc_blk_discard(sparse->dev_desc, blk, blkcnt);
+}
+
 static void write_raw_image(struct blk_desc *dev_desc, disk_partition_t *info,
 		const char *part_name, void *buffer,
 		u32 download_bytes, char *response)
 {
+	struct mmc *mmc = find_mmc_device(dev_desc->devnum);
 	lbaint_t blkcnt;
 	lbaint_t blks;
 
@@ -116,7 +156,11 @@ static void write_raw_image(struct blk_desc *dev_desc, disk_partition_t *info,
 
 	puts("Flashing Raw Image\n");
 
+	/* Only flush the cache of the device once the image is written */
+	mmc_start_write_session(mmc);
 	blks = fb_mmc_blk_write(dev_desc, info->start, blkcnt, buffer);
+	if (mmc_end_write_session(mmc))
+		blks = 0;
 
 	if (blks != blkcnt) {
 		pr_err("failed writing to device %d\n", dev_desc->devnum);
@@ -488,6 +532,7 @@ void fastboot_mmc_flash_write(const char *cmd, void *download_buffer,
 	if (is_sparse_image(download_buffer)) {
 		struct fb_mmc_sparse sparse_priv;
 		struct sparse_storage sparse;
+		struct mmc *mmc;
 		int err;
 
 		sparse_priv.dev_desc = dev_desc;
@@ -497,14 +542,22 @@ void fastboot_mmc_flash_write(const char *cmd, void *download_buffer,
 		sparse.size = info.size;
 		sparse.write = fb_mmc_sparse_write;
 		sparse.reserve = fb_mmc_sparse_reserve;
+		sparse.discard = fb_mmc_sparse_discard;
+		sparse.discard_zeroes = dev_desc->discard_zeroes;
 		sparse.mssg = fastboot_fail;
 
 		printf("Flashing sparse image at offset " LBAFU "\n",
 		       sparse.start);
 
 		sparse.priv = &sparse_priv;
+		mmc = find_mmc_device(dev_desc->devnum);
+		mmc_start_write_session(mmc);
 		err = write_sparse_image(&sparse, cmd, download_buffer,
 					 response);
+		if (mmc_end_write_session(mmc) && !err) {
+			fastboot_fail("failed to flush the cache", response);
+			err = -EIO;
+		}
 		if (!err)
 			fastboot_okay(NULL, response);
 	} else {
@@ -566,6 +619,15 @@ void fastboot_mmc_erase(const char *cmd, char *response)
 		return;
 	}
 
+	/* Discarding leaves no partly erased groups to align to */
+	if (dev_desc->discard_zeroes &&
+	    fb_mmc_blk_discard(dev_desc, info.start, info.size) == info.size) {
+		printf("........ discarded " LBAFU " bytes from '%s'\n",
+		       info.size * info.blksz, cmd);
+		fastboot_okay(NULL, response);
+		return;
+	}
+
 	/* Align blocks to erase group size to avoid erasing other partitions */
 	grp_size = mmc->erase_grp_size;
 	blks_start = (info.start + grp_size - 1) & ~(grp_size - 1);
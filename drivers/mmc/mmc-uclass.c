@@ -103,6 +103,34 @@ int mmc_execute_tuning(struct mmc *mmc, uint opcode)
 {
 	return dm_mmc_execute_tuning(mmc->dev, opcode);
 }
+
+int dm_mmc_get_tuning(struct udevice *dev, u32 *tuning)
+{
+	struct dm_mmc_ops *ops = mmc_get_ops(dev);
+
+	if (!ops->get_tuning)
+		return -ENOSYS;
+	return ops->get_tuning(dev, tuning);
+}
+
+int mmc_get_tuning(struct mmc *mmc, u32 *tuning)
+{
+	return dm_mmc_get_tuning(mmc->dev, tuning);
+}
+
+int dm_mmc_set_tuning(struct udevice *dev, u32 tuning)
+{
+	struct dm_mmc_ops *ops = mmc_get_ops(dev);
+
+	if (!ops->set_tuning)
+		return -ENOSYS;
+	return ops->set_tuning(dev, tuning);
+}
+
+int mmc_set_tuning(struct mmc *mmc, u32 tuning)
+{
+	return dm_mmc_set_tuning(mmc->dev, tuning);
+}
 #endif
 
 #if CONFIG_IS_ENABLED(MMC_HS400_ES_SUPPORT)
@@ -423,6 +451,7 @@ static const struct blk_ops mmc_blk_ops = {
 #if CONFIG_IS_ENABLED(MMC_WRITE)
 	.write	= mmc_bwrite,
 	.erase	= mmc_berase,
+	.discard	= mmc_bdiscard,
 #endif
 	.select_hwpart	= mmc_select_hwpart,
 };
@@ -9,9 +9,12 @@
 #include <config.h>
 #include <common.h>
 #include <command.h>
+#include <bloblist.h>
 #include <dm.h>
 #include <dm/device-internal.h>
+#include <env.h>
 #include <errno.h>
+#include <fs.h>
 #include <mmc.h>
 #include <part.h>
 #include <power/regulator.h>
@@ -19,11 +22,14 @@
 #include <memalign.h>
 #include <linux/list.h>
 #include <div64.h>
+#include <u-boot/crc.h>
 #include "mmc_private.h"
 
 #define DEFAULT_CMD6_TIMEOUT_MS  500
+#define CACHE_FLUSH_TIMEOUT_MS	30000
 
 static int mmc_set_signal_voltage(struct mmc *mmc, uint signal_voltage);
+static int mmc_power_on(struct mmc *mmc);
 static int mmc_power_cycle(struct mmc *mmc);
 #if !CONFIG_IS_ENABLED(MMC_TINY)
 static int mmc_select_mode_and_width(struct mmc *mmc, uint card_caps);
@@ -304,6 +310,21 @@ int mmc_set_blocklen(struct mmc *mmc, int len)
 	return err;
 }
 
+/*
+ * Announce the size of the next multiple-block transfer, so that it stops by
+ * itself rather than with STOP_TRANSMISSION
+ */
+int mmc_set_block_count(struct mmc *mmc, lbaint_t blkcnt)
+{
+	struct mmc_cmd cmd;
+
+	cmd.cmdidx = MMC_CMD_SET_BLOCK_COUNT;
+	cmd.resp_type = MMC_RSP_R1;
+	cmd.cmdarg = blkcnt;
+
+	return mmc_send_cmd(mmc, &cmd, NULL);
+}
+
 #ifdef MMC_SUPPORTS_TUNING
 static const u8 tuning_blk_pattern_4bit[] = {
 	0xff, 0x0f, 0xff, 0x00, 0xff, 0xcc, 0xc3, 0xcc,
@@ -379,6 +400,10 @@ static int mmc_read_blocks(struct mmc *mmc, void *dst, lbaint_t start,
 {
 	struct mmc_cmd cmd;
 	struct mmc_data data;
+	bool sbc = mmc_use_sbc(mmc, blkcnt);
+
+	if (sbc && mmc_set_block_count(mmc, blkcnt))
+		return 0;
 
 	if (blkcnt > 1)
 		cmd.cmdidx = MMC_CMD_READ_MULTIPLE_BLOCK;
@@ -400,7 +425,7 @@ static int mmc_read_blocks(struct mmc *mmc, void *dst, lbaint_t start,
 	if (mmc_send_cmd(mmc, &cmd, &data))
 		return 0;
 
-	if (blkcnt > 1) {
+	if (blkcnt > 1 && !sbc) {
 		cmd.cmdidx = MMC_CMD_STOP_TRANSMISSION;
 		cmd.cmdarg = 0;
 		cmd.resp_type = MMC_RSP_R1b;
@@ -762,6 +787,9 @@ static int __mmc_switch(struct mmc *mmc, u8 set, u8 index, u8 value,
 	if (is_part_switch  && mmc->part_switch_time)
 		timeout_ms = mmc->part_switch_time * 10;
 
+	if (set == EXT_CSD_CMD_SET_NORMAL && index == EXT_CSD_FLUSH_CACHE)
+		timeout_ms = CACHE_FLUSH_TIMEOUT_MS;
+
 	cmd.cmdidx = MMC_CMD_SWITCH;
 	cmd.resp_type = MMC_RSP_R1b;
 	cmd.cmdarg = (MMC_SWITCH_MODE_WRITE_BYTE << 24) |
@@ -1549,6 +1577,18 @@ static int mmc_execute_tuning(struct mmc *mmc, uint opcode)
 {
 	return -ENOTSUPP;
 }
+
+#if CONFIG_IS_ENABLED(MMC_FAST_INIT)
+static int mmc_get_tuning(struct mmc *mmc, u32 *tuning)
+{
+	return -ENOTSUPP;
+}
+
+static int mmc_set_tuning(struct mmc *mmc, u32 tuning)
+{
+	return -ENOTSUPP;
+}
+#endif
 #endif
 
 static int mmc_set_ios(struct mmc *mmc)
@@ -1597,6 +1637,32 @@ static int mmc_set_bus_width(struct mmc *mmc, uint width)
 	return mmc_set_ios(mmc);
 }
 
+#ifdef MMC_SUPPORTS_TUNING
+/*
+ * Tune the host for the current bus mode. When retrying the settings of
+ * a previous init, apply the tuning result found then if the host can.
+ */
+static int mmc_tune(struct mmc *mmc, uint opcode)
+{
+	int err;
+
+#if CONFIG_IS_ENABLED(MMC_FAST_INIT)
+	struct mmc_fast_init *fi = &mmc->fast_init;
+
+	if (mmc->fast_init_try && fi->tuned &&
+	    !mmc_set_tuning(mmc, fi->tuning))
+		return 0;
+#endif
+	err = mmc_execute_tuning(mmc, opcode);
+#if CONFIG_IS_ENABLED(MMC_FAST_INIT)
+	if (!err)
+		fi->tuned = !mmc_get_tuning(mmc, &fi->tuning);
+#endif
+
+	return err;
+}
+#endif
+
 #if CONFIG_IS_ENABLED(MMC_VERBOSE) || defined(DEBUG)
 /*
  * helper function to display the capabilities in a human
@@ -1767,8 +1833,7 @@ static int sd_select_mode_and_width(struct mmc *mmc, uint card_caps)
 #ifdef MMC_SUPPORTS_TUNING
 				/* execute tuning if needed */
 				if (mwt->tuning && !mmc_host_is_spi(mmc)) {
-					err = mmc_execute_tuning(mmc,
-								 mwt->tuning);
+					err = mmc_tune(mmc, mwt->tuning);
 					if (err) {
 						pr_debug("tuning failed\n");
 						goto error;
@@ -1952,7 +2017,7 @@ static int mmc_select_hs400(struct mmc *mmc)
 	mmc_set_clock(mmc, mmc->tran_speed, false);
 
 	/* execute tuning if needed */
-	err = mmc_execute_tuning(mmc, MMC_CMD_SEND_TUNING_BLOCK_HS200);
+	err = mmc_tune(mmc, MMC_CMD_SEND_TUNING_BLOCK_HS200);
 	if (err) {
 		debug("tuning failed\n");
 		return err;
@@ -2138,8 +2203,7 @@ static int mmc_select_mode_and_width(struct mmc *mmc, uint card_caps)
 
 				/* execute tuning if needed */
 				if (mwt->tuning) {
-					err = mmc_execute_tuning(mmc,
-								 mwt->tuning);
+					err = mmc_tune(mmc, mwt->tuning);
 					if (err) {
 						pr_debug("tuning failed\n");
 						goto error;
@@ -2168,6 +2232,347 @@ error:
 }
 #endif
 
+#if CONFIG_IS_ENABLED(MMC_FAST_INIT)
+static u32 mmc_fingerprint(struct mmc *mmc)
+{
+	u32 crc;
+
+	crc = crc32(0, (const u8 *)mmc->cid, sizeof(mmc->cid));
+
+	return crc32(crc, (const u8 *)mmc->csd, sizeof(mmc->csd));
+}
+
+static void mmc_fast_init_var(struct mmc *mmc, char *name, int size)
+{
+	snprintf(name, size, "mmc%d_fastinit", mmc_get_blk_desc(mmc)->devnum);
+}
+
+/*
+ * Find the settings negotiated with this card by a previous init, in
+ * memory or else in the environment. They are stored there as
+ * "<fingerprint>,<mode>,<bus width>[,<tuning>]", in hex.
+ * Return true if there are some.
+ */
+static bool mmc_fast_init_find(struct mmc *mmc)
+{
+	struct mmc_fast_init fi;
+	char name[20];
+	const char *s;
+	char *end;
+
+	if (mmc->fast_init_valid &&
+	    mmc->fast_init.fingerprint == mmc_fingerprint(mmc))
+		return true;
+	mmc->fast_init_valid = false;
+
+	mmc_fast_init_var(mmc, name, sizeof(name));
+	s = env_get(name);
+	if (!s)
+		return false;
+
+	fi.fingerprint = simple_strtoul(s, &end, 16);
+	if (*end++ != ',')
+		return false;
+	fi.mode = simple_strtoul(end, &end, 16);
+	if (*end++ != ',')
+		return false;
+	fi.bus_width = simple_strtoul(end, &end, 16);
+	fi.tuned = *end == ',';
+	fi.tuning = fi.tuned ? simple_strtoul(end + 1, &end, 16) : 0;
+	if (*end || fi.mode >= MMC_MODES_END ||
+	    fi.fingerprint != mmc_fingerprint(mmc))
+		return false;
+
+	mmc->fast_init = fi;
+	mmc->fast_init_valid = true;
+
+	return true;
+}
+
+/* Keep the settings just negotiated with the card */
+static void mmc_fast_init_save(struct mmc *mmc)
+{
+	struct mmc_fast_init *fi = &mmc->fast_init;
+	char name[20], val[40];
+	const char *s;
+	int len;
+
+	fi->fingerprint = mmc_fingerprint(mmc);
+	fi->mode = mmc->selected_mode;
+	fi->bus_width = mmc->bus_width;
+	mmc->fast_init_valid = true;
+
+	len = snprintf(val, sizeof(val), "%x,%x,%x", fi->fingerprint,
+		       fi->mode, fi->bus_width);
+	if (fi->tuned)
+		snprintf(val + len, sizeof(val) - len, ",%x", fi->tuning);
+
+	mmc_fast_init_var(mmc, name, sizeof(name));
+	s = env_get(name);
+	if (!s || strcmp(s, val))
+		env_set(name, val);
+}
+
+static uint mmc_width_cap(uint width)
+{
+	if (width == 8)
+		return MMC_MODE_8BIT;
+	if (width == 4)
+		return MMC_MODE_4BIT;
+
+	return MMC_MODE_1BIT;
+}
+#endif
+
+#if CONFIG_IS_ENABLED(MMC_HANDOFF)
+/* Identify the host by its base address, or by its sequence if it has none */
+static u64 mmc_handoff_addr(struct mmc *mmc)
+{
+	fdt_addr_t addr = dev_read_addr(mmc->dev);
+
+	return addr == FDT_ADDR_T_NONE ? 0 : addr;
+}
+
+int mmc_write_handoff(struct mmc *mmc)
+{
+	struct mmc_handoff *ho;
+
+	if (!mmc->has_init)
+		return -EINVAL;
+	ho = bloblist_ensure(BLOBLISTT_MMC_HANDOFF, sizeof(*ho));
+	if (!ho)
+		return -ENOSPC;
+
+	memset(ho, '\0', sizeof(*ho));
+	ho->addr = mmc_handoff_addr(mmc);
+	ho->seq = mmc->dev->seq;
+	memcpy(ho->cid, mmc->cid, sizeof(ho->cid));
+	ho->ocr = mmc->ocr;
+	ho->version = mmc->version;
+	ho->clock = mmc->clock;
+	ho->rca = mmc->rca;
+	ho->mode = mmc->selected_mode;
+	ho->bus_width = mmc->bus_width;
+	ho->signal_voltage = mmc->signal_voltage;
+#ifdef MMC_SUPPORTS_TUNING
+	ho->tuned = !mmc_get_tuning(mmc, &ho->tuning);
+#endif
+	ho->valid = 1;
+
+	return 0;
+}
+#endif
+
+#if CONFIG_IS_ENABLED(MMC_HANDOFF) && !defined(CONFIG_SPL_BUILD)
+static bool mmc_adopting(struct mmc *mmc)
+{
+	return mmc->handoff;
+}
+
+#ifdef MMC_SUPPORTS_TUNING
+/* Get the tuning command needed by a bus mode, 0 if it needs none */
+static uint mmc_mode_tuning(struct mmc *mmc, enum bus_mode mode)
+{
+	const struct mode_width_tuning *mwt, *end;
+
+	if (IS_SD(mmc)) {
+		mwt = sd_modes_by_pref;
+		end = mwt + ARRAY_SIZE(sd_modes_by_pref);
+	} else {
+		mwt = mmc_modes_by_pref;
+		end = mwt + ARRAY_SIZE(mmc_modes_by_pref);
+	}
+	for (; mwt < end; mwt++) {
+		if (mwt->mode == mode)
+			return mwt->tuning;
+	}
+
+	return 0;
+}
+#endif
+
+/* Set the host up for the bus settings the card was left with */
+static int mmc_adopt_bus(struct mmc *mmc)
+{
+	struct mmc_handoff *ho = mmc->handoff;
+	int err;
+
+	mmc_select_mode(mmc, ho->mode);
+	err = mmc_set_bus_width(mmc, ho->bus_width);
+	if (!err)
+		err = mmc_set_clock(mmc, ho->clock, MMC_CLK_ENABLE);
+	if (err)
+		return err;
+
+#if CONFIG_IS_ENABLED(MMC_HS400_ES_SUPPORT)
+	if (ho->mode == MMC_HS_400_ES)
+		return mmc_set_enhanced_strobe(mmc);
+#endif
+#ifdef MMC_SUPPORTS_TUNING
+	if (!mmc_mode_tuning(mmc, ho->mode))
+		return 0;
+	if (ho->tuned && !mmc_set_tuning(mmc, ho->tuning))
+		return 0;
+	/* HS400 is tuned in HS200 mode, which the card is no longer in */
+	if (ho->mode == MMC_HS_400)
+		return -ENOTSUPP;
+
+	return mmc_execute_tuning(mmc, mmc_mode_tuning(mmc, ho->mode));
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Take over the card SPL left ready for this host, if any. It must still be
+ * in the transfer state and have the CID SPL recorded. It is then left in
+ * the standby state, and mmc_startup() carries on from there.
+ */
+static int mmc_adopt(struct mmc *mmc)
+{
+	struct mmc_handoff *ho;
+	struct mmc_cmd cmd;
+	uint status;
+	u64 addr;
+	int err;
+
+	if (mmc_host_is_spi(mmc))
+		return -EOPNOTSUPP;
+	ho = bloblist_find(BLOBLISTT_MMC_HANDOFF, sizeof(*ho));
+	if (!ho || !ho->valid)
+		return -ENOENT;
+	addr = mmc_handoff_addr(mmc);
+	if (addr ? ho->addr != addr : ho->addr || ho->seq != mmc->dev->seq)
+		return -ENOENT;
+	/* Later initialisations start from scratch */
+	ho->valid = 0;
+
+	err = mmc_power_on(mmc);
+	if (err)
+		return err;
+	err = mmc_set_signal_voltage(mmc, ho->signal_voltage);
+	if (err)
+		return err;
+	mmc_select_mode(mmc, MMC_LEGACY);
+	mmc_set_bus_width(mmc, 1);
+	mmc_set_clock(mmc, 0, MMC_CLK_ENABLE);
+
+	mmc->rca = ho->rca;
+	err = mmc_send_status(mmc, &status);
+	if (err)
+		return err;
+	if ((status & MMC_STATUS_CURR_STATE) != MMC_STATE_TRANS)
+		return -EBUSY;
+
+	/* Deselect the card to check its CID */
+	cmd.cmdidx = MMC_CMD_SELECT_CARD;
+	cmd.resp_type = MMC_RSP_NONE;
+	cmd.cmdarg = 0;
+	err = mmc_send_cmd(mmc, &cmd, NULL);
+	if (err)
+		return err;
+
+	cmd.cmdidx = MMC_CMD_SEND_CID;
+	cmd.resp_type = MMC_RSP_R2;
+	cmd.cmdarg = mmc->rca << 16;
+	err = mmc_send_cmd(mmc, &cmd, NULL);
+	if (err)
+		return err;
+	if (memcmp(cmd.response, ho->cid, sizeof(ho->cid)))
+		return -ENODEV;
+	memcpy(mmc->cid, cmd.response, 16);
+
+	mmc->version = ho->version;
+	mmc->ocr = ho->ocr;
+	mmc->high_capacity = (mmc->ocr & OCR_HCS) == OCR_HCS;
+	mmc->op_cond_pending = 0;
+	mmc->ddr_mode = 0;
+	mmc_get_blk_desc(mmc)->hwpart = 0;
+	mmc->handoff = ho;
+	pr_debug("%s: taking over the card from SPL\n", mmc->cfg->name);
+
+	return 0;
+}
+#else
+static inline bool mmc_adopting(struct mmc *mmc)
+{
+	return false;
+}
+
+static inline int mmc_adopt_bus(struct mmc *mmc)
+{
+	return -ENOSYS;
+}
+
+static inline int mmc_adopt(struct mmc *mmc)
+{
+	return -ENOSYS;
+}
+#endif
+
+#if !CONFIG_IS_ENABLED(MMC_TINY)
+/*
+ * Select the bus mode and width for the card. With CONFIG_MMC_FAST_INIT,
+ * the ones which worked last time with the same card are tried first, so
+ * that the faster modes which failed then are skipped and the tuning can
+ * be applied again rather than redone.
+ */
+static int mmc_select_bus(struct mmc *mmc)
+{
+#if CONFIG_IS_ENABLED(MMC_FAST_INIT)
+	struct mmc_fast_init *fi = &mmc->fast_init;
+	uint caps;
+#endif
+	int err;
+
+	if (mmc_adopting(mmc)) {
+		/* The bus is already set up, see mmc_adopt_bus() */
+#if CONFIG_IS_ENABLED(MMC_WRITE)
+		if (IS_SD(mmc) && sd_read_ssr(mmc))
+			pr_warn("unable to read ssr\n");
+#endif
+		return 0;
+	}
+
+#if CONFIG_IS_ENABLED(MMC_FAST_INIT)
+	if (mmc_fast_init_find(mmc)) {
+		caps = MMC_CAP(fi->mode) | mmc_width_cap(fi->bus_width);
+		if ((mmc->card_caps & mmc->host_caps & caps) == caps) {
+			mmc->fast_init_try = true;
+			if (IS_SD(mmc))
+				err = sd_select_mode_and_width(mmc, caps);
+			else
+				err = mmc_select_mode_and_width(mmc, caps);
+			mmc->fast_init_try = false;
+			if (!err) {
+				mmc_fast_init_save(mmc);
+				return 0;
+			}
+		}
+		pr_debug("%s: settings of the last init failed\n",
+			 mmc->cfg->name);
+		mmc->fast_init_valid = false;
+	}
+	fi->tuned = false;
+#endif
+
+	if (IS_SD(mmc)) {
+		err = sd_select_mode_and_width(mmc, mmc->card_caps);
+		if (err)
+			return err;
+	} else if (mmc_select_mode_and_width(mmc, mmc->card_caps)) {
+		/* the card is still usable in legacy mode */
+		return 0;
+	}
+
+#if CONFIG_IS_ENABLED(MMC_FAST_INIT)
+	mmc_fast_init_save(mmc);
+#endif
+
+	return 0;
+}
+#endif
+
 #if CONFIG_IS_ENABLED(MMC_TINY)
 DEFINE_CACHE_ALIGN_BUFFER(u8, ext_csd_bkup, MMC_MAX_BLOCK_LEN);
 #endif
@@ -2366,6 +2771,24 @@ static int mmc_startup_v4(struct mmc *mmc)
 #endif
 
 	mmc->wr_rel_set = ext_csd[EXT_CSD_WR_REL_SET];
+#if CONFIG_IS_ENABLED(MMC_WRITE)
+	if (ext_csd[EXT_CSD_SEC_FEATURE_SUPPORT] & EXT_CSD_SEC_GB_CL_EN)
+		mmc->trim_timeout = 300 * ext_csd[EXT_CSD_TRIM_MULT];
+#endif
+
+#if CONFIG_IS_ENABLED(MMC_CACHE)
+	/* The volatile cache comes with eMMC 4.5, see mmc_flush_cache() */
+	if (mmc->version >= MMC_VERSION_4_5 &&
+	    (ext_csd[EXT_CSD_CACHE_SIZE] | ext_csd[EXT_CSD_CACHE_SIZE + 1] |
+	     ext_csd[EXT_CSD_CACHE_SIZE + 2] |
+	     ext_csd[EXT_CSD_CACHE_SIZE + 3])) {
+		if (mmc_switch(mmc, EXT_CSD_CMD_SET_NORMAL,
+			       EXT_CSD_CACHE_CTRL, 1))
+			pr_warn("MMC: unable to enable the cache\n");
+		else
+			mmc->cache_on = true;
+	}
+#endif
 
 	return 0;
 error:
@@ -2378,24 +2801,10 @@ error:
 	return err;
 }
 
-static int mmc_startup(struct mmc *mmc)
+static int mmc_identify(struct mmc *mmc)
 {
-	int err, i;
-	uint mult, freq;
-	u64 cmult, csize;
 	struct mmc_cmd cmd;
-	struct blk_desc *bdesc;
-
-#ifdef CONFIG_MMC_SPI_CRC_ON
-	if (mmc_host_is_spi(mmc)) { /* enable CRC check for spi */
-		cmd.cmdidx = MMC_CMD_SPI_CRC_ON_OFF;
-		cmd.resp_type = MMC_RSP_R1;
-		cmd.cmdarg = 1;
-		err = mmc_send_cmd(mmc, &cmd, NULL);
-		if (err)
-			return err;
-	}
-#endif
+	int err;
 
 	/* Put the Card in Identify Mode */
 	cmd.cmdidx = mmc_host_is_spi(mmc) ? MMC_CMD_SEND_CID :
@@ -2444,6 +2853,35 @@ static int mmc_startup(struct mmc *mmc)
 			mmc->rca = (cmd.response[0] >> 16) & 0xffff;
 	}
 
+	return 0;
+}
+
+static int mmc_startup(struct mmc *mmc)
+{
+	int err, i;
+	uint mult, freq;
+	u64 cmult, csize;
+	struct mmc_cmd cmd;
+	struct blk_desc *bdesc;
+
+#ifdef CONFIG_MMC_SPI_CRC_ON
+	if (mmc_host_is_spi(mmc)) { /* enable CRC check for spi */
+		cmd.cmdidx = MMC_CMD_SPI_CRC_ON_OFF;
+		cmd.resp_type = MMC_RSP_R1;
+		cmd.cmdarg = 1;
+		err = mmc_send_cmd(mmc, &cmd, NULL);
+		if (err)
+			return err;
+	}
+#endif
+
+	/* A card taken over from SPL is already identified */
+	if (!mmc_adopting(mmc)) {
+		err = mmc_identify(mmc);
+		if (err)
+			return err;
+	}
+
 	/* Get the Card-Specific Data */
 	cmd.cmdidx = MMC_CMD_SEND_CSD;
 	cmd.resp_type = MMC_RSP_R2;
@@ -2545,18 +2983,38 @@ static int mmc_startup(struct mmc *mmc)
 			return err;
 	}
 
+	if (mmc_adopting(mmc)) {
+		err = mmc_adopt_bus(mmc);
+		if (err)
+			return err;
+	}
+
 	/*
 	 * For SD, its erase group is always one sector
 	 */
 #if CONFIG_IS_ENABLED(MMC_WRITE)
 	mmc->erase_grp_size = 1;
+	mmc->trim_timeout = 0;
 #endif
 	mmc->part_config = MMCPART_NOAVAILABLE;
+#if CONFIG_IS_ENABLED(MMC_CACHE)
+	mmc->cache_on = false;
+	mmc->cache_dirty = false;
+#endif
 
 	err = mmc_startup_v4(mmc);
 	if (err)
 		return err;
 
+	/* SPL may have left the card on a boot partition */
+	if (mmc_adopting(mmc) && mmc->part_config != MMCPART_NOAVAILABLE &&
+	    (mmc->part_config & PART_ACCESS_MASK)) {
+		err = mmc_switch_part(mmc, 0);
+		if (err)
+			return err;
+		mmc->part_config &= ~PART_ACCESS_MASK;
+	}
+
 	err = mmc_set_capacity(mmc, mmc_get_blk_desc(mmc)->hwpart);
 	if (err)
 		return err;
@@ -2566,23 +3024,30 @@ static int mmc_startup(struct mmc *mmc)
 	mmc_select_mode(mmc, IS_SD(mmc) ? SD_LEGACY : MMC_LEGACY);
 	mmc_set_bus_width(mmc, 1);
 #else
-	if (IS_SD(mmc)) {
+	if (IS_SD(mmc))
 		err = sd_get_capabilities(mmc);
-		if (err)
-			return err;
-		err = sd_select_mode_and_width(mmc, mmc->card_caps);
-	} else {
+	else
 		err = mmc_get_capabilities(mmc);
-		if (err)
-			return err;
-		mmc_select_mode_and_width(mmc, mmc->card_caps);
-	}
+	if (err)
+		return err;
+	err = mmc_select_bus(mmc);
 #endif
 	if (err)
 		return err;
 
 	mmc->best_mode = mmc->selected_mode;
 
+	/*
+	 * SET_BLOCK_COUNT is mandatory from MMC 3.1, the first version with
+	 * a CSD of version 3 (MMC_VERSION_3), and optional for SD
+	 */
+	if (IS_SD(mmc))
+		mmc->sbc = mmc->scr[0] & SD_CMD23_SUPPORT;
+	else
+		mmc->sbc = mmc->version >= MMC_VERSION_3;
+	if (!(mmc->host_caps & MMC_CAP_CMD23))
+		mmc->sbc = false;
+
 	/* Fix the block length for DDR mode */
 	if (mmc->ddr_mode) {
 		mmc->read_bl_len = MMC_MAX_BLOCK_LEN;
@@ -2599,6 +3064,15 @@ static int mmc_startup(struct mmc *mmc)
 	bdesc->blksz = mmc->read_bl_len;
 	bdesc->log2blksz = LOG2(bdesc->blksz);
 	bdesc->lba = lldiv(mmc->capacity, mmc->read_bl_len);
+#if CONFIG_IS_ENABLED(MMC_WRITE)
+	/* what erased blocks read as, see mmc_bdiscard() */
+	if (IS_SD(mmc))
+		bdesc->discard_zeroes =
+			!(mmc->scr[0] & SD_DATA_STAT_AFTER_ERASE);
+	else
+		bdesc->discard_zeroes = mmc->trim_timeout &&
+			!mmc->ext_csd[EXT_CSD_ERASED_MEM_CONT];
+#endif
 #if !defined(CONFIG_SPL_BUILD) || \
 		(defined(CONFIG_SPL_LIBCOMMON_SUPPORT) && \
 		!CONFIG_IS_ENABLED(USE_TINY_PRINTF))
@@ -2617,6 +3091,9 @@ static int mmc_startup(struct mmc *mmc)
 	bdesc->revision[0] = 0;
 #endif
 
+	/* the card may have been swapped */
+	fs_invalidate(bdesc);
+
 #if !defined(CONFIG_DM_MMC) && (!defined(CONFIG_SPL_BUILD) || defined(CONFIG_SPL_LIBDISK_SUPPORT))
 	part_init(bdesc);
 #endif
@@ -2773,6 +3250,10 @@ int mmc_get_op_cond(struct mmc *mmc)
 		      MMC_QUIRK_RETRY_APP_CMD;
 #endif
 
+	/* Carry on with the card SPL left ready, if any */
+	if (!mmc_adopt(mmc))
+		return 0;
+
 	err = mmc_power_cycle(mmc);
 	if (err) {
 		/*
@@ -2909,6 +3390,19 @@ int mmc_init(struct mmc *mmc)
 
 	if (!err)
 		err = mmc_complete_init(mmc);
+#if CONFIG_IS_ENABLED(MMC_HANDOFF) && !defined(CONFIG_SPL_BUILD)
+	if (mmc->handoff) {
+		mmc->handoff = NULL;
+		/* The card left by SPL could not be used, start from scratch */
+		if (err) {
+			pr_debug("%s: card from SPL unusable (err %d)\n",
+				 mmc->cfg->name, err);
+			err = mmc_start_init(mmc);
+			if (!err)
+				err = mmc_complete_init(mmc);
+		}
+	}
+#endif
 	if (err)
 		pr_info("%s: %d, time %lu\n", __func__, err, get_timer(start));
 
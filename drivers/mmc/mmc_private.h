@@ -16,6 +16,14 @@ int mmc_send_status(struct mmc *mmc, unsigned int *status);
 int mmc_poll_for_busy(struct mmc *mmc, int timeout);
 
 int mmc_set_blocklen(struct mmc *mmc, int len);
+int mmc_set_block_count(struct mmc *mmc, lbaint_t blkcnt);
+
+/* Whether a multiple-block transfer can be announced with SET_BLOCK_COUNT */
+static inline bool mmc_use_sbc(struct mmc *mmc, lbaint_t blkcnt)
+{
+	/* eMMC takes a 16-bit count, the upper bits being flags */
+	return mmc->sbc && blkcnt > 1 && blkcnt <= 0xffff;
+}
 #ifdef CONFIG_FSL_ESDHC_ADAPTER_IDENT
 void mmc_adapter_card_type_ident(void);
 #endif
@@ -34,6 +42,7 @@ ulong mmc_bread(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt,
 ulong mmc_bwrite(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 		 const void *src);
 ulong mmc_berase(struct udevice *dev, lbaint_t start, lbaint_t blkcnt);
+ulong mmc_bdiscard(struct udevice *dev, lbaint_t start, lbaint_t blkcnt);
 #else
 ulong mmc_bwrite(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt,
 		 const void *src);
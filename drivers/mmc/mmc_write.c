@@ -14,7 +14,8 @@
 #include <linux/math64.h>
 #include "mmc_private.h"
 
-static ulong mmc_erase_t(struct mmc *mmc, ulong start, lbaint_t blkcnt)
+static ulong mmc_erase_t(struct mmc *mmc, ulong start, lbaint_t blkcnt,
+			 uint arg)
 {
 	struct mmc_cmd cmd;
 	ulong end;
@@ -51,7 +52,7 @@ static ulong mmc_erase_t(struct mmc *mmc, ulong start, lbaint_t blkcnt)
 		goto err_out;
 
 	cmd.cmdidx = MMC_CMD_ERASE;
-	cmd.cmdarg = MMC_ERASE_ARG;
+	cmd.cmdarg = arg;
 	cmd.resp_type = MMC_RSP_R1b;
 
 	err = mmc_send_cmd(mmc, &cmd, NULL);
@@ -112,7 +113,7 @@ ulong mmc_berase(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt)
 			blk_r = ((blkcnt - blk) > mmc->erase_grp_size) ?
 				mmc->erase_grp_size : (blkcnt - blk);
 		}
-		err = mmc_erase_t(mmc, start + blk, blk_r);
+		err = mmc_erase_t(mmc, start + blk, blk_r, MMC_ERASE_ARG);
 		if (err)
 			break;
 
@@ -126,12 +127,62 @@ ulong mmc_berase(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt)
 	return blk;
 }
 
+#if CONFIG_IS_ENABLED(BLK)
+/* Erase groups, or allocation units of SD cards, discarded per command */
+#define MMC_DISCARD_GROUPS	64
+
+/*
+ * eMMC cards trim the blocks, which then read as erased. SD cards have no
+ * TRIM before version 5, but erase per write block rather than per group,
+ * so they are simply erased.
+ */
+ulong mmc_bdiscard(struct udevice *dev, lbaint_t start, lbaint_t blkcnt)
+{
+	struct blk_desc *block_dev = dev_get_uclass_platdata(dev);
+	struct mmc *mmc = find_mmc_device(block_dev->devnum);
+	lbaint_t blk = 0, blk_r, max;
+	uint arg, timeout_ms;
+
+	if (!mmc)
+		return -1;
+
+	if (IS_SD(mmc)) {
+		arg = MMC_ERASE_ARG;
+		max = mmc->ssr.au ? mmc->ssr.au : mmc->erase_grp_size;
+		timeout_ms = MMC_DISCARD_GROUPS * 1000;
+	} else if (mmc->trim_timeout) {
+		arg = MMC_TRIM_ARG;
+		max = mmc->erase_grp_size;
+		timeout_ms = MMC_DISCARD_GROUPS * mmc->trim_timeout;
+	} else {
+		return 0;
+	}
+	max *= MMC_DISCARD_GROUPS;
+
+	if (blk_select_hwpart_devnum(IF_TYPE_MMC, block_dev->devnum,
+				     block_dev->hwpart) < 0)
+		return -1;
+
+	while (blk < blkcnt) {
+		blk_r = min(blkcnt - blk, max);
+		if (mmc_erase_t(mmc, start + blk, blk_r, arg))
+			break;
+		if (mmc_poll_for_busy(mmc, timeout_ms))
+			break;
+		blk += blk_r;
+	}
+
+	return blk;
+}
+#endif
+
 static ulong mmc_write_blocks(struct mmc *mmc, lbaint_t start,
 		lbaint_t blkcnt, const void *src)
 {
 	struct mmc_cmd cmd;
 	struct mmc_data data;
 	int timeout_ms = 1000;
+	bool sbc = mmc_use_sbc(mmc, blkcnt);
 
 	if ((start + blkcnt) > mmc_get_blk_desc(mmc)->lba) {
 		printf("MMC: block number 0x" LBAF " exceeds max(0x" LBAF ")\n",
@@ -141,7 +192,13 @@ static ulong mmc_write_blocks(struct mmc *mmc, lbaint_t start,
 
 	if (blkcnt == 0)
 		return 0;
-	else if (blkcnt == 1)
+
+	if (sbc && mmc_set_block_count(mmc, blkcnt)) {
+		printf("mmc fail to set block count\n");
+		return 0;
+	}
+
+	if (blkcnt == 1)
 		cmd.cmdidx = MMC_CMD_WRITE_SINGLE_BLOCK;
 	else
 		cmd.cmdidx = MMC_CMD_WRITE_MULTIPLE_BLOCK;
@@ -166,7 +223,7 @@ static ulong mmc_write_blocks(struct mmc *mmc, lbaint_t start,
 	/* SPI multiblock writes terminate using a special
 	 * token, not a STOP_TRANSMISSION request.
 	 */
-	if (!mmc_host_is_spi(mmc) && blkcnt > 1) {
+	if (!mmc_host_is_spi(mmc) && blkcnt > 1 && !sbc) {
 		cmd.cmdidx = MMC_CMD_STOP_TRANSMISSION;
 		cmd.cmdarg = 0;
 		cmd.resp_type = MMC_RSP_R1b;
@@ -209,6 +266,9 @@ ulong mmc_bwrite(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt,
 	if (mmc_set_blocklen(mmc, mmc->write_bl_len))
 		return 0;
 
+#if CONFIG_IS_ENABLED(MMC_CACHE)
+	mmc->cache_dirty |= mmc->cache_on;
+#endif
 	do {
 		cur = (blocks_todo > mmc->cfg->b_max) ?
 			mmc->cfg->b_max : blocks_todo;
@@ -219,5 +279,42 @@ ulong mmc_bwrite(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt,
 		src += cur * mmc->write_bl_len;
 	} while (blocks_todo > 0);
 
+#if CONFIG_IS_ENABLED(MMC_CACHE)
+	/* Outside write sessions, nothing is left in the cache */
+	if (!mmc->write_session && mmc_flush_cache(mmc))
+		return 0;
+#endif
+
 	return blkcnt;
 }
+
+#if CONFIG_IS_ENABLED(MMC_CACHE)
+int mmc_flush_cache(struct mmc *mmc)
+{
+	int err;
+
+	if (!mmc->cache_dirty)
+		return 0;
+
+	err = mmc_switch(mmc, EXT_CSD_CMD_SET_NORMAL, EXT_CSD_FLUSH_CACHE, 1);
+	if (err) {
+		printf("mmc fail to flush the cache\n");
+		return err;
+	}
+	mmc->cache_dirty = false;
+
+	return 0;
+}
+
+void mmc_start_write_session(struct mmc *mmc)
+{
+	mmc->write_session = true;
+}
+
+int mmc_end_write_session(struct mmc *mmc)
+{
+	mmc->write_session = false;
+
+	return mmc_flush_cache(mmc);
+}
+#endif
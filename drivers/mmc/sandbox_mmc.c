@@ -14,6 +14,10 @@
 struct sandbox_mmc_plat {
 	struct mmc_config cfg;
 	struct mmc mmc;
+	uint block_count;	/* from SET_BLOCK_COUNT, 0 if none */
+	bool predefined;	/* last transfer had a block count */
+	uint erase_start;	/* from ERASE_WR_BLK_START */
+	uint erase_end;		/* from ERASE_WR_BLK_END */
 };
 
 /**
@@ -25,8 +29,20 @@ struct sandbox_mmc_plat {
 static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 				struct mmc_data *data)
 {
+	struct sandbox_mmc_plat *plat = dev_get_platdata(dev);
+	uint block_count = plat->block_count;
+
+	/* A block count only applies to the command which follows it */
+	plat->block_count = 0;
+	if (data) {
+		if (block_count && data->blocks != block_count)
+			return -EIO;
+		plat->predefined = block_count;
+	}
+
 	switch (cmd->cmdidx) {
 	case MMC_CMD_ALL_SEND_CID:
+	case MMC_CMD_SEND_CID:
 		memset(cmd->response, '\0', sizeof(cmd->response));
 		break;
 	case SD_CMD_SEND_RELATIVE_ADDR:
@@ -37,7 +53,7 @@ static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 		cmd->response[0] = 0xaa;
 		break;
 	case MMC_CMD_SEND_STATUS:
-		cmd->response[0] = MMC_STATUS_RDY_FOR_DATA;
+		cmd->response[0] = MMC_STATUS_RDY_FOR_DATA | MMC_STATE_TRANS;
 		break;
 	case MMC_CMD_SELECT_CARD:
 		break;
@@ -63,7 +79,26 @@ static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 	case MMC_CMD_READ_MULTIPLE_BLOCK:
 		strcpy(data->dest, "this is a test");
 		break;
+	case MMC_CMD_SET_BLOCK_COUNT:
+		plat->block_count = cmd->cmdarg;
+		break;
 	case MMC_CMD_STOP_TRANSMISSION:
+		/* Transfers of a known size stop by themselves */
+		if (plat->predefined)
+			return -EILSEQ;
+		break;
+	case SD_CMD_ERASE_WR_BLK_START:
+		plat->erase_start = cmd->cmdarg;
+		plat->erase_end = 0;
+		break;
+	case SD_CMD_ERASE_WR_BLK_END:
+		plat->erase_end = cmd->cmdarg;
+		break;
+	case MMC_CMD_ERASE:
+		/* Erased blocks read as zero, as the SCR says */
+		if (plat->erase_end < plat->erase_start ||
+		    cmd->cmdarg != MMC_ERASE_ARG)
+			return -EIO;
 		break;
 	case SD_CMD_APP_SEND_OP_COND:
 		cmd->response[0] = OCR_BUSY | OCR_HCS;
@@ -78,7 +113,8 @@ static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 	case SD_CMD_APP_SEND_SCR: {
 		u32 *scr = (u32 *)data->dest;
 
-		scr[0] = cpu_to_be32(2 << 24 | 1 << 15);  /* SD version 3 */
+		/* SD version 3, with SET_BLOCK_COUNT */
+		scr[0] = cpu_to_be32(2 << 24 | 1 << 15 | SD_CMD23_SUPPORT);
 		break;
 	}
 	default:
@@ -118,7 +154,8 @@ int sandbox_mmc_bind(struct udevice *dev)
 	struct mmc_config *cfg = &plat->cfg;
 
 	cfg->name = dev->name;
-	cfg->host_caps = MMC_MODE_HS_52MHz | MMC_MODE_HS | MMC_MODE_8BIT;
+	cfg->host_caps = MMC_MODE_HS_52MHz | MMC_MODE_HS | MMC_MODE_8BIT |
+			 MMC_CAP_CMD23;
 	cfg->voltages = MMC_VDD_165_195 | MMC_VDD_32_33 | MMC_VDD_33_34;
 	cfg->f_min = 1000000;
 	cfg->f_max = 52000000;
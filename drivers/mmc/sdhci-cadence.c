@@ -226,6 +226,25 @@ static int __maybe_unused sdhci_cdns_execute_tuning(struct udevice *dev,
 	return sdhci_cdns_set_tune_val(plat, end_of_streak - max_streak / 2);
 }
 
+static int __maybe_unused sdhci_cdns_get_tuning(struct udevice *dev,
+						u32 *tuning)
+{
+	struct sdhci_cdns_plat *plat = dev_get_platdata(dev);
+
+	*tuning = FIELD_GET(SDHCI_CDNS_HRS06_TUNE,
+			    readl(plat->hrs_addr + SDHCI_CDNS_HRS06));
+
+	return 0;
+}
+
+static int __maybe_unused sdhci_cdns_set_tuning(struct udevice *dev,
+						u32 tuning)
+{
+	struct sdhci_cdns_plat *plat = dev_get_platdata(dev);
+
+	return sdhci_cdns_set_tune_val(plat, tuning);
+}
+
 static struct dm_mmc_ops sdhci_cdns_mmc_ops;
 
 static int sdhci_cdns_bind(struct udevice *dev)
@@ -259,6 +278,8 @@ static int sdhci_cdns_probe(struct udevice *dev)
 	sdhci_cdns_mmc_ops = sdhci_ops;
 #ifdef MMC_SUPPORTS_TUNING
 	sdhci_cdns_mmc_ops.execute_tuning = sdhci_cdns_execute_tuning;
+	sdhci_cdns_mmc_ops.get_tuning = sdhci_cdns_get_tuning;
+	sdhci_cdns_mmc_ops.set_tuning = sdhci_cdns_set_tuning;
 #endif
 
 	ret = mmc_of_parse(dev, &plat->cfg);
@@ -71,13 +71,23 @@ static void sdhci_transfer_pio(struct sdhci_host *host, struct mmc_data *data)
 }
 
 #if CONFIG_IS_ENABLED(MMC_SDHCI_ADMA)
-static void sdhci_adma_desc(struct sdhci_host *host, char *buf, u16 len,
-			    bool end)
+/* 64-bit descriptors are 96 bits long, or 128 bits in version 4 mode */
+static uint sdhci_adma_desc_len(struct sdhci_host *host)
+{
+	if (!(host->flags & USE_ADMA64))
+		return 8;
+
+	return host->v4_mode ? 16 : 12;
+}
+
+static void sdhci_adma_desc(struct sdhci_host *host, dma_addr_t addr,
+			    u16 len, bool end)
 {
 	struct sdhci_adma_desc *desc;
 	u8 attr;
 
-	desc = &host->adma_desc_table[host->desc_slot];
+	desc = (void *)host->adma_desc_table +
+	       host->desc_slot * sdhci_adma_desc_len(host);
 
 	attr = ADMA_DESC_ATTR_VALID | ADMA_DESC_TRANSFER_DATA;
 	if (!end)
@@ -85,42 +95,103 @@ static void sdhci_adma_desc(struct sdhci_host *host, char *buf, u16 len,
 	else
 		attr |= ADMA_DESC_ATTR_END;
 
+	memset(desc, '\0', sdhci_adma_desc_len(host));
 	desc->attr = attr;
 	desc->len = len;
-	desc->reserved = 0;
-	desc->addr_lo = (dma_addr_t)buf;
+	desc->addr_lo = lower_32_bits(addr);
 #ifdef CONFIG_DMA_ADDR_T_64BIT
-	desc->addr_hi = (u64)buf >> 32;
+	if (host->flags & USE_ADMA64)
+		desc->addr_hi = upper_32_bits(addr);
 #endif
 }
 
+/* Describe a buffer, with as many descriptors as its length needs */
+static void sdhci_adma_buf(struct sdhci_host *host, dma_addr_t addr,
+			   uint len, bool end)
+{
+	while (len > ADMA_MAX_LEN) {
+		sdhci_adma_desc(host, addr, ADMA_MAX_LEN, false);
+		addr += ADMA_MAX_LEN;
+		len -= ADMA_MAX_LEN;
+	}
+	sdhci_adma_desc(host, addr, len, end);
+}
+
+/*
+ * The partial cache lines at the ends of a buffer go through the align
+ * buffer, so that the cache maintenance of the rest, which the controller
+ * reads or writes in place, does not touch what is around the buffer. This
+ * also keeps the addresses in the descriptors aligned, as ADMA2 needs.
+ */
+static void sdhci_adma_split(ulong buf, uint len, uint *head, uint *tail)
+{
+	*head = -buf & (ARCH_DMA_MINALIGN - 1);
+	*tail = (buf + len) & (ARCH_DMA_MINALIGN - 1);
+	if (*head + *tail >= len) {
+		*head = len;
+		*tail = 0;
+	}
+}
+
 static void sdhci_prepare_adma_table(struct sdhci_host *host,
 				     struct mmc_data *data)
 {
 	uint trans_bytes = data->blocksize * data->blocks;
-	uint desc_count = DIV_ROUND_UP(trans_bytes, ADMA_MAX_LEN);
-	int i = desc_count;
-	char *buf;
+	ulong align = (ulong)host->align_buffer;
+	uint head, tail, len;
+	ulong buf;
 
 	host->desc_slot = 0;
 
 	if (data->flags & MMC_DATA_READ)
-		buf = data->dest;
+		buf = (ulong)data->dest;
 	else
-		buf = (char *)data->src;
-
-	while (--i) {
-		sdhci_adma_desc(host, buf, ADMA_MAX_LEN, false);
-		buf += ADMA_MAX_LEN;
-		trans_bytes -= ADMA_MAX_LEN;
+		buf = (ulong)data->src;
+
+	sdhci_adma_split(buf, trans_bytes, &head, &tail);
+	len = trans_bytes - head - tail;
+	if (!(data->flags & MMC_DATA_READ)) {
+		memcpy(host->align_buffer, data->src, head);
+		memcpy(host->align_buffer + ARCH_DMA_MINALIGN,
+		       data->src + trans_bytes - tail, tail);
 	}
-
-	sdhci_adma_desc(host, buf, trans_bytes, true);
+	if (head || tail)
+		flush_cache(align, 2 * ARCH_DMA_MINALIGN);
+	if (len)
+		flush_cache(buf + head, len);
+
+	if (head)
+		sdhci_adma_buf(host, align, head, !len && !tail);
+	if (len)
+		sdhci_adma_buf(host, buf + head, len, !tail);
+	if (tail)
+		sdhci_adma_buf(host, align + ARCH_DMA_MINALIGN, tail, true);
 
 	flush_cache((dma_addr_t)host->adma_desc_table,
-		    ROUND(desc_count * sizeof(struct sdhci_adma_desc),
+		    ROUND((host->desc_slot + 1) * sdhci_adma_desc_len(host),
 			  ARCH_DMA_MINALIGN));
 }
+
+/* Drop what the cache holds of the buffer, and copy its ends over */
+static void sdhci_adma_read_done(struct sdhci_host *host,
+				 struct mmc_data *data)
+{
+	uint trans_bytes = data->blocksize * data->blocks;
+	ulong align = (ulong)host->align_buffer;
+	ulong buf = (ulong)data->dest;
+	uint head, tail, len;
+
+	sdhci_adma_split(buf, trans_bytes, &head, &tail);
+	len = trans_bytes - head - tail;
+	if (len)
+		invalidate_dcache_range(buf + head, buf + head + len);
+	if (head || tail) {
+		invalidate_dcache_range(align, align + 2 * ARCH_DMA_MINALIGN);
+		memcpy(data->dest, host->align_buffer, head);
+		memcpy(data->dest + trans_bytes - tail,
+		       host->align_buffer + ARCH_DMA_MINALIGN, tail);
+	}
+}
 #elif defined(CONFIG_MMC_SDHCI_SDMA)
 static void sdhci_prepare_adma_table(struct sdhci_host *host,
 				     struct mmc_data *data)
@@ -139,9 +210,10 @@ static void sdhci_prepare_dma(struct sdhci_host *host, struct mmc_data *data,
 
 	ctrl = sdhci_readb(host, SDHCI_HOST_CONTROL);
 	ctrl &= ~SDHCI_CTRL_DMA_MASK;
-	if (host->flags & USE_ADMA64)
+	/* Version 4 mode picks the descriptor size in SDHCI_HOST_CONTROL2 */
+	if ((host->flags & USE_ADMA64) && !host->v4_mode)
 		ctrl |= SDHCI_CTRL_ADMA64;
-	else if (host->flags & USE_ADMA)
+	else if (host->flags & (USE_ADMA | USE_ADMA64))
 		ctrl |= SDHCI_CTRL_ADMA32;
 	sdhci_writeb(host, ctrl, SDHCI_HOST_CONTROL);
 
@@ -165,7 +237,8 @@ static void sdhci_prepare_dma(struct sdhci_host *host, struct mmc_data *data,
 			memcpy(aligned_buffer, data->src, trans_bytes);
 #endif
 		sdhci_writel(host, host->start_addr, SDHCI_DMA_ADDRESS);
-
+		flush_cache(host->start_addr,
+			    ROUND(trans_bytes, ARCH_DMA_MINALIGN));
 	} else if (host->flags & (USE_ADMA | USE_ADMA64)) {
 		sdhci_prepare_adma_table(host, data);
 
@@ -174,13 +247,47 @@ static void sdhci_prepare_dma(struct sdhci_host *host, struct mmc_data *data,
 			sdhci_writel(host, (u64)host->adma_addr >> 32,
 				     SDHCI_ADMA_ADDRESS_HI);
 	}
+}
+
+static bool sdhci_below_4g(ulong addr, uint len)
+{
+	return !upper_32_bits((u64)addr + len - 1);
+}
+
+/*
+ * Without 64-bit addressing, buffers above 4GiB are moved by PIO, as are
+ * unaligned ones whose bounce buffer is above 4GiB
+ */
+static bool sdhci_dma_reachable(struct sdhci_host *host,
+				struct mmc_data *data, int trans_bytes)
+{
+	ulong buf;
+
+	if ((host->flags & USE_ADMA64) ||
+	    IS_ENABLED(CONFIG_FIXED_SDHCI_ALIGNED_BUFFER))
+		return true;
+
+	if (data->flags == MMC_DATA_READ)
+		buf = (ulong)data->dest;
+	else
+		buf = (ulong)data->src;
 
-	flush_cache(host->start_addr, ROUND(trans_bytes, ARCH_DMA_MINALIGN));
+	if ((host->flags & USE_SDMA) &&
+	    (host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR) && (buf & 0x7))
+		buf = (ulong)aligned_buffer;
+
+	return sdhci_below_4g(buf, trans_bytes);
 }
 #else
 static void sdhci_prepare_dma(struct sdhci_host *host, struct mmc_data *data,
 			      int *is_aligned, int trans_bytes)
 {}
+
+static bool sdhci_dma_reachable(struct sdhci_host *host,
+				struct mmc_data *data, int trans_bytes)
+{
+	return false;
+}
 #endif
 static int sdhci_transfer_data(struct sdhci_host *host, struct mmc_data *data)
 {
@@ -260,6 +367,7 @@ static int sdhci_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
 	unsigned int stat = 0;
 	int ret = 0;
 	int trans_bytes = 0, is_aligned = 1;
+	bool dma = false;
 	u32 mask, flags, mode;
 	unsigned int time = 0;
 	int mmc_dev = mmc_get_blk_desc(mmc)->devnum;
@@ -331,7 +439,9 @@ static int sdhci_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
 		if (data->flags == MMC_DATA_READ)
 			mode |= SDHCI_TRNS_READ;
 
-		if (host->flags & USE_DMA) {
+		dma = (host->flags & USE_DMA) &&
+		      sdhci_dma_reachable(host, data, trans_bytes);
+		if (dma) {
 			mode |= SDHCI_TRNS_DMA;
 			sdhci_prepare_dma(host, data, &is_aligned, trans_bytes);
 		}
@@ -382,6 +492,11 @@ static int sdhci_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
 		if ((host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR) &&
 				!is_aligned && (data->flags == MMC_DATA_READ))
 			memcpy(data->dest, aligned_buffer, trans_bytes);
+#if CONFIG_IS_ENABLED(MMC_SDHCI_ADMA)
+		if (dma && !(host->flags & USE_SDMA) &&
+		    data->flags == MMC_DATA_READ)
+			sdhci_adma_read_done(host, data);
+#endif
 		return 0;
 	}
 
@@ -630,6 +745,15 @@ static int sdhci_init(struct mmc *mmc)
 
 	sdhci_reset(host, SDHCI_RESET_ALL);
 
+	if (host->v4_mode) {
+		u16 ctrl2 = sdhci_readw(host, SDHCI_HOST_CONTROL2);
+
+		ctrl2 |= SDHCI_CTRL_V4_MODE;
+		if (host->flags & USE_ADMA64)
+			ctrl2 |= SDHCI_CTRL_64BIT_ADDR;
+		sdhci_writew(host, ctrl2, SDHCI_HOST_CONTROL2);
+	}
+
 	if ((host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR) && !aligned_buffer) {
 		aligned_buffer = memalign(8, 512*1024);
 		if (!aligned_buffer) {
@@ -726,6 +850,14 @@ int sdhci_setup_cfg(struct mmc_config *cfg, struct sdhci_host *host,
 #endif
 	debug("%s, caps: 0x%x\n", __func__, caps);
 
+	if (host->quirks & SDHCI_QUIRK_REG32_RW)
+		host->version =
+			sdhci_readl(host, SDHCI_HOST_VERSION - 2) >> 16;
+	else
+		host->version = sdhci_readw(host, SDHCI_HOST_VERSION);
+	if (SDHCI_GET_VERSION(host) < SDHCI_SPEC_400)
+		host->v4_mode = false;
+
 #ifdef CONFIG_MMC_SDHCI_SDMA
 	if (!(caps & SDHCI_CAN_DO_SDMA)) {
 		printf("%s: Your controller doesn't support SDMA!!\n",
@@ -743,19 +875,29 @@ int sdhci_setup_cfg(struct mmc_config *cfg, struct sdhci_host *host,
 	}
 	host->adma_desc_table = (struct sdhci_adma_desc *)
 				memalign(ARCH_DMA_MINALIGN, ADMA_TABLE_SZ);
+	host->align_buffer = memalign(ARCH_DMA_MINALIGN,
+				      2 * ARCH_DMA_MINALIGN);
+	if (!host->adma_desc_table || !host->align_buffer)
+		return -ENOMEM;
 
 	host->adma_addr = (dma_addr_t)host->adma_desc_table;
 #ifdef CONFIG_DMA_ADDR_T_64BIT
-	host->flags |= USE_ADMA64;
+	if (caps & (host->v4_mode ? SDHCI_CAN_64BIT_V4 : SDHCI_CAN_64BIT))
+		host->flags |= USE_ADMA64;
+	else
+		host->flags |= USE_ADMA;
 #else
 	host->flags |= USE_ADMA;
 #endif
+	/* the descriptors must be reachable too, else data go by PIO */
+	if ((host->flags & USE_ADMA) &&
+	    (!sdhci_below_4g((ulong)host->adma_desc_table, ADMA_TABLE_SZ) ||
+	     !sdhci_below_4g((ulong)host->align_buffer,
+			     2 * ARCH_DMA_MINALIGN))) {
+		printf("%s: ADMA tables above 4GiB, using PIO\n", __func__);
+		host->flags &= ~USE_ADMA;
+	}
 #endif
-	if (host->quirks & SDHCI_QUIRK_REG32_RW)
-		host->version =
-			sdhci_readl(host, SDHCI_HOST_VERSION - 2) >> 16;
-	else
-		host->version = sdhci_readw(host, SDHCI_HOST_VERSION);
 
 	cfg->name = host->name;
 #ifndef CONFIG_DM_MMC
@@ -854,6 +996,9 @@ int sdhci_setup_cfg(struct mmc_config *cfg, struct sdhci_host *host,
 	if (host->host_caps)
 		cfg->host_caps |= host->host_caps;
 
+	/* Nothing stops transfers behind the core's back, see mmc_use_sbc() */
+	if (!(host->quirks & SDHCI_QUIRK_NO_CMD23))
+		cfg->host_caps |= MMC_CAP_CMD23;
 	cfg->b_max = CONFIG_SYS_MMC_MAX_BLK_COUNT;
 
 	return 0;
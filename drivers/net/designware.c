@@ -453,6 +453,45 @@ static int _dw_eth_recv(struct dw_eth_dev *priv, uchar **packetp)
 	return length;
 }
 
+static int _dw_eth_recv_batch(struct dw_eth_dev *priv,
+			      struct eth_rx_pkt *pkts, int count)
+{
+	u32 status, desc_num = priv->rx_currdescnum;
+	struct dmamacdescr *desc_p;
+	ulong data_start;
+	int length;
+	int n;
+
+	/* Invalidate all descriptors at once rather than one at a time */
+	invalidate_dcache_range((ulong)priv->rx_mac_descrtable,
+				(ulong)priv->rx_mac_descrtable +
+				sizeof(priv->rx_mac_descrtable));
+
+	count = min(count, CONFIG_RX_DESCR_NUM);
+	for (n = 0; n < count; n++) {
+		desc_p = &priv->rx_mac_descrtable[desc_num];
+		status = desc_p->txrx_status;
+		if (status & DESC_RXSTS_OWNBYDMA)
+			break;
+
+		length = (status & DESC_RXSTS_FRMLENMSK) >>
+			 DESC_RXSTS_FRMLENSHFT;
+		data_start = desc_p->dmamac_addr;
+		invalidate_dcache_range(data_start, data_start +
+					roundup(length, ARCH_DMA_MINALIGN));
+
+		pkts[n].packet = (uchar *)data_start;
+		pkts[n].length = length;
+		pkts[n].payload = NULL;
+
+		/* _dw_free_pkt() hands them back in the same order */
+		if (++desc_num >= CONFIG_RX_DESCR_NUM)
+			desc_num = 0;
+	}
+
+	return n;
+}
+
 static int _dw_free_pkt(struct dw_eth_dev *priv)
 {
 	u32 desc_num = priv->rx_currdescnum;
@@ -632,6 +671,14 @@ int designware_eth_recv(struct udevice *dev, int flags, uchar **packetp)
 	return _dw_eth_recv(priv, packetp);
 }
 
+int designware_eth_recv_batch(struct udevice *dev, int flags,
+			      struct eth_rx_pkt *pkts, int count)
+{
+	struct dw_eth_dev *priv = dev_get_priv(dev);
+
+	return _dw_eth_recv_batch(priv, pkts, count);
+}
+
 int designware_eth_free_pkt(struct udevice *dev, uchar *packet, int length)
 {
 	struct dw_eth_dev *priv = dev_get_priv(dev);
@@ -799,6 +846,7 @@ const struct eth_ops designware_eth_ops = {
 	.start			= designware_eth_start,
 	.send			= designware_eth_send,
 	.recv			= designware_eth_recv,
+	.recv_batch		= designware_eth_recv_batch,
 	.free_pkt		= designware_eth_free_pkt,
 	.stop			= designware_eth_stop,
 	.write_hwaddr		= designware_eth_write_hwaddr,
@@ -12,7 +12,7 @@
 #endif
 
 #define CONFIG_TX_DESCR_NUM	16
-#define CONFIG_RX_DESCR_NUM	16
+#define CONFIG_RX_DESCR_NUM	ETH_RX_RING_SIZE(16)
 #define CONFIG_ETH_BUFSIZE	2048
 #define TX_TOTAL_BUFSIZE	(CONFIG_ETH_BUFSIZE * CONFIG_TX_DESCR_NUM)
 #define RX_TOTAL_BUFSIZE	(CONFIG_ETH_BUFSIZE * CONFIG_RX_DESCR_NUM)
@@ -261,6 +261,8 @@ int designware_eth_init(struct dw_eth_dev *priv, u8 *enetaddr);
 int designware_eth_enable(struct dw_eth_dev *priv);
 int designware_eth_send(struct udevice *dev, void *packet, int length);
 int designware_eth_recv(struct udevice *dev, int flags, uchar **packetp);
+int designware_eth_recv_batch(struct udevice *dev, int flags,
+			      struct eth_rx_pkt *pkts, int count);
 int designware_eth_free_pkt(struct udevice *dev, uchar *packet,
 				   int length);
 void designware_eth_stop(struct udevice *dev);
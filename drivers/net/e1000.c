@@ -55,6 +55,20 @@ tested on both gig copper and gig fiber boards
 /* Intel i210 needs the DMA descriptor rings aligned to 128b */
 #define E1000_BUFFER_ALIGN	128
 
+/*
+ * Receive descriptors share cache lines, so they are given back to the
+ * hardware a whole line at a time. The length of the ring must be a
+ * multiple of 128 bytes as well as of the line size.
+ */
+#define E1000_RX_DESC_PER_LINE	\
+	(ARCH_DMA_MINALIGN > 16 ? ARCH_DMA_MINALIGN / 16 : 1)
+#define E1000_RX_RING_SIZE	ALIGN(ETH_RX_RING_SIZE(32), \
+				      E1000_RX_DESC_PER_LINE > 8 ? \
+				      E1000_RX_DESC_PER_LINE : 8)
+#define E1000_RX_ALIGN		(ARCH_DMA_MINALIGN > E1000_BUFFER_ALIGN ? \
+				 ARCH_DMA_MINALIGN : E1000_BUFFER_ALIGN)
+#define E1000_RX_BUF_SIZE	2048
+
 /*
  * TODO(sjg@chromium.org): Even with driver model we share these buffers.
  * Concurrent receiving on multiple active Ethernet devices will not work.
@@ -62,11 +76,13 @@ tested on both gig copper and gig fiber boards
  * move these buffers and the tx/rx pointers to struct e1000_hw.
  */
 DEFINE_ALIGN_BUFFER(struct e1000_tx_desc, tx_base, 16, E1000_BUFFER_ALIGN);
-DEFINE_ALIGN_BUFFER(struct e1000_rx_desc, rx_base, 16, E1000_BUFFER_ALIGN);
-DEFINE_ALIGN_BUFFER(unsigned char, packet, 4096, E1000_BUFFER_ALIGN);
+DEFINE_ALIGN_BUFFER(struct e1000_rx_desc, rx_base, E1000_RX_RING_SIZE,
+		    E1000_RX_ALIGN);
+DEFINE_ALIGN_BUFFER(unsigned char, packet,
+		    E1000_RX_RING_SIZE * E1000_RX_BUF_SIZE, E1000_BUFFER_ALIGN);
 
 static int tx_tail;
-static int rx_tail, rx_last;
+static int rx_last;	/* next receive descriptor to look at */
 #ifdef CONFIG_DM_ETH
 static int num_cards;	/* Number of E1000 devices seen so far */
 #endif
@@ -5130,31 +5146,54 @@ e1000_sw_init(struct e1000_hw *hw)
 	return E1000_SUCCESS;
 }
 
-void
-fill_rx(struct e1000_hw *hw)
+static void
+init_rx_desc(int i)
 {
-	struct e1000_rx_desc *rd;
-	unsigned long flush_start, flush_end;
+	struct e1000_rx_desc *rd = rx_base + i;
+	unsigned char *buf = packet + i * E1000_RX_BUF_SIZE;
 
-	rx_last = rx_tail;
-	rd = rx_base + rx_tail;
-	rx_tail = (rx_tail + 1) % 8;
 	memset(rd, 0, 16);
-	rd->buffer_addr = cpu_to_le64((unsigned long)packet);
+	rd->buffer_addr = cpu_to_le64((unsigned long)buf);
 
 	/*
 	 * Make sure there are no stale data in WB over this area, which
 	 * might get written into the memory while the e1000 also writes
 	 * into the same memory area.
 	 */
-	invalidate_dcache_range((unsigned long)packet,
-				(unsigned long)packet + 4096);
-	/* Dump the DMA descriptor into RAM. */
-	flush_start = ((unsigned long)rd) & ~(ARCH_DMA_MINALIGN - 1);
-	flush_end = flush_start + roundup(sizeof(*rd), ARCH_DMA_MINALIGN);
-	flush_dcache_range(flush_start, flush_end);
+	invalidate_dcache_range((unsigned long)buf,
+				(unsigned long)buf + E1000_RX_BUF_SIZE);
+}
 
-	E1000_WRITE_REG(hw, RDT, rx_tail);
+/*
+ * Done with the oldest receive descriptor. Once all descriptors sharing its
+ * cache line are, give the line back to the hardware: flushing it earlier
+ * would write stale copies over descriptors the hardware has completed.
+ */
+void
+fill_rx(struct e1000_hw *hw)
+{
+	int first;
+	int i;
+
+	rx_last = (rx_last + 1) % E1000_RX_RING_SIZE;
+	if (rx_last % E1000_RX_DESC_PER_LINE)
+		return;
+
+	first = (rx_last ? rx_last : E1000_RX_RING_SIZE) -
+		E1000_RX_DESC_PER_LINE;
+	for (i = first; i < first + E1000_RX_DESC_PER_LINE; i++)
+		init_rx_desc(i);
+
+	/* Dump the DMA descriptors into RAM. */
+	flush_dcache_range((unsigned long)(rx_base + first),
+			   (unsigned long)(rx_base + first +
+					   E1000_RX_DESC_PER_LINE));
+
+	/*
+	 * The hardware owns all descriptors from RDH up to RDT - 1, so the
+	 * line just filled is the one it stays off until the next call
+	 */
+	E1000_WRITE_REG(hw, RDT, first);
 }
 
 /**
@@ -5295,7 +5334,7 @@ static void
 e1000_configure_rx(struct e1000_hw *hw)
 {
 	unsigned long rctl, ctrl_ext;
-	rx_tail = 0;
+	int i;
 
 	/* make sure receives are disabled while setting up the descriptors */
 	rctl = E1000_READ_REG(hw, RCTL);
@@ -5319,7 +5358,8 @@ e1000_configure_rx(struct e1000_hw *hw)
 	E1000_WRITE_REG(hw, RDBAL, lower_32_bits((unsigned long)rx_base));
 	E1000_WRITE_REG(hw, RDBAH, upper_32_bits((unsigned long)rx_base));
 
-	E1000_WRITE_REG(hw, RDLEN, 128);
+	E1000_WRITE_REG(hw, RDLEN,
+			E1000_RX_RING_SIZE * sizeof(struct e1000_rx_desc));
 
 	/* Setup the HW Rx Head and Tail Descriptor Pointers */
 	E1000_WRITE_REG(hw, RDH, 0);
@@ -5336,21 +5376,31 @@ e1000_configure_rx(struct e1000_hw *hw)
 
 	E1000_WRITE_REG(hw, RCTL, rctl);
 
-	fill_rx(hw);
+	/* Fill the whole ring, but for the cache line RDT points at */
+	for (i = 0; i < E1000_RX_RING_SIZE; i++)
+		init_rx_desc(i);
+	flush_dcache_range((unsigned long)rx_base,
+			   (unsigned long)(rx_base + E1000_RX_RING_SIZE));
+	rx_last = 0;
+	E1000_WRITE_REG(hw, RDT, E1000_RX_RING_SIZE - E1000_RX_DESC_PER_LINE);
 }
 
 /**************************************************************************
 POLL - Wait for a frame
 ***************************************************************************/
 static int
-_e1000_poll(struct e1000_hw *hw)
+_e1000_poll(struct e1000_hw *hw, int ahead, uchar **packetp)
 {
 	struct e1000_rx_desc *rd;
 	unsigned long inval_start, inval_end;
+	unsigned char *buf;
 	uint32_t len;
+	int i;
 
 	/* return true if there's an ethernet packet ready to read */
-	rd = rx_base + rx_last;
+	i = (rx_last + ahead) % E1000_RX_RING_SIZE;
+	rd = rx_base + i;
+	buf = packet + i * E1000_RX_BUF_SIZE;
 
 	/* Re-load the descriptor from RAM. */
 	inval_start = ((unsigned long)rd) & ~(ARCH_DMA_MINALIGN - 1);
@@ -5362,9 +5412,10 @@ _e1000_poll(struct e1000_hw *hw)
 	/* DEBUGOUT("recv: packet len=%d\n", rd->length); */
 	/* Packet received, make sure the data are re-loaded from RAM. */
 	len = le16_to_cpu(rd->length);
-	invalidate_dcache_range((unsigned long)packet,
-				(unsigned long)packet +
+	invalidate_dcache_range((unsigned long)buf,
+				(unsigned long)buf +
 				roundup(len, ARCH_DMA_MINALIGN));
+	*packetp = buf;
 	return len;
 }
 
@@ -5639,11 +5690,12 @@ static int
 e1000_poll(struct eth_device *nic)
 {
 	struct e1000_hw *hw = nic->priv;
+	uchar *pkt;
 	int len;
 
-	len = _e1000_poll(hw);
+	len = _e1000_poll(hw, 0, &pkt);
 	if (len) {
-		net_process_received_packet((uchar *)packet, len);
+		net_process_received_packet(pkt, len);
 		fill_rx(hw);
 	}
 
@@ -5861,13 +5913,31 @@ static int e1000_eth_recv(struct udevice *dev, int flags, uchar **packetp)
 	struct e1000_hw *hw = dev_get_priv(dev);
 	int len;
 
-	len = _e1000_poll(hw);
-	if (len)
-		*packetp = packet;
+	len = _e1000_poll(hw, 0, packetp);
 
 	return len ? len : -EAGAIN;
 }
 
+static int e1000_eth_recv_batch(struct udevice *dev, int flags,
+				struct eth_rx_pkt *pkts, int count)
+{
+	struct e1000_hw *hw = dev_get_priv(dev);
+	int len;
+	int n;
+
+	/* e1000_free_pkt() gives them back in the same order */
+	count = min(count, E1000_RX_RING_SIZE - E1000_RX_DESC_PER_LINE);
+	for (n = 0; n < count; n++) {
+		len = _e1000_poll(hw, n, &pkts[n].packet);
+		if (!len)
+			break;
+		pkts[n].length = len;
+		pkts[n].payload = NULL;
+	}
+
+	return n;
+}
+
 static int e1000_free_pkt(struct udevice *dev, uchar *packet, int length)
 {
 	struct e1000_hw *hw = dev_get_priv(dev);
@@ -5913,6 +5983,7 @@ static const struct eth_ops e1000_eth_ops = {
 	.start	= e1000_eth_start,
 	.send	= e1000_eth_send,
 	.recv	= e1000_eth_recv,
+	.recv_batch = e1000_eth_recv_batch,
 	.stop	= e1000_eth_stop,
 	.free_pkt = e1000_free_pkt,
 };
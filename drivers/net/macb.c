@@ -54,7 +54,7 @@ DECLARE_GLOBAL_DATA_PTR;
 #define GEM_RX_BUFFER_SIZE		2048
 #define RX_BUFFER_MULTIPLE		64
 
-#define MACB_RX_RING_SIZE		32
+#define MACB_RX_RING_SIZE		ETH_RX_RING_SIZE(32)
 #define MACB_TX_RING_SIZE		16
 
 #define MACB_TX_TIMEOUT		1000
@@ -100,6 +100,8 @@ struct macb_device {
 	unsigned int		tx_head;
 	unsigned int		tx_tail;
 	unsigned int		next_rx_tail;
+	unsigned int		rx_frame;	/* first buffer of the frame */
+	unsigned int		rx_pending;	/* frames not freed yet */
 	bool			wrapped;
 
 	void			*rx_buffer;
@@ -390,6 +392,7 @@ static int _macb_recv(struct macb_device *macb, uchar **packetp)
 	u32 status;
 
 	macb->wrapped = false;
+	macb->rx_frame = next_rx_tail;
 	for (;;) {
 		macb_invalidate_ring_desc(macb, RX);
 
@@ -398,14 +401,19 @@ static int _macb_recv(struct macb_device *macb, uchar **packetp)
 
 		status = macb->rx_ring[next_rx_tail].ctrl;
 		if (status & MACB_BIT(RX_SOF)) {
-			if (next_rx_tail != macb->rx_tail)
+			/*
+			 * Drop the start of an incomplete frame, unless the
+			 * buffers still hold frames of the current batch
+			 */
+			if (next_rx_tail != macb->rx_tail && !macb->rx_pending)
 				reclaim_rx_buffers(macb, next_rx_tail);
+			macb->rx_frame = next_rx_tail;
 			macb->wrapped = false;
 		}
 
 		if (status & MACB_BIT(RX_EOF)) {
 			buffer = macb->rx_buffer +
-				macb->rx_buffer_size * macb->rx_tail;
+				macb->rx_buffer_size * macb->rx_frame;
 			length = status & RXBUF_FRMLEN_MASK;
 
 			macb_invalidate_rx_buffer(macb);
@@ -413,7 +421,7 @@ static int _macb_recv(struct macb_device *macb, uchar **packetp)
 				unsigned int headlen, taillen;
 
 				headlen = macb->rx_buffer_size *
-					(MACB_RX_RING_SIZE - macb->rx_tail);
+					(MACB_RX_RING_SIZE - macb->rx_frame);
 				taillen = length - headlen;
 				memcpy((void *)net_rx_packets[0],
 				       buffer, headlen);
@@ -805,6 +813,7 @@ static int _macb_init(struct macb_device *macb, const char *name)
 	macb->tx_head = 0;
 	macb->tx_tail = 0;
 	macb->next_rx_tail = 0;
+	macb->rx_pending = 0;
 
 #ifdef CONFIG_MACB_ZYNQ
 	macb_writel(macb, DMACFG, MACB_ZYNQ_GEM_DMACR_INIT);
@@ -1149,10 +1158,39 @@ static int macb_recv(struct udevice *dev, int flags, uchar **packetp)
 	return _macb_recv(macb, packetp);
 }
 
+/*
+ * The buffers of all frames are only handed back once the last one has been
+ * processed, so at most one frame in a batch can wrap around the end of the
+ * ring and need copying into net_rx_packets[0].
+ */
+static int macb_recv_batch(struct udevice *dev, int flags,
+			   struct eth_rx_pkt *pkts, int count)
+{
+	struct macb_device *macb = dev_get_priv(dev);
+	int length;
+	int n;
+
+	macb->next_rx_tail = macb->rx_tail;
+	macb->rx_pending = 0;
+	for (n = 0; n < count; n++) {
+		length = _macb_recv(macb, &pkts[n].packet);
+		if (length < 0)
+			break;
+		pkts[n].length = length;
+		pkts[n].payload = NULL;
+		macb->rx_pending++;
+	}
+
+	return n;
+}
+
 static int macb_free_pkt(struct udevice *dev, uchar *packet, int length)
 {
 	struct macb_device *macb = dev_get_priv(dev);
 
+	if (macb->rx_pending && --macb->rx_pending)
+		return 0;
+
 	reclaim_rx_buffers(macb, macb->next_rx_tail);
 
 	return 0;
@@ -1177,6 +1215,7 @@ static const struct eth_ops macb_eth_ops = {
 	.start	= macb_start,
 	.send	= macb_send,
 	.recv	= macb_recv,
+	.recv_batch	= macb_recv_batch,
 	.stop	= macb_stop,
 	.free_pkt	= macb_free_pkt,
 	.write_hwaddr	= macb_write_hwaddr,
@@ -14,13 +14,11 @@
 #include <dm/device-internal.h>
 #include "nvme.h"
 
-#define NVME_Q_DEPTH		2
 #define NVME_AQ_DEPTH		2
 #define NVME_SQ_SIZE(depth)	(depth * sizeof(struct nvme_command))
 #define NVME_CQ_SIZE(depth)	(depth * sizeof(struct nvme_completion))
 #define ADMIN_TIMEOUT		60
 #define IO_TIMEOUT		30
-#define MAX_PRP_POOL		512
 
 enum nvme_queue_id {
 	NVME_ADMIN_Q,
@@ -67,12 +65,22 @@ static int nvme_wait_ready(struct nvme_dev *dev, bool enabled)
 	return -ETIME;
 }
 
-static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp2,
+/**
+ * nvme_setup_prps() - build the PRP list of a command
+ *
+ * @dev:	NVMe device
+ * @prp_pool:	Where to build the list, prp_entry_num entries long
+ * @prp2:	Returns the PRP2 value of the command
+ * @total_len:	Number of bytes to transfer
+ * @dma_addr:	Address of the buffer, which goes in PRP1
+ * @return 0 if OK, -EINVAL if the list does not fit
+ */
+static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp_pool, u64 *prp2,
 			   int total_len, u64 dma_addr)
 {
 	u32 page_size = dev->page_size;
 	int offset = dma_addr & (page_size - 1);
-	u64 *prp_pool;
+	u64 *prp_list = prp_pool;
 	int length = total_len;
 	int i, nprps;
 	u32 prps_per_page = (page_size >> 3) - 1;
@@ -96,37 +104,27 @@ static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp2,
 	nprps = DIV_ROUND_UP(length, page_size);
 	num_pages = DIV_ROUND_UP(nprps, prps_per_page);
 
-	if (nprps > dev->prp_entry_num) {
-		free(dev->prp_pool);
-		/*
-		 * Always increase in increments of pages.  It doesn't waste
-		 * much memory and reduces the number of allocations.
-		 */
-		dev->prp_pool = memalign(page_size, num_pages * page_size);
-		if (!dev->prp_pool) {
-			printf("Error: malloc prp_pool fail\n");
-			return -ENOMEM;
-		}
-		dev->prp_entry_num = prps_per_page * num_pages;
+	if (num_pages * (page_size >> 3) > dev->prp_entry_num) {
+		printf("Error: PRP list too long\n");
+		return -EINVAL;
 	}
 
-	prp_pool = dev->prp_pool;
 	i = 0;
 	while (nprps) {
 		if (i == ((page_size >> 3) - 1)) {
-			*(prp_pool + i) = cpu_to_le64((ulong)prp_pool +
+			*(prp_list + i) = cpu_to_le64((ulong)prp_list +
 					page_size);
 			i = 0;
-			prp_pool += page_size;
+			prp_list += page_size >> 3;
 		}
-		*(prp_pool + i++) = cpu_to_le64(dma_addr);
+		*(prp_list + i++) = cpu_to_le64(dma_addr);
 		dma_addr += page_size;
 		nprps--;
 	}
-	*prp2 = (ulong)dev->prp_pool;
+	*prp2 = (ulong)prp_pool;
 
-	flush_dcache_range((ulong)dev->prp_pool, (ulong)dev->prp_pool +
-			   dev->prp_entry_num * sizeof(u64));
+	flush_dcache_range((ulong)prp_pool, (ulong)prp_pool +
+			   num_pages * page_size);
 
 	return 0;
 }
@@ -168,47 +166,34 @@ static void nvme_submit_cmd(struct nvme_queue *nvmeq, struct nvme_command *cmd)
 	nvmeq->sq_tail = tail;
 }
 
-static int nvme_submit_sync_cmd(struct nvme_queue *nvmeq,
-				struct nvme_command *cmd,
-				u32 *result, unsigned timeout)
+/**
+ * nvme_get_completion() - take the next completion posted on a queue
+ *
+ * @nvmeq:	The queue to check
+ * @cmdid:	Returns the ID of the command which completed, if not NULL
+ * @result:	Returns the result of the command, if not NULL
+ * @return 0 if the command succeeded, -EINPROGRESS if no command has
+ * completed, -EIO if it failed
+ */
+static int nvme_get_completion(struct nvme_queue *nvmeq, u16 *cmdid,
+			       u32 *result)
 {
 	u16 head = nvmeq->cq_head;
 	u16 phase = nvmeq->cq_phase;
 	u16 status;
-	ulong start_time;
-	ulong timeout_us = timeout * 100000;
 
-	cmd->common.command_id = nvme_get_cmd_id();
-	nvme_submit_cmd(nvmeq, cmd);
-
-	start_time = timer_get_us();
+	status = nvme_read_completion_status(nvmeq, head);
+	if ((status & 0x01) != phase)
+		return -EINPROGRESS;
 
-	for (;;) {
-		status = nvme_read_completion_status(nvmeq, head);
-		if ((status & 0x01) == phase)
-			break;
-		if (timeout_us > 0 && (timer_get_us() - start_time)
-		    >= timeout_us)
-			return -ETIMEDOUT;
-	}
+	if (cmdid)
+		*cmdid = le16_to_cpu(readw(&nvmeq->cqes[head].command_id));
 
 	status >>= 1;
-	if (status) {
+	if (status)
 		printf("ERROR: status = %x, phase = %d, head = %d\n",
 		       status, phase, head);
-		status = 0;
-		if (++head == nvmeq->q_depth) {
-			head = 0;
-			phase = !phase;
-		}
-		writel(head, nvmeq->q_db + nvmeq->dev->db_stride);
-		nvmeq->cq_head = head;
-		nvmeq->cq_phase = phase;
-
-		return -EIO;
-	}
-
-	if (result)
+	else if (result)
 		*result = le32_to_cpu(readl(&(nvmeq->cqes[head].result)));
 
 	if (++head == nvmeq->q_depth) {
@@ -219,7 +204,33 @@ static int nvme_submit_sync_cmd(struct nvme_queue *nvmeq,
 	nvmeq->cq_head = head;
 	nvmeq->cq_phase = phase;
 
-	return status;
+	return status ? -EIO : 0;
+}
+
+static int nvme_submit_sync_cmd(struct nvme_queue *nvmeq,
+				struct nvme_command *cmd,
+				u32 *result, unsigned timeout)
+{
+	ulong start_time;
+	ulong timeout_us = timeout * 100000;
+	int ret;
+	u16 id;
+
+	cmd->common.command_id = nvme_get_cmd_id();
+	nvme_submit_cmd(nvmeq, cmd);
+
+	start_time = timer_get_us();
+
+	for (;;) {
+		ret = nvme_get_completion(nvmeq, &id, result);
+		/* skip late completions of commands which timed out */
+		if (ret != -EINPROGRESS &&
+		    id == le16_to_cpu(cmd->common.command_id))
+			return ret;
+		if (timeout_us > 0 && (timer_get_us() - start_time)
+		    >= timeout_us)
+			return -ETIMEDOUT;
+	}
 }
 
 static int nvme_submit_admin_cmd(struct nvme_dev *dev, struct nvme_command *cmd,
@@ -601,6 +612,7 @@ static int nvme_get_info_from_identify(struct nvme_dev *dev)
 
 	dev->nn = le32_to_cpu(ctrl->nn);
 	dev->vwc = ctrl->vwc;
+	dev->oncs = le16_to_cpu(ctrl->oncs);
 	memcpy(dev->serial, ctrl->sn, sizeof(ctrl->sn));
 	memcpy(dev->model, ctrl->mn, sizeof(ctrl->mn));
 	memcpy(dev->firmware_rev, ctrl->fr, sizeof(ctrl->fr));
@@ -632,6 +644,36 @@ static int nvme_get_info_from_identify(struct nvme_dev *dev)
 	return 0;
 }
 
+/*
+ * Allocate the PRP list of each command which may be in flight on the I/O
+ * queue, long enough for the maximum transfer size, so that the commands of
+ * a large transfer can all be sent at once
+ */
+static int nvme_alloc_io_cmds(struct nvme_dev *dev)
+{
+	u32 page_size = dev->page_size;
+	u32 prps_per_page = (page_size >> 3) - 1;
+	int count = dev->q_depth - 1;
+	u32 nprps, num_pages;
+
+	/* one more page as the buffer may not start on a page boundary */
+	nprps = (1ULL << dev->max_transfer_shift) / page_size + 1;
+	num_pages = DIV_ROUND_UP(nprps, prps_per_page);
+
+	dev->prp_entry_num = num_pages * (page_size >> 3);
+	dev->prp_pool = memalign(page_size, count * num_pages * page_size);
+	if (!dev->prp_pool)
+		return -ENOMEM;
+
+	dev->cmds = calloc(count, sizeof(*dev->cmds));
+	if (!dev->cmds) {
+		free(dev->prp_pool);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
 int nvme_get_namespace_id(struct udevice *udev, u32 *ns_id, u8 *eui64)
 {
 	struct nvme_ns *ns = dev_get_priv(udev);
@@ -701,69 +743,240 @@ static int nvme_blk_probe(struct udevice *udev)
 	sprintf(desc->vendor, "0x%.4x", pplat->vendor);
 	memcpy(desc->product, ndev->serial, sizeof(ndev->serial));
 	memcpy(desc->revision, ndev->firmware_rev, sizeof(ndev->firmware_rev));
+	desc->queue_depth = NVME_MAX_REQS;
+	/* deallocated blocks read as zero if the namespace says so */
+	desc->discard_zeroes = (ndev->oncs & NVME_CTRL_ONCS_DSM) &&
+		(id->dlfeat & NVME_NS_DLFEAT_READ_MASK) ==
+		NVME_NS_DLFEAT_READ_ZEROES;
 
 	free(id);
 	return 0;
 }
 
-static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
-			 lbaint_t blkcnt, void *buffer, bool read)
+/* Send a command for the next blocks of a transfer */
+static int nvme_io_cmd(struct nvme_dev *dev, struct nvme_rq *rq, int id)
 {
-	struct nvme_ns *ns = dev_get_priv(udev);
-	struct nvme_dev *dev = ns->dev;
+	struct nvme_ns *ns = rq->ns;
+	struct blk_req *req = rq->req;
+	struct nvme_io_cmd *cmd = &dev->cmds[id];
+	void *buffer = req->buffer + (rq->sent << ns->lba_shift);
 	struct nvme_command c;
-	struct blk_desc *desc = dev_get_uclass_platdata(udev);
-	int status;
+	lbaint_t lbas;
 	u64 prp2;
-	u64 total_len = blkcnt << desc->log2blksz;
-	u64 temp_len = total_len;
-
-	u64 slba = blknr;
-	u16 lbas = 1 << (dev->max_transfer_shift - ns->lba_shift);
-	u64 total_lbas = blkcnt;
 
-	flush_dcache_range((unsigned long)buffer,
-			   (unsigned long)buffer + total_len);
+	lbas = min(req->blkcnt - rq->sent,
+		   (lbaint_t)1 << (dev->max_transfer_shift - ns->lba_shift));
+	/* the length field of the command is 16 bits */
+	lbas = min(lbas, (lbaint_t)0x10000);
+	if (nvme_setup_prps(dev, dev->prp_pool + id * dev->prp_entry_num,
+			    &prp2, lbas << ns->lba_shift, (ulong)buffer))
+		return -EIO;
 
-	c.rw.opcode = read ? nvme_cmd_read : nvme_cmd_write;
-	c.rw.flags = 0;
+	memset(&c, '\0', sizeof(c));
+	c.rw.opcode = rq->write ? nvme_cmd_write : nvme_cmd_read;
+	c.rw.command_id = cpu_to_le16(id);
 	c.rw.nsid = cpu_to_le32(ns->ns_id);
-	c.rw.control = 0;
-	c.rw.dsmgmt = 0;
-	c.rw.reftag = 0;
-	c.rw.apptag = 0;
-	c.rw.appmask = 0;
-	c.rw.metadata = 0;
-
-	while (total_lbas) {
-		if (total_lbas < lbas) {
-			lbas = (u16)total_lbas;
-			total_lbas = 0;
-		} else {
-			total_lbas -= lbas;
+	c.rw.slba = cpu_to_le64(req->start + rq->sent);
+	c.rw.length = cpu_to_le16(lbas - 1);
+	c.rw.prp1 = cpu_to_le64((ulong)buffer);
+	c.rw.prp2 = cpu_to_le64(prp2);
+	nvme_submit_cmd(dev->queues[NVME_IO_Q], &c);
+
+	cmd->rq = rq;
+	cmd->lbas = lbas;
+	cmd->start = timer_get_us();
+	rq->sent += lbas;
+	rq->inflight++;
+
+	return 0;
+}
+
+/* Fill the I/O queue with commands for the transfers in progress */
+static void nvme_io_send(struct nvme_dev *dev)
+{
+	struct nvme_rq *rq;
+	int i, id = 0;
+	int ret;
+
+	for (i = 0; i < NVME_MAX_REQS; i++) {
+		rq = &dev->rqs[i];
+		if (!rq->req)
+			continue;
+		while (!rq->err && rq->sent < rq->req->blkcnt) {
+			while (id < dev->q_depth - 1 && dev->cmds[id].rq)
+				id++;
+			if (id == dev->q_depth - 1)
+				return;
+			ret = nvme_io_cmd(dev, rq, id);
+			if (ret)
+				rq->err = ret;
 		}
+	}
+}
 
-		if (nvme_setup_prps(dev, &prp2,
-				    lbas << ns->lba_shift, (ulong)buffer))
-			return -EIO;
-		c.rw.slba = cpu_to_le64(slba);
-		slba += lbas;
-		c.rw.length = cpu_to_le16(lbas - 1);
-		c.rw.prp1 = cpu_to_le64((ulong)buffer);
-		c.rw.prp2 = cpu_to_le64(prp2);
-		status = nvme_submit_sync_cmd(dev->queues[NVME_IO_Q],
-				&c, NULL, IO_TIMEOUT);
-		if (status)
-			break;
-		temp_len -= (u32)lbas << ns->lba_shift;
-		buffer += lbas << ns->lba_shift;
+/* Take the completions posted on the I/O queue */
+static void nvme_io_complete(struct nvme_dev *dev)
+{
+	struct nvme_queue *nvmeq = dev->queues[NVME_IO_Q];
+	struct nvme_io_cmd *cmd;
+	u16 id;
+	int ret;
+
+	while ((ret = nvme_get_completion(nvmeq, &id, NULL)) !=
+	       -EINPROGRESS) {
+		if (id >= dev->q_depth - 1 || !dev->cmds[id].rq)
+			continue;
+		cmd = &dev->cmds[id];
+		if (ret)
+			cmd->rq->err = ret;
+		else
+			cmd->rq->done += cmd->lbas;
+		cmd->rq->inflight--;
+		cmd->rq = NULL;
+	}
+}
+
+/*
+ * Reset the I/O queue after a command timed out. The controller may still
+ * complete that command, so its ID cannot be used again until the queue is
+ * deleted: this aborts whatever the controller still holds. The commands
+ * left over fail and the queue is created again from scratch.
+ */
+static void nvme_io_reset(struct nvme_dev *dev)
+{
+	struct nvme_queue *nvmeq = dev->queues[NVME_IO_Q];
+	struct nvme_io_cmd *cmd;
+	int i, ret;
+
+	ret = nvme_delete_sq(dev, NVME_IO_Q);
+	/* the commands aborted by the deletion are completed before it */
+	nvme_io_complete(dev);
+	if (!ret)
+		ret = nvme_delete_cq(dev, NVME_IO_Q);
+	if (!ret) {
+		dev->online_queues--;
+		ret = nvme_create_queue(nvmeq, NVME_IO_Q);
+	}
+	if (ret) {
+		/* a disabled controller no longer touches the queues */
+		printf("Error: cannot reset the I/O queue (%d)\n", ret);
+		nvme_disable_ctrl(dev);
+	}
+
+	for (i = 0; i < dev->q_depth - 1; i++) {
+		cmd = &dev->cmds[i];
+		if (!cmd->rq)
+			continue;
+		if (!cmd->rq->err)
+			cmd->rq->err = -EIO;
+		cmd->rq->inflight--;
+		cmd->rq = NULL;
 	}
+}
+
+/* Take the completions of the I/O commands and finish the transfers */
+static void nvme_io_poll(struct nvme_dev *dev)
+{
+	struct nvme_io_cmd *cmd;
+	struct blk_req *req;
+	struct nvme_rq *rq;
+	bool timed_out = false;
+	int i;
+
+	nvme_io_complete(dev);
+
+	for (i = 0; i < dev->q_depth - 1; i++) {
+		cmd = &dev->cmds[i];
+		if (cmd->rq &&
+		    timer_get_us() - cmd->start >= IO_TIMEOUT * 100000) {
+			printf("Error: I/O command %d timed out\n", i);
+			cmd->rq->err = -ETIMEDOUT;
+			timed_out = true;
+		}
+	}
+	if (timed_out)
+		nvme_io_reset(dev);
+
+	for (i = 0; i < NVME_MAX_REQS; i++) {
+		rq = &dev->rqs[i];
+		req = rq->req;
+		if (!req || rq->inflight ||
+		    (!rq->err && rq->done < req->blkcnt))
+			continue;
+		if (!rq->write)
+			invalidate_dcache_range((ulong)req->buffer,
+						(ulong)req->buffer +
+						(req->blkcnt <<
+						 rq->ns->lba_shift));
+		req->result = rq->err ? rq->err : req->blkcnt;
+		req->done = true;
+		rq->req = NULL;
+	}
+
+	nvme_io_send(dev);
+}
+
+/* Start a transfer, whose commands are sent as the queue has room */
+static int nvme_io_start(struct nvme_ns *ns, struct blk_req *req, bool write)
+{
+	struct nvme_dev *dev = ns->dev;
+	struct nvme_rq *rq;
+	int i;
+
+	for (i = 0; i < NVME_MAX_REQS; i++)
+		if (!dev->rqs[i].req)
+			break;
+	if (i == NVME_MAX_REQS)
+		return -EBUSY;
+
+	flush_dcache_range((ulong)req->buffer,
+			   (ulong)req->buffer + (req->blkcnt << ns->lba_shift));
+
+	rq = &dev->rqs[i];
+	memset(rq, '\0', sizeof(*rq));
+	rq->ns = ns;
+	rq->req = req;
+	rq->write = write;
+	nvme_io_send(dev);
+
+	return 0;
+}
+
+static int nvme_blk_submit_read(struct udevice *udev, struct blk_req *req)
+{
+	return nvme_io_start(dev_get_priv(udev), req, false);
+}
+
+static int nvme_blk_poll(struct udevice *udev)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+
+	nvme_io_poll(ns->dev);
+
+	return 0;
+}
+
+static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
+			 lbaint_t blkcnt, void *buffer, bool read)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct blk_req req = {
+		.start = blknr,
+		.blkcnt = blkcnt,
+		.buffer = buffer,
+	};
+	int ret;
+
+	/* wait for room if transfers submitted earlier take it all */
+	while ((ret = nvme_io_start(ns, &req, !read)) == -EBUSY)
+		nvme_io_poll(ns->dev);
+	if (ret)
+		return ret;
 
-	if (read)
-		invalidate_dcache_range((unsigned long)buffer,
-					(unsigned long)buffer + total_len);
+	while (!req.done)
+		nvme_io_poll(ns->dev);
 
-	return (total_len - temp_len) >> desc->log2blksz;
+	return req.result;
 }
 
 static ulong nvme_blk_read(struct udevice *udev, lbaint_t blknr,
@@ -778,9 +991,66 @@ static ulong nvme_blk_write(struct udevice *udev, lbaint_t blknr,
 	return nvme_blk_rw(udev, blknr, blkcnt, (void *)buffer, false);
 }
 
+/*
+ * Deallocate the blocks with a Dataset Management command. It is sent on
+ * the I/O queue once the transfers in progress are done, so that it does
+ * not get in the way of their commands.
+ */
+static ulong nvme_blk_discard(struct udevice *udev, lbaint_t blknr,
+			      lbaint_t blkcnt)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_dev *dev = ns->dev;
+	struct nvme_dsm_range *range;
+	struct nvme_command c;
+	lbaint_t blks = 0, nlb;
+	int i, ret;
+
+	if (!(dev->oncs & NVME_CTRL_ONCS_DSM))
+		return 0;
+
+	range = memalign(dev->page_size, dev->page_size);
+	if (!range)
+		return -ENOMEM;
+
+	for (i = 0; i < NVME_MAX_REQS; i++)
+		while (dev->rqs[i].req)
+			nvme_io_poll(dev);
+
+	while (blks < blkcnt) {
+		nlb = min(blkcnt - blks, (lbaint_t)U32_MAX);
+		memset(range, '\0', sizeof(*range));
+		range->nlb = cpu_to_le32(nlb);
+		range->slba = cpu_to_le64(blknr + blks);
+		flush_dcache_range((ulong)range,
+				   (ulong)range + dev->page_size);
+
+		memset(&c, '\0', sizeof(c));
+		c.dsm.opcode = nvme_cmd_dsm;
+		c.dsm.nsid = cpu_to_le32(ns->ns_id);
+		c.dsm.prp1 = cpu_to_le64((ulong)range);
+		c.dsm.nr = 0;	/* one range */
+		c.dsm.attributes = cpu_to_le32(NVME_DSMGMT_AD);
+		ret = nvme_submit_sync_cmd(dev->queues[NVME_IO_Q], &c, NULL,
+					   IO_TIMEOUT);
+		if (ret == -ETIMEDOUT)
+			nvme_io_reset(dev);
+		if (ret)
+			break;
+		blks += nlb;
+	}
+
+	free(range);
+
+	return blks;
+}
+
 static const struct blk_ops nvme_blk_ops = {
 	.read	= nvme_blk_read,
 	.write	= nvme_blk_write,
+	.discard	= nvme_blk_discard,
+	.submit_read	= nvme_blk_submit_read,
+	.poll	= nvme_blk_poll,
 };
 
 U_BOOT_DRIVER(nvme_blk) = {
@@ -826,7 +1096,8 @@ static int nvme_probe(struct udevice *udev)
 	memset(ndev->queues, 0, NVME_Q_NUM * sizeof(struct nvme_queue *));
 
 	ndev->cap = nvme_readq(&ndev->bar->cap);
-	ndev->q_depth = min_t(int, NVME_CAP_MQES(ndev->cap) + 1, NVME_Q_DEPTH);
+	ndev->q_depth = min_t(int, NVME_CAP_MQES(ndev->cap) + 1,
+			      CONFIG_NVME_QUEUE_DEPTH);
 	ndev->db_stride = 1 << NVME_CAP_STRIDE(ndev->cap);
 	ndev->dbs = ((void __iomem *)ndev->bar) + 4096;
 
@@ -834,21 +1105,19 @@ static int nvme_probe(struct udevice *udev)
 	if (ret)
 		goto free_queue;
 
-	/* Allocate after the page size is known */
-	ndev->prp_pool = memalign(ndev->page_size, MAX_PRP_POOL);
-	if (!ndev->prp_pool) {
-		ret = -ENOMEM;
-		printf("Error: %s: Out of memory!\n", udev->name);
-		goto free_nvme;
-	}
-	ndev->prp_entry_num = MAX_PRP_POOL >> 3;
-
 	ret = nvme_setup_io_queues(ndev);
 	if (ret)
 		goto free_queue;
 
 	nvme_get_info_from_identify(ndev);
 
+	/* Allocate once the page size and maximum transfer size are known */
+	ret = nvme_alloc_io_cmds(ndev);
+	if (ret) {
+		printf("Error: %s: Out of memory!\n", udev->name);
+		goto free_queue;
+	}
+
 	return 0;
 
 free_queue:
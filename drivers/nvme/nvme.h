@@ -103,7 +103,7 @@ struct nvme_id_ns {
 	__u8			nmic;
 	__u8			rescap;
 	__u8			fpi;
-	__u8			rsvd33;
+	__u8			dlfeat;
 	__le16			nawun;
 	__le16			nawupf;
 	__le16			nacwu;
@@ -124,6 +124,8 @@ enum {
 	NVME_NS_FEAT_THIN	= 1 << 0,
 	NVME_NS_FLBAS_LBA_MASK	= 0xf,
 	NVME_NS_FLBAS_META_EXT	= 0x10,
+	NVME_NS_DLFEAT_READ_MASK	= 0x7,
+	NVME_NS_DLFEAT_READ_ZEROES	= 0x1,
 	NVME_LBAF_RP_BEST	= 0,
 	NVME_LBAF_RP_BETTER	= 1,
 	NVME_LBAF_RP_GOOD	= 2,
@@ -602,6 +604,30 @@ enum {
 	NVME_CSTS_SHST_MASK	= 3 << 2,
 };
 
+/* Number of transfers which can be in progress at once */
+#define NVME_MAX_REQS		4
+
+/*
+ * A transfer, split into commands of at most the maximum transfer size,
+ * which are sent as soon as there is room for them on the I/O queue
+ */
+struct nvme_rq {
+	struct nvme_ns *ns;
+	struct blk_req *req;	/* NULL if this is free */
+	bool write;
+	lbaint_t sent;		/* blocks which commands were sent for */
+	lbaint_t done;		/* blocks transferred */
+	int inflight;		/* commands sent and not completed */
+	int err;
+};
+
+/* A command in flight on the I/O queue, indexed by its command ID */
+struct nvme_io_cmd {
+	struct nvme_rq *rq;	/* NULL if this is free */
+	lbaint_t lbas;
+	ulong start;		/* time it was sent, in us */
+};
+
 /* Represents an NVM Express device. Each nvme_dev is a PCI function. */
 struct nvme_dev {
 	struct list_head node;
@@ -624,9 +650,12 @@ struct nvme_dev {
 	u32 stripe_size;
 	u32 page_size;
 	u8 vwc;
-	u64 *prp_pool;
-	u32 prp_entry_num;
+	u16 oncs;
+	u64 *prp_pool;		/* PRP lists of the I/O commands, one each */
+	u32 prp_entry_num;	/* entries in each of these lists */
 	u32 nn;
+	struct nvme_rq rqs[NVME_MAX_REQS];
+	struct nvme_io_cmd *cmds;	/* q_depth - 1 of them */
 };
 
 /*
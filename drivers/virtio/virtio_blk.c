@@ -7,51 +7,257 @@
 #include <common.h>
 #include <blk.h>
 #include <dm.h>
+#include <div64.h>
+#include <malloc.h>
 #include <virtio_types.h>
 #include <virtio.h>
 #include <virtio_ring.h>
 #include "virtio_blk.h"
 
+/* Number of transfers which can be in progress at once */
+#define VIRTIO_BLK_MAX_REQS	4
+
+/* Most data segments put in one request */
+#define VIRTIO_BLK_MAX_SEGS	16
+
+/*
+ * A transfer, split into requests the device accepts, which are passed to
+ * it as soon as there is room for them in the virtqueue
+ */
+struct virtio_blk_rq {
+	struct blk_req *req;	/* NULL if this is free */
+	u32 type;
+	lbaint_t sent;		/* blocks which requests were passed for */
+	int inflight;		/* requests passed and not completed */
+	int err;
+};
+
+/*
+ * A request passed to the device, with the header and status which must
+ * stay in place until the device is done with it
+ */
+struct virtio_blk_slot {
+	struct virtio_blk_outhdr out_hdr;
+	struct virtio_blk_discard_write_zeroes range;	/* of discards */
+	u8 status;
+	struct virtio_blk_rq *rq;	/* NULL if this is free */
+};
+
 struct virtio_blk_priv {
 	struct virtqueue *vq;
+	struct virtio_blk_rq rqs[VIRTIO_BLK_MAX_REQS];
+	struct virtio_blk_slot *slots;
+	unsigned int num_slots;
+	unsigned int max_segs;	/* data segments in a request */
+	u32 seg_size;		/* bytes in a segment, a multiple of 512 */
+	u32 discard_type;	/* request type of discards, 0 if none */
+	u32 max_discard;	/* sectors in a discard request */
+	u32 discard_align;	/* sectors discards are aligned to, 0 if any */
 };
 
-static ulong virtio_blk_do_req(struct udevice *dev, u64 sector,
-			       lbaint_t blkcnt, void *buffer, u32 type)
+static const u32 feature[] = {
+	VIRTIO_BLK_F_SIZE_MAX,
+	VIRTIO_BLK_F_SEG_MAX,
+	VIRTIO_BLK_F_DISCARD,
+	VIRTIO_BLK_F_WRITE_ZEROES,
+	VIRTIO_RING_F_INDIRECT_DESC,
+};
+
+static bool virtio_blk_is_discard(u32 type)
+{
+	return type == VIRTIO_BLK_T_DISCARD ||
+	       type == VIRTIO_BLK_T_WRITE_ZEROES;
+}
+
+/* Pass a request for the next blocks of a transfer */
+static int virtio_blk_add(struct udevice *dev, struct virtio_blk_rq *rq,
+			  struct virtio_blk_slot *slot)
 {
 	struct virtio_blk_priv *priv = dev_get_priv(dev);
-	unsigned int num_out = 0, num_in = 0;
-	struct virtio_sg *sgs[3];
-	u8 status;
-	int ret;
+	struct virtio_sg sg[VIRTIO_BLK_MAX_SEGS + 2];
+	struct virtio_sg *sgs[VIRTIO_BLK_MAX_SEGS + 2];
+	struct blk_req *req = rq->req;
+	void *buffer = req->buffer + rq->sent * 512;
+	unsigned int n = 0;
+	lbaint_t blkcnt;
+	u64 len, seg;
+	int i, ret;
 
-	struct virtio_blk_outhdr out_hdr = {
-		.type = cpu_to_virtio32(dev, type),
-		.sector = cpu_to_virtio64(dev, sector),
-	};
-	struct virtio_sg hdr_sg = { &out_hdr, sizeof(out_hdr) };
-	struct virtio_sg data_sg = { buffer, blkcnt * 512 };
-	struct virtio_sg status_sg = { &status, sizeof(status) };
+	if (virtio_blk_is_discard(rq->type))
+		blkcnt = min(req->blkcnt - rq->sent,
+			     (lbaint_t)priv->max_discard);
+	else
+		blkcnt = min(req->blkcnt - rq->sent,
+			     (lbaint_t)priv->max_segs * (priv->seg_size / 512));
+
+	slot->out_hdr.type = cpu_to_virtio32(dev, rq->type);
+	slot->out_hdr.ioprio = 0;
+	/* discards give their range in the data, the sector must be 0 */
+	if (virtio_blk_is_discard(rq->type))
+		slot->out_hdr.sector = 0;
+	else
+		slot->out_hdr.sector = cpu_to_virtio64(dev,
+						       req->start + rq->sent);
+	sg[n].addr = &slot->out_hdr;
+	sg[n++].length = sizeof(slot->out_hdr);
+
+	if (virtio_blk_is_discard(rq->type)) {
+		/* the range to discard takes the place of the data */
+		slot->range.sector = cpu_to_le64(req->start + rq->sent);
+		slot->range.num_sectors = cpu_to_le32(blkcnt);
+		slot->range.flags = 0;
+		if (rq->type == VIRTIO_BLK_T_WRITE_ZEROES)
+			slot->range.flags =
+				cpu_to_le32(VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP);
+		sg[n].addr = &slot->range;
+		sg[n++].length = sizeof(slot->range);
+	} else {
+		for (len = (u64)blkcnt * 512; len; len -= seg) {
+			seg = min(len, (u64)priv->seg_size);
+			sg[n].addr = buffer;
+			sg[n++].length = seg;
+			buffer += seg;
+		}
+	}
+
+	sg[n].addr = &slot->status;
+	sg[n++].length = sizeof(slot->status);
 
-	sgs[num_out++] = &hdr_sg;
+	for (i = 0; i < n; i++)
+		sgs[i] = &sg[i];
 
-	if (type & VIRTIO_BLK_T_OUT)
-		sgs[num_out++] = &data_sg;
+	/* the range of a discard is read by the device, like written data */
+	if (rq->type == VIRTIO_BLK_T_OUT || virtio_blk_is_discard(rq->type))
+		ret = virtqueue_add(priv->vq, sgs, n - 1, 1);
 	else
-		sgs[num_out + num_in++] = &data_sg;
+		ret = virtqueue_add(priv->vq, sgs, 1, n - 1);
+	if (ret)
+		return ret;
+
+	slot->rq = rq;
+	rq->sent += blkcnt;
+	rq->inflight++;
+
+	return 0;
+}
+
+/*
+ * Pass requests for the transfers in progress while the virtqueue has room,
+ * then notify the device once
+ */
+static void virtio_blk_send(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_blk_rq *rq;
+	unsigned int id = 0;
+	bool added = false;
+	int i, ret;
+
+	for (i = 0; i < VIRTIO_BLK_MAX_REQS; i++) {
+		rq = &priv->rqs[i];
+		if (!rq->req)
+			continue;
+		while (!rq->err && rq->sent < rq->req->blkcnt) {
+			while (id < priv->num_slots && priv->slots[id].rq)
+				id++;
+			if (id == priv->num_slots)
+				goto kick;
+			ret = virtio_blk_add(dev, rq, &priv->slots[id]);
+			if (ret == -ENOSPC)
+				goto kick;
+			if (ret)
+				rq->err = ret;
+			else
+				added = true;
+		}
+	}
+
+kick:
+	if (added)
+		virtqueue_kick(priv->vq);
+}
+
+static int virtio_blk_poll(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_blk_slot *slot;
+	struct virtio_blk_rq *rq;
+	struct blk_req *req;
+	int i;
+
+	/* the device hands back the header, which starts the slot */
+	while ((slot = virtqueue_get_buf(priv->vq, NULL))) {
+		rq = slot->rq;
+		if (slot->status != VIRTIO_BLK_S_OK)
+			rq->err = -EIO;
+		rq->inflight--;
+		slot->rq = NULL;
+	}
+
+	for (i = 0; i < VIRTIO_BLK_MAX_REQS; i++) {
+		rq = &priv->rqs[i];
+		req = rq->req;
+		if (!req || rq->inflight ||
+		    (!rq->err && rq->sent < req->blkcnt))
+			continue;
+		req->result = rq->err ? rq->err : req->blkcnt;
+		req->done = true;
+		rq->req = NULL;
+	}
+
+	virtio_blk_send(dev);
 
-	sgs[num_out + num_in++] = &status_sg;
+	return 0;
+}
+
+/* Start a transfer, whose requests are passed as the virtqueue has room */
+static int virtio_blk_start(struct udevice *dev, struct blk_req *req,
+			    u32 type)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_blk_rq *rq;
+	int i;
+
+	for (i = 0; i < VIRTIO_BLK_MAX_REQS; i++)
+		if (!priv->rqs[i].req)
+			break;
+	if (i == VIRTIO_BLK_MAX_REQS)
+		return -EBUSY;
 
-	ret = virtqueue_add(priv->vq, sgs, num_out, num_in);
+	rq = &priv->rqs[i];
+	memset(rq, '\0', sizeof(*rq));
+	rq->req = req;
+	rq->type = type;
+	virtio_blk_send(dev);
+
+	return 0;
+}
+
+static ulong virtio_blk_do_req(struct udevice *dev, u64 sector,
+			       lbaint_t blkcnt, void *buffer, u32 type)
+{
+	struct blk_req req = {
+		.start = sector,
+		.blkcnt = blkcnt,
+		.buffer = buffer,
+	};
+	int ret;
+
+	/* wait for room if transfers submitted earlier take it all */
+	while ((ret = virtio_blk_start(dev, &req, type)) == -EBUSY)
+		virtio_blk_poll(dev);
 	if (ret)
 		return ret;
 
-	virtqueue_kick(priv->vq);
+	while (!req.done)
+		virtio_blk_poll(dev);
 
-	while (!virtqueue_get_buf(priv->vq, NULL))
-		;
+	return req.result;
+}
 
-	return status == VIRTIO_BLK_S_OK ? blkcnt : -EIO;
+static int virtio_blk_submit_read(struct udevice *dev, struct blk_req *req)
+{
+	return virtio_blk_start(dev, req, VIRTIO_BLK_T_IN);
 }
 
 static ulong virtio_blk_read(struct udevice *dev, lbaint_t start,
@@ -68,6 +274,37 @@ static ulong virtio_blk_write(struct udevice *dev, lbaint_t start,
 				 VIRTIO_BLK_T_OUT);
 }
 
+static ulong virtio_blk_discard(struct udevice *dev, lbaint_t start,
+				lbaint_t blkcnt)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	lbaint_t end = start + blkcnt;
+	ulong ret;
+
+	if (!priv->discard_type)
+		return 0;
+
+	/*
+	 * Discarded blocks read as anything, so the unaligned ends of the
+	 * range can be left alone. Blocks written as zeroes cannot.
+	 */
+	if (priv->discard_type == VIRTIO_BLK_T_DISCARD &&
+	    priv->discard_align > 1) {
+		start = lldiv(start + priv->discard_align - 1,
+			      priv->discard_align) * priv->discard_align;
+		end = lldiv(end, priv->discard_align) * priv->discard_align;
+		if (start >= end)
+			return blkcnt;
+	}
+
+	ret = virtio_blk_do_req(dev, start, end - start, NULL,
+				priv->discard_type);
+	if (IS_ERR_VALUE(ret))
+		return ret;
+
+	return blkcnt;
+}
+
 static int virtio_blk_bind(struct udevice *dev)
 {
 	struct virtio_dev_priv *uc_priv = dev_get_uclass_priv(dev->parent);
@@ -97,7 +334,8 @@ static int virtio_blk_bind(struct udevice *dev)
 	desc->bdev = dev;
 
 	/* Indicate what driver features we support */
-	virtio_driver_features_init(uc_priv, NULL, 0, NULL, 0);
+	virtio_driver_features_init(uc_priv, feature, ARRAY_SIZE(feature),
+				    NULL, 0);
 
 	return 0;
 }
@@ -106,6 +344,9 @@ static int virtio_blk_probe(struct udevice *dev)
 {
 	struct virtio_blk_priv *priv = dev_get_priv(dev);
 	struct blk_desc *desc = dev_get_uclass_platdata(dev);
+	u32 seg_max = 1, size_max = 0;
+	u8 may_unmap = 0;
+	unsigned int num;
 	u64 cap;
 	int ret;
 
@@ -116,13 +357,82 @@ static int virtio_blk_probe(struct udevice *dev)
 	desc->blksz = 512;
 	virtio_cread(dev, struct virtio_blk_config, capacity, &cap);
 	desc->lba = cap;
+	desc->queue_depth = VIRTIO_BLK_MAX_REQS;
+
+	if (virtio_has_feature(dev, VIRTIO_BLK_F_SEG_MAX))
+		virtio_cread(dev, struct virtio_blk_config, seg_max, &seg_max);
+	if (virtio_has_feature(dev, VIRTIO_BLK_F_SIZE_MAX))
+		virtio_cread(dev, struct virtio_blk_config, size_max,
+			     &size_max);
+
+	/*
+	 * Without indirect descriptors, each segment of a request takes an
+	 * entry of the virtqueue, besides the header and status
+	 */
+	num = virtqueue_get_vring_size(priv->vq);
+	priv->max_segs = clamp(seg_max, 1U, (u32)VIRTIO_BLK_MAX_SEGS);
+	if (!virtio_has_feature(dev, VIRTIO_RING_F_INDIRECT_DESC))
+		priv->max_segs = max(min(priv->max_segs, num - 2), 1U);
+	priv->seg_size = size_max ? max(size_max & ~511, 512U) : ~511U;
+
+	/*
+	 * Writing zeroes leaves blocks which are known to read as zero, but
+	 * unless the device may unmap them, discarding them is quicker
+	 */
+	if (virtio_has_feature(dev, VIRTIO_BLK_F_WRITE_ZEROES))
+		virtio_cread(dev, struct virtio_blk_config,
+			     write_zeroes_may_unmap, &may_unmap);
+	if (virtio_has_feature(dev, VIRTIO_BLK_F_WRITE_ZEROES) &&
+	    (may_unmap || !virtio_has_feature(dev, VIRTIO_BLK_F_DISCARD))) {
+		priv->discard_type = VIRTIO_BLK_T_WRITE_ZEROES;
+		virtio_cread(dev, struct virtio_blk_config,
+			     max_write_zeroes_sectors, &priv->max_discard);
+		desc->discard_zeroes = true;
+	} else if (virtio_has_feature(dev, VIRTIO_BLK_F_DISCARD)) {
+		priv->discard_type = VIRTIO_BLK_T_DISCARD;
+		virtio_cread(dev, struct virtio_blk_config,
+			     max_discard_sectors, &priv->max_discard);
+		virtio_cread(dev, struct virtio_blk_config,
+			     discard_sector_alignment, &priv->discard_align);
+	}
+	if (!priv->max_discard)
+		priv->max_discard = U32_MAX;
+	/*
+	 * Each request holds a single range, which max_discard_seg always
+	 * allows. Requests split a discard at multiples of the alignment.
+	 */
+	if (priv->discard_align > 1 && priv->max_discard >= priv->discard_align)
+		priv->max_discard = rounddown(priv->max_discard,
+					      priv->discard_align);
+
+	/* each request takes at least one entry */
+	priv->num_slots = num;
+	priv->slots = calloc(num, sizeof(*priv->slots));
+	if (!priv->slots)
+		return -ENOMEM;
 
 	return 0;
 }
 
+static int virtio_blk_remove(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	int ret;
+
+	/* stop the device before its requests go away */
+	ret = virtio_reset(dev);
+	virtio_del_vqs(dev);
+	free(priv->slots);
+
+	return ret;
+}
+
 static const struct blk_ops virtio_blk_ops = {
 	.read	= virtio_blk_read,
 	.write	= virtio_blk_write,
+	.discard	= virtio_blk_discard,
+	.submit_read	= virtio_blk_submit_read,
+	.poll	= virtio_blk_poll,
 };
 
 U_BOOT_DRIVER(virtio_blk) = {
@@ -131,7 +441,7 @@ U_BOOT_DRIVER(virtio_blk) = {
 	.ops	= &virtio_blk_ops,
 	.bind	= virtio_blk_bind,
 	.probe	= virtio_blk_probe,
-	.remove	= virtio_reset,
+	.remove	= virtio_blk_remove,
 	.priv_auto_alloc_size = sizeof(struct virtio_blk_priv),
 	.flags	= DM_FLAG_ACTIVE_DMA,
 };
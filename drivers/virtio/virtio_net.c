@@ -13,7 +13,7 @@
 #include "virtio_net.h"
 
 /* Amount of buffers to keep in the RX virtqueue */
-#define VIRTIO_NET_NUM_RX_BUFS	32
+#define VIRTIO_NET_NUM_RX_BUFS	ETH_RX_RING_SIZE(32)
 
 /*
  * This value comes from the VirtIO spec: 1500 for maximum packet size,
@@ -31,7 +31,17 @@ struct virtio_net_priv {
 	};
 
 	char rx_buff[VIRTIO_NET_NUM_RX_BUFS][VIRTIO_NET_RX_BUF_SIZE];
+	/* where the rest of a frame goes, if split off (see eth_rx_dest) */
+	void *rx_dest[VIRTIO_NET_NUM_RX_BUFS];
+	/* offset in the receive buffer at which the frame is split */
+	int rx_split[VIRTIO_NET_NUM_RX_BUFS];
+	/* receive buffers handed to the network stack and not freed yet */
+	bool rx_taken[VIRTIO_NET_NUM_RX_BUFS];
+	/* number of split receive buffers the device still owns */
+	int rx_placed;
 	bool rx_running;
+	/* the queues could not be set up again after a reset */
+	bool dead;
 	int net_hdr_len;
 };
 
@@ -48,27 +58,73 @@ static const u32 feature_legacy[] = {
 	VIRTIO_NET_F_MAC
 };
 
+/*
+ * Put receive buffer @i into the rx ring. If the network stack knows where
+ * the payload of a future frame goes, the buffer is given to the device as
+ * two parts, so that the payload lands there without being copied.
+ */
+static void virtio_net_add_rx_buf(struct virtio_net_priv *priv, int i)
+{
+	const struct eth_rx_dest *dest = eth_get_rx_dest();
+	struct virtio_sg sg[2];
+	struct virtio_sg *sgs[] = { &sg[0], &sg[1] };
+	int split = 0, len = 0;
+
+	/* receive buffer length is always 1526 */
+	sg[0].addr = priv->rx_buff[i];
+	sg[0].length = VIRTIO_NET_RX_BUF_SIZE;
+	priv->rx_dest[i] = NULL;
+
+	if (dest) {
+		/* the whole chain must have room for the largest frame */
+		split = priv->net_hdr_len + dest->hdr_len;
+		len = min(dest->max_len, VIRTIO_NET_RX_BUF_SIZE - split);
+		if (split + len >= priv->net_hdr_len + ETHER_HDR_SIZE + 1500)
+			priv->rx_dest[i] = dest->addr(VIRTIO_NET_NUM_RX_BUFS - 1);
+	}
+
+	if (priv->rx_dest[i]) {
+		sg[0].length = split;
+		sg[1].addr = priv->rx_dest[i];
+		sg[1].length = len;
+		priv->rx_split[i] = split;
+		priv->rx_placed++;
+		virtqueue_add(priv->rx_vq, sgs, 0, 2);
+	} else {
+		virtqueue_add(priv->rx_vq, sgs, 0, 1);
+	}
+}
+
 static int virtio_net_start(struct udevice *dev)
 {
 	struct virtio_net_priv *priv = dev_get_priv(dev);
-	struct virtio_sg sg;
-	struct virtio_sg *sgs[] = { &sg };
-	int i;
+	int i, n = 0;
 
-	if (!priv->rx_running) {
-		/* receive buffer length is always 1526 */
-		sg.length = VIRTIO_NET_RX_BUF_SIZE;
+	if (priv->dead)
+		return -ENODEV;
 
+	if (!priv->rx_running) {
 		/* setup the receive buffer address */
-		for (i = 0; i < VIRTIO_NET_NUM_RX_BUFS; i++) {
-			sg.addr = priv->rx_buff[i];
-			virtqueue_add(priv->rx_vq, sgs, 0, 1);
-		}
+		for (i = 0; i < VIRTIO_NET_NUM_RX_BUFS; i++)
+			virtio_net_add_rx_buf(priv, i);
+		memset(priv->rx_taken, 0, sizeof(priv->rx_taken));
 
 		virtqueue_kick(priv->rx_vq);
 
 		/* setup the receive queue only once */
 		priv->rx_running = true;
+	} else {
+		/* take back the buffers of frames dropped by a stop */
+		for (i = 0; i < VIRTIO_NET_NUM_RX_BUFS; i++) {
+			if (priv->rx_taken[i]) {
+				priv->rx_taken[i] = false;
+				virtio_net_add_rx_buf(priv, i);
+				n++;
+			}
+		}
+
+		if (n)
+			virtqueue_kick(priv->rx_vq);
 	}
 
 	return 0;
@@ -84,6 +140,9 @@ static int virtio_net_send(struct udevice *dev, void *packet, int length)
 	struct virtio_sg *sgs[] = { &hdr_sg, &data_sg };
 	int ret;
 
+	if (priv->dead)
+		return -ENODEV;
+
 	if (priv->net_hdr_len == sizeof(struct virtio_net_hdr))
 		hdr_sg.addr = &hdr;
 	else
@@ -106,42 +165,66 @@ static int virtio_net_send(struct udevice *dev, void *packet, int length)
 	return 0;
 }
 
-static int virtio_net_recv(struct udevice *dev, int flags, uchar **packetp)
+/*
+ * Whether the payload of a split frame is where it belongs is left to the
+ * uclass, since it depends on the frames processed before it.
+ */
+static int virtio_net_recv_batch(struct udevice *dev, int flags,
+				 struct eth_rx_pkt *pkts, int count)
 {
 	struct virtio_net_priv *priv = dev_get_priv(dev);
+	struct eth_rx_pkt *pkt;
 	unsigned int len;
-	void *buf;
+	void *buf, *payload;
+	int i, n, split;
+
+	if (priv->dead)
+		return -ENODEV;
 
-	buf = virtqueue_get_buf(priv->rx_vq, &len);
-	if (!buf)
-		return -EAGAIN;
+	for (n = 0; n < count; n++) {
+		buf = virtqueue_get_buf(priv->rx_vq, &len);
+		if (!buf)
+			break;
+
+		i = (buf - (void *)priv->rx_buff) / VIRTIO_NET_RX_BUF_SIZE;
+		payload = priv->rx_dest[i];
+		split = priv->rx_split[i];
+		if (payload) {
+			priv->rx_dest[i] = NULL;
+			priv->rx_placed--;
+		}
+		priv->rx_taken[i] = true;
+
+		pkt = &pkts[n];
+		pkt->packet = buf + priv->net_hdr_len;
+		pkt->length = len - priv->net_hdr_len;
+		pkt->payload = NULL;
+		if (payload && len > split) {
+			pkt->payload = payload;
+			pkt->split = split - priv->net_hdr_len;
+		}
+	}
 
-	*packetp = buf + priv->net_hdr_len;
-	return len - priv->net_hdr_len;
+	return n;
 }
 
 static int virtio_net_free_pkt(struct udevice *dev, uchar *packet, int length)
 {
 	struct virtio_net_priv *priv = dev_get_priv(dev);
 	void *buf = packet - priv->net_hdr_len;
-	struct virtio_sg sg = { buf, VIRTIO_NET_RX_BUF_SIZE };
-	struct virtio_sg *sgs[] = { &sg };
+	int i = (buf - (void *)priv->rx_buff) / VIRTIO_NET_RX_BUF_SIZE;
+
+	/* The queue may have been reset and refilled since the frame came */
+	if (!priv->rx_running || !priv->rx_taken[i])
+		return 0;
 
 	/* Put the buffer back to the rx ring */
-	virtqueue_add(priv->rx_vq, sgs, 0, 1);
+	priv->rx_taken[i] = false;
+	virtio_net_add_rx_buf(priv, i);
 
 	return 0;
 }
 
-static void virtio_net_stop(struct udevice *dev)
-{
-	/*
-	 * There is no way to stop the queue from running, unless we issue
-	 * a reset to the virtio device, and re-do the queue initialization
-	 * from the beginning.
-	 */
-}
-
 static int virtio_net_write_hwaddr(struct udevice *dev)
 {
 	struct virtio_dev_priv *uc_priv = dev_get_uclass_priv(dev->parent);
@@ -164,6 +247,39 @@ static int virtio_net_write_hwaddr(struct udevice *dev)
 	return 0;
 }
 
+static void virtio_net_stop(struct udevice *dev)
+{
+	struct virtio_net_priv *priv = dev_get_priv(dev);
+
+	/*
+	 * There is no way to stop the queue from running, unless we issue
+	 * a reset to the virtio device, and re-do the queue initialization
+	 * from the beginning. This is only needed if the device still owns
+	 * buffers pointing outside of rx_buff, which it must not write to
+	 * once the transfer they were meant for is over.
+	 */
+	if (!priv->rx_placed)
+		return;
+
+	virtio_reset(dev);
+	virtio_del_vqs(dev);
+	virtio_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
+			  VIRTIO_CONFIG_S_DRIVER);
+	if (virtio_finalize_features(dev) ||
+	    virtio_find_vqs(dev, 2, priv->vqs)) {
+		virtio_add_status(dev, VIRTIO_CONFIG_S_FAILED);
+		priv->rx_running = false;
+		priv->dead = true;
+		return;
+	}
+	virtio_add_status(dev, VIRTIO_CONFIG_S_DRIVER_OK);
+	virtio_net_write_hwaddr(dev);
+
+	memset(priv->rx_dest, 0, sizeof(priv->rx_dest));
+	priv->rx_placed = 0;
+	priv->rx_running = false;
+}
+
 static int virtio_net_read_rom_hwaddr(struct udevice *dev)
 {
 	struct eth_pdata *pdata = dev_get_platdata(dev);
@@ -219,7 +335,7 @@ static int virtio_net_probe(struct udevice *dev)
 static const struct eth_ops virtio_net_ops = {
 	.start = virtio_net_start,
 	.send = virtio_net_send,
-	.recv = virtio_net_recv,
+	.recv_batch = virtio_net_recv_batch,
 	.free_pkt = virtio_net_free_pkt,
 	.stop = virtio_net_stop,
 	.write_hwaddr = virtio_net_write_hwaddr,
@@ -13,21 +13,59 @@
 #include <virtio.h>
 #include <virtio_ring.h>
 
+static struct vring_desc *alloc_indirect(struct virtqueue *vq,
+					 unsigned int total_sg)
+{
+	struct vring_desc *desc;
+	unsigned int i;
+
+	desc = malloc(total_sg * sizeof(struct vring_desc));
+	if (!desc)
+		return NULL;
+
+	for (i = 0; i < total_sg; i++)
+		desc[i].next = cpu_to_virtio16(vq->vdev, i + 1);
+
+	return desc;
+}
+
 int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 		  unsigned int out_sgs, unsigned int in_sgs)
 {
 	struct vring_desc *desc;
 	unsigned int total_sg = out_sgs + in_sgs;
 	unsigned int i, n, avail, descs_used, uninitialized_var(prev);
+	bool indirect;
 	int head;
 
 	WARN_ON(total_sg == 0);
 
 	head = vq->free_head;
 
-	desc = vq->vring.desc;
-	i = head;
-	descs_used = total_sg;
+	/*
+	 * If the host supports indirect descriptor tables, and we have more
+	 * buffers than a header, data and status, then go indirect, so that
+	 * the request only takes one entry of the ring
+	 */
+	if (vq->indirect && total_sg > 3 && vq->num_free)
+		desc = alloc_indirect(vq, total_sg);
+	else
+		desc = NULL;
+
+	/* Without the table, a request larger than the ring never fits */
+	if (!desc && total_sg > vq->vring.num)
+		return -ENOMEM;
+
+	if (desc) {
+		indirect = true;
+		i = 0;
+		descs_used = 1;
+	} else {
+		indirect = false;
+		desc = vq->vring.desc;
+		i = head;
+		descs_used = total_sg;
+	}
 
 	if (vq->num_free < descs_used) {
 		debug("Can't add buf len %i - avail = %i\n",
@@ -67,6 +105,17 @@ int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 	/* Last one doesn't continue */
 	desc[prev].flags &= cpu_to_virtio16(vq->vdev, ~VRING_DESC_F_NEXT);
 
+	if (indirect) {
+		/* Now that the indirect table is filled in, point to it */
+		vq->vring.desc[head].flags = cpu_to_virtio16(vq->vdev,
+						VRING_DESC_F_INDIRECT);
+		vq->vring.desc[head].addr = cpu_to_virtio64(vq->vdev,
+						(u64)(uintptr_t)desc);
+		vq->vring.desc[head].len = cpu_to_virtio32(vq->vdev,
+					total_sg * sizeof(struct vring_desc));
+		i = virtio16_to_cpu(vq->vdev, vq->vring.desc[head].next);
+	}
+
 	/* We're using some buffers from the free list. */
 	vq->num_free -= descs_used;
 
@@ -136,6 +185,14 @@ static void detach_buf(struct virtqueue *vq, unsigned int head)
 	unsigned int i;
 	__virtio16 nextflag = cpu_to_virtio16(vq->vdev, VRING_DESC_F_NEXT);
 
+	/* Free the indirect table, if any */
+	if (vq->vring.desc[head].flags &
+	    cpu_to_virtio16(vq->vdev, VRING_DESC_F_INDIRECT)) {
+		free((void *)(uintptr_t)virtio64_to_cpu(vq->vdev,
+						vq->vring.desc[head].addr));
+		vq->vring.desc[head].flags = 0;
+	}
+
 	/* Put back on free list: unmap first-level descriptors and find end */
 	i = head;
 
@@ -159,8 +216,10 @@ static inline bool more_used(const struct virtqueue *vq)
 
 void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
 {
+	struct vring_desc *desc;
 	unsigned int i;
 	u16 last_used;
+	void *ret;
 
 	if (!more_used(vq)) {
 		debug("(%s.%d): No more buffers in queue\n",
@@ -186,6 +245,12 @@ void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
 		return NULL;
 	}
 
+	/* Return the address of the first buffer, even if it was indirect */
+	desc = &vq->vring.desc[i];
+	if (desc->flags & cpu_to_virtio16(vq->vdev, VRING_DESC_F_INDIRECT))
+		desc = (void *)(uintptr_t)virtio64_to_cpu(vq->vdev, desc->addr);
+	ret = (void *)(uintptr_t)virtio64_to_cpu(vq->vdev, desc->addr);
+
 	detach_buf(vq, i);
 	vq->last_used_idx++;
 	/*
@@ -197,8 +262,7 @@ void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
 		virtio_store_mb(&vring_used_event(&vq->vring),
 				cpu_to_virtio16(vq->vdev, vq->last_used_idx));
 
-	return (void *)(uintptr_t)virtio64_to_cpu(vq->vdev,
-						  vq->vring.desc[i].addr);
+	return ret;
 }
 
 static struct virtqueue *__vring_new_virtqueue(unsigned int index,
@@ -225,6 +289,7 @@ static struct virtqueue *__vring_new_virtqueue(unsigned int index,
 	list_add_tail(&vq->list, &uc_priv->vqs);
 
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC);
 
 	/* Tell other side not to bother us */
 	vq->avail_flags_shadow |= VRING_AVAIL_F_NO_INTERRUPT;
@@ -287,6 +352,15 @@ struct virtqueue *vring_create_virtqueue(unsigned int index, unsigned int num,
 
 void vring_del_virtqueue(struct virtqueue *vq)
 {
+	unsigned int i;
+
+	/* Free the indirect tables of the requests still in the ring */
+	for (i = 0; i < vq->vring.num; i++)
+		if (vq->vring.desc[i].flags &
+		    cpu_to_virtio16(vq->vdev, VRING_DESC_F_INDIRECT))
+			free((void *)(uintptr_t)virtio64_to_cpu(vq->vdev,
+						vq->vring.desc[i].addr));
+
 	free(vq->vring.desc);
 	list_del(&vq->list);
 	free(vq);
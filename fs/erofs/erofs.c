@@ -0,0 +1,725 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * EROFS filesystem implementation for U-Boot
+ *
+ * Read-only support for EROFS images: regular files, directories and
+ * symbolic links, with compact or extended inodes. File data may be
+ * stored flat, with its tail end inline after the inode, in chunks or
+ * compressed with LZ4 (see zmap.c). Owners and extended attributes are
+ * ignored.
+ *
+ * Inodes, directories and the maps of chunked and compressed files are
+ * read through a small cache of metadata blocks, so walking a path only
+ * reads each of the blocks it needs once. File data is read straight into
+ * the destination buffer.
+ */
+
+#include <common.h>
+#include <erofs.h>
+#include <errno.h>
+#include <fs.h>
+#include <fs_internal.h>
+#include <malloc.h>
+#include <linux/kernel.h>
+#include <linux/stat.h>
+
+#include "internal.h"
+
+#define EROFS_META_CACHE	8	/* Metadata blocks kept */
+#define EROFS_MAX_SYMLINKS	8	/* Links followed to find a file */
+#define EROFS_MAX_LINK_LEN	4096
+#define EROFS_READ_MAX		BIT(30) /* Largest read from the disk */
+
+struct erofs_dir_stream {
+	struct fs_dir_stream fs_dirs;
+	struct fs_dirent dirent;
+	struct erofs_inode inode;
+	u64 pos;		/* Offset of the next block of the directory */
+	int count;		/* Entries in the current block */
+	int next;		/* Next one to return */
+	u32 len;		/* Bytes in the current block */
+	u8 blk[];
+};
+
+struct erofs_sb_info erofs_sbi;
+
+static struct {
+	u64 blkaddr;
+	u32 used;		/* When it was last used, 0 if unused */
+	void *data;
+} erofs_meta[EROFS_META_CACHE];
+static u32 erofs_meta_tick;
+
+int erofs_dev_read(u64 offset, u64 len, void *buf)
+{
+	struct blk_desc *dev = erofs_sbi.dev;
+	u32 count;
+
+	while (len) {
+		count = min_t(u64, len, EROFS_READ_MAX);
+		if (!fs_devread(dev, &erofs_sbi.part, offset >> dev->log2blksz,
+				offset & (dev->blksz - 1), count, buf))
+			return -EIO;
+		offset += count;
+		buf += count;
+		len -= count;
+	}
+
+	return 0;
+}
+
+/* Return the metadata block 'blkaddr', from the cache if it is there */
+static void *erofs_get_meta(u64 blkaddr)
+{
+	int i, lru = 0;
+
+	for (i = 0; i < EROFS_META_CACHE; i++) {
+		if (erofs_meta[i].used && erofs_meta[i].blkaddr == blkaddr) {
+			erofs_meta[i].used = ++erofs_meta_tick;
+			return erofs_meta[i].data;
+		}
+		if (erofs_meta[i].used < erofs_meta[lru].used)
+			lru = i;
+	}
+
+	if (!erofs_meta[lru].data) {
+		erofs_meta[lru].data = malloc(erofs_blksz());
+		if (!erofs_meta[lru].data)
+			return NULL;
+	}
+	erofs_meta[lru].used = 0;
+	if (erofs_dev_read(erofs_pos(blkaddr), erofs_blksz(),
+			   erofs_meta[lru].data))
+		return NULL;
+	erofs_meta[lru].blkaddr = blkaddr;
+	erofs_meta[lru].used = ++erofs_meta_tick;
+
+	return erofs_meta[lru].data;
+}
+
+/* Copy 'len' bytes of metadata at byte 'pos' of the disk into 'buf' */
+int erofs_read_meta(u64 pos, void *buf, u32 len)
+{
+	u32 offset, count;
+	void *data;
+
+	while (len) {
+		data = erofs_get_meta(pos >> erofs_sbi.blkszbits);
+		if (!data)
+			return -EIO;
+		offset = pos & (erofs_blksz() - 1);
+		count = min(len, erofs_blksz() - offset);
+		memcpy(buf, data + offset, count);
+		buf += count;
+		pos += count;
+		len -= count;
+	}
+
+	return 0;
+}
+
+static int erofs_read_inode(u64 nid, struct erofs_inode *inode)
+{
+	union {
+		struct erofs_inode_compact c;
+		struct erofs_inode_extended e;
+	} di;
+	union erofs_inode_i_u i_u;
+	u16 format, icount;
+	int ret;
+
+	memset(inode, 0, sizeof(*inode));
+	inode->nid = nid;
+	ret = erofs_read_meta(erofs_iloc(inode), &di.c, sizeof(di.c));
+	if (ret)
+		return ret;
+
+	format = le16_to_cpu(di.c.i_format);
+	if (format & ~0xf)
+		return -EOPNOTSUPP;
+	if (EROFS_I_VERSION(format) == EROFS_INODE_LAYOUT_EXTENDED) {
+		ret = erofs_read_meta(erofs_iloc(inode) + sizeof(di.c),
+				      (void *)&di + sizeof(di.c),
+				      sizeof(di.e) - sizeof(di.c));
+		if (ret)
+			return ret;
+		inode->inode_isize = sizeof(di.e);
+		inode->size = le64_to_cpu(di.e.i_size);
+		i_u = di.e.i_u;
+	} else {
+		inode->inode_isize = sizeof(di.c);
+		inode->size = le32_to_cpu(di.c.i_size);
+		i_u = di.c.i_u;
+	}
+	/* the mode and the attribute count are at the same place in both */
+	inode->mode = le16_to_cpu(di.c.i_mode);
+	icount = le16_to_cpu(di.c.i_xattr_icount);
+	if (icount)
+		inode->xattr_isize = EROFS_XATTR_IBODY_HEADER_SIZE +
+				     (icount - 1) * EROFS_XATTR_ENTRY_SIZE;
+
+	inode->datalayout = EROFS_I_DATALAYOUT(format);
+	switch (inode->datalayout) {
+	case EROFS_INODE_FLAT_PLAIN:
+	case EROFS_INODE_FLAT_INLINE:
+	case EROFS_INODE_COMPRESSED_FULL:
+	case EROFS_INODE_COMPRESSED_COMPACT:
+		inode->raw_blkaddr = le32_to_cpu(i_u.raw_blkaddr);
+		break;
+	case EROFS_INODE_CHUNK_BASED:
+		inode->chunkformat = le16_to_cpu(i_u.c.format);
+		if (inode->chunkformat & ~(EROFS_CHUNK_FORMAT_BLKBITS_MASK |
+					   EROFS_CHUNK_FORMAT_INDEXES))
+			return -EOPNOTSUPP;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	return 0;
+}
+
+static int erofs_map_chunk(struct erofs_inode *inode, u64 offset,
+			   struct erofs_map_blocks *map)
+{
+	u32 chunkbits = erofs_sbi.blkszbits +
+			(inode->chunkformat & EROFS_CHUNK_FORMAT_BLKBITS_MASK);
+	struct erofs_inode_chunk_index idx;
+	u64 chunknr = offset >> chunkbits;
+	__le32 blkaddr;
+	u64 pos;
+	u32 addr;
+	int ret;
+
+	/* the map of the chunks follows the inode */
+	if (inode->chunkformat & EROFS_CHUNK_FORMAT_INDEXES) {
+		pos = ALIGN(erofs_iend(inode), sizeof(idx));
+		ret = erofs_read_meta(pos + chunknr * sizeof(idx), &idx,
+				      sizeof(idx));
+		if (ret)
+			return ret;
+		/* other devices are not supported */
+		if (le16_to_cpu(idx.device_id))
+			return -EOPNOTSUPP;
+		addr = le32_to_cpu(idx.blkaddr);
+	} else {
+		pos = ALIGN(erofs_iend(inode), sizeof(blkaddr));
+		ret = erofs_read_meta(pos + chunknr * sizeof(blkaddr),
+				      &blkaddr, sizeof(blkaddr));
+		if (ret)
+			return ret;
+		addr = le32_to_cpu(blkaddr);
+	}
+
+	map->m_la = chunknr << chunkbits;
+	map->m_llen = min_t(u64, 1ULL << chunkbits, inode->size - map->m_la);
+	map->m_flags = 0;
+	if (addr != EROFS_NULL_ADDR) {
+		map->m_pa = erofs_pos(addr);
+		map->m_flags = EROFS_MAP_MAPPED;
+	}
+
+	return 0;
+}
+
+/* Find where the data at 'offset' of 'inode' is */
+static int erofs_map_blocks(struct erofs_inode *inode, u64 offset,
+			    struct erofs_map_blocks *map)
+{
+	u64 lastblk;
+
+	if (offset >= inode->size)
+		return -EIO;
+	if (erofs_inode_is_compressed(inode))
+		return z_erofs_map_blocks(inode, offset, map);
+	if (inode->datalayout == EROFS_INODE_CHUNK_BASED)
+		return erofs_map_chunk(inode, offset, map);
+
+	/* the last block, if it is not whole, may be inline */
+	lastblk = DIV_ROUND_UP(inode->size, erofs_blksz());
+	if (inode->datalayout == EROFS_INODE_FLAT_INLINE)
+		lastblk--;
+
+	map->m_flags = EROFS_MAP_MAPPED;
+	if (offset < erofs_pos(lastblk)) {
+		map->m_la = 0;
+		map->m_llen = min_t(u64, erofs_pos(lastblk), inode->size);
+		map->m_pa = erofs_pos(inode->raw_blkaddr);
+		return 0;
+	}
+
+	map->m_la = erofs_pos(lastblk);
+	map->m_llen = inode->size - map->m_la;
+	map->m_pa = erofs_iend(inode);
+	map->m_flags |= EROFS_MAP_META;
+	/* it may not go over the end of the block */
+	if ((map->m_pa & (erofs_blksz() - 1)) + map->m_llen > erofs_blksz())
+		return -EIO;
+
+	return 0;
+}
+
+/*
+ * Read 'len' bytes at 'offset' of 'inode' into 'buf'. Directories and
+ * links set 'meta' so that their blocks go through the metadata cache.
+ */
+static int erofs_read_data(struct erofs_inode *inode, void *buf, u64 offset,
+			   u64 len, bool meta)
+{
+	u64 skip, count, run_pos = 0, run_len = 0;
+	struct erofs_map_blocks map;
+	void *run_buf = NULL;
+	int ret = 0;
+
+	if (erofs_inode_is_compressed(inode))
+		return z_erofs_read_data(inode, buf, offset, len);
+
+	while (len) {
+		ret = erofs_map_blocks(inode, offset, &map);
+		if (ret)
+			break;
+		skip = offset - map.m_la;
+		count = min(len, map.m_llen - skip);
+
+		/* extents one after another on the disk are read together */
+		if (run_len && (!(map.m_flags & EROFS_MAP_MAPPED) || meta ||
+				(map.m_flags & EROFS_MAP_META) ||
+				map.m_pa + skip != run_pos + run_len)) {
+			ret = erofs_dev_read(run_pos, run_len, run_buf);
+			run_len = 0;
+			if (ret)
+				break;
+		}
+
+		if (!(map.m_flags & EROFS_MAP_MAPPED)) {
+			memset(buf, 0, count);
+		} else if (meta || (map.m_flags & EROFS_MAP_META)) {
+			ret = erofs_read_meta(map.m_pa + skip, buf, count);
+			if (ret)
+				break;
+		} else {
+			if (!run_len) {
+				run_pos = map.m_pa + skip;
+				run_buf = buf;
+			}
+			run_len += count;
+		}
+		buf += count;
+		offset += count;
+		len -= count;
+	}
+
+	if (!ret && run_len)
+		ret = erofs_dev_read(run_pos, run_len, run_buf);
+
+	return ret;
+}
+
+/*
+ * Read the block of the directory 'dir' at 'pos' into 'blk', setting
+ * '*len' to its size. Return the number of entries in it, or -errno.
+ */
+static int erofs_read_dir_block(struct erofs_inode *dir, u64 pos, void *blk,
+				u32 *len)
+{
+	struct erofs_dirent *de = blk;
+	u32 nameoff;
+	int ret;
+
+	*len = min_t(u64, erofs_blksz(), dir->size - pos);
+	if (*len < sizeof(*de))
+		return -EIO;
+	ret = erofs_read_data(dir, blk, pos, *len, true);
+	if (ret)
+		return ret;
+
+	/* the names start after the last entry */
+	nameoff = le16_to_cpu(de->nameoff);
+	if (nameoff < sizeof(*de) || nameoff % sizeof(*de) || nameoff >= *len)
+		return -EIO;
+
+	return nameoff / sizeof(*de);
+}
+
+/* Get the name of entry 'i' of a directory block, and its length */
+static const char *erofs_dirent_name(const void *blk, u32 len, int count,
+				     int i, u32 *namelen)
+{
+	const struct erofs_dirent *de = blk;
+	u32 start, end;
+
+	start = le16_to_cpu(de[i].nameoff);
+	if (i + 1 < count)
+		end = le16_to_cpu(de[i + 1].nameoff);
+	else
+		end = len;
+	if (start >= end || end > len)
+		return NULL;
+	/* the last name ends at the end of the block, or at a nul */
+	if (i + 1 == count)
+		end = start + strnlen(blk + start, end - start);
+	if (start == end || end - start > EROFS_NAME_LEN)
+		return NULL;
+	*namelen = end - start;
+
+	return blk + start;
+}
+
+static int erofs_namecmp(const char *name, const char *dname, u32 dlen)
+{
+	u32 len = strlen(name);
+	int ret;
+
+	ret = memcmp(name, dname, min(len, dlen));
+	if (ret)
+		return ret;
+
+	return len < dlen ? -1 : len > dlen;
+}
+
+/*
+ * Find the entry 'name' of the directory 'dir'. The entries are sorted
+ * across the blocks, so the blocks are searched by their first names, then
+ * the block where the name would be.
+ */
+static int erofs_dir_find(struct erofs_inode *dir, const char *name,
+			  u64 *nid)
+{
+	s64 blk = -1, first, last, mid_blk;
+	int head, back, mid, count, ret;
+	const char *dname;
+	struct erofs_dirent *de;
+	u32 len, dlen;
+	void *buf;
+
+	buf = malloc(erofs_blksz());
+	if (!buf)
+		return -ENOMEM;
+	de = buf;
+
+	first = 0;
+	last = DIV_ROUND_UP(dir->size, erofs_blksz()) - 1;
+	while (first <= last) {
+		mid_blk = first + (last - first) / 2;
+		ret = erofs_read_dir_block(dir, erofs_pos(mid_blk), buf, &len);
+		if (ret < 0)
+			goto out;
+		count = ret;
+		dname = erofs_dirent_name(buf, len, count, 0, &dlen);
+		if (!dname) {
+			ret = -EIO;
+			goto out;
+		}
+		ret = erofs_namecmp(name, dname, dlen);
+		if (!ret) {
+			*nid = le64_to_cpu(de[0].nid);
+			goto out;
+		}
+		if (ret > 0) {
+			blk = mid_blk;
+			first = mid_blk + 1;
+		} else {
+			last = mid_blk - 1;
+		}
+	}
+
+	ret = -ENOENT;
+	if (blk < 0)
+		goto out;
+	ret = erofs_read_dir_block(dir, erofs_pos(blk), buf, &len);
+	if (ret < 0)
+		goto out;
+	count = ret;
+
+	head = 1;
+	back = count - 1;
+	ret = -ENOENT;
+	while (head <= back) {
+		mid = head + (back - head) / 2;
+		dname = erofs_dirent_name(buf, len, count, mid, &dlen);
+		if (!dname) {
+			ret = -EIO;
+			break;
+		}
+		ret = erofs_namecmp(name, dname, dlen);
+		if (!ret) {
+			*nid = le64_to_cpu(de[mid].nid);
+			break;
+		}
+		if (ret > 0)
+			head = mid + 1;
+		else
+			back = mid - 1;
+		ret = -ENOENT;
+	}
+
+out:
+	free(buf);
+
+	return ret;
+}
+
+/*
+ * Find the inode of 'path', following the symbolic links on the way, and
+ * the last one too if 'follow' is set
+ */
+static int erofs_lookup(const char *path, struct erofs_inode *inode,
+			bool follow)
+{
+	char *buf, *p, *name, *link;
+	int links = 0, ret;
+	u64 dir_nid, nid;
+
+	if (!erofs_sbi.dev)
+		return -ENODEV;
+
+	buf = strdup(path);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = erofs_read_inode(erofs_sbi.root_nid, inode);
+	p = buf;
+	while (!ret) {
+		while (*p == '/')
+			p++;
+		if (!*p)
+			break;
+		name = p;
+		p = strchr(p, '/');
+		if (p)
+			*p++ = '\0';
+		else
+			p = name + strlen(name);
+
+		if (!S_ISDIR(inode->mode)) {
+			ret = -ENOTDIR;
+			break;
+		}
+		/* "." and ".." are in the directories like other entries */
+		dir_nid = inode->nid;
+		ret = erofs_dir_find(inode, name, &nid);
+		if (!ret)
+			ret = erofs_read_inode(nid, inode);
+		if (ret)
+			break;
+
+		if (S_ISLNK(inode->mode) && (*p || follow)) {
+			if (++links > EROFS_MAX_SYMLINKS) {
+				ret = -ELOOP;
+				break;
+			}
+			if (inode->size > EROFS_MAX_LINK_LEN) {
+				ret = -ENAMETOOLONG;
+				break;
+			}
+			/* go on with the target, then what is left of path */
+			link = malloc(inode->size + 1 + strlen(p) + 1);
+			if (!link) {
+				ret = -ENOMEM;
+				break;
+			}
+			ret = erofs_read_data(inode, link, 0, inode->size,
+					      true);
+			link[inode->size] = '/';
+			strcpy(link + inode->size + 1, p);
+			free(buf);
+			buf = link;
+			p = buf;
+			if (!ret)
+				ret = erofs_read_inode(*p == '/' ?
+						       erofs_sbi.root_nid :
+						       dir_nid, inode);
+		}
+	}
+
+	free(buf);
+
+	return ret;
+}
+
+int erofs_probe(struct blk_desc *fs_dev_desc, disk_partition_t *fs_partition)
+{
+	struct erofs_super_block sb;
+	struct erofs_inode root;
+	u32 features, unsupported;
+	int ret;
+
+	erofs_close();
+	erofs_sbi.dev = fs_dev_desc;
+	erofs_sbi.part = *fs_partition;
+
+	ret = erofs_dev_read(EROFS_SUPER_OFFSET, sizeof(sb), &sb);
+	if (ret || le32_to_cpu(sb.magic) != EROFS_SUPER_MAGIC_V1) {
+		erofs_sbi.dev = NULL;
+		return -EINVAL;
+	}
+
+	erofs_sbi.blkszbits = sb.blkszbits;
+	features = le32_to_cpu(sb.feature_incompat);
+	unsupported = features & ~EROFS_FEATURE_INCOMPAT_SUPP;
+	if (sb.blkszbits < EROFS_MIN_BLKSZBITS ||
+	    sb.blkszbits > EROFS_MAX_BLKSZBITS || unsupported) {
+		printf("EROFS: unsupported block size %u or features %#x\n",
+		       1U << sb.blkszbits, unsupported);
+		ret = -EINVAL;
+		goto err;
+	}
+	erofs_sbi.feature_incompat = features;
+	erofs_sbi.meta_start = erofs_pos(le32_to_cpu(sb.meta_blkaddr));
+	erofs_sbi.root_nid = le16_to_cpu(sb.root_nid);
+
+	ret = erofs_read_inode(erofs_sbi.root_nid, &root);
+	if (!ret && !S_ISDIR(root.mode))
+		ret = -EIO;
+	if (ret) {
+		printf("EROFS: cannot read the root directory\n");
+		goto err;
+	}
+
+	return 0;
+
+err:
+	erofs_close();
+
+	return ret;
+}
+
+int erofs_opendir(const char *filename, struct fs_dir_stream **dirsp)
+{
+	struct erofs_dir_stream *dirs;
+	struct erofs_inode inode;
+	int ret;
+
+	ret = erofs_lookup(filename, &inode, true);
+	if (ret)
+		return ret;
+	if (!S_ISDIR(inode.mode))
+		return -ENOTDIR;
+
+	dirs = calloc(1, sizeof(*dirs) + erofs_blksz());
+	if (!dirs)
+		return -ENOMEM;
+	dirs->inode = inode;
+	*dirsp = &dirs->fs_dirs;
+
+	return 0;
+}
+
+int erofs_readdir(struct fs_dir_stream *fs_dirs, struct fs_dirent **dentp)
+{
+	struct erofs_dir_stream *dirs = (struct erofs_dir_stream *)fs_dirs;
+	struct erofs_dirent *de = (struct erofs_dirent *)dirs->blk;
+	struct fs_dirent *dent = &dirs->dirent;
+	struct erofs_inode inode;
+	const char *name;
+	u32 namelen;
+	int ret;
+
+	while (dirs->next == dirs->count) {
+		if (dirs->pos >= dirs->inode.size)
+			return -ENOENT;
+		ret = erofs_read_dir_block(&dirs->inode, dirs->pos, dirs->blk,
+					   &dirs->len);
+		if (ret < 0)
+			return ret;
+		dirs->count = ret;
+		dirs->next = 0;
+		dirs->pos += erofs_blksz();
+	}
+
+	name = erofs_dirent_name(dirs->blk, dirs->len, dirs->count,
+				 dirs->next, &namelen);
+	if (!name)
+		return -EIO;
+	de += dirs->next++;
+
+	memset(dent, 0, sizeof(*dent));
+	memcpy(dent->name, name, namelen);
+	switch (de->file_type) {
+	case EROFS_FT_DIR:
+		dent->type = FS_DT_DIR;
+		break;
+	case EROFS_FT_SYMLINK:
+		dent->type = FS_DT_LNK;
+		break;
+	default:
+		dent->type = FS_DT_REG;
+		ret = erofs_read_inode(le64_to_cpu(de->nid), &inode);
+		if (ret)
+			return ret;
+		dent->size = inode.size;
+		break;
+	}
+	*dentp = dent;
+
+	return 0;
+}
+
+void erofs_closedir(struct fs_dir_stream *dirs)
+{
+	free(dirs);
+}
+
+int erofs_exists(const char *filename)
+{
+	struct erofs_inode inode;
+
+	return erofs_lookup(filename, &inode, true) == 0;
+}
+
+int erofs_size(const char *filename, loff_t *size)
+{
+	struct erofs_inode inode;
+	int ret;
+
+	ret = erofs_lookup(filename, &inode, true);
+	if (ret) {
+		printf("** File not found %s **\n", filename);
+		return ret;
+	}
+	*size = inode.size;
+
+	return 0;
+}
+
+int erofs_read(const char *filename, void *buf, loff_t offset, loff_t len,
+	       loff_t *actread)
+{
+	struct erofs_inode inode;
+	int ret;
+
+	*actread = 0;
+	ret = erofs_lookup(filename, &inode, true);
+	if (ret) {
+		printf("** File not found %s **\n", filename);
+		return ret;
+	}
+	if (S_ISDIR(inode.mode))
+		return -EISDIR;
+	if (!S_ISREG(inode.mode))
+		return -EINVAL;
+	if (offset >= inode.size)
+		return offset == inode.size ? 0 : -EINVAL;
+
+	if (!len || len > inode.size - offset)
+		len = inode.size - offset;
+	ret = erofs_read_data(&inode, buf, offset, len, false);
+	if (ret) {
+		printf("EROFS: error reading %s\n", filename);
+		return ret;
+	}
+	*actread = len;
+
+	return 0;
+}
+
+void erofs_close(void)
+{
+	int i;
+
+	for (i = 0; i < EROFS_META_CACHE; i++)
+		free(erofs_meta[i].data);
+	memset(erofs_meta, 0, sizeof(erofs_meta));
+	z_erofs_cleanup();
+	memset(&erofs_sbi, 0, sizeof(erofs_sbi));
+}
@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * EROFS filesystem implementation for U-Boot
+ *
+ * On-disk format as described in the Linux kernel's fs/erofs/erofs_fs.h.
+ * Everything is little endian.
+ */
+
+#ifndef __EROFS_FS_H__
+#define __EROFS_FS_H__
+
+#include <linux/bitops.h>
+#include <linux/types.h>
+
+#define EROFS_SUPER_MAGIC_V1		0xe0f5e1e2
+#define EROFS_SUPER_OFFSET		1024
+
+#define EROFS_MIN_BLKSZBITS		9
+#define EROFS_MAX_BLKSZBITS		12
+
+/* Superblock features which change how the image is read */
+#define EROFS_FEATURE_INCOMPAT_ZERO_PADDING	BIT(0)
+#define EROFS_FEATURE_INCOMPAT_BIG_PCLUSTER	BIT(1)
+#define EROFS_FEATURE_INCOMPAT_CHUNKED_FILE	BIT(2)
+#define EROFS_FEATURE_INCOMPAT_DEVICE_TABLE	BIT(3)
+#define EROFS_FEATURE_INCOMPAT_ZTAILPACKING	BIT(4)
+#define EROFS_FEATURE_INCOMPAT_FRAGMENTS	BIT(5)
+#define EROFS_FEATURE_INCOMPAT_XATTR_PREFIXES	BIT(6)
+#define EROFS_FEATURE_INCOMPAT_SUPP	(EROFS_FEATURE_INCOMPAT_ZERO_PADDING | \
+					 EROFS_FEATURE_INCOMPAT_BIG_PCLUSTER | \
+					 EROFS_FEATURE_INCOMPAT_CHUNKED_FILE | \
+					 EROFS_FEATURE_INCOMPAT_XATTR_PREFIXES)
+
+struct erofs_super_block {
+	__le32 magic;
+	__le32 checksum;
+	__le32 feature_compat;
+	__u8 blkszbits;
+	__u8 sb_extslots;
+	__le16 root_nid;
+	__le64 inos;
+	__le64 build_time;
+	__le32 build_time_nsec;
+	__le32 blocks;
+	__le32 meta_blkaddr;		/* Block of the inode with nid 0 */
+	__le32 xattr_blkaddr;
+	__u8 uuid[16];
+	__u8 volume_name[16];
+	__le32 feature_incompat;
+	__le16 available_compr_algs;
+	__le16 extra_devices;
+	__le16 devt_slotoff;
+	__u8 reserved[38];
+} __packed;
+
+/* Inodes are found at meta_blkaddr plus nid slots of this size */
+#define EROFS_ISLOTBITS			5
+
+/* i_format: bit 0 is the version, bits 1 to 3 the data layout */
+#define EROFS_INODE_LAYOUT_EXTENDED	1
+#define EROFS_I_VERSION(format)		((format) & 1)
+#define EROFS_I_DATALAYOUT(format)	(((format) >> 1) & 7)
+
+enum erofs_datalayout {
+	EROFS_INODE_FLAT_PLAIN,		/* Blocks one after another */
+	EROFS_INODE_COMPRESSED_FULL,	/* Compressed, full indexes */
+	EROFS_INODE_FLAT_INLINE,	/* Tail end just after the inode */
+	EROFS_INODE_COMPRESSED_COMPACT,	/* Compressed, packed indexes */
+	EROFS_INODE_CHUNK_BASED,	/* Chunks which may be anywhere */
+};
+
+struct erofs_inode_chunk_info {
+	__le16 format;			/* See EROFS_CHUNK_FORMAT_* */
+	__le16 reserved;
+} __packed;
+
+#define EROFS_CHUNK_FORMAT_BLKBITS_MASK	0x1f
+#define EROFS_CHUNK_FORMAT_INDEXES	BIT(5)
+
+union erofs_inode_i_u {
+	__le32 compressed_blocks;
+	__le32 raw_blkaddr;
+	__le32 rdev;
+	struct erofs_inode_chunk_info c;
+};
+
+/* 32 bytes */
+struct erofs_inode_compact {
+	__le16 i_format;
+	__le16 i_xattr_icount;
+	__le16 i_mode;
+	__le16 i_nlink;
+	__le32 i_size;
+	__le32 i_reserved;
+	union erofs_inode_i_u i_u;
+	__le32 i_ino;
+	__le16 i_uid;
+	__le16 i_gid;
+	__le32 i_reserved2;
+} __packed;
+
+/* 64 bytes */
+struct erofs_inode_extended {
+	__le16 i_format;
+	__le16 i_xattr_icount;
+	__le16 i_mode;
+	__le16 i_reserved;
+	__le64 i_size;
+	union erofs_inode_i_u i_u;
+	__le32 i_ino;
+	__le32 i_uid;
+	__le32 i_gid;
+	__le64 i_mtime;
+	__le32 i_mtime_nsec;
+	__le32 i_nlink;
+	__u8 i_reserved2[16];
+} __packed;
+
+/* The extended attributes after an inode take 12 + 4 * (icount - 1) bytes */
+#define EROFS_XATTR_IBODY_HEADER_SIZE	12
+#define EROFS_XATTR_ENTRY_SIZE		4
+
+/* Block of each chunk with EROFS_CHUNK_FORMAT_INDEXES */
+struct erofs_inode_chunk_index {
+	__le16 advise;
+	__le16 device_id;
+	__le32 blkaddr;
+} __packed;
+
+/* A hole, in chunk maps */
+#define EROFS_NULL_ADDR			0xffffffff
+
+/*
+ * A directory block starts with its entries, sorted by name, followed by
+ * the names. Each name ends where the next one starts, or at the end of
+ * the block or at a nul for the last one.
+ */
+struct erofs_dirent {
+	__le64 nid;
+	__le16 nameoff;
+	__u8 file_type;
+	__u8 reserved;
+} __packed;
+
+#define EROFS_NAME_LEN			255
+
+enum erofs_file_type {
+	EROFS_FT_UNKNOWN,
+	EROFS_FT_REG_FILE,
+	EROFS_FT_DIR,
+	EROFS_FT_CHRDEV,
+	EROFS_FT_BLKDEV,
+	EROFS_FT_FIFO,
+	EROFS_FT_SOCK,
+	EROFS_FT_SYMLINK,
+};
+
+/* Compressed files: the map header follows the inode, aligned to 8 */
+struct z_erofs_map_header {
+	__le16 h_reserved1;
+	__le16 h_idata_size;
+	__le16 h_advise;
+	__u8 h_algorithmtype;		/* Bits 0-3: HEAD1, 4-7: HEAD2 */
+	__u8 h_clusterbits;		/* Bits 0-2: lclusterbits - blkszbits */
+} __packed;
+
+#define Z_EROFS_ADVISE_COMPACTED_2B	BIT(0)
+#define Z_EROFS_ADVISE_BIG_PCLUSTER_1	BIT(1)
+#define Z_EROFS_ADVISE_BIG_PCLUSTER_2	BIT(2)
+#define Z_EROFS_ADVISE_BIG_PCLUSTERS	(Z_EROFS_ADVISE_BIG_PCLUSTER_1 | \
+					 Z_EROFS_ADVISE_BIG_PCLUSTER_2)
+#define Z_EROFS_ADVISE_INLINE_PCLUSTER	BIT(3)
+#define Z_EROFS_ADVISE_INTERLACED_PCLUSTER BIT(4)
+#define Z_EROFS_ADVISE_FRAGMENT_PCLUSTER BIT(5)
+
+enum z_erofs_compression {
+	Z_EROFS_COMPRESSION_LZ4,
+	Z_EROFS_COMPRESSION_LZMA,
+};
+
+/* Each logical cluster of a file has one of these types */
+enum z_erofs_lcluster_type {
+	Z_EROFS_LCLUSTER_TYPE_PLAIN,	/* An extent stored uncompressed */
+	Z_EROFS_LCLUSTER_TYPE_HEAD1,	/* A compressed extent starts */
+	Z_EROFS_LCLUSTER_TYPE_NONHEAD,	/* No extent starts */
+	Z_EROFS_LCLUSTER_TYPE_HEAD2,	/* Same, second algorithm */
+};
+
+#define Z_EROFS_LI_LCLUSTER_TYPE_MASK	3
+/* delta[0] of the first NONHEAD lcluster holds the blocks of the extent */
+#define Z_EROFS_LI_D0_CBLKCNT		BIT(11)
+
+/* Full index of a logical cluster */
+struct z_erofs_lcluster_index {
+	__le16 di_advise;
+	__le16 di_clusterofs;		/* Where the extent starts in it */
+	union {
+		__le32 blkaddr;		/* HEAD and PLAIN */
+		__le16 delta[2];	/* NONHEAD: lclusters to the heads */
+	} di_u;
+} __packed;
+
+#endif /* __EROFS_FS_H__ */
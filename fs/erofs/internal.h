@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * EROFS filesystem implementation for U-Boot
+ *
+ * Definitions shared by the files of the driver
+ */
+
+#ifndef __EROFS_INTERNAL_H__
+#define __EROFS_INTERNAL_H__
+
+#include <part.h>
+#include "erofs_fs.h"
+
+struct erofs_sb_info {
+	struct blk_desc *dev;
+	disk_partition_t part;
+	u32 blkszbits;
+	u32 feature_incompat;
+	u64 meta_start;			/* Byte where the inode of nid 0 is */
+	u64 root_nid;
+};
+
+extern struct erofs_sb_info erofs_sbi;
+
+#define erofs_blksz()		(1U << erofs_sbi.blkszbits)
+#define erofs_pos(blk)		((u64)(blk) << erofs_sbi.blkszbits)
+
+/* What is known of an inode */
+struct erofs_inode {
+	u64 nid;
+	u16 mode;
+	u8 datalayout;
+	u8 inode_isize;			/* Size of the on-disk inode */
+	u32 xattr_isize;		/* Size of its extended attributes */
+	u64 size;
+	union {
+		u32 raw_blkaddr;	/* Flat layouts */
+		u16 chunkformat;	/* Chunk-based */
+	};
+
+	/* Compressed files, once z_erofs_init_inode() has filled them in */
+	bool z_inited;
+	u16 z_advise;
+	u8 z_algorithmtype[2];
+	u8 z_lclusterbits;
+};
+
+/* Where the data at some offset of a file is */
+struct erofs_map_blocks {
+	u64 m_la;			/* Extent of the file */
+	u64 m_llen;
+	u64 m_pa;			/* Where it is on the disk */
+	u64 m_plen;
+	unsigned int m_flags;		/* EROFS_MAP_* */
+	u8 m_algorithm;			/* Z_EROFS_COMPRESSION_*, if encoded */
+};
+
+#define EROFS_MAP_MAPPED	BIT(0)	/* Not a hole */
+#define EROFS_MAP_META		BIT(1)	/* Inline, in the metadata */
+#define EROFS_MAP_ENCODED	BIT(2)	/* Compressed or shifted */
+
+/* Compressed extents stored as they are, rotated or not */
+#define Z_EROFS_COMPRESSION_SHIFTED	0xff
+#define Z_EROFS_COMPRESSION_INTERLACED	0xfe
+
+/* Where the inode is on the disk */
+static inline u64 erofs_iloc(struct erofs_inode *inode)
+{
+	return erofs_sbi.meta_start + (inode->nid << EROFS_ISLOTBITS);
+}
+
+/* Where what follows the inode and its extended attributes is */
+static inline u64 erofs_iend(struct erofs_inode *inode)
+{
+	return erofs_iloc(inode) + inode->inode_isize + inode->xattr_isize;
+}
+
+static inline bool erofs_inode_is_compressed(struct erofs_inode *inode)
+{
+	return inode->datalayout == EROFS_INODE_COMPRESSED_FULL ||
+	       inode->datalayout == EROFS_INODE_COMPRESSED_COMPACT;
+}
+
+/* erofs.c */
+int erofs_dev_read(u64 offset, u64 len, void *buf);
+int erofs_read_meta(u64 pos, void *buf, u32 len);
+
+/* zmap.c */
+int z_erofs_map_blocks(struct erofs_inode *inode, u64 offset,
+		       struct erofs_map_blocks *map);
+int z_erofs_read_data(struct erofs_inode *inode, void *buf, u64 offset,
+		      u64 len);
+void z_erofs_cleanup(void);
+
+#endif /* __EROFS_INTERNAL_H__ */
@@ -0,0 +1,555 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * EROFS filesystem implementation for U-Boot
+ *
+ * Compressed files, after the Linux kernel's fs/erofs/zmap.c
+ *
+ * A compressed file is cut into logical clusters (lclusters) of the block
+ * size. Each one has an index, in full or packed (compact) form, telling
+ * whether an extent starts in it and where. The extent goes on to the
+ * start of the next one and is stored in a physical cluster of one or
+ * more blocks, compressed with LZ4 or as it is.
+ */
+
+#include <common.h>
+#include <errno.h>
+#include <lz4.h>
+#include <malloc.h>
+#include <asm/unaligned.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+
+#include "internal.h"
+
+struct z_erofs_maprecorder {
+	struct erofs_inode *inode;
+	u64 lcn;			/* Last lcluster loaded */
+	u8 type;
+	u8 headtype;			/* Type of the head of the extent */
+	u16 clusterofs;
+	u16 delta[2];
+	u32 pblk;
+	u32 compressedblks;
+};
+
+/* Where the full indexes are, after the map header and 8 reserved bytes */
+#define Z_EROFS_FULL_INDEX_ALIGN(end) \
+	(ALIGN(end, 8) + sizeof(struct z_erofs_map_header) + 8)
+
+/*
+ * The last extent decompressed, so that reading a file in pieces does not
+ * decompress it again for each of them
+ */
+static struct {
+	u64 pa;
+	u64 la;
+	u64 len;			/* 0 if nothing is kept */
+	void *data;
+	u64 size;			/* Size of 'data' */
+} z_erofs_last;
+
+static void *z_erofs_cbuf;		/* Compressed data read from the disk */
+static u64 z_erofs_cbuf_size;
+
+static int z_erofs_init_inode(struct erofs_inode *inode)
+{
+	struct z_erofs_map_header h;
+	int ret;
+
+	ret = erofs_read_meta(ALIGN(erofs_iend(inode), 8), &h, sizeof(h));
+	if (ret)
+		return ret;
+
+	inode->z_advise = le16_to_cpu(h.h_advise);
+	inode->z_algorithmtype[0] = h.h_algorithmtype & 15;
+	inode->z_algorithmtype[1] = h.h_algorithmtype >> 4;
+	inode->z_lclusterbits = erofs_sbi.blkszbits + (h.h_clusterbits & 7);
+
+	/* tail ends packed inline or in fragments are not supported */
+	if (inode->z_advise & (Z_EROFS_ADVISE_INLINE_PCLUSTER |
+			       Z_EROFS_ADVISE_FRAGMENT_PCLUSTER))
+		return -EOPNOTSUPP;
+	if (inode->datalayout == EROFS_INODE_COMPRESSED_COMPACT &&
+	    !(inode->z_advise & Z_EROFS_ADVISE_BIG_PCLUSTER_1) !=
+	    !(inode->z_advise & Z_EROFS_ADVISE_BIG_PCLUSTER_2))
+		return -EIO;
+	inode->z_inited = true;
+
+	return 0;
+}
+
+static int z_erofs_load_full_lcluster(struct z_erofs_maprecorder *m, u64 lcn)
+{
+	struct erofs_inode *inode = m->inode;
+	struct z_erofs_lcluster_index di;
+	u16 advise;
+	int ret;
+
+	ret = erofs_read_meta(Z_EROFS_FULL_INDEX_ALIGN(erofs_iend(inode)) +
+			      lcn * sizeof(di), &di, sizeof(di));
+	if (ret)
+		return ret;
+
+	m->lcn = lcn;
+	advise = le16_to_cpu(di.di_advise);
+	m->type = advise & Z_EROFS_LI_LCLUSTER_TYPE_MASK;
+	if (m->type == Z_EROFS_LCLUSTER_TYPE_NONHEAD) {
+		m->clusterofs = 1 << inode->z_lclusterbits;
+		m->delta[0] = le16_to_cpu(di.di_u.delta[0]);
+		if (m->delta[0] & Z_EROFS_LI_D0_CBLKCNT) {
+			if (!(inode->z_advise & Z_EROFS_ADVISE_BIG_PCLUSTERS))
+				return -EIO;
+			m->compressedblks = m->delta[0] &
+					    ~Z_EROFS_LI_D0_CBLKCNT;
+			m->delta[0] = 1;
+		}
+		m->delta[1] = le16_to_cpu(di.di_u.delta[1]);
+	} else {
+		m->clusterofs = le16_to_cpu(di.di_clusterofs);
+		if (m->clusterofs >= 1 << inode->z_lclusterbits)
+			return -EIO;
+		m->pblk = le32_to_cpu(di.di_u.blkaddr);
+	}
+
+	return 0;
+}
+
+static u32 z_erofs_decode_bits(u32 lobits, const u8 *in, u32 pos, u8 *type)
+{
+	u32 v = get_unaligned_le32(in + pos / 8) >> (pos & 7);
+
+	*type = (v >> lobits) & 3;
+	return v & ((1 << lobits) - 1);
+}
+
+/*
+ * Compact indexes come in packs of 'vcnt' lclusters, each taking 2 or 4
+ * bytes on average ('1 << shift'). The pack holds their types and low
+ * bits, then the block address of its first extent; the addresses of the
+ * others are counted from it.
+ */
+static int z_erofs_unpack_compact_index(struct z_erofs_maprecorder *m,
+					u32 shift, u64 pos)
+{
+	struct erofs_inode *inode = m->inode;
+	u32 lclusterbits = inode->z_lclusterbits;
+	u32 vcnt, packsize, lobits, encodebits, lo, nblk;
+	bool big = inode->z_advise & Z_EROFS_ADVISE_BIG_PCLUSTER_1;
+	u8 pack[32], type;
+	u64 packpos;
+	int i, ret;
+
+	if (shift == 2 && lclusterbits <= 14)
+		vcnt = 2;
+	else if (shift == 1 && lclusterbits <= 12)
+		vcnt = 16;
+	else
+		return -EOPNOTSUPP;
+
+	packsize = vcnt << shift;
+	packpos = round_down(pos, packsize);
+	ret = erofs_read_meta(packpos, pack, packsize);
+	if (ret)
+		return ret;
+
+	lobits = max(lclusterbits, ilog2(Z_EROFS_LI_D0_CBLKCNT) + 1U);
+	encodebits = (packsize - sizeof(__le32)) * 8 / vcnt;
+	i = (pos - packpos) >> shift;
+
+	lo = z_erofs_decode_bits(lobits, pack, encodebits * i, &type);
+	m->type = type;
+	m->delta[1] = 0;
+	if (type == Z_EROFS_LCLUSTER_TYPE_NONHEAD) {
+		m->clusterofs = 1 << lclusterbits;
+		if (lo & Z_EROFS_LI_D0_CBLKCNT) {
+			if (!big)
+				return -EIO;
+			m->compressedblks = lo & ~Z_EROFS_LI_D0_CBLKCNT;
+			m->delta[0] = 1;
+			return 0;
+		} else if (i + 1 != vcnt) {
+			m->delta[0] = lo;
+			return 0;
+		}
+		/*
+		 * The last lcluster of a pack holds delta[1] rather than
+		 * delta[0], so get it from the one before
+		 */
+		lo = z_erofs_decode_bits(lobits, pack, encodebits * (i - 1),
+					 &type);
+		if (type != Z_EROFS_LCLUSTER_TYPE_NONHEAD)
+			lo = 0;
+		else if (lo & Z_EROFS_LI_D0_CBLKCNT)
+			lo = 1;
+		m->delta[0] = lo + 1;
+		return 0;
+	}
+
+	m->clusterofs = lo;
+	m->delta[0] = 0;
+	/* count the blocks of the extents before this one in the pack */
+	if (!big) {
+		nblk = 1;
+		while (i > 0) {
+			--i;
+			lo = z_erofs_decode_bits(lobits, pack, encodebits * i,
+						 &type);
+			if (type == Z_EROFS_LCLUSTER_TYPE_NONHEAD)
+				i -= lo;
+			if (i >= 0)
+				++nblk;
+		}
+	} else {
+		nblk = 0;
+		while (i > 0) {
+			--i;
+			lo = z_erofs_decode_bits(lobits, pack, encodebits * i,
+						 &type);
+			if (type == Z_EROFS_LCLUSTER_TYPE_NONHEAD) {
+				if (lo & Z_EROFS_LI_D0_CBLKCNT) {
+					--i;
+					nblk += lo & ~Z_EROFS_LI_D0_CBLKCNT;
+					continue;
+				}
+				if (lo <= 1)
+					return -EIO;
+				i -= lo - 2;
+				continue;
+			}
+			++nblk;
+		}
+	}
+	m->pblk = get_unaligned_le32(pack + packsize - sizeof(__le32)) + nblk;
+
+	return 0;
+}
+
+/*
+ * The compact indexes start with 4-byte ones up to a 32-byte boundary,
+ * then 2-byte ones in packs of 16 if the file has them, then 4-byte ones
+ * again for the lclusters left
+ */
+static int z_erofs_load_compact_lcluster(struct z_erofs_maprecorder *m,
+					 u64 lcn)
+{
+	struct erofs_inode *inode = m->inode;
+	u64 ebase = ALIGN(erofs_iend(inode), 8) +
+		    sizeof(struct z_erofs_map_header);
+	u64 totalidx = DIV_ROUND_UP(inode->size, erofs_blksz());
+	u64 initial_4b, compact_2b, pos;
+	u32 shift;
+
+	m->lcn = lcn;
+
+	initial_4b = (32 - ebase % 32) / 4;
+	if (initial_4b == 32 / 4)
+		initial_4b = 0;
+	if ((inode->z_advise & Z_EROFS_ADVISE_COMPACTED_2B) &&
+	    initial_4b < totalidx)
+		compact_2b = rounddown(totalidx - initial_4b, 16);
+	else
+		compact_2b = 0;
+
+	pos = ebase;
+	if (lcn < initial_4b) {
+		shift = 2;
+	} else {
+		pos += initial_4b * 4;
+		lcn -= initial_4b;
+		if (lcn < compact_2b) {
+			shift = 1;
+		} else {
+			pos += compact_2b * 2;
+			lcn -= compact_2b;
+			shift = 2;
+		}
+	}
+
+	return z_erofs_unpack_compact_index(m, shift, pos + (lcn << shift));
+}
+
+static int z_erofs_load_lcluster(struct z_erofs_maprecorder *m, u64 lcn)
+{
+	if (lcn >= DIV_ROUND_UP(m->inode->size, erofs_blksz()))
+		return -EIO;
+
+	if (m->inode->datalayout == EROFS_INODE_COMPRESSED_FULL)
+		return z_erofs_load_full_lcluster(m, lcn);
+
+	return z_erofs_load_compact_lcluster(m, lcn);
+}
+
+/* Go back 'distance' lclusters at a time to the head of the extent */
+static int z_erofs_extent_lookback(struct z_erofs_maprecorder *m,
+				   u64 distance, struct erofs_map_blocks *map)
+{
+	int ret;
+
+	while (distance && m->lcn >= distance) {
+		ret = z_erofs_load_lcluster(m, m->lcn - distance);
+		if (ret)
+			return ret;
+		if (m->type == Z_EROFS_LCLUSTER_TYPE_NONHEAD) {
+			distance = m->delta[0];
+			continue;
+		}
+		m->headtype = m->type;
+		map->m_la = (m->lcn << m->inode->z_lclusterbits) |
+			    m->clusterofs;
+		return 0;
+	}
+
+	return -EIO;
+}
+
+static int z_erofs_get_extent_compressedlen(struct z_erofs_maprecorder *m,
+					    struct erofs_map_blocks *map)
+{
+	struct erofs_inode *inode = m->inode;
+	u32 lclusterbits = inode->z_lclusterbits;
+	bool big;
+	int ret;
+
+	if (m->headtype == Z_EROFS_LCLUSTER_TYPE_HEAD1)
+		big = inode->z_advise & Z_EROFS_ADVISE_BIG_PCLUSTER_1;
+	else if (m->headtype == Z_EROFS_LCLUSTER_TYPE_HEAD2)
+		big = inode->z_advise & Z_EROFS_ADVISE_BIG_PCLUSTER_2;
+	else
+		big = false;
+	if (!big) {
+		map->m_plen = 1ULL << lclusterbits;
+		return 0;
+	}
+
+	/* the first lcluster after the head holds the number of blocks */
+	if (!m->compressedblks) {
+		ret = z_erofs_load_lcluster(m, m->lcn + 1);
+		if (ret)
+			return ret;
+		if (m->type != Z_EROFS_LCLUSTER_TYPE_NONHEAD)
+			m->compressedblks = 1 << (lclusterbits -
+						  erofs_sbi.blkszbits);
+		else if (m->delta[0] != 1 || !m->compressedblks)
+			return -EIO;
+	}
+	map->m_plen = erofs_pos(m->compressedblks);
+
+	return 0;
+}
+
+/* The extent goes on to the next head lcluster, or the end of the file */
+static int z_erofs_get_extent_end(struct z_erofs_maprecorder *m,
+				  struct erofs_map_blocks *map)
+{
+	struct erofs_inode *inode = m->inode;
+	u32 lclusterbits = inode->z_lclusterbits;
+	u64 lcn = (map->m_la >> lclusterbits) + 1;
+	int ret;
+
+	while ((lcn << lclusterbits) < inode->size) {
+		ret = z_erofs_load_lcluster(m, lcn);
+		if (ret)
+			return ret;
+		if (m->type != Z_EROFS_LCLUSTER_TYPE_NONHEAD) {
+			map->m_llen = (lcn << lclusterbits) + m->clusterofs -
+				      map->m_la;
+			return 0;
+		}
+		/* full indexes tell how far the next head is */
+		lcn += m->delta[1] ? m->delta[1] : 1;
+	}
+	map->m_llen = inode->size - map->m_la;
+
+	return 0;
+}
+
+int z_erofs_map_blocks(struct erofs_inode *inode, u64 offset,
+		       struct erofs_map_blocks *map)
+{
+	struct z_erofs_maprecorder m = { .inode = inode };
+	u32 lclusterbits, endoff;
+	bool head2;
+	int ret;
+
+	if (!inode->z_inited) {
+		ret = z_erofs_init_inode(inode);
+		if (ret)
+			return ret;
+	}
+	lclusterbits = inode->z_lclusterbits;
+	endoff = offset & ((1ULL << lclusterbits) - 1);
+
+	ret = z_erofs_load_lcluster(&m, offset >> lclusterbits);
+	if (ret)
+		return ret;
+
+	switch (m.type) {
+	case Z_EROFS_LCLUSTER_TYPE_PLAIN:
+	case Z_EROFS_LCLUSTER_TYPE_HEAD1:
+	case Z_EROFS_LCLUSTER_TYPE_HEAD2:
+		if (endoff >= m.clusterofs) {
+			m.headtype = m.type;
+			map->m_la = (m.lcn << lclusterbits) | m.clusterofs;
+			break;
+		}
+		/* the offset is in the extent before this one */
+		ret = z_erofs_extent_lookback(&m, 1, map);
+		break;
+	case Z_EROFS_LCLUSTER_TYPE_NONHEAD:
+		ret = z_erofs_extent_lookback(&m, m.delta[0], map);
+		break;
+	default:
+		ret = -EIO;
+	}
+	if (ret)
+		return ret;
+
+	map->m_pa = erofs_pos(m.pblk);
+	if (m.headtype == Z_EROFS_LCLUSTER_TYPE_PLAIN) {
+		if (inode->z_advise & Z_EROFS_ADVISE_INTERLACED_PCLUSTER)
+			map->m_algorithm = Z_EROFS_COMPRESSION_INTERLACED;
+		else
+			map->m_algorithm = Z_EROFS_COMPRESSION_SHIFTED;
+	} else {
+		head2 = m.headtype == Z_EROFS_LCLUSTER_TYPE_HEAD2;
+		map->m_algorithm = inode->z_algorithmtype[head2];
+	}
+	map->m_flags = EROFS_MAP_MAPPED | EROFS_MAP_ENCODED;
+
+	ret = z_erofs_get_extent_compressedlen(&m, map);
+	if (ret)
+		return ret;
+
+	return z_erofs_get_extent_end(&m, map);
+}
+
+/* Decompress the extent 'map' into 'out', which has room for all of it */
+static int z_erofs_decompress(struct erofs_map_blocks *map, void *out)
+{
+	size_t outlen = map->m_llen;
+	u32 pad = 0, cur;
+	void *in;
+	int ret;
+
+	if (map->m_plen > z_erofs_cbuf_size) {
+		free(z_erofs_cbuf);
+		z_erofs_cbuf_size = 0;
+		z_erofs_cbuf = malloc(map->m_plen);
+		if (!z_erofs_cbuf)
+			return -ENOMEM;
+		z_erofs_cbuf_size = map->m_plen;
+	}
+	in = z_erofs_cbuf;
+	ret = erofs_dev_read(map->m_pa, map->m_plen, in);
+	if (ret)
+		return ret;
+
+	switch (map->m_algorithm) {
+	case Z_EROFS_COMPRESSION_SHIFTED:
+		if (map->m_llen > map->m_plen)
+			return -EIO;
+		memcpy(out, in, map->m_llen);
+		return 0;
+	case Z_EROFS_COMPRESSION_INTERLACED:
+		/* the data is rotated to where it would be in its block */
+		if (map->m_llen > map->m_plen)
+			return -EIO;
+		cur = erofs_blksz() - (map->m_la & (erofs_blksz() - 1));
+		memcpy(out, in + map->m_plen - cur,
+		       min_t(u64, cur, map->m_llen));
+		if (map->m_llen > cur)
+			memcpy(out + cur, in, map->m_llen - cur);
+		return 0;
+	case Z_EROFS_COMPRESSION_LZ4:
+		/* without the padding the end of the data is not known */
+		if (!(erofs_sbi.feature_incompat &
+		      EROFS_FEATURE_INCOMPAT_ZERO_PADDING))
+			return -EOPNOTSUPP;
+		/* the data is at the end of the physical cluster */
+		while (pad < map->m_plen && !((u8 *)in)[pad])
+			pad++;
+		if (pad == map->m_plen)
+			return -EIO;
+		ret = ulz4_block(in + pad, map->m_plen - pad, out, &outlen);
+		if (ret || outlen != map->m_llen)
+			return -EIO;
+		return 0;
+	default:
+		printf("EROFS: compression %d is not supported\n",
+		       map->m_algorithm);
+		return -EOPNOTSUPP;
+	}
+}
+
+/* Return the extent 'map' decompressed, from z_erofs_last if it is there */
+static void *z_erofs_get_extent(struct erofs_map_blocks *map)
+{
+	if (z_erofs_last.len && z_erofs_last.pa == map->m_pa &&
+	    z_erofs_last.la == map->m_la && z_erofs_last.len == map->m_llen)
+		return z_erofs_last.data;
+
+	z_erofs_last.len = 0;
+	if (map->m_llen > z_erofs_last.size) {
+		free(z_erofs_last.data);
+		z_erofs_last.size = 0;
+		z_erofs_last.data = malloc(map->m_llen);
+		if (!z_erofs_last.data)
+			return NULL;
+		z_erofs_last.size = map->m_llen;
+	}
+	if (z_erofs_decompress(map, z_erofs_last.data))
+		return NULL;
+	z_erofs_last.pa = map->m_pa;
+	z_erofs_last.la = map->m_la;
+	z_erofs_last.len = map->m_llen;
+
+	return z_erofs_last.data;
+}
+
+/*
+ * Read 'len' bytes at 'offset' of the compressed file 'inode' into 'buf'.
+ * Extents wanted whole are decompressed straight into it.
+ */
+int z_erofs_read_data(struct erofs_inode *inode, void *buf, u64 offset,
+		      u64 len)
+{
+	struct erofs_map_blocks map;
+	u64 skip, count;
+	void *data;
+	int ret;
+
+	while (len) {
+		ret = z_erofs_map_blocks(inode, offset, &map);
+		if (ret)
+			return ret;
+		skip = offset - map.m_la;
+		if (offset < map.m_la || skip >= map.m_llen)
+			return -EIO;
+		count = min(len, map.m_llen - skip);
+
+		if (!skip && count == map.m_llen) {
+			ret = z_erofs_decompress(&map, buf);
+			if (ret)
+				return ret;
+		} else {
+			data = z_erofs_get_extent(&map);
+			if (!data)
+				return -EIO;
+			memcpy(buf, data + skip, count);
+		}
+		buf += count;
+		offset += count;
+		len -= count;
+	}
+
+	return 0;
+}
+
+void z_erofs_cleanup(void)
+{
+	free(z_erofs_last.data);
+	memset(&z_erofs_last, 0, sizeof(z_erofs_last));
+	free(z_erofs_cbuf);
+	z_erofs_cbuf = NULL;
+	z_erofs_cbuf_size = 0;
+}
@@ -25,6 +25,7 @@
 #include <common.h>
 #include <blk.h>
 #include <config.h>
+#include <fs.h>
 #include <fs_internal.h>
 #include <ext4fs.h>
 #include <ext_common.h>
@@ -38,6 +39,8 @@ static disk_partition_t *part_info;
 void ext4fs_set_blk_dev(struct blk_desc *rbdd, disk_partition_t *info)
 {
 	assert(rbdd->blksz == (1 << rbdd->log2blksz));
+	/* whatever the fs layer kept mounted is about to be replaced */
+	fs_invalidate(NULL);
 	ext4fs_blk_desc = rbdd;
 	get_fs()->dev_desc = rbdd;
 	part_info = info;
@@ -180,6 +180,13 @@ uint64_t ext4fs_bg_get_inode_table_id(const struct ext2_block_group *bg,
 	return block_nr;
 }
 
+static unsigned long long ext4fs_extent_start(struct ext4_extent *extent)
+{
+	unsigned long long start = le16_to_cpu(extent->ee_start_hi);
+
+	return (start << 32) + le32_to_cpu(extent->ee_start_lo);
+}
+
 #if defined(CONFIG_EXT4_WRITE)
 uint32_t ext4fs_div_roundup(uint32_t size, uint32_t n)
 {
@@ -270,35 +277,17 @@ static int _get_new_inode_no(unsigned char *buffer)
 	return -1;
 }
 
-static int _get_new_blk_no(unsigned char *buffer)
+/* Note that a bitmap changed, so that ext4fs_update() writes it back */
+void ext4fs_blk_bmap_dirty(int index)
 {
-	int operand;
-	int count = 0;
-	int i;
-	unsigned char *ptr = buffer;
-	struct ext_filesystem *fs = get_fs();
-
-	while (*ptr == 255) {
-		ptr++;
-		count += 8;
-		if (count == (fs->blksz * 8))
-			return -1;
-	}
-
-	if (fs->blksz == 1024)
-		count += 1;
+	get_fs()->bmaps_dirty[index] = 1;
+}
 
-	for (i = 0; i <= 7; i++) {
-		operand = 1 << i;
-		if (*ptr & operand) {
-			count++;
-		} else {
-			*ptr |= operand;
-			return count;
-		}
-	}
+void ext4fs_inode_bmap_dirty(int index)
+{
+	struct ext_filesystem *fs = get_fs();
 
-	return -1;
+	fs->bmaps_dirty[fs->no_blkgrp + index] = 1;
 }
 
 int ext4fs_set_block_bmap(long int blockno, unsigned char *buffer, int index)
@@ -319,6 +308,7 @@ int ext4fs_set_block_bmap(long int blockno, unsigned char *buffer, int index)
 			return -1;
 
 		*ptr = *ptr | operand;
+		ext4fs_blk_bmap_dirty(index);
 		return 0;
 	} else {
 		if (remainder == 0) {
@@ -333,6 +323,7 @@ int ext4fs_set_block_bmap(long int blockno, unsigned char *buffer, int index)
 			return -1;
 
 		*ptr = *ptr | operand;
+		ext4fs_blk_bmap_dirty(index);
 		return 0;
 	}
 }
@@ -351,8 +342,10 @@ void ext4fs_reset_block_bmap(long int blockno, unsigned char *buffer, int index)
 		ptr = ptr + i;
 		operand = (1 << remainder);
 		status = *ptr & operand;
-		if (status)
+		if (status) {
 			*ptr = *ptr & ~(operand);
+			ext4fs_blk_bmap_dirty(index);
+		}
 	} else {
 		if (remainder == 0) {
 			ptr = ptr + i - 1;
@@ -362,8 +355,10 @@ void ext4fs_reset_block_bmap(long int blockno, unsigned char *buffer, int index)
 			operand = (1 << (remainder - 1));
 		}
 		status = *ptr & operand;
-		if (status)
+		if (status) {
 			*ptr = *ptr & ~(operand);
+			ext4fs_blk_bmap_dirty(index);
+		}
 	}
 }
 
@@ -388,6 +383,7 @@ int ext4fs_set_inode_bmap(int inode_no, unsigned char *buffer, int index)
 		return -1;
 
 	*ptr = *ptr | operand;
+	ext4fs_inode_bmap_dirty(index);
 
 	return 0;
 }
@@ -409,8 +405,10 @@ void ext4fs_reset_inode_bmap(int inode_no, unsigned char *buffer, int index)
 		operand = (1 << (remainder - 1));
 	}
 	status = *ptr & operand;
-	if (status)
+	if (status) {
 		*ptr = *ptr & ~(operand);
+		ext4fs_inode_bmap_dirty(index);
+	}
 }
 
 uint16_t ext4fs_checksum_update(uint32_t i)
@@ -955,135 +953,195 @@ int ext4fs_filename_unlink(char *filename)
 	return -1;
 }
 
-uint32_t ext4fs_get_new_blk_no(void)
+/* Whether a group holds a backup of the superblock and descriptors */
+static bool ext4fs_bg_has_super(uint32_t bg_idx)
 {
-	short i;
-	short status;
-	int remainder;
-	unsigned int bg_idx;
-	static int prev_bg_bitmap_index = -1;
-	unsigned int blk_per_grp = le32_to_cpu(ext4fs_root->sblock.blocks_per_group);
 	struct ext_filesystem *fs = get_fs();
-	char *journal_buffer = zalloc(fs->blksz);
-	char *zero_buffer = zalloc(fs->blksz);
-	if (!journal_buffer || !zero_buffer)
-		goto fail;
+	uint64_t power;
+	uint32_t n;
+
+	if (bg_idx <= 1 || !(le32_to_cpu(fs->sb->feature_ro_compat) &
+			     EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER))
+		return true;
+	if (!(bg_idx & 1))
+		return false;
+
+	/* the others are the powers of 3, 5 and 7 */
+	for (n = 3; n <= 7; n += 2) {
+		for (power = n; power < bg_idx; power *= n)
+			;
+		if (power == bg_idx)
+			return true;
+	}
 
-	if (fs->first_pass_bbmap == 0) {
-		for (i = 0; i < fs->no_blkgrp; i++) {
-			struct ext2_block_group *bgd = NULL;
-			bgd = ext4fs_get_group_descriptor(fs, i);
-			if (ext4fs_bg_get_free_blocks(bgd, fs)) {
-				uint16_t bg_flags = ext4fs_bg_get_flags(bgd);
-				uint64_t b_bitmap_blk =
-					ext4fs_bg_get_block_id(bgd, fs);
-				if (bg_flags & EXT4_BG_BLOCK_UNINIT) {
-					memcpy(fs->blk_bmaps[i], zero_buffer,
-					       fs->blksz);
-					put_ext4(b_bitmap_blk * fs->blksz,
-						 fs->blk_bmaps[i], fs->blksz);
-					bg_flags &= ~EXT4_BG_BLOCK_UNINIT;
-					ext4fs_bg_set_flags(bgd, bg_flags);
-				}
-				fs->curr_blkno =
-				    _get_new_blk_no(fs->blk_bmaps[i]);
-				if (fs->curr_blkno == -1)
-					/* block bitmap is completely filled */
-					continue;
-				fs->curr_blkno = fs->curr_blkno +
-						(i * fs->blksz * 8);
-				fs->first_pass_bbmap++;
-				ext4fs_bg_free_blocks_dec(bgd, fs);
-				ext4fs_sb_free_blocks_dec(fs->sb);
-				status = ext4fs_devread(b_bitmap_blk *
-							fs->sect_perblk,
-							0, fs->blksz,
-							journal_buffer);
-				if (status == 0)
-					goto fail;
-				if (ext4fs_log_journal(journal_buffer,
-						       b_bitmap_blk))
-					goto fail;
-				goto success;
-			} else {
-				debug("no space left on block group %d\n", i);
-			}
-		}
+	return false;
+}
 
-		goto fail;
-	} else {
-		fs->curr_blkno++;
-restart:
-		/* get the blockbitmap index respective to blockno */
-		bg_idx = fs->curr_blkno / blk_per_grp;
-		if (fs->blksz == 1024) {
-			remainder = fs->curr_blkno % blk_per_grp;
-			if (!remainder)
-				bg_idx--;
-		}
+/* Mark the blocks of [first, first + count) falling in [start, end) */
+static void ext4fs_mark_blocks(unsigned char *bmap, uint64_t start,
+			       uint64_t end, uint64_t first, uint64_t count)
+{
+	uint64_t last = first + count;
 
-		/*
-		 * To skip completely filled block group bitmaps
-		 * Optimize the block allocation
-		 */
-		if (bg_idx >= fs->no_blkgrp)
-			goto fail;
+	first = max(first, start);
+	last = min(last, end);
+	for (; first < last; first++)
+		bmap[(first - start) >> 3] |= 1 << ((first - start) & 7);
+}
+
+/*
+ * Build the block bitmap of a group which mkfs left uninitialised: the
+ * backup superblock and descriptors are in use, as are the bitmaps and
+ * inode tables of any group which are stored in this one (flex_bg), and
+ * the bits past the end of the group
+ */
+static void ext4fs_init_block_bmap(uint32_t bg_idx)
+{
+	struct ext_filesystem *fs = get_fs();
+	struct ext2_block_group *bgd = ext4fs_get_group_descriptor(fs, bg_idx);
+	uint16_t bg_flags = ext4fs_bg_get_flags(bgd);
+	uint32_t blk_per_grp = le32_to_cpu(fs->sb->blocks_per_group);
+	uint64_t start = le32_to_cpu(fs->sb->first_data_block) +
+			 (uint64_t)bg_idx * blk_per_grp;
+	uint64_t end = min(start + blk_per_grp,
+			   (uint64_t)le32_to_cpu(fs->sb->total_blocks));
+	uint32_t itable_blks = ext4fs_div_roundup(
+			le32_to_cpu(fs->sb->inodes_per_group) * fs->inodesz,
+			fs->blksz);
+	unsigned char *bmap = fs->blk_bmaps[bg_idx];
+	struct ext2_block_group *bg;
+	uint32_t i;
+
+	if (!(bg_flags & EXT4_BG_BLOCK_UNINIT))
+		return;
 
-		struct ext2_block_group *bgd = NULL;
+	memset(bmap, '\0', fs->blksz);
+	if (ext4fs_bg_has_super(bg_idx))
+		ext4fs_mark_blocks(bmap, start, end, start, 1 +
+				   fs->no_blk_pergdt +
+				   le16_to_cpu(fs->sb->reserved_gdt_blocks));
+	for (i = 0; i < fs->no_blkgrp; i++) {
+		bg = ext4fs_get_group_descriptor(fs, i);
+		ext4fs_mark_blocks(bmap, start, end,
+				   ext4fs_bg_get_block_id(bg, fs), 1);
+		ext4fs_mark_blocks(bmap, start, end,
+				   ext4fs_bg_get_inode_id(bg, fs), 1);
+		ext4fs_mark_blocks(bmap, start, end,
+				   ext4fs_bg_get_inode_table_id(bg, fs),
+				   itable_blks);
+	}
+	ext4fs_mark_blocks(bmap, start, start + fs->blksz * 8, end,
+			   start + fs->blksz * 8 - end);
+
+	bg_flags &= ~EXT4_BG_BLOCK_UNINIT;
+	ext4fs_bg_set_flags(bgd, bg_flags);
+	ext4fs_blk_bmap_dirty(bg_idx);
+}
+
+/* Keep the on-disk copy of a bitmap block in the journal, once */
+int ext4fs_log_bmap(uint64_t blknr)
+{
+	struct ext_filesystem *fs = get_fs();
+	char *buf;
+	int ret = -EIO;
+
+	if (ext4fs_journal_logged(blknr))
+		return 0;
+
+	buf = zalloc(fs->blksz);
+	if (!buf)
+		return -ENOMEM;
+	if (ext4fs_devread(blknr * fs->sect_perblk, 0, fs->blksz, buf))
+		ret = ext4fs_log_journal(buf, blknr);
+	free(buf);
+
+	return ret;
+}
+
+static inline int ext4fs_bmap_test(const unsigned char *bmap, uint32_t bit)
+{
+	return bmap[bit >> 3] & (1 << (bit & 7));
+}
+
+/**
+ * ext4fs_get_new_blk_run() - Allocate blocks following each other
+ *
+ * The search starts after the last block allocated, so that the blocks of
+ * a file are laid out in order, and wraps around the disk once.
+ *
+ * @want:	Number of blocks wanted
+ * @count:	Returns the number of blocks allocated, from 1 to @want
+ * @return the first block allocated, or -1 if the disk is full
+ */
+long int ext4fs_get_new_blk_run(unsigned int want, unsigned int *count)
+{
+	struct ext_filesystem *fs = get_fs();
+	uint32_t blk_per_grp = le32_to_cpu(fs->sb->blocks_per_group);
+	uint32_t first_data = le32_to_cpu(fs->sb->first_data_block);
+	uint32_t total = le32_to_cpu(fs->sb->total_blocks);
+	struct ext2_block_group *bgd;
+	unsigned char *bmap;
+	uint32_t bg_idx, bit, end, n, tried;
+	long int start;
+
+	start = fs->first_pass_bbmap ? fs->curr_blkno + 1 : first_data;
+	if (start < first_data || start >= total)
+		start = first_data;
+	bg_idx = (start - first_data) / blk_per_grp;
+	bit = (start - first_data) % blk_per_grp;
+
+	for (tried = 0; tried <= fs->no_blkgrp; tried++, bg_idx++, bit = 0) {
+		if (bg_idx >= fs->no_blkgrp)
+			bg_idx = 0;
 		bgd = ext4fs_get_group_descriptor(fs, bg_idx);
-		if (ext4fs_bg_get_free_blocks(bgd, fs) == 0) {
+		if (!ext4fs_bg_get_free_blocks(bgd, fs)) {
 			debug("block group %u is full. Skipping\n", bg_idx);
-			fs->curr_blkno = (bg_idx + 1) * blk_per_grp;
-			if (fs->blksz == 1024)
-				fs->curr_blkno += 1;
-			goto restart;
+			continue;
 		}
-
-		uint16_t bg_flags = ext4fs_bg_get_flags(bgd);
-		uint64_t b_bitmap_blk = ext4fs_bg_get_block_id(bgd, fs);
-		if (bg_flags & EXT4_BG_BLOCK_UNINIT) {
-			memcpy(fs->blk_bmaps[bg_idx], zero_buffer, fs->blksz);
-			put_ext4(b_bitmap_blk * fs->blksz,
-				 zero_buffer, fs->blksz);
-			bg_flags &= ~EXT4_BG_BLOCK_UNINIT;
-			ext4fs_bg_set_flags(bgd, bg_flags);
+		ext4fs_init_block_bmap(bg_idx);
+
+		bmap = fs->blk_bmaps[bg_idx];
+		end = min(blk_per_grp, total - first_data -
+				       bg_idx * blk_per_grp);
+		while (bit < end && ext4fs_bmap_test(bmap, bit)) {
+			if (!(bit & 7) && bmap[bit >> 3] == 0xff)
+				bit += 8;
+			else
+				bit++;
 		}
-
-		if (ext4fs_set_block_bmap(fs->curr_blkno, fs->blk_bmaps[bg_idx],
-				   bg_idx) != 0) {
-			debug("going for restart for the block no %ld %u\n",
-			      fs->curr_blkno, bg_idx);
-			fs->curr_blkno++;
-			goto restart;
+		if (bit >= end)
+			continue;
+
+		for (n = 0; n < want && bit + n < end &&
+		     !ext4fs_bmap_test(bmap, bit + n); n++) {
+			bmap[(bit + n) >> 3] |= 1 << ((bit + n) & 7);
+			ext4fs_bg_free_blocks_dec(bgd, fs);
+			ext4fs_sb_free_blocks_dec(fs->sb);
 		}
+		ext4fs_blk_bmap_dirty(bg_idx);
 
 		/* journal backup */
-		if (prev_bg_bitmap_index != bg_idx) {
-			status = ext4fs_devread(b_bitmap_blk * fs->sect_perblk,
-						0, fs->blksz, journal_buffer);
-			if (status == 0)
-				goto fail;
-			if (ext4fs_log_journal(journal_buffer, b_bitmap_blk))
-				goto fail;
+		if (ext4fs_log_bmap(ext4fs_bg_get_block_id(bgd, fs)))
+			return -1;
 
-			prev_bg_bitmap_index = bg_idx;
-		}
-		ext4fs_bg_free_blocks_dec(bgd, fs);
-		ext4fs_sb_free_blocks_dec(fs->sb);
-		goto success;
-	}
-success:
-	free(journal_buffer);
-	free(zero_buffer);
+		start = first_data + bg_idx * blk_per_grp + bit;
+		fs->curr_blkno = start + n - 1;
+		fs->first_pass_bbmap = 1;
+		*count = n;
 
-	return fs->curr_blkno;
-fail:
-	free(journal_buffer);
-	free(zero_buffer);
+		return start;
+	}
 
 	return -1;
 }
 
+uint32_t ext4fs_get_new_blk_no(void)
+{
+	unsigned int count;
+
+	return ext4fs_get_new_blk_run(1, &count);
+}
+
 int ext4fs_get_new_inode_no(void)
 {
 	short i;
@@ -1124,6 +1182,7 @@ int ext4fs_get_new_inode_no(void)
 				if (fs->curr_inode_no == -1)
 					/* inode bitmap is completely filled */
 					continue;
+				ext4fs_inode_bmap_dirty(i);
 				fs->curr_inode_no = fs->curr_inode_no +
 							(i * inodes_per_grp);
 				fs->first_pass_ibmap++;
@@ -1520,6 +1579,120 @@ void ext4fs_allocate_blocks(struct ext2_inode *file_inode,
 	*total_no_of_block += no_blks_reqd;
 }
 
+/**
+ * ext4fs_allocate_extents() - Allocate the blocks of a new file in runs
+ *
+ * Each run is mapped by one extent. Up to four extents are held in the
+ * inode, more go to leaf blocks which the inode points to.
+ *
+ * @file_inode:	Inode of the file, with no blocks yet
+ * @total_remaining_blocks: Number of data blocks to allocate
+ * @total_no_of_block: Has the number of leaf blocks added to it
+ * @return 0 on success, -ve on error
+ */
+int ext4fs_allocate_extents(struct ext2_inode *file_inode,
+			    unsigned int total_remaining_blocks,
+			    unsigned int *total_no_of_block)
+{
+	struct ext_filesystem *fs = get_fs();
+	struct ext4_extent_header *eh = (struct ext4_extent_header *)
+					file_inode->b.blocks.dir_blocks;
+	struct ext4_extent_header *leaf = NULL;
+	struct ext4_extent_idx *idx;
+	struct ext4_extent *extents, *ext;
+	unsigned int in_inode = (sizeof(file_inode->b.blocks.dir_blocks) -
+				 sizeof(*eh)) / sizeof(*ext);
+	unsigned int per_leaf = (fs->blksz - sizeof(*eh)) / sizeof(*ext);
+	unsigned int nr = 0, count, leaves, n, i;
+	uint32_t fileblock = 0;
+	long int blknr;
+	int ret = -ENOSPC;
+
+	extents = zalloc(in_inode * per_leaf * sizeof(*ext));
+	if (!extents)
+		return -ENOMEM;
+
+	while (total_remaining_blocks) {
+		blknr = ext4fs_get_new_blk_run(min(total_remaining_blocks,
+						   (unsigned int)EXT_INIT_MAX_LEN),
+					       &count);
+		if (blknr == -1) {
+			printf("no block left to assign\n");
+			goto fail;
+		}
+		debug("run %ld: %u of %u\n", blknr, count,
+		      total_remaining_blocks);
+
+		ext = nr ? &extents[nr - 1] : NULL;
+		if (ext && ext4fs_extent_start(ext) + le16_to_cpu(ext->ee_len) ==
+		    blknr && le16_to_cpu(ext->ee_len) + count <=
+		    EXT_INIT_MAX_LEN) {
+			/* carries on from the last run, across groups */
+			ext->ee_len = cpu_to_le16(le16_to_cpu(ext->ee_len) +
+						  count);
+		} else {
+			if (nr == in_inode * per_leaf) {
+				printf("free space too fragmented\n");
+				goto fail;
+			}
+			ext = &extents[nr++];
+			ext->ee_block = cpu_to_le32(fileblock);
+			ext->ee_len = cpu_to_le16(count);
+			ext->ee_start_hi = cpu_to_le16((uint64_t)blknr >> 32);
+			ext->ee_start_lo = cpu_to_le32(blknr);
+		}
+		fileblock += count;
+		total_remaining_blocks -= count;
+	}
+
+	eh->eh_magic = cpu_to_le16(EXT4_EXT_MAGIC);
+	eh->eh_max = cpu_to_le16(in_inode);
+	if (nr <= in_inode) {
+		eh->eh_entries = cpu_to_le16(nr);
+		memcpy(eh + 1, extents, nr * sizeof(*ext));
+		goto done;
+	}
+
+	leaf = zalloc(fs->blksz);
+	if (!leaf) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+	leaves = DIV_ROUND_UP(nr, per_leaf);
+	idx = (struct ext4_extent_idx *)(eh + 1);
+	for (i = 0; i < leaves; i++) {
+		blknr = ext4fs_get_new_blk_run(1, &count);
+		if (blknr == -1) {
+			printf("no block left to assign\n");
+			goto fail;
+		}
+		n = min(nr - i * per_leaf, per_leaf);
+		memset(leaf, '\0', fs->blksz);
+		leaf->eh_magic = cpu_to_le16(EXT4_EXT_MAGIC);
+		leaf->eh_entries = cpu_to_le16(n);
+		leaf->eh_max = cpu_to_le16(per_leaf);
+		memcpy(leaf + 1, &extents[i * per_leaf], n * sizeof(*ext));
+		put_ext4((uint64_t)blknr * fs->blksz, leaf, fs->blksz);
+
+		idx[i].ei_block = extents[i * per_leaf].ee_block;
+		idx[i].ei_leaf_lo = cpu_to_le32(blknr);
+		idx[i].ei_leaf_hi = cpu_to_le16((uint64_t)blknr >> 32);
+		(*total_no_of_block)++;
+	}
+	eh->eh_entries = cpu_to_le16(leaves);
+	eh->eh_depth = cpu_to_le16(1);
+
+done:
+	file_inode->flags = cpu_to_le32(le32_to_cpu(file_inode->flags) |
+					EXT4_EXTENTS_FL);
+	ret = 0;
+fail:
+	free(leaf);
+	free(extents);
+
+	return ret;
+}
+
 #endif
 
 static struct ext4_extent_header *ext4fs_get_extent_block
@@ -1992,6 +2165,98 @@ long int read_allocated_block(struct ext2_inode *inode, int fileblock,
 	return blknr;
 }
 
+/**
+ * read_allocated_run() - Find where a run of file blocks is on the disk
+ *
+ * For a file made of extents, the extent holding @fileblock is looked up
+ * once and the following extents of the same leaf are merged into the run
+ * as long as they carry on from it on the disk. Other files are mapped one
+ * block at a time.
+ *
+ * @inode:	Inode of the file
+ * @fileblock:	First block of the run in the file
+ * @cache:	Keeps the last extent tree block read, may be NULL
+ * @count:	Returns the number of blocks in the run
+ * @return the disk block holding @fileblock, with the rest of the run
+ * following it, 0 if the run is a hole, or -ve on error
+ */
+long int read_allocated_run(struct ext2_inode *inode, int fileblock,
+			    struct ext_block_cache *cache, lbaint_t *count)
+{
+	struct ext4_extent_header *ext_block;
+	struct ext4_extent *extent;
+	struct ext_block_cache cd;
+	lbaint_t startblock, len, end;
+	unsigned long long start;
+	long int blknr = 0;
+	int entries, i;
+
+	*count = 1;
+	if (!(le32_to_cpu(inode->flags) & EXT4_EXTENTS_FL))
+		return read_allocated_block(inode, fileblock, cache);
+
+	if (!cache) {
+		cache = &cd;
+		ext_cache_init(cache);
+	}
+	ext_block = ext4fs_get_extent_block(ext4fs_root, cache,
+					    (struct ext4_extent_header *)
+					    inode->b.blocks.dir_blocks,
+					    fileblock,
+					    LOG2_BLOCK_SIZE(ext4fs_root) -
+					    get_fs()->dev_desc->log2blksz);
+	if (!ext_block) {
+		printf("invalid extent block\n");
+		blknr = -EINVAL;
+		goto out;
+	}
+
+	extent = (struct ext4_extent *)(ext_block + 1);
+	entries = le16_to_cpu(ext_block->eh_entries);
+	for (i = 0; i < entries; i++) {
+		startblock = le32_to_cpu(extent[i].ee_block);
+		len = le16_to_cpu(extent[i].ee_len);
+
+		if (startblock > fileblock) {
+			/* Sparse file, up to the next extent */
+			*count = startblock - fileblock;
+			goto out;
+		}
+		if (len > EXT_INIT_MAX_LEN) {
+			/* Unwritten, it reads as zeroes */
+			if (fileblock < startblock + len - EXT_INIT_MAX_LEN) {
+				*count = startblock + len - EXT_INIT_MAX_LEN -
+					 fileblock;
+				goto out;
+			}
+			continue;
+		}
+		if (fileblock >= startblock + len)
+			continue;
+
+		start = ext4fs_extent_start(&extent[i]);
+		blknr = start + fileblock - startblock;
+		end = startblock + len;
+		for (i++; i < entries; i++) {
+			len = le16_to_cpu(extent[i].ee_len);
+			if (le32_to_cpu(extent[i].ee_block) != end ||
+			    len > EXT_INIT_MAX_LEN ||
+			    ext4fs_extent_start(&extent[i]) !=
+			    start + end - startblock)
+				break;
+			end += len;
+		}
+		*count = end - fileblock;
+		break;
+	}
+
+out:
+	if (cache == &cd)
+		ext_cache_fini(cache);
+
+	return blknr;
+}
+
 /**
  * ext4fs_reinit_global() - Reinitialize values of ext4 write implementation's
  *			    global pointers
@@ -2042,9 +2307,7 @@ void ext4fs_close(void)
 int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 				struct ext2fs_node **fnode, int *ftype)
 {
-	unsigned int fpos = 0;
 	int status;
-	loff_t actread;
 	struct ext2fs_node *diro = (struct ext2fs_node *) dir;
 
 #ifdef DEBUG
@@ -2056,8 +2319,27 @@ int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 		if (status == 0)
 			return 0;
 	}
+
+	/* Only the blocks the name hashes to, if the directory is indexed */
+	if (name && fnode && ftype) {
+		status = ext4fs_dx_find(diro, name, fnode, ftype);
+		if (status >= 0)
+			return status;
+	}
+
+	return ext4fs_iterate_dir_range(diro, 0, le32_to_cpu(diro->inode.size),
+					name, fnode, ftype);
+}
+
+int ext4fs_iterate_dir_range(struct ext2fs_node *diro, loff_t fpos,
+			     loff_t end, const char *name,
+			     struct ext2fs_node **fnode, int *ftype)
+{
+	int status;
+	loff_t actread;
+
 	/* Search the file.  */
-	while (fpos < le32_to_cpu(diro->inode.size)) {
+	while (fpos < end) {
 		struct ext2_dirent dirent;
 
 		status = ext4fs_read_file(diro, fpos,
@@ -2338,7 +2620,11 @@ int ext4fs_open(const char *filename, loff_t *len)
 	if (ext4fs_root == NULL)
 		return -1;
 
-	ext4fs_file = NULL;
+	/* the filesystem may stay mounted, so drop the file opened last */
+	if (ext4fs_file) {
+		ext4fs_free_node(ext4fs_file, &ext4fs_root->diropen);
+		ext4fs_file = NULL;
+	}
 	status = ext4fs_find_file(filename, &ext4fs_root->diropen, &fdiro,
 				  FILETYPE_REG);
 	if (status == 0)
@@ -55,6 +55,11 @@ int ext4fs_find_file(const char *path, struct ext2fs_node *rootnode,
 			struct ext2fs_node **foundnode, int expecttype);
 int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 			struct ext2fs_node **fnode, int *ftype);
+int ext4fs_iterate_dir_range(struct ext2fs_node *diro, loff_t fpos,
+			     loff_t end, const char *name,
+			     struct ext2fs_node **fnode, int *ftype);
+int ext4fs_dx_find(struct ext2fs_node *dir, const char *name,
+		   struct ext2fs_node **fnode, int *ftype);
 
 #if defined(CONFIG_EXT4_WRITE)
 uint32_t ext4fs_div_roundup(uint32_t size, uint32_t n);
@@ -62,7 +67,11 @@ uint16_t ext4fs_checksum_update(unsigned int i);
 int ext4fs_get_parent_inode_num(const char *dirname, char *dname, int flags);
 int ext4fs_update_parent_dentry(char *filename, int file_type);
 uint32_t ext4fs_get_new_blk_no(void);
+long int ext4fs_get_new_blk_run(unsigned int want, unsigned int *count);
+int ext4fs_log_bmap(uint64_t blknr);
 int ext4fs_get_new_inode_no(void);
+void ext4fs_blk_bmap_dirty(int index);
+void ext4fs_inode_bmap_dirty(int index);
 void ext4fs_reset_block_bmap(long int blockno, unsigned char *buffer,
 					int index);
 int ext4fs_set_block_bmap(long int blockno, unsigned char *buffer, int index);
@@ -72,6 +81,9 @@ int ext4fs_iget(int inode_no, struct ext2_inode *inode);
 void ext4fs_allocate_blocks(struct ext2_inode *file_inode,
 				unsigned int total_remaining_blocks,
 				unsigned int *total_no_of_block);
+int ext4fs_allocate_extents(struct ext2_inode *file_inode,
+			    unsigned int total_remaining_blocks,
+			    unsigned int *total_no_of_block);
 void put_ext4(uint64_t off, const void *buf, uint32_t size);
 struct ext2_block_group *ext4fs_get_group_descriptor
 	(const struct ext_filesystem *fs, uint32_t bg_idx);
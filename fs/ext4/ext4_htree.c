@@ -0,0 +1,364 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Lookups in directories indexed by a hash tree
+ *
+ * The hash functions are taken from the Linux kernel, fs/ext4/hash.c:
+ * Copyright (C) 2002 by Theodore Ts'o
+ */
+
+#include <common.h>
+#include <ext_common.h>
+#include <ext4fs.h>
+#include <malloc.h>
+#include "ext4_common.h"
+
+#define DX_HASH_LEGACY			0
+#define DX_HASH_HALF_MD4		1
+#define DX_HASH_TEA			2
+#define DX_HASH_LEGACY_UNSIGNED		3
+#define DX_HASH_HALF_MD4_UNSIGNED	4
+#define DX_HASH_TEA_UNSIGNED		5
+
+#define EXT4_HTREE_EOF_32BIT		0x7fffffff
+
+/* Deepest tree, with the largedir feature */
+#define DX_MAX_LEVELS			3
+
+/* Follows the "." and ".." entries at the start of the first block */
+struct dx_root_info {
+	__le32 reserved_zero;
+	u8 hash_version;
+	u8 info_length;
+	u8 indirect_levels;
+	u8 unused_flags;
+};
+
+struct dx_entry {
+	__le32 hash;
+	__le32 block;
+};
+
+/* Takes the place of the hash of the first entry of each block */
+struct dx_countlimit {
+	__le16 limit;
+	__le16 count;
+};
+
+#define DX_ROOT_INFO_OFFSET		24
+#define DX_NODE_ENTRIES_OFFSET		8
+
+#define DELTA 0x9E3779B9
+
+static void tea_transform(u32 buf[4], u32 const in[])
+{
+	u32 sum = 0;
+	u32 b0 = buf[0], b1 = buf[1];
+	u32 a = in[0], b = in[1], c = in[2], d = in[3];
+	int n = 16;
+
+	do {
+		sum += DELTA;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	} while (--n);
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+/* F, G and H are basic MD4 functions: selection, majority, parity */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define MD4_ROUND(f, a, b, c, d, x, s)	\
+	(a += f(b, c, d) + x, a = (a << s) | (a >> (32 - s)))
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+/* Basic cut-down MD4 transform, returns only 32 bits of result */
+static void half_md4_transform(u32 buf[4], u32 const in[8])
+{
+	u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	/* Round 1 */
+	MD4_ROUND(F, a, b, c, d, in[0] + K1,  3);
+	MD4_ROUND(F, d, a, b, c, in[1] + K1,  7);
+	MD4_ROUND(F, c, d, a, b, in[2] + K1, 11);
+	MD4_ROUND(F, b, c, d, a, in[3] + K1, 19);
+	MD4_ROUND(F, a, b, c, d, in[4] + K1,  3);
+	MD4_ROUND(F, d, a, b, c, in[5] + K1,  7);
+	MD4_ROUND(F, c, d, a, b, in[6] + K1, 11);
+	MD4_ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+	/* Round 2 */
+	MD4_ROUND(G, a, b, c, d, in[1] + K2,  3);
+	MD4_ROUND(G, d, a, b, c, in[3] + K2,  5);
+	MD4_ROUND(G, c, d, a, b, in[5] + K2,  9);
+	MD4_ROUND(G, b, c, d, a, in[7] + K2, 13);
+	MD4_ROUND(G, a, b, c, d, in[0] + K2,  3);
+	MD4_ROUND(G, d, a, b, c, in[2] + K2,  5);
+	MD4_ROUND(G, c, d, a, b, in[4] + K2,  9);
+	MD4_ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+	/* Round 3 */
+	MD4_ROUND(H, a, b, c, d, in[3] + K3,  3);
+	MD4_ROUND(H, d, a, b, c, in[7] + K3,  9);
+	MD4_ROUND(H, c, d, a, b, in[2] + K3, 11);
+	MD4_ROUND(H, b, c, d, a, in[6] + K3, 15);
+	MD4_ROUND(H, a, b, c, d, in[1] + K3,  3);
+	MD4_ROUND(H, d, a, b, c, in[5] + K3,  9);
+	MD4_ROUND(H, c, d, a, b, in[0] + K3, 11);
+	MD4_ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+#undef MD4_ROUND
+#undef K1
+#undef K2
+#undef K3
+#undef F
+#undef G
+#undef H
+
+/* The old legacy hash */
+static u32 dx_hack_hash(const char *name, int len, bool is_unsigned)
+{
+	u32 hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+	int c;
+
+	while (len--) {
+		c = is_unsigned ? (unsigned char)*name : (signed char)*name;
+		name++;
+		hash = hash1 + (hash0 ^ (c * 7152373));
+
+		if (hash & 0x80000000)
+			hash -= 0x7fffffff;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+
+	return hash0 << 1;
+}
+
+static void str2hashbuf(const char *msg, int len, u32 *buf, int num,
+			bool is_unsigned)
+{
+	u32 pad, val;
+	int i, c;
+
+	pad = (u32)len | ((u32)len << 8);
+	pad |= pad << 16;
+
+	val = pad;
+	if (len > num * 4)
+		len = num * 4;
+	for (i = 0; i < len; i++) {
+		c = is_unsigned ? (unsigned char)msg[i] : (signed char)msg[i];
+		val = c + (val << 8);
+		if ((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+	if (--num >= 0)
+		*buf++ = val;
+	while (--num >= 0)
+		*buf++ = pad;
+}
+
+/**
+ * ext4fs_dirhash() - Hash a name the way the index of a directory does
+ *
+ * @name:	Name to hash
+ * @len:	Length of the name
+ * @version:	Hash function, DX_HASH_...
+ * @seed:	Seed from the superblock
+ * @hash:	Returns the hash
+ * @return 0 if OK, -EINVAL if the hash function is not known
+ */
+static int ext4fs_dirhash(const char *name, int len, int version,
+			  const __le32 *seed, u32 *hash)
+{
+	bool is_unsigned = false;
+	u32 in[8], buf[4];
+	int i;
+
+	/* Initialize the default seed for the hash checksum functions */
+	buf[0] = 0x67452301;
+	buf[1] = 0xefcdab89;
+	buf[2] = 0x98badcfe;
+	buf[3] = 0x10325476;
+
+	/* Check to see if the seed is all zero's */
+	for (i = 0; i < 4; i++) {
+		if (seed[i]) {
+			for (i = 0; i < 4; i++)
+				buf[i] = le32_to_cpu(seed[i]);
+			break;
+		}
+	}
+
+	switch (version) {
+	case DX_HASH_LEGACY_UNSIGNED:
+		is_unsigned = true;
+		/* fall through */
+	case DX_HASH_LEGACY:
+		*hash = dx_hack_hash(name, len, is_unsigned);
+		break;
+	case DX_HASH_HALF_MD4_UNSIGNED:
+		is_unsigned = true;
+		/* fall through */
+	case DX_HASH_HALF_MD4:
+		for (; len > 0; len -= 32, name += 32) {
+			str2hashbuf(name, len, in, 8, is_unsigned);
+			half_md4_transform(buf, in);
+		}
+		*hash = buf[1];
+		break;
+	case DX_HASH_TEA_UNSIGNED:
+		is_unsigned = true;
+		/* fall through */
+	case DX_HASH_TEA:
+		for (; len > 0; len -= 16, name += 16) {
+			str2hashbuf(name, len, in, 4, is_unsigned);
+			tea_transform(buf, in);
+		}
+		*hash = buf[0];
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	*hash &= ~1;
+	if (*hash == (EXT4_HTREE_EOF_32BIT << 1))
+		*hash = (EXT4_HTREE_EOF_32BIT - 1) << 1;
+
+	return 0;
+}
+
+/* Find the last entry whose hash is not above @hash */
+static struct dx_entry *dx_search(struct dx_entry *entries, int count,
+				  u32 hash)
+{
+	struct dx_entry *p = entries + 1, *q = entries + count - 1, *m;
+
+	while (p <= q) {
+		m = p + (q - p) / 2;
+		if (le32_to_cpu(m->hash) > hash)
+			q = m - 1;
+		else
+			p = m + 1;
+	}
+
+	return p - 1;
+}
+
+/**
+ * ext4fs_dx_find() - Look a name up through the index of a directory
+ *
+ * Only the leaf blocks holding the names with the same hash are read,
+ * instead of the whole directory.
+ *
+ * @dir:	Directory, with its inode read
+ * @name:	Name to look for
+ * @fnode:	Returns the node found
+ * @ftype:	Returns its type, FILETYPE_...
+ * @return 1 if found, 0 if not, or -1 if the directory has no index which
+ * can be used, so that it must be scanned
+ */
+int ext4fs_dx_find(struct ext2fs_node *dir, const char *name,
+		   struct ext2fs_node **fnode, int *ftype)
+{
+	struct ext2_sblock *sblock = &dir->data->sblock;
+	int blksz = EXT2_BLOCK_SIZE(dir->data);
+	struct dx_countlimit *countlimit;
+	struct dx_root_info *info;
+	struct dx_entry *entries, *at;
+	int version, levels, level, count, limit;
+	u32 hash, block;
+	loff_t actread;
+	char *buf;
+	int ret = -1;
+
+	if (!(le32_to_cpu(sblock->feature_compatibility) &
+	      EXT4_FEATURE_COMPAT_DIR_INDEX) ||
+	    !(le32_to_cpu(dir->inode.flags) & EXT4_INDEX_FL))
+		return -1;
+	/* these are only in the first block, which the index leaves out */
+	if (!strcmp(name, ".") || !strcmp(name, ".."))
+		return -1;
+
+	buf = malloc(blksz);
+	if (!buf)
+		return -1;
+	if (ext4fs_read_file(dir, 0, blksz, buf, &actread) || actread != blksz)
+		goto out;
+
+	info = (struct dx_root_info *)(buf + DX_ROOT_INFO_OFFSET);
+	levels = info->indirect_levels;
+	if (info->reserved_zero || info->info_length < sizeof(*info) ||
+	    levels >= DX_MAX_LEVELS)
+		goto out;
+
+	version = info->hash_version;
+	if (version <= DX_HASH_TEA &&
+	    (le32_to_cpu(sblock->flags) & EXT2_FLAGS_UNSIGNED_HASH))
+		version += DX_HASH_LEGACY_UNSIGNED;
+	if (ext4fs_dirhash(name, strlen(name), version, sblock->hash_seed,
+			   &hash))
+		goto out;
+
+	entries = (struct dx_entry *)(buf + DX_ROOT_INFO_OFFSET +
+				      info->info_length);
+	for (level = 0; ; level++) {
+		countlimit = (struct dx_countlimit *)entries;
+		count = le16_to_cpu(countlimit->count);
+		limit = le16_to_cpu(countlimit->limit);
+		if (!count || count > limit ||
+		    (char *)(entries + limit) > buf + blksz)
+			goto out;
+
+		at = dx_search(entries, count, hash);
+		block = le32_to_cpu(at->block) & 0x0fffffff;
+		if (level == levels)
+			break;
+
+		if (ext4fs_read_file(dir, (loff_t)block * blksz, blksz, buf,
+				     &actread) || actread != blksz)
+			goto out;
+		entries = (struct dx_entry *)(buf + DX_NODE_ENTRIES_OFFSET);
+	}
+
+	while (1) {
+		ret = ext4fs_iterate_dir_range(dir, (loff_t)block * blksz,
+					       (loff_t)(block + 1) * blksz,
+					       name, fnode, ftype);
+		if (ret)
+			break;
+
+		/*
+		 * Names with the same hash can carry on in the next leaf,
+		 * whose hash then has the lowest bit set. Scan the whole
+		 * directory if that leaf is in another index block.
+		 */
+		if (++at == entries + count) {
+			ret = levels ? -1 : 0;
+			break;
+		}
+		if (le32_to_cpu(at->hash) != (hash | 1))
+			break;
+		block = le32_to_cpu(at->block) & 0x0fffffff;
+	}
+
+out:
+	free(buf);
+
+	return ret;
+}
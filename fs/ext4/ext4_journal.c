@@ -134,6 +134,10 @@ int ext4fs_log_gdt(char *gd_table)
 	struct ext_filesystem *fs = get_fs();
 	short i;
 	long int var = fs->gdtable_blkno;
+	if (gindex + fs->no_blk_pergdt > MAX_JOURNAL_ENTRIES) {
+		printf("Too many blocks for the journal\n");
+		return -ENOSPC;
+	}
 	for (i = 0; i < fs->no_blk_pergdt; i++) {
 		journal_ptr[gindex]->buf = zalloc(fs->blksz);
 		if (!journal_ptr[gindex]->buf)
@@ -146,6 +150,22 @@ int ext4fs_log_gdt(char *gd_table)
 	return 0;
 }
 
+/*
+ * This function tells whether the backup copy of a block is already in RAM
+ * blknr -- Block number on disk of the meta data buffer
+ */
+int ext4fs_journal_logged(uint32_t blknr)
+{
+	short i;
+
+	for (i = 0; i < gindex; i++) {
+		if (journal_ptr[i]->blknr == blknr)
+			return 1;
+	}
+
+	return 0;
+}
+
 /*
  * This function stores the backup copy of meta data in RAM
  * journal_buffer -- Buffer containing meta data
@@ -154,18 +174,17 @@ int ext4fs_log_gdt(char *gd_table)
 int ext4fs_log_journal(char *journal_buffer, uint32_t blknr)
 {
 	struct ext_filesystem *fs = get_fs();
-	short i;
 
 	if (!journal_buffer) {
 		printf("Invalid input arguments %s\n", __func__);
 		return -EINVAL;
 	}
 
-	for (i = 0; i < MAX_JOURNAL_ENTRIES; i++) {
-		if (journal_ptr[i]->blknr == -1)
-			break;
-		if (journal_ptr[i]->blknr == blknr)
-			return 0;
+	if (ext4fs_journal_logged(blknr))
+		return 0;
+	if (gindex >= MAX_JOURNAL_ENTRIES) {
+		printf("Too many blocks for the journal\n");
+		return -ENOSPC;
 	}
 
 	journal_ptr[gindex]->buf = zalloc(fs->blksz);
@@ -190,6 +209,10 @@ int ext4fs_put_metadata(char *metadata_buffer, uint32_t blknr)
 		printf("Invalid input arguments %s\n", __func__);
 		return -EINVAL;
 	}
+	if (gd_index >= MAX_JOURNAL_ENTRIES) {
+		printf("Too many blocks for the journal\n");
+		return -ENOSPC;
+	}
 	if (dirty_block_ptr[gd_index]->buf)
 		assert(dirty_block_ptr[gd_index]->blknr == blknr);
 	else
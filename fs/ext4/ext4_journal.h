@@ -117,6 +117,7 @@ extern struct ext2_data *ext4fs_root;
 int ext4fs_init_journal(void);
 int ext4fs_log_gdt(char *gd_table);
 int ext4fs_check_journal_state(int recovery_flag);
+int ext4fs_journal_logged(uint32_t blknr);
 int ext4fs_log_journal(char *journal_buffer, uint32_t blknr);
 int ext4fs_put_metadata(char *metadata_buffer, uint32_t blknr);
 void ext4fs_update_journal(void);
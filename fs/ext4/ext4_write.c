@@ -27,6 +27,9 @@
 #include <div64.h>
 #include "ext4_common.h"
 
+/* Largest write made at once, a run of blocks may be split in several */
+#define EXT4_WRITE_MAX	(1 << 30)
+
 static inline void ext4fs_sb_free_inodes_inc(struct ext2_sblock *sb)
 {
 	sb->free_inodes = cpu_to_le32(le32_to_cpu(sb->free_inodes) + 1);
@@ -74,21 +77,27 @@ static void ext4fs_update(void)
 	put_ext4((uint64_t)(SUPERBLOCK_SIZE),
 		 (struct ext2_sblock *)fs->sb, (uint32_t)SUPERBLOCK_SIZE);
 
-	/* update block bitmaps */
+	/* update the block bitmaps which changed */
 	for (i = 0; i < fs->no_blkgrp; i++) {
 		bgd = ext4fs_get_group_descriptor(fs, i);
 		bgd->bg_checksum = cpu_to_le16(ext4fs_checksum_update(i));
+		if (!fs->bmaps_dirty[i])
+			continue;
 		uint64_t b_bitmap_blk = ext4fs_bg_get_block_id(bgd, fs);
 		put_ext4(b_bitmap_blk * fs->blksz,
 			 fs->blk_bmaps[i], fs->blksz);
+		fs->bmaps_dirty[i] = 0;
 	}
 
-	/* update inode bitmaps */
+	/* update the inode bitmaps which changed */
 	for (i = 0; i < fs->no_blkgrp; i++) {
 		bgd = ext4fs_get_group_descriptor(fs, i);
+		if (!fs->bmaps_dirty[fs->no_blkgrp + i])
+			continue;
 		uint64_t i_bitmap_blk = ext4fs_bg_get_inode_id(bgd, fs);
 		put_ext4(i_bitmap_blk * fs->blksz,
 			 fs->inode_bmaps[i], fs->blksz);
+		fs->bmaps_dirty[fs->no_blkgrp + i] = 0;
 	}
 
 	/* update the block group descriptor table */
@@ -431,24 +440,116 @@ fail:
 	free(journal_buffer);
 }
 
+/* Give a run of blocks back to the free space of their groups */
+static int ext4fs_release_blocks(uint64_t blknr, uint32_t count)
+{
+	struct ext_filesystem *fs = get_fs();
+	uint32_t blk_per_grp = le32_to_cpu(fs->sb->blocks_per_group);
+	uint32_t first_data = le32_to_cpu(fs->sb->first_data_block);
+	struct ext2_block_group *bgd = NULL;
+	uint32_t bg_idx, bit, prev_bg_idx = -1;
+	unsigned char *bmap;
+
+	for (; count; blknr++, count--) {
+		if (blknr < first_data ||
+		    blknr >= le32_to_cpu(fs->sb->total_blocks))
+			return -EINVAL;
+		/* the write path only handles 32-bit block numbers */
+		bit = blknr - first_data;
+		bg_idx = bit / blk_per_grp;
+		bit %= blk_per_grp;
+		bmap = fs->blk_bmaps[bg_idx];
+		debug("EXT4 Block releasing %llu: %u\n",
+		      (unsigned long long)blknr, bg_idx);
+
+		if (bg_idx != prev_bg_idx) {
+			bgd = ext4fs_get_group_descriptor(fs, bg_idx);
+			/* journal backup */
+			if (ext4fs_log_bmap(ext4fs_bg_get_block_id(bgd, fs)))
+				return -EIO;
+			prev_bg_idx = bg_idx;
+		}
+		if (!(bmap[bit >> 3] & (1 << (bit & 7))))
+			continue;
+		bmap[bit >> 3] &= ~(1 << (bit & 7));
+		ext4fs_blk_bmap_dirty(bg_idx);
+		ext4fs_bg_free_blocks_inc(bgd, fs);
+		ext4fs_sb_free_blocks_inc(fs->sb);
+	}
+
+	return 0;
+}
+
+/*
+ * Release the blocks mapped below an extent tree node, unwritten ones
+ * included, then the index and leaf blocks of the tree
+ */
+static int ext4fs_release_extents(struct ext4_extent_header *eh)
+{
+	struct ext_filesystem *fs = get_fs();
+	struct ext4_extent_idx *idx = (struct ext4_extent_idx *)(eh + 1);
+	struct ext4_extent *ext = (struct ext4_extent *)(eh + 1);
+	struct ext4_extent_header *child;
+	uint64_t blknr;
+	uint32_t len;
+	int i, ret = 0;
+
+	if (!eh->eh_depth) {
+		for (i = 0; i < le16_to_cpu(eh->eh_entries); i++) {
+			len = le16_to_cpu(ext[i].ee_len);
+			if (len > EXT_INIT_MAX_LEN)
+				len -= EXT_INIT_MAX_LEN;
+			blknr = le32_to_cpu(ext[i].ee_start_lo) +
+				((uint64_t)le16_to_cpu(ext[i].ee_start_hi) <<
+				 32);
+			ret = ext4fs_release_blocks(blknr, len);
+			if (ret)
+				break;
+		}
+		return ret;
+	}
+
+	child = zalloc(fs->blksz);
+	if (!child)
+		return -ENOMEM;
+	for (i = 0; i < le16_to_cpu(eh->eh_entries); i++) {
+		blknr = le32_to_cpu(idx[i].ei_leaf_lo) +
+			((uint64_t)le16_to_cpu(idx[i].ei_leaf_hi) << 32);
+		if (!ext4fs_devread(blknr * fs->sect_perblk, 0, fs->blksz,
+				    (char *)child) ||
+		    le16_to_cpu(child->eh_magic) != EXT4_EXT_MAGIC ||
+		    le16_to_cpu(child->eh_depth) + 1 !=
+		    le16_to_cpu(eh->eh_depth)) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = ext4fs_release_extents(child);
+		if (!ret)
+			ret = ext4fs_release_blocks(blknr, 1);
+		if (ret)
+			break;
+	}
+	free(child);
+
+	return ret;
+}
+
 static int ext4fs_delete_file(int inodeno)
 {
 	struct ext2_inode inode;
 	short status;
-	int i;
-	int remainder;
+	uint32_t i;
 	long int blknr;
-	int bg_idx;
+	lbaint_t count;
 	int ibmap_idx;
 	char *read_buffer = NULL;
 	char *start_block_address = NULL;
 	uint32_t no_blocks;
+	struct ext_block_cache cache;
 
-	static int prev_bg_bmap_idx = -1;
 	unsigned int inodes_per_block;
 	uint32_t blkno;
 	unsigned int blkoff;
-	uint32_t blk_per_grp = le32_to_cpu(ext4fs_root->sblock.blocks_per_group);
 	uint32_t inode_per_grp = le32_to_cpu(ext4fs_root->sblock.inodes_per_group);
 	struct ext2_inode *inode_buffer = NULL;
 	struct ext2_block_group *bgd = NULL;
@@ -475,50 +576,27 @@ static int ext4fs_delete_file(int inodeno)
 	}
 
 	if (le32_to_cpu(inode.flags) & EXT4_EXTENTS_FL) {
-		/* FIXME delete extent index blocks, i.e. eh_depth >= 1 */
-		struct ext4_extent_header *eh =
-			(struct ext4_extent_header *)
-				inode.b.blocks.dir_blocks;
-		debug("del: dep=%d entries=%d\n", eh->eh_depth, eh->eh_entries);
+		/* the extents map every block, even past the end of file */
+		if (ext4fs_release_extents((struct ext4_extent_header *)
+					   inode.b.blocks.dir_blocks))
+			goto fail;
 	} else {
 		delete_single_indirect_block(&inode);
 		delete_double_indirect_block(&inode);
 		delete_triple_indirect_block(&inode);
-	}
 
-	/* release data blocks */
-	for (i = 0; i < no_blocks; i++) {
-		blknr = read_allocated_block(&inode, i, NULL);
-		if (blknr == 0)
-			continue;
-		if (blknr < 0)
-			goto fail;
-		bg_idx = blknr / blk_per_grp;
-		if (fs->blksz == 1024) {
-			remainder = blknr % blk_per_grp;
-			if (!remainder)
-				bg_idx--;
-		}
-		ext4fs_reset_block_bmap(blknr, fs->blk_bmaps[bg_idx],
-					bg_idx);
-		debug("EXT4 Block releasing %ld: %d\n", blknr, bg_idx);
-
-		/* get  block group descriptor table */
-		bgd = ext4fs_get_group_descriptor(fs, bg_idx);
-		ext4fs_bg_free_blocks_inc(bgd, fs);
-		ext4fs_sb_free_blocks_inc(fs->sb);
-		/* journal backup */
-		if (prev_bg_bmap_idx != bg_idx) {
-			uint64_t b_bitmap_blk = ext4fs_bg_get_block_id(bgd, fs);
-			status = ext4fs_devread(b_bitmap_blk * fs->sect_perblk,
-						0, fs->blksz,
-						journal_buffer);
-			if (status == 0)
-				goto fail;
-			if (ext4fs_log_journal(journal_buffer, b_bitmap_blk))
+		/* release data blocks, a run at a time */
+		ext_cache_init(&cache);
+		for (i = 0; i < no_blocks; i += count) {
+			blknr = read_allocated_run(&inode, i, &cache, &count);
+			count = min(count, (lbaint_t)no_blocks - i);
+			if (blknr < 0 ||
+			    (blknr && ext4fs_release_blocks(blknr, count))) {
+				ext_cache_fini(&cache);
 				goto fail;
-			prev_bg_bmap_idx = bg_idx;
+			}
 		}
+		ext_cache_fini(&cache);
 	}
 
 	/* release inode */
@@ -667,6 +745,11 @@ int ext4fs_init(void)
 			goto fail;
 	}
 
+	/* only the bitmaps which change are written back */
+	fs->bmaps_dirty = zalloc(2 * fs->no_blkgrp);
+	if (!fs->bmaps_dirty)
+		goto fail;
+
 	/*
 	 * check filesystem consistency with free blocks of file system
 	 * some time we observed that superblock freeblocks does not match
@@ -743,6 +826,8 @@ void ext4fs_deinit(void)
 		fs->inode_bmaps = NULL;
 	}
 
+	free(fs->bmaps_dirty);
+	fs->bmaps_dirty = NULL;
 
 	free(fs->gdtable);
 	fs->gdtable = NULL;
@@ -757,23 +842,24 @@ void ext4fs_deinit(void)
 }
 
 /*
- * Write data to filesystem blocks. Uses same optimization for
- * contigous sectors as ext4fs_read_file
+ * Write data to filesystem blocks, a run of blocks following each other
+ * on the disk at a time, as ext4fs_read_file does
  */
 static int ext4fs_write_file(struct ext2_inode *file_inode,
 			     int pos, unsigned int len, const char *buf)
 {
-	int i;
-	int blockcnt;
 	uint32_t filesize = le32_to_cpu(file_inode->size);
 	struct ext_filesystem *fs = get_fs();
-	int log2blksz = fs->dev_desc->log2blksz;
-	int log2_fs_blocksize = LOG2_BLOCK_SIZE(ext4fs_root) - log2blksz;
-	int previous_block_number = -1;
-	int delayed_start = 0;
-	int delayed_extent = 0;
-	int delayed_next = 0;
+	struct ext_block_cache cache;
+	lbaint_t delayed_start = 0;
+	lbaint_t delayed_next = 0;
+	lbaint_t count;
+	uint32_t delayed_extent = 0;
 	const char *delayed_buf = NULL;
+	long int blknr;
+	int blockcnt;
+	int i;
+	int ret = -1;
 
 	/* Adjust len so it we can't read past the end of the file. */
 	if (len > filesize)
@@ -781,61 +867,37 @@ static int ext4fs_write_file(struct ext2_inode *file_inode,
 
 	blockcnt = ((len + pos) + fs->blksz - 1) / fs->blksz;
 
-	for (i = pos / fs->blksz; i < blockcnt; i++) {
-		long int blknr;
-		int blockend = fs->blksz;
-		int skipfirst = 0;
-		blknr = read_allocated_block(file_inode, i, NULL);
+	ext_cache_init(&cache);
+	for (i = pos / fs->blksz; i < blockcnt; i += count) {
+		blknr = read_allocated_run(file_inode, i, &cache, &count);
 		if (blknr <= 0)
-			return -1;
-
-		blknr = blknr << log2_fs_blocksize;
-
-		if (blknr) {
-			if (previous_block_number != -1) {
-				if (delayed_next == blknr) {
-					delayed_extent += blockend;
-					delayed_next += blockend >> log2blksz;
-				} else {	/* spill */
-					put_ext4((uint64_t)
-						 ((uint64_t)delayed_start << log2blksz),
-						 delayed_buf,
-						 (uint32_t) delayed_extent);
-					previous_block_number = blknr;
-					delayed_start = blknr;
-					delayed_extent = blockend;
-					delayed_buf = buf;
-					delayed_next = blknr +
-					    (blockend >> log2blksz);
-				}
-			} else {
-				previous_block_number = blknr;
-				delayed_start = blknr;
-				delayed_extent = blockend;
-				delayed_buf = buf;
-				delayed_next = blknr +
-				    (blockend >> log2blksz);
-			}
+			goto out;
+		count = min(count, (lbaint_t)(blockcnt - i));
+		count = min(count, (lbaint_t)(EXT4_WRITE_MAX / fs->blksz));
+
+		if (delayed_extent && blknr == delayed_next &&
+		    delayed_extent + count * fs->blksz <= EXT4_WRITE_MAX) {
+			delayed_extent += count * fs->blksz;
 		} else {
-			if (previous_block_number != -1) {
-				/* spill */
-				put_ext4((uint64_t) ((uint64_t)delayed_start <<
-						     log2blksz),
-					 delayed_buf,
-					 (uint32_t) delayed_extent);
-				previous_block_number = -1;
-			}
+			/* spill */
+			if (delayed_extent)
+				put_ext4((uint64_t)delayed_start * fs->blksz,
+					 delayed_buf, delayed_extent);
+			delayed_start = blknr;
+			delayed_extent = count * fs->blksz;
+			delayed_buf = buf;
 		}
-		buf += fs->blksz - skipfirst;
-	}
-	if (previous_block_number != -1) {
-		/* spill */
-		put_ext4((uint64_t) ((uint64_t)delayed_start << log2blksz),
-			 delayed_buf, (uint32_t) delayed_extent);
-		previous_block_number = -1;
+		delayed_next = blknr + count;
+		buf += count * fs->blksz;
 	}
-
-	return len;
+	if (delayed_extent)
+		put_ext4((uint64_t)delayed_start * fs->blksz, delayed_buf,
+			 delayed_extent);
+	ret = len;
+out:
+	ext_cache_fini(&cache);
+
+	return ret;
 }
 
 int ext4fs_write(const char *fname, const char *buffer,
@@ -954,8 +1016,15 @@ int ext4fs_write(const char *fname, const char *buffer,
 	file_inode->nlinks = cpu_to_le16(1);
 
 	/* Allocate data blocks */
-	ext4fs_allocate_blocks(file_inode, blocks_remaining,
-			       &blks_reqd_for_file);
+	if (blocks_remaining && (le32_to_cpu(fs->sb->feature_incompat) &
+				 EXT4_FEATURE_INCOMPAT_EXTENTS)) {
+		if (ext4fs_allocate_extents(file_inode, blocks_remaining,
+					    &blks_reqd_for_file))
+			goto fail;
+	} else {
+		ext4fs_allocate_blocks(file_inode, blocks_remaining,
+				       &blks_reqd_for_file);
+	}
 	file_inode->blockcnt = cpu_to_le32((blks_reqd_for_file * fs->blksz) >>
 					   LOG2_SECTOR_SIZE);
 
@@ -40,30 +40,34 @@ void ext4fs_free_node(struct ext2fs_node *node, struct ext2fs_node *currroot)
 		free(node);
 }
 
+/* Largest read handed to ext4fs_devread(), which counts bytes in an int */
+#define EXT4_READ_MAX	(1 << 30)
+
 /*
  * Taken from openmoko-kernel mailing list: By Andy green
  * Optimized read file API : collects and defers contiguous sector
  * reads into one potentially more efficient larger sequential read action
+ *
+ * The file is mapped a run of blocks at a time, each being a whole extent
+ * (or several following each other on the disk) for files made of extents,
+ * and each run is read straight into the buffer.
  */
 int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 		loff_t len, char *buf, loff_t *actread)
 {
 	struct ext_filesystem *fs = get_fs();
-	int i;
-	lbaint_t blockcnt;
 	int log2blksz = fs->dev_desc->log2blksz;
 	int log2_fs_blocksize = LOG2_BLOCK_SIZE(node->data) - log2blksz;
 	int blocksize = (1 << (log2_fs_blocksize + log2blksz));
 	unsigned int filesize = le32_to_cpu(node->inode.size);
-	lbaint_t previous_block_number = -1;
+	lbaint_t blockcnt, i, count;
 	lbaint_t delayed_start = 0;
-	lbaint_t delayed_extent = 0;
-	lbaint_t delayed_skipfirst = 0;
 	lbaint_t delayed_next = 0;
+	int delayed_extent = 0;
+	int delayed_skipfirst = 0;
 	char *delayed_buf = NULL;
-	char *start_buf = buf;
-	short status;
 	struct ext_block_cache cache;
+	int ret = -1;
 
 	ext_cache_init(&cache);
 
@@ -71,112 +75,65 @@ int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 	if (len + pos > filesize)
 		len = (filesize - pos);
 
-	if (blocksize <= 0 || len <= 0) {
-		ext_cache_fini(&cache);
-		return -1;
-	}
+	if (blocksize <= 0 || len <= 0)
+		goto out;
 
 	blockcnt = lldiv(((len + pos) + blocksize - 1), blocksize);
 
-	for (i = lldiv(pos, blocksize); i < blockcnt; i++) {
+	for (i = lldiv(pos, blocksize); i < blockcnt; i += count) {
 		long int blknr;
-		int blockoff = pos - (blocksize * i);
-		int blockend = blocksize;
-		int skipfirst = 0;
-		blknr = read_allocated_block(&node->inode, i, &cache);
-		if (blknr < 0) {
-			ext_cache_fini(&cache);
-			return -1;
-		}
+		loff_t from, to;
 
-		blknr = blknr << log2_fs_blocksize;
+		blknr = read_allocated_run(&node->inode, i, &cache, &count);
+		if (blknr < 0)
+			goto out;
 
-		/* Last block.  */
-		if (i == blockcnt - 1) {
-			blockend = (len + pos) - (blocksize * i);
+		count = min(count, blockcnt - i);
+		count = min(count, (lbaint_t)(EXT4_READ_MAX / blocksize));
 
-			/* The last portion is exactly blocksize. */
-			if (!blockend)
-				blockend = blocksize;
-		}
+		/* The part of the run which is wanted */
+		from = max(pos, (loff_t)i * blocksize);
+		to = min(pos + len, (loff_t)(i + count) * blocksize);
 
-		/* First block. */
-		if (i == lldiv(pos, blocksize)) {
-			skipfirst = blockoff;
-			blockend -= skipfirst;
-		}
 		if (blknr) {
-			int status;
-
-			if (previous_block_number != -1) {
-				if (delayed_next == blknr) {
-					delayed_extent += blockend;
-					delayed_next += blockend >> log2blksz;
-				} else {	/* spill */
-					status = ext4fs_devread(delayed_start,
-							delayed_skipfirst,
-							delayed_extent,
-							delayed_buf);
-					if (status == 0) {
-						ext_cache_fini(&cache);
-						return -1;
-					}
-					previous_block_number = blknr;
-					delayed_start = blknr;
-					delayed_extent = blockend;
-					delayed_skipfirst = skipfirst;
-					delayed_buf = buf;
-					delayed_next = blknr +
-						(blockend >> log2blksz);
-				}
-			} else {
-				previous_block_number = blknr;
-				delayed_start = blknr;
-				delayed_extent = blockend;
-				delayed_skipfirst = skipfirst;
-				delayed_buf = buf;
-				delayed_next = blknr +
-					(blockend >> log2blksz);
+			lbaint_t sector = (lbaint_t)blknr << log2_fs_blocksize;
+
+			if (delayed_extent && delayed_next == sector &&
+			    delayed_extent + (to - from) <= EXT4_READ_MAX) {
+				delayed_extent += to - from;
+				delayed_next += count << log2_fs_blocksize;
+				continue;
 			}
+			/* spill */
+			if (delayed_extent &&
+			    !ext4fs_devread(delayed_start, delayed_skipfirst,
+					    delayed_extent, delayed_buf))
+				goto out;
+			delayed_start = sector;
+			delayed_skipfirst = from - (loff_t)i * blocksize;
+			delayed_extent = to - from;
+			delayed_buf = buf + (from - pos);
+			delayed_next = sector + (count << log2_fs_blocksize);
 		} else {
-			int n;
-			int n_left;
-			if (previous_block_number != -1) {
-				/* spill */
-				status = ext4fs_devread(delayed_start,
-							delayed_skipfirst,
-							delayed_extent,
-							delayed_buf);
-				if (status == 0) {
-					ext_cache_fini(&cache);
-					return -1;
-				}
-				previous_block_number = -1;
-			}
-			/* Zero no more than `len' bytes. */
-			n = blocksize - skipfirst;
-			n_left = len - ( buf - start_buf );
-			if (n > n_left)
-				n = n_left;
-			memset(buf, 0, n);
+			/* spill */
+			if (delayed_extent &&
+			    !ext4fs_devread(delayed_start, delayed_skipfirst,
+					    delayed_extent, delayed_buf))
+				goto out;
+			delayed_extent = 0;
+			memset(buf + (from - pos), 0, to - from);
 		}
-		buf += blocksize - skipfirst;
-	}
-	if (previous_block_number != -1) {
-		/* spill */
-		status = ext4fs_devread(delayed_start,
-					delayed_skipfirst, delayed_extent,
-					delayed_buf);
-		if (status == 0) {
-			ext_cache_fini(&cache);
-			return -1;
-		}
-		previous_block_number = -1;
 	}
+	if (delayed_extent &&
+	    !ext4fs_devread(delayed_start, delayed_skipfirst, delayed_extent,
+			    delayed_buf))
+		goto out;
 
 	*actread  = len;
+	ret = 0;
+out:
 	ext_cache_fini(&cache);
-	return 0;
+	return ret;
 }
 
 int ext4fs_ls(const char *dirname)
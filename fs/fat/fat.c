@@ -37,6 +37,9 @@ static void downcase(char *str, size_t len)
 static struct blk_desc *cur_dev;
 static disk_partition_t cur_part_info;
 
+/* Largest read of consecutive clusters made at once */
+#define FAT_READ_MAX		(1 << 30)
+
 #define DOS_BOOT_MAGIC_OFFSET	0x1fe
 #define DOS_FS_TYPE_OFFSET	0x36
 #define DOS_FS32_TYPE_OFFSET	0x52
@@ -60,6 +63,8 @@ int fat_set_blk_dev(struct blk_desc *dev_desc, disk_partition_t *info)
 {
 	ALLOC_CACHE_ALIGN_BUFFER(unsigned char, buffer, dev_desc->blksz);
 
+	/* whatever the fs layer kept mounted is about to be replaced */
+	fs_invalidate(NULL);
 	cur_dev = dev_desc;
 	cur_part_info = *info;
 
@@ -155,6 +160,97 @@ int flush_dirty_fat_buffer(fsdata *mydata)
 }
 #endif
 
+/*
+ * Allocate the windows of the FAT kept in memory, none of them holding
+ * anything yet. Their bookkeeping follows them in the same allocation,
+ * which keeps fsdata small enough for the stack.
+ * Return 0 on success, -1 otherwise.
+ */
+static int fat_alloc_fatbufs(fsdata *mydata)
+{
+	int i;
+
+	mydata->bounce = NULL;
+	mydata->fatbufs = malloc_cache_aligned(FATBUF_WINDOWS *
+					       (FATBUFSIZE + sizeof(int) +
+						sizeof(__u32)));
+	if (!mydata->fatbufs) {
+		debug("Error: allocating memory\n");
+		return -1;
+	}
+	mydata->fatbufnums = (int *)(mydata->fatbufs +
+				     FATBUF_WINDOWS * FATBUFSIZE);
+	mydata->fatbufused = (__u32 *)(mydata->fatbufnums + FATBUF_WINDOWS);
+	for (i = 0; i < FATBUF_WINDOWS; i++) {
+		mydata->fatbufnums[i] = -1;
+		mydata->fatbufused[i] = 0;
+	}
+	mydata->fatbuftick = 0;
+	mydata->fatbuf = mydata->fatbufs;
+	mydata->fatbufnum = -1;
+	mydata->fat_dirty = 0;
+
+	return 0;
+}
+
+/* Free what fat_alloc_fatbufs() and get_cluster() allocated */
+static void fat_free_fatbufs(fsdata *mydata)
+{
+	free(mydata->fatbufs);
+	free(mydata->bounce);
+}
+
+/*
+ * Make window 'bufnum' of the FAT the current fatbuf, reading it into the
+ * least recently used window unless it is kept already. Only the current
+ * window may be dirty, it is written back first.
+ * Return 0 on success, -1 otherwise.
+ */
+static int fat_select_fatbuf(fsdata *mydata, __u32 bufnum)
+{
+	__u32 getsize = FATBUFBLOCKS;
+	__u32 startblock = bufnum * FATBUFBLOCKS;
+	int i, victim = 0;
+
+	if (bufnum == mydata->fatbufnum)
+		return 0;
+
+	/* Write back the fatbuf to the disk */
+	if (flush_dirty_fat_buffer(mydata) < 0)
+		return -1;
+
+	for (i = 0; i < FATBUF_WINDOWS; i++) {
+		if (mydata->fatbufnums[i] == bufnum) {
+			victim = i;
+			goto found;
+		}
+		if (mydata->fatbufused[i] < mydata->fatbufused[victim])
+			victim = i;
+	}
+
+	/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
+	if (startblock + getsize > mydata->fatlength)
+		getsize = mydata->fatlength - startblock;
+
+	startblock += mydata->fat_sect;	/* Offset from start of disk */
+
+	mydata->fatbufnums[victim] = -1;
+	mydata->fatbufnum = -1;
+	if (disk_read(startblock, getsize,
+		      mydata->fatbufs + victim * FATBUFSIZE) < 0) {
+		debug("Error reading FAT blocks\n");
+		return -1;
+	}
+	mydata->fatbufnums[victim] = bufnum;
+
+found:
+	mydata->fatbufused[victim] = ++mydata->fatbuftick;
+	mydata->fatbuf = mydata->fatbufs + victim * FATBUFSIZE;
+	mydata->fatbufnum = bufnum;
+
+	return 0;
+}
+
 /*
  * Get the entry at index 'entry' in a FAT (12/16/32) table.
  * On failure 0x00 is returned.
@@ -193,28 +289,8 @@ static __u32 get_fatent(fsdata *mydata, __u32 entry)
 	       mydata->fatsize, entry, entry, offset, offset);
 
 	/* Read a new block of FAT entries into the cache. */
-	if (bufnum != mydata->fatbufnum) {
-		__u32 getsize = FATBUFBLOCKS;
-		__u8 *bufptr = mydata->fatbuf;
-		__u32 fatlength = mydata->fatlength;
-		__u32 startblock = bufnum * FATBUFBLOCKS;
-
-		/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
-		if (startblock + getsize > fatlength)
-			getsize = fatlength - startblock;
-
-		startblock += mydata->fat_sect;	/* Offset from start of disk */
-
-		/* Write back the fatbuf to the disk */
-		if (flush_dirty_fat_buffer(mydata) < 0)
-			return -1;
-
-		if (disk_read(startblock, getsize, bufptr) < 0) {
-			debug("Error reading FAT blocks\n");
-			return ret;
-		}
-		mydata->fatbufnum = bufnum;
-	}
+	if (fat_select_fatbuf(mydata, bufnum))
+		return ret;
 
 	/* Get the actual entry from the table */
 	switch (mydata->fatsize) {
@@ -259,20 +335,38 @@ get_cluster(fsdata *mydata, __u32 clustnum, __u8 *buffer, unsigned long size)
 	debug("gc - clustnum: %d, startsect: %d\n", clustnum, startsect);
 
 	if ((unsigned long)buffer & (ARCH_DMA_MINALIGN - 1)) {
-		ALLOC_CACHE_ALIGN_BUFFER(__u8, tmpbuf, mydata->sect_size);
+		ALLOC_CACHE_ALIGN_BUFFER(__u8, sectbuf, mydata->sect_size);
+		__u8 *tmpbuf = sectbuf;
+		__u32 max = mydata->clust_size;
 
 		debug("FAT: Misaligned buffer address (%p)\n", buffer);
 
+		/*
+		 * Bounce a cluster at a time through a buffer kept until the
+		 * filesystem is closed, falling back to a sector on the stack.
+		 * SPL always does the latter, to spare its heap.
+		 */
+		if (!IS_ENABLED(CONFIG_SPL_BUILD) && !mydata->bounce &&
+		    size > mydata->sect_size)
+			mydata->bounce =
+				malloc_cache_aligned(max * mydata->sect_size);
+		if (mydata->bounce)
+			tmpbuf = mydata->bounce;
+		else
+			max = 1;
+
 		while (size >= mydata->sect_size) {
-			ret = disk_read(startsect++, 1, tmpbuf);
-			if (ret != 1) {
+			idx = min(max, (__u32)(size / mydata->sect_size));
+			ret = disk_read(startsect, idx, tmpbuf);
+			if (ret != idx) {
 				debug("Error reading data (got %d)\n", ret);
 				return -1;
 			}
 
-			memcpy(buffer, tmpbuf, mydata->sect_size);
-			buffer += mydata->sect_size;
-			size -= mydata->sect_size;
+			memcpy(buffer, tmpbuf, idx * mydata->sect_size);
+			startsect += idx;
+			buffer += idx * mydata->sect_size;
+			size -= idx * mydata->sect_size;
 		}
 	} else {
 		idx = size / mydata->sect_size;
@@ -395,6 +489,8 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 	do {
 		/* search for consecutive clusters */
 		while (actsize < filesize) {
+			if (actsize >= FAT_READ_MAX)
+				goto getit;
 			newclust = get_fatent(mydata, endclust);
 			if ((newclust - 1) != endclust)
 				goto getit;
@@ -621,13 +717,8 @@ static int get_fs_info(fsdata *mydata)
 		mydata->root_cluster = 0;
 	}
 
-	mydata->fatbufnum = -1;
-	mydata->fat_dirty = 0;
-	mydata->fatbuf = malloc_cache_aligned(FATBUFSIZE);
-	if (mydata->fatbuf == NULL) {
-		debug("Error: allocating memory\n");
+	if (fat_alloc_fatbufs(mydata))
 		return -1;
-	}
 
 	debug("FAT%d, fat_sect: %d, fatlength: %d\n",
 	       mydata->fatsize, mydata->fat_sect, mydata->fatlength);
@@ -1149,7 +1240,7 @@ int fat_exists(const char *filename)
 		goto out;
 
 	ret = fat_itr_resolve(itr, filename, TYPE_ANY);
-	free(fsdata.fatbuf);
+	fat_free_fatbufs(&fsdata);
 out:
 	free(itr);
 	return ret == 0;
@@ -1174,7 +1265,7 @@ int fat_size(const char *filename, loff_t *size)
 		 * Directories don't have size, but fs_size() is not
 		 * expected to fail if passed a directory path:
 		 */
-		free(fsdata.fatbuf);
+		fat_free_fatbufs(&fsdata);
 		ret = fat_itr_root(itr, &fsdata);
 		if (ret)
 			goto out_free_itr;
@@ -1186,7 +1277,7 @@ int fat_size(const char *filename, loff_t *size)
 
 	*size = FAT2CPU32(itr->dent->size);
 out_free_both:
-	free(fsdata.fatbuf);
+	fat_free_fatbufs(&fsdata);
 out_free_itr:
 	free(itr);
 	return ret;
@@ -1218,7 +1309,7 @@ int file_fat_read_at(const char *filename, loff_t pos, void *buffer,
 	ret = get_contents(&fsdata, dentptr, pos, buffer, maxsize, actread);
 
 out_free_both:
-	free(fsdata.fatbuf);
+	fat_free_fatbufs(&fsdata);
 out_free_itr:
 	free(itr);
 	return ret;
@@ -1277,7 +1368,7 @@ int fat_opendir(const char *filename, struct fs_dir_stream **dirsp)
 	return 0;
 
 fail_free_both:
-	free(dir->fsdata.fatbuf);
+	fat_free_fatbufs(&dir->fsdata);
 fail_free_dir:
 	free(dir);
 	return ret;
@@ -1309,7 +1400,7 @@ int fat_readdir(struct fs_dir_stream *dirs, struct fs_dirent **dentp)
 void fat_closedir(struct fs_dir_stream *dirs)
 {
 	fat_dir *dir = (fat_dir *)dirs;
-	free(dir->fsdata.fatbuf);
+	fat_free_fatbufs(&dir->fsdata);
 	free(dir);
 }
 
@@ -258,6 +258,194 @@ fill_dir_slot(fat_itr *itr, const char *l_name)
 	return 0;
 }
 
+/*
+ * Free clusters are looked for in a bitmap with a bit set for each cluster
+ * in use, rather than by reading the FAT one entry at a time. The bitmap is
+ * filled from the FAT in large reads when a cluster is first needed, only
+ * as far as needed, and set_fatent_value() keeps it up to date.
+ */
+#define FAT_MAP_READ	(128 * 1024)	/* Bytes of FAT read at once */
+
+/*
+ * Number of FAT entries which may be allocated, that is which are in the
+ * FAT and whose cluster is within the filesystem
+ */
+static __u32 fat_map_count(fsdata *mydata)
+{
+	__u32 bytes = mydata->fatlength * mydata->sect_size;
+	__u32 count, max;
+
+	switch (mydata->fatsize) {
+	case 32:
+		count = bytes / 4;
+		max = 0xffffff0;
+		break;
+	case 16:
+		count = bytes / 2;
+		max = 0xfff0;
+		break;
+	default:
+		count = bytes * 2 / 3;
+		max = 0xff0;
+		break;
+	}
+	count = min(count, max);
+
+	return min(count, (mydata->total_sect - mydata->data_begin) /
+			  mydata->clust_size);
+}
+
+/*
+ * Read the next part of the FAT into the bitmap, allocating it first.
+ * Return 0 on success, -ENOMEM if there is not enough memory and -EIO on
+ * read errors.
+ */
+static int fat_map_extend(fsdata *mydata)
+{
+	__u32 count = fat_map_count(mydata);
+	__u32 perbuf, bufnum, startblock, getsize, clust, val, off8, i;
+	__u8 *buf;
+
+	if (!mydata->clustmap) {
+		mydata->clustmap = calloc(DIV_ROUND_UP(count, 32),
+					  sizeof(__u32));
+		if (!mydata->clustmap)
+			return -ENOMEM;
+		mydata->clustmap_len = 0;
+	}
+
+	switch (mydata->fatsize) {
+	case 32:
+		perbuf = FAT32BUFSIZE;
+		break;
+	case 16:
+		perbuf = FAT16BUFSIZE;
+		break;
+	default:
+		perbuf = FAT12BUFSIZE;
+		break;
+	}
+
+	/* Read as many FAT buffers as fit in FAT_MAP_READ, at least one */
+	bufnum = mydata->clustmap_len / perbuf;
+	startblock = bufnum * FATBUFBLOCKS;
+	getsize = max(FAT_MAP_READ / FATBUFSIZE, 1) * FATBUFBLOCKS;
+	if (startblock + getsize > mydata->fatlength)
+		getsize = mydata->fatlength - startblock;
+
+	/* What is on the disk must be up to date */
+	if (flush_dirty_fat_buffer(mydata) < 0)
+		return -EIO;
+
+	buf = malloc_cache_aligned(getsize * mydata->sect_size);
+	if (!buf)
+		return -ENOMEM;
+	if (disk_read(mydata->fat_sect + startblock, getsize, buf) < 0) {
+		debug("Error reading FAT blocks\n");
+		free(buf);
+		return -EIO;
+	}
+
+	clust = mydata->clustmap_len;
+	for (i = 0; i < getsize * mydata->sect_size * 8 / mydata->fatsize &&
+	     clust < count; i++, clust++) {
+		switch (mydata->fatsize) {
+		case 32:
+			val = FAT2CPU32(((__u32 *)buf)[i]) & 0xfffffff;
+			break;
+		case 16:
+			val = FAT2CPU16(((__u16 *)buf)[i]);
+			break;
+		default:
+			off8 = (i * 3) / 2;
+			val = buf[off8] + (buf[off8 + 1] << 8);
+			if (i & 0x1)
+				val >>= 4;
+			val &= 0xfff;
+			break;
+		}
+		/* The first two entries are reserved */
+		if (val || clust < 2)
+			mydata->clustmap[clust / 32] |= 1U << (clust % 32);
+	}
+	mydata->clustmap_len = clust;
+	free(buf);
+
+	return 0;
+}
+
+/*
+ * Return the first free cluster from 'clust' on, or 0 if there is none
+ * up to the end of the FAT
+ */
+static __u32 fat_next_free(fsdata *mydata, __u32 clust)
+{
+	__u32 count = fat_map_count(mydata);
+	__u32 word;
+	int ret;
+
+	while (clust < count) {
+		if (clust >= mydata->clustmap_len) {
+			ret = fat_map_extend(mydata);
+			if (ret == -ENOMEM) {
+				/* Without a bitmap look at each entry */
+				if (!get_fatent(mydata, clust))
+					return clust;
+				clust++;
+				continue;
+			}
+			if (ret)
+				return 0;
+		}
+
+		word = mydata->clustmap[clust / 32] >> (clust % 32);
+		if (!~word) {
+			/* All the clusters of this word are in use */
+			clust = ALIGN(clust + 1, 32);
+			continue;
+		}
+		if (!(word & 1))
+			return clust;
+		clust++;
+	}
+
+	return 0;
+}
+
+/*
+ * Return the first cluster of the first run of 'want' free clusters, or
+ * if there is no such run the first free cluster, or 0 if there is none.
+ */
+static __u32 fat_find_run(fsdata *mydata, __u32 want)
+{
+	__u32 first, clust, start = 2;
+
+	first = fat_next_free(mydata, start);
+	for (clust = first; clust; clust = fat_next_free(mydata, clust)) {
+		for (start = clust; clust - start < want; clust++)
+			if (fat_next_free(mydata, clust) != clust)
+				break;
+		if (clust - start >= want)
+			return start;
+	}
+
+	return first;
+}
+
+/*
+ * Keep the bitmap of the clusters in use up to date when 'entry' is set
+ */
+static void fat_map_set(fsdata *mydata, __u32 entry, __u32 entry_value)
+{
+	if (entry >= mydata->clustmap_len)
+		return;
+
+	if (entry_value)
+		mydata->clustmap[entry / 32] |= 1U << (entry % 32);
+	else
+		mydata->clustmap[entry / 32] &= ~(1U << (entry % 32));
+}
+
 /*
  * Set the entry at index 'entry' in a FAT (12/16/32) table.
  */
@@ -285,27 +473,8 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 	}
 
 	/* Read a new block of FAT entries into the cache. */
-	if (bufnum != mydata->fatbufnum) {
-		int getsize = FATBUFBLOCKS;
-		__u8 *bufptr = mydata->fatbuf;
-		__u32 fatlength = mydata->fatlength;
-		__u32 startblock = bufnum * FATBUFBLOCKS;
-
-		/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
-		if (startblock + getsize > fatlength)
-			getsize = fatlength - startblock;
-
-		if (flush_dirty_fat_buffer(mydata) < 0)
-			return -1;
-
-		startblock += mydata->fat_sect;
-
-		if (disk_read(startblock, getsize, bufptr) < 0) {
-			debug("Error reading FAT blocks\n");
-			return -1;
-		}
-		mydata->fatbufnum = bufnum;
-	}
+	if (fat_select_fatbuf(mydata, bufnum))
+		return -1;
 
 	/* Mark as dirty */
 	mydata->fat_dirty = 1;
@@ -360,6 +529,7 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 	default:
 		return -1;
 	}
+	fat_map_set(mydata, entry, entry_value);
 
 	return 0;
 }
@@ -367,20 +537,21 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 /*
  * Determine the next free cluster after 'entry' in a FAT (12/16/32) table
  * and link it to 'entry'. EOC marker is not set on returned entry.
+ * Return 0 if there is no free cluster left.
  */
 static __u32 determine_fatent(fsdata *mydata, __u32 entry)
 {
-	__u32 next_fat, next_entry = entry + 1;
+	__u32 next_entry;
 
-	while (1) {
-		next_fat = get_fatent(mydata, next_entry);
-		if (next_fat == 0) {
-			/* found free entry, link to entry */
-			set_fatent_value(mydata, entry, next_entry);
-			break;
-		}
-		next_entry++;
-	}
+	next_entry = fat_next_free(mydata, entry + 1);
+	if (!next_entry)
+		/* 'entry' itself may look free, the EOC marker not being set */
+		next_entry = fat_next_free(mydata, 2);
+	if (!next_entry || next_entry == entry)
+		return 0;
+
+	/* found free entry, link to entry */
+	set_fatent_value(mydata, entry, next_entry);
 	debug("FAT%d: entry: %08x, entry_value: %04x\n",
 	       mydata->fatsize, entry, next_entry);
 
@@ -604,20 +775,11 @@ get_set_cluster(fsdata *mydata, __u32 clustnum, loff_t pos, __u8 *buffer,
 }
 
 /*
- * Find the first empty cluster
+ * Find the first empty cluster, return 0 if there is none
  */
-static int find_empty_cluster(fsdata *mydata)
+static __u32 find_empty_cluster(fsdata *mydata)
 {
-	__u32 fat_val, entry = 3;
-
-	while (1) {
-		fat_val = get_fatent(mydata, entry);
-		if (fat_val == 0)
-			break;
-		entry++;
-	}
-
-	return entry;
+	return fat_next_free(mydata, 2);
 }
 
 /*
@@ -630,6 +792,10 @@ static int new_dir_table(fat_itr *itr)
 	unsigned int bytesperclust = mydata->clust_size * mydata->sect_size;
 
 	dir_newclust = find_empty_cluster(mydata);
+	if (!dir_newclust) {
+		printf("Error: no space left for directory\n");
+		return -1;
+	}
 	set_fatent_value(mydata, itr->clust, dir_newclust);
 	if (mydata->fatsize == 32)
 		set_fatent_value(mydata, dir_newclust, 0xffffff8);
@@ -725,7 +891,7 @@ set_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos, __u8 *buffer,
 {
 	unsigned int bytesperclust = mydata->clust_size * mydata->sect_size;
 	__u32 curclust = START(dentptr);
-	__u32 endclust = 0, newclust = 0;
+	__u32 endclust = 0, newclust = 0, prevclust;
 	u64 cur_pos, filesize;
 	loff_t offset, actsize, wsize;
 
@@ -860,16 +1026,24 @@ set_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos, __u8 *buffer,
 set_clusters:
 	/* allocate and write */
 	assert(!pos);
+	prevclust = curclust;
 
 	/* Assure that curclust is valid */
 	if (!curclust) {
-		curclust = find_empty_cluster(mydata);
+		/* Look for room for the whole file in one piece */
+		curclust = fat_find_run(mydata,
+					div_u64(filesize + bytesperclust - 1,
+						bytesperclust));
+		if (!curclust)
+			goto no_space;
 		set_start_cluster(mydata, dentptr, curclust);
 	} else {
 		newclust = get_fatent(mydata, curclust);
 
 		if (IS_LAST_CLUST(newclust, mydata->fatsize)) {
 			newclust = determine_fatent(mydata, curclust);
+			if (!newclust)
+				goto no_space;
 			set_fatent_value(mydata, curclust, newclust);
 			curclust = newclust;
 		} else {
@@ -890,6 +1064,8 @@ set_clusters:
 		/* search for consecutive clusters */
 		while (actsize < filesize) {
 			newclust = determine_fatent(mydata, endclust);
+			if (!newclust)
+				goto no_space;
 
 			if ((newclust - 1) != endclust)
 				/* write to <curclust..endclust> */
@@ -940,7 +1116,25 @@ getit:
 		curclust = endclust = newclust;
 	} while (1);
 
-	return 0;
+no_space:
+	printf("Error: no space left: %llu\n", filesize);
+
+	/* Give back the clusters allocated so far */
+	if (prevclust) {
+		clear_fatent(mydata, get_fatent(mydata, prevclust));
+		if (mydata->fatsize == 12)
+			newclust = 0xfff;
+		else if (mydata->fatsize == 16)
+			newclust = 0xffff;
+		else if (mydata->fatsize == 32)
+			newclust = 0xfffffff;
+		set_fatent_value(mydata, prevclust, newclust);
+	} else {
+		clear_fatent(mydata, START(dentptr));
+		set_start_cluster(mydata, dentptr, 0);
+	}
+
+	return -1;
 }
 
 /*
@@ -1073,7 +1267,7 @@ int file_fat_write_at(const char *filename, loff_t pos, void *buffer,
 		      loff_t size, loff_t *actwrite)
 {
 	dir_entry *retdent;
-	fsdata datablock = { .fatbuf = NULL, };
+	fsdata datablock = { .fatbufs = NULL, };
 	fsdata *mydata = &datablock;
 	fat_itr *itr = NULL;
 	int ret = -1;
@@ -1203,7 +1397,8 @@ int file_fat_write_at(const char *filename, loff_t pos, void *buffer,
 
 exit:
 	free(filename_copy);
-	free(mydata->fatbuf);
+	fat_free_fatbufs(mydata);
+	free(mydata->clustmap);
 	free(itr);
 	return ret;
 }
@@ -1217,8 +1412,7 @@ int file_fat_write(const char *filename, void *buffer, loff_t offset,
 static int fat_dir_entries(fat_itr *itr)
 {
 	fat_itr *dirs;
-	fsdata fsdata = { .fatbuf = NULL, }, *mydata = &fsdata;
-						/* for FATBUFSIZE */
+	fsdata fsdata = { .fatbufs = NULL, };
 	int count;
 
 	dirs = malloc_cache_aligned(sizeof(fat_itr));
@@ -1233,20 +1427,18 @@ static int fat_dir_entries(fat_itr *itr)
 	fsdata = *dirs->fsdata;
 
 	/* allocate local fat buffer */
-	fsdata.fatbuf = malloc_cache_aligned(FATBUFSIZE);
-	if (!fsdata.fatbuf) {
-		debug("Error: allocating memory\n");
+	if (fat_alloc_fatbufs(&fsdata)) {
+		fsdata.fatbufs = NULL;
 		count = -ENOMEM;
 		goto exit;
 	}
-	fsdata.fatbufnum = -1;
 	dirs->fsdata = &fsdata;
 
 	for (count = 0; fat_itr_next(dirs); count++)
 		;
 
 exit:
-	free(fsdata.fatbuf);
+	fat_free_fatbufs(&fsdata);
 	free(dirs);
 	return count;
 }
@@ -1282,7 +1474,7 @@ static int delete_dentry(fat_itr *itr)
 
 int fat_unlink(const char *filename)
 {
-	fsdata fsdata = { .fatbuf = NULL, };
+	fsdata fsdata = { .fatbufs = NULL, };
 	fat_itr *itr = NULL;
 	int n_entries, ret;
 	char *filename_copy, *dirname, *basename;
@@ -1344,7 +1536,8 @@ int fat_unlink(const char *filename)
 	ret = delete_dentry(itr);
 
 exit:
-	free(fsdata.fatbuf);
+	fat_free_fatbufs(&fsdata);
+	free(fsdata.clustmap);
 	free(itr);
 	free(filename_copy);
 
@@ -1354,7 +1547,7 @@ exit:
 int fat_mkdir(const char *new_dirname)
 {
 	dir_entry *retdent;
-	fsdata datablock = { .fatbuf = NULL, };
+	fsdata datablock = { .fatbufs = NULL, };
 	fsdata *mydata = &datablock;
 	fat_itr *itr = NULL;
 	char *dirname_copy, *parent, *dirname;
@@ -1480,7 +1673,8 @@ int fat_mkdir(const char *new_dirname)
 
 exit:
 	free(dirname_copy);
-	free(mydata->fatbuf);
+	fat_free_fatbufs(mydata);
+	free(mydata->clustmap);
 	free(itr);
 	free(dotdent);
 	return ret;
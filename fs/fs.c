@@ -15,6 +15,8 @@
 #include <sandboxfs.h>
 #include <ubifs_uboot.h>
 #include <btrfs.h>
+#include <squashfs.h>
+#include <erofs.h>
 #include <asm/io.h>
 #include <div64.h>
 #include <linux/math64.h>
@@ -273,6 +275,48 @@ static struct fstype_info fstypes[] = {
 		.mkdir = fs_mkdir_unsupported,
 		.ln = fs_ln_unsupported,
 	},
+#endif
+#ifdef CONFIG_FS_SQUASHFS
+	{
+		.fstype = FS_TYPE_SQUASHFS,
+		.name = "squashfs",
+		.null_dev_desc_ok = false,
+		.probe = sqfs_probe,
+		.close = sqfs_close,
+		.ls = fs_ls_generic,
+		.exists = sqfs_exists,
+		.size = sqfs_size,
+		.read = sqfs_read,
+		.write = fs_write_unsupported,
+		.uuid = fs_uuid_unsupported,
+		.opendir = sqfs_opendir,
+		.readdir = sqfs_readdir,
+		.closedir = sqfs_closedir,
+		.unlink = fs_unlink_unsupported,
+		.mkdir = fs_mkdir_unsupported,
+		.ln = fs_ln_unsupported,
+	},
+#endif
+#ifdef CONFIG_FS_EROFS
+	{
+		.fstype = FS_TYPE_EROFS,
+		.name = "erofs",
+		.null_dev_desc_ok = false,
+		.probe = erofs_probe,
+		.close = erofs_close,
+		.ls = fs_ls_generic,
+		.exists = erofs_exists,
+		.size = erofs_size,
+		.read = erofs_read,
+		.write = fs_write_unsupported,
+		.uuid = fs_uuid_unsupported,
+		.opendir = erofs_opendir,
+		.readdir = erofs_readdir,
+		.closedir = erofs_closedir,
+		.unlink = fs_unlink_unsupported,
+		.mkdir = fs_mkdir_unsupported,
+		.ln = fs_ln_unsupported,
+	},
 #endif
 	{
 		.fstype = FS_TYPE_ANY,
@@ -307,6 +351,96 @@ static struct fstype_info *fs_get_info(int fstype)
 	return info;
 }
 
+#if CONFIG_IS_ENABLED(FS_MOUNT_CACHE)
+/*
+ * The filesystem last mounted on a block device stays mounted after
+ * fs_close(), and is used again as long as the same partition is asked for.
+ * The drivers keep their state in globals, so only one can be kept.
+ */
+static struct {
+	struct blk_desc *desc;
+	int part;
+	lbaint_t start;
+	lbaint_t size;
+	int type;
+	bool stale;
+} fs_mount = {
+	.type = FS_TYPE_ANY,
+};
+
+static void fs_mount_drop(void)
+{
+	if (fs_mount.type != FS_TYPE_ANY)
+		fs_get_info(fs_mount.type)->close();
+	fs_mount.type = FS_TYPE_ANY;
+	fs_mount.stale = false;
+}
+
+/* Use the kept filesystem if it is on fs_partition, else unmount it */
+static bool fs_mount_reuse(struct blk_desc *desc, int part, int fstype)
+{
+	if (fs_mount.type != FS_TYPE_ANY && !fs_mount.stale &&
+	    fs_mount.desc == desc && fs_mount.part == part &&
+	    fs_mount.start == fs_partition.start &&
+	    fs_mount.size == fs_partition.size &&
+	    (fstype == FS_TYPE_ANY || fstype == fs_mount.type)) {
+		fs_type = fs_mount.type;
+		fs_dev_part = part;
+		return true;
+	}
+	fs_mount_drop();
+
+	return false;
+}
+
+static void fs_mount_keep(void)
+{
+	/* there is nothing to tell whether other devices have changed */
+	if (!fs_dev_desc)
+		return;
+
+	fs_mount.desc = fs_dev_desc;
+	fs_mount.part = fs_dev_part;
+	fs_mount.start = fs_partition.start;
+	fs_mount.size = fs_partition.size;
+	fs_mount.type = fs_type;
+	fs_mount.stale = false;
+}
+
+/* Whether the current filesystem must stay mounted after fs_close() */
+static bool fs_mount_kept(void)
+{
+	if (fs_type == FS_TYPE_ANY || fs_type != fs_mount.type)
+		return false;
+	if (fs_mount.stale) {
+		fs_mount.type = FS_TYPE_ANY;
+		fs_mount.stale = false;
+		return false;
+	}
+
+	return true;
+}
+
+void fs_invalidate(struct blk_desc *desc)
+{
+	if (!desc || desc == fs_mount.desc)
+		fs_mount.stale = true;
+}
+#else
+static inline bool fs_mount_reuse(struct blk_desc *desc, int part,
+				  int fstype)
+{
+	return false;
+}
+
+static inline void fs_mount_keep(void) {}
+
+static inline bool fs_mount_kept(void)
+{
+	return false;
+}
+#endif
+
 /**
  * fs_get_type() - Get type of current filesystem
  *
@@ -359,6 +493,9 @@ int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
 	if (part < 0)
 		return -1;
 
+	if (fs_mount_reuse(fs_dev_desc, part, fstype))
+		return 0;
+
 	for (i = 0, info = fstypes; i < ARRAY_SIZE(fstypes); i++, info++) {
 		if (fstype != FS_TYPE_ANY && info->fstype != FS_TYPE_ANY &&
 				fstype != info->fstype)
@@ -370,6 +507,7 @@ int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
 		if (!info->probe(fs_dev_desc, &fs_partition)) {
 			fs_type = info->fstype;
 			fs_dev_part = part;
+			fs_mount_keep();
 			return 0;
 		}
 	}
@@ -391,10 +529,14 @@ int fs_set_blk_dev_with_part(struct blk_desc *desc, int part)
 		return ret;
 	fs_dev_desc = desc;
 
+	if (fs_mount_reuse(desc, part, FS_TYPE_ANY))
+		return 0;
+
 	for (i = 0, info = fstypes; i < ARRAY_SIZE(fstypes); i++, info++) {
 		if (!info->probe(fs_dev_desc, &fs_partition)) {
 			fs_type = info->fstype;
 			fs_dev_part = part;
+			fs_mount_keep();
 			return 0;
 		}
 	}
@@ -406,7 +548,8 @@ void fs_close(void)
 {
 	struct fstype_info *info = fs_get_info(fs_type);
 
-	info->close();
+	if (!fs_mount_kept())
+		info->close();
 
 	fs_type = FS_TYPE_ANY;
 }
@@ -544,6 +687,7 @@ int fs_write(const char *filename, ulong addr, loff_t offset, loff_t len,
 		printf("** Unable to write file %s **\n", filename);
 		ret = -1;
 	}
+	fs_invalidate(fs_dev_desc);
 	fs_close();
 
 	return ret;
@@ -609,6 +753,7 @@ int fs_unlink(const char *filename)
 
 	ret = info->unlink(filename);
 
+	fs_invalidate(fs_dev_desc);
 	fs_close();
 
 	return ret;
@@ -622,6 +767,7 @@ int fs_mkdir(const char *dirname)
 
 	ret = info->mkdir(dirname);
 
+	fs_invalidate(fs_dev_desc);
 	fs_close();
 
 	return ret;
@@ -638,6 +784,7 @@ int fs_ln(const char *fname, const char *target)
 		printf("** Unable to create link %s -> %s **\n", fname, target);
 		ret = -1;
 	}
+	fs_invalidate(fs_dev_desc);
 	fs_close();
 
 	return ret;
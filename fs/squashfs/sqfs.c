@@ -0,0 +1,920 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * SquashFS filesystem implementation for U-Boot
+ *
+ * Read-only support for images in version 4.0 of the format: regular
+ * files, directories and symbolic links. Owners, extended attributes and
+ * the export table are ignored.
+ *
+ * Metadata blocks, fragment blocks and data blocks of files read in part
+ * are kept decompressed in small caches, so that walking a path, listing a
+ * directory or reading a file in pieces does not decompress the same
+ * blocks again and again.
+ */
+
+#include <common.h>
+#include <errno.h>
+#include <fs.h>
+#include <fs_internal.h>
+#include <malloc.h>
+#include <part.h>
+#include <squashfs.h>
+#include <linux/kernel.h>
+
+#include "sqfs_filesystem.h"
+
+#define SQFS_NAME_LEN		256
+#define SQFS_META_CACHE		8	/* Metadata blocks kept */
+#define SQFS_MAX_SYMLINKS	8	/* Links followed to find a file */
+#define SQFS_MAX_DEPTH		64	/* Directories deep for ".." */
+#define SQFS_READ_MAX		(1 << 30) /* Largest read from the disk */
+
+struct sqfs_cache_entry {
+	u64 start;		/* Where the block is on the disk */
+	u32 disk_size;		/* Bytes on the disk */
+	u32 size;		/* Bytes of data */
+	u32 used;		/* When it was last used, 0 if unused */
+	void *data;
+};
+
+struct sqfs_cache {
+	struct sqfs_cache_entry *entries;
+	int count;
+	u32 bufsize;		/* Size of the data of each entry */
+	u32 tick;		/* Counts the uses of the entries */
+};
+
+/* What is known of an inode */
+struct sqfs_inode {
+	int type;		/* Basic SQFS_*_TYPE, for extended ones too */
+	u64 size;
+	u64 start;		/* Data blocks or directory listing */
+	u32 offset;		/* Offset of the listing in its block */
+	u32 fragment;		/* Fragment with the tail end, or none */
+	u32 frag_offset;	/* Offset of the tail end in it */
+	u32 index_count;	/* Number of directory indexes */
+	u64 block;		/* What follows the inode: the block sizes, */
+	u32 block_offset;	/* directory indexes or link target */
+};
+
+/* Where a directory is being read */
+struct sqfs_dir {
+	u64 block;		/* Metadata block of the listing */
+	u32 offset;		/* Offset in it */
+	u32 size;		/* Bytes of the listing left */
+	u32 count;		/* Entries left under the current header */
+	u32 inode_block;	/* Inode table block of these entries */
+};
+
+struct sqfs_dir_stream {
+	struct fs_dir_stream fs_dirs;
+	struct fs_dirent dirent;
+	struct sqfs_dir dir;
+};
+
+/* The sizes of the data blocks of a file, read a few at a time */
+struct sqfs_block_list {
+	u64 block;
+	u32 offset;
+	__le32 sizes[64];
+	u32 count;		/* Sizes in 'sizes' */
+	u32 next;		/* Next one to use */
+	u64 left;		/* Sizes not read yet */
+};
+
+static struct {
+	struct blk_desc *dev;
+	disk_partition_t part;
+	int comp;
+	u32 block_log;
+	u32 fragments;
+	u64 root_inode;
+	u64 inode_table;
+	u64 dir_table;
+	__le64 *frag_index;	/* Metadata blocks of the fragment table */
+	void *cbuf;		/* Compressed block read from the disk */
+	struct sqfs_cache meta;
+	struct sqfs_cache frags;
+	struct sqfs_cache blocks;
+} sqfs;
+
+static int sqfs_disk_read(u64 offset, u32 len, void *buf)
+{
+	lbaint_t sector = offset >> sqfs.dev->log2blksz;
+	int byte_offset = offset & (sqfs.dev->blksz - 1);
+
+	if (!fs_devread(sqfs.dev, &sqfs.part, sector, byte_offset, len, buf))
+		return -EIO;
+
+	return 0;
+}
+
+/*
+ * Read the block of 'disk_size' bytes at 'start' into 'dst', which has room
+ * for '*size' bytes, decompressing it if 'compressed' is set. '*size' is
+ * set to the size of the data.
+ */
+static int sqfs_read_block(u64 start, u32 disk_size, bool compressed,
+			   void *dst, u32 *size)
+{
+	u32 max = max_t(u32, 1U << sqfs.block_log, SQFS_METADATA_SIZE);
+	int ret;
+
+	if (!compressed) {
+		if (disk_size > *size)
+			return -EIO;
+		*size = disk_size;
+		return sqfs_disk_read(start, disk_size, dst);
+	}
+
+	if (disk_size > max)
+		return -EIO;
+	ret = sqfs_disk_read(start, disk_size, sqfs.cbuf);
+	if (ret)
+		return ret;
+
+	return sqfs_decompress(sqfs.comp, dst, size, sqfs.cbuf, disk_size);
+}
+
+static int sqfs_cache_init(struct sqfs_cache *cache, int count, u32 bufsize)
+{
+	cache->entries = calloc(count, sizeof(*cache->entries));
+	if (!cache->entries)
+		return -ENOMEM;
+	cache->count = count;
+	cache->bufsize = bufsize;
+	cache->tick = 0;
+
+	return 0;
+}
+
+static void sqfs_cache_free(struct sqfs_cache *cache)
+{
+	int i;
+
+	if (!cache->entries)
+		return;
+	for (i = 0; i < cache->count; i++)
+		free(cache->entries[i].data);
+	free(cache->entries);
+	cache->entries = NULL;
+}
+
+static struct sqfs_cache_entry *sqfs_cache_find(struct sqfs_cache *cache,
+						u64 start)
+{
+	struct sqfs_cache_entry *entry;
+	int i;
+
+	for (i = 0; i < cache->count; i++) {
+		entry = &cache->entries[i];
+		if (entry->used && entry->start == start) {
+			entry->used = ++cache->tick;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the block at 'start' into the least recently used entry of 'cache'
+ * Return the entry, or NULL on errors.
+ */
+static struct sqfs_cache_entry *sqfs_cache_fill(struct sqfs_cache *cache,
+						u64 start, u32 disk_size,
+						bool compressed)
+{
+	struct sqfs_cache_entry *entry = &cache->entries[0];
+	int i;
+
+	for (i = 1; i < cache->count; i++)
+		if (cache->entries[i].used < entry->used)
+			entry = &cache->entries[i];
+
+	if (!entry->data) {
+		entry->data = malloc(cache->bufsize);
+		if (!entry->data)
+			return NULL;
+	}
+
+	entry->used = 0;
+	entry->size = cache->bufsize;
+	if (sqfs_read_block(start, disk_size, compressed, entry->data,
+			    &entry->size))
+		return NULL;
+	entry->start = start;
+	entry->disk_size = disk_size;
+	entry->used = ++cache->tick;
+
+	return entry;
+}
+
+/* Return the metadata block at 'start' */
+static struct sqfs_cache_entry *sqfs_get_meta(u64 start)
+{
+	struct sqfs_cache_entry *entry;
+	__le16 header;
+	u16 size;
+
+	entry = sqfs_cache_find(&sqfs.meta, start);
+	if (entry)
+		return entry;
+
+	if (sqfs_disk_read(start, sizeof(header), &header))
+		return NULL;
+	size = le16_to_cpu(header);
+
+	/* the data follows the header, keep the entry under the header */
+	entry = sqfs_cache_fill(&sqfs.meta, start + sizeof(header),
+				size & SQFS_METADATA_SIZE_MASK,
+				!(size & SQFS_METADATA_UNCOMPRESSED));
+	if (!entry)
+		return NULL;
+	entry->start = start;
+	entry->disk_size += sizeof(header);
+
+	return entry;
+}
+
+/*
+ * Copy 'len' bytes of metadata from 'offset' in the block at '*block' into
+ * 'buf', going on in the following blocks as needed. '*block' and '*offset'
+ * are moved past them.
+ */
+static int sqfs_read_meta(u64 *block, u32 *offset, void *buf, u32 len)
+{
+	struct sqfs_cache_entry *entry;
+	u32 count;
+
+	while (len) {
+		entry = sqfs_get_meta(*block);
+		if (!entry || !entry->size)
+			return -EIO;
+
+		if (*offset >= entry->size) {
+			*offset -= entry->size;
+			*block += entry->disk_size;
+			continue;
+		}
+
+		count = min(len, entry->size - *offset);
+		memcpy(buf, entry->data + *offset, count);
+		buf += count;
+		len -= count;
+		*offset += count;
+	}
+
+	return 0;
+}
+
+static int sqfs_read_inode(u64 ref, struct sqfs_inode *inode)
+{
+	u64 block = sqfs.inode_table + SQFS_REF_BLOCK(ref);
+	u32 offset = SQFS_REF_OFFSET(ref);
+	struct squashfs_base_inode base;
+	union {
+		struct squashfs_dir_inode dir;
+		struct squashfs_ldir_inode ldir;
+		struct squashfs_reg_inode reg;
+		struct squashfs_lreg_inode lreg;
+		struct squashfs_symlink_inode symlink;
+	} i;
+	int type, ret;
+
+	ret = sqfs_read_meta(&block, &offset, &base, sizeof(base));
+	if (ret)
+		return ret;
+
+	memset(inode, 0, sizeof(*inode));
+	inode->fragment = SQFS_NO_FRAGMENT;
+	type = le16_to_cpu(base.inode_type);
+
+	switch (type) {
+	case SQFS_DIR_TYPE:
+		ret = sqfs_read_meta(&block, &offset, &i.dir, sizeof(i.dir));
+		inode->size = le16_to_cpu(i.dir.file_size);
+		inode->start = sqfs.dir_table + le32_to_cpu(i.dir.start_block);
+		inode->offset = le16_to_cpu(i.dir.offset);
+		break;
+	case SQFS_LDIR_TYPE:
+		ret = sqfs_read_meta(&block, &offset, &i.ldir, sizeof(i.ldir));
+		inode->size = le32_to_cpu(i.ldir.file_size);
+		inode->start = sqfs.dir_table +
+			       le32_to_cpu(i.ldir.start_block);
+		inode->offset = le16_to_cpu(i.ldir.offset);
+		inode->index_count = le16_to_cpu(i.ldir.i_count);
+		break;
+	case SQFS_REG_TYPE:
+		ret = sqfs_read_meta(&block, &offset, &i.reg, sizeof(i.reg));
+		inode->size = le32_to_cpu(i.reg.file_size);
+		inode->start = le32_to_cpu(i.reg.start_block);
+		inode->fragment = le32_to_cpu(i.reg.fragment);
+		inode->frag_offset = le32_to_cpu(i.reg.offset);
+		break;
+	case SQFS_LREG_TYPE:
+		ret = sqfs_read_meta(&block, &offset, &i.lreg, sizeof(i.lreg));
+		inode->size = le64_to_cpu(i.lreg.file_size);
+		inode->start = le64_to_cpu(i.lreg.start_block);
+		inode->fragment = le32_to_cpu(i.lreg.fragment);
+		inode->frag_offset = le32_to_cpu(i.lreg.offset);
+		break;
+	case SQFS_SYMLINK_TYPE:
+	case SQFS_LSYMLINK_TYPE:
+		ret = sqfs_read_meta(&block, &offset, &i.symlink,
+				     sizeof(i.symlink));
+		inode->size = le32_to_cpu(i.symlink.symlink_size);
+		break;
+	case SQFS_BLKDEV_TYPE ... SQFS_SOCKET_TYPE:
+	case SQFS_LBLKDEV_TYPE ... SQFS_LSOCKET_TYPE:
+		break;
+	default:
+		return -EIO;
+	}
+
+	/* the extended types come after the basic ones, in the same order */
+	inode->type = type >= SQFS_LDIR_TYPE ? type - SQFS_LDIR_TYPE + 1 :
+					      type;
+	inode->block = block;
+	inode->block_offset = offset;
+
+	return ret;
+}
+
+static void sqfs_dir_open(struct sqfs_inode *inode, struct sqfs_dir *dir)
+{
+	dir->block = inode->start;
+	dir->offset = inode->offset;
+	/* the size counts 3 bytes for "." and ".." which are not there */
+	dir->size = inode->size > 3 ? inode->size - 3 : 0;
+	dir->count = 0;
+}
+
+/*
+ * Read the next entry of 'dir': its name, nul terminated, into 'name' which
+ * has room for SQFS_NAME_LEN + 1 bytes, its inode into '*ref' and its type
+ * into '*type'.
+ * Return 1 if there is one, 0 at the end of the directory, -errno on errors.
+ */
+static int sqfs_dir_next(struct sqfs_dir *dir, char *name, u64 *ref,
+			 int *type)
+{
+	struct squashfs_dir_header header;
+	struct squashfs_dir_entry entry;
+	u32 len;
+	int ret;
+
+	if (!dir->count) {
+		if (dir->size < sizeof(header) + sizeof(entry))
+			return 0;
+		ret = sqfs_read_meta(&dir->block, &dir->offset, &header,
+				     sizeof(header));
+		if (ret)
+			return ret;
+		dir->size -= sizeof(header);
+		dir->count = le32_to_cpu(header.count) + 1;
+		dir->inode_block = le32_to_cpu(header.start_block);
+	}
+
+	if (dir->size < sizeof(entry))
+		return -EIO;
+	ret = sqfs_read_meta(&dir->block, &dir->offset, &entry, sizeof(entry));
+	if (ret)
+		return ret;
+	len = le16_to_cpu(entry.size) + 1;
+	if (len > SQFS_NAME_LEN || dir->size < sizeof(entry) + len)
+		return -EIO;
+	ret = sqfs_read_meta(&dir->block, &dir->offset, name, len);
+	if (ret)
+		return ret;
+	name[len] = '\0';
+
+	dir->size -= sizeof(entry) + len;
+	dir->count--;
+	*ref = ((u64)dir->inode_block << 16) | le16_to_cpu(entry.offset);
+	*type = le16_to_cpu(entry.type);
+
+	return 1;
+}
+
+/*
+ * Move 'dir' on to the part of the listing of a large directory where
+ * 'name' would be, using its index
+ */
+static int sqfs_dir_seek(struct sqfs_inode *inode, struct sqfs_dir *dir,
+			 const char *name)
+{
+	u64 block = inode->block;
+	u32 offset = inode->block_offset;
+	struct squashfs_dir_index index;
+	char iname[SQFS_NAME_LEN + 1];
+	u32 size = dir->size;
+	u32 i, len, skip;
+	int ret;
+
+	for (i = 0; i < inode->index_count; i++) {
+		ret = sqfs_read_meta(&block, &offset, &index, sizeof(index));
+		if (ret)
+			return ret;
+		len = le32_to_cpu(index.size) + 1;
+		if (len > SQFS_NAME_LEN)
+			return -EIO;
+		ret = sqfs_read_meta(&block, &offset, iname, len);
+		if (ret)
+			return ret;
+		iname[len] = '\0';
+
+		if (strcmp(iname, name) > 0)
+			break;
+
+		skip = le32_to_cpu(index.index);
+		if (skip > size)
+			return -EIO;
+		dir->block = sqfs.dir_table + le32_to_cpu(index.start_block);
+		dir->offset = (inode->offset + skip) % SQFS_METADATA_SIZE;
+		dir->size = size - skip;
+		dir->count = 0;
+	}
+
+	return 0;
+}
+
+/* Find 'name' in the directory 'inode' and return its inode in '*ref' */
+static int sqfs_dir_find(struct sqfs_inode *inode, const char *name, u64 *ref)
+{
+	char ename[SQFS_NAME_LEN + 1];
+	struct sqfs_dir dir;
+	int type, cmp, ret;
+
+	sqfs_dir_open(inode, &dir);
+	ret = sqfs_dir_seek(inode, &dir, name);
+	if (ret)
+		return ret;
+
+	/* the entries are sorted by name */
+	while ((ret = sqfs_dir_next(&dir, ename, ref, &type)) > 0) {
+		cmp = strcmp(ename, name);
+		if (!cmp)
+			return 0;
+		if (cmp > 0)
+			break;
+	}
+
+	return ret < 0 ? ret : -ENOENT;
+}
+
+/*
+ * Find the inode of 'path'. Symbolic links are followed, the one 'path'
+ * ends with only if 'follow' is set.
+ */
+static int sqfs_lookup(const char *path, struct sqfs_inode *inode,
+		       bool follow)
+{
+	u64 dirs[SQFS_MAX_DEPTH];
+	int depth = 0, links = 0;
+	char *buf, *p, *name, *link;
+	u64 ref;
+	int ret;
+
+	if (!sqfs.dev)
+		return -ENODEV;
+
+	buf = strdup(path);
+	if (!buf)
+		return -ENOMEM;
+
+	dirs[0] = sqfs.root_inode;
+	ret = sqfs_read_inode(dirs[0], inode);
+	p = buf;
+	while (!ret) {
+		while (*p == '/')
+			p++;
+		if (!*p)
+			break;
+		name = p;
+		p = strchr(p, '/');
+		if (p)
+			*p++ = '\0';
+		else
+			p = name + strlen(name);
+
+		if (inode->type != SQFS_DIR_TYPE) {
+			ret = -ENOTDIR;
+			break;
+		}
+		if (!strcmp(name, "."))
+			continue;
+		if (!strcmp(name, "..")) {
+			if (depth)
+				depth--;
+			ret = sqfs_read_inode(dirs[depth], inode);
+			continue;
+		}
+
+		ret = sqfs_dir_find(inode, name, &ref);
+		if (!ret)
+			ret = sqfs_read_inode(ref, inode);
+		if (ret)
+			break;
+
+		if (inode->type == SQFS_SYMLINK_TYPE && (*p || follow)) {
+			if (++links > SQFS_MAX_SYMLINKS) {
+				ret = -ELOOP;
+				break;
+			}
+			/* go on with the target, then what is left of path */
+			link = malloc(inode->size + 1 + strlen(p) + 1);
+			if (!link) {
+				ret = -ENOMEM;
+				break;
+			}
+			ret = sqfs_read_meta(&inode->block,
+					     &inode->block_offset, link,
+					     inode->size);
+			link[inode->size] = '/';
+			strcpy(link + inode->size + 1, p);
+			free(buf);
+			buf = link;
+			p = buf;
+			if (*p == '/')
+				depth = 0;
+			if (!ret)
+				ret = sqfs_read_inode(dirs[depth], inode);
+		} else if (inode->type == SQFS_DIR_TYPE) {
+			if (++depth == SQFS_MAX_DEPTH) {
+				ret = -ENAMETOOLONG;
+				break;
+			}
+			dirs[depth] = ref;
+		}
+	}
+
+	free(buf);
+
+	return ret;
+}
+
+/* Read the size of the next data block of a file */
+static int sqfs_next_block_size(struct sqfs_block_list *list, u32 *size)
+{
+	int ret;
+
+	if (list->next == list->count) {
+		list->count = min_t(u64, list->left, ARRAY_SIZE(list->sizes));
+		if (!list->count)
+			return -EIO;
+		ret = sqfs_read_meta(&list->block, &list->offset, list->sizes,
+				     list->count * sizeof(list->sizes[0]));
+		if (ret)
+			return ret;
+		list->left -= list->count;
+		list->next = 0;
+	}
+	*size = le32_to_cpu(list->sizes[list->next++]);
+
+	return 0;
+}
+
+static struct sqfs_cache_entry *sqfs_get_fragment(u32 index)
+{
+	struct squashfs_fragment_entry frag;
+	struct sqfs_cache_entry *entry;
+	u64 block, start;
+	u32 offset, size;
+
+	if (index >= sqfs.fragments)
+		return NULL;
+
+	block = le64_to_cpu(sqfs.frag_index[index / SQFS_FRAGMENTS_PER_BLOCK]);
+	offset = (index % SQFS_FRAGMENTS_PER_BLOCK) * sizeof(frag);
+	if (sqfs_read_meta(&block, &offset, &frag, sizeof(frag)))
+		return NULL;
+	start = le64_to_cpu(frag.start_block);
+	size = le32_to_cpu(frag.size);
+
+	entry = sqfs_cache_find(&sqfs.frags, start);
+	if (entry)
+		return entry;
+
+	return sqfs_cache_fill(&sqfs.frags, start, size & SQFS_BLOCK_SIZE_MASK,
+			       !(size & SQFS_BLOCK_UNCOMPRESSED));
+}
+
+/* Read 'len' bytes at 'offset' in the file 'inode' into 'buf' */
+static int sqfs_read_data(struct sqfs_inode *inode, void *buf, u64 offset,
+			  u64 len)
+{
+	u64 end = offset + len, blocks, i, pos, from, to, blk_start;
+	u32 block_size = 1U << sqfs.block_log;
+	struct sqfs_cache_entry *entry;
+	struct sqfs_block_list list;
+	u64 run_pos = 0, run_len = 0;
+	void *run_buf = NULL;
+	u32 size, disk_size, blk_len;
+	bool compressed, whole;
+	int ret = 0;
+
+	/* the tail end is in a fragment, if the file has one */
+	if (inode->fragment == SQFS_NO_FRAGMENT)
+		blocks = (inode->size + block_size - 1) >> sqfs.block_log;
+	else
+		blocks = inode->size >> sqfs.block_log;
+
+	list.block = inode->block;
+	list.offset = inode->block_offset;
+	list.count = 0;
+	list.next = 0;
+	list.left = blocks;
+
+	pos = inode->start;
+	for (i = 0; i < blocks && !ret; i++) {
+		blk_start = i << sqfs.block_log;
+		if (blk_start >= end)
+			break;
+
+		ret = sqfs_next_block_size(&list, &size);
+		if (ret)
+			break;
+		disk_size = size & SQFS_BLOCK_SIZE_MASK;
+		compressed = !(size & SQFS_BLOCK_UNCOMPRESSED);
+		blk_len = min_t(u64, block_size, inode->size - blk_start);
+		from = max(offset, blk_start);
+		to = min(end, blk_start + blk_len);
+		pos += disk_size;
+		if (from >= to)
+			continue;
+
+		/*
+		 * Blocks stored as they are and wanted whole are read from
+		 * the disk together
+		 */
+		whole = from == blk_start && to == blk_start + blk_len;
+		if (run_len && (!whole || compressed || disk_size != blk_len ||
+				run_len + blk_len > SQFS_READ_MAX)) {
+			ret = sqfs_disk_read(run_pos, run_len, run_buf);
+			run_len = 0;
+			if (ret)
+				break;
+		}
+		if (whole && !compressed && disk_size == blk_len) {
+			if (!run_len) {
+				run_pos = pos - disk_size;
+				run_buf = buf + (from - offset);
+			}
+			run_len += blk_len;
+			continue;
+		}
+
+		if (!disk_size) {
+			/* a sparse block */
+			memset(buf + (from - offset), 0, to - from);
+		} else if (whole) {
+			/* decompressed straight into the buffer */
+			size = blk_len;
+			ret = sqfs_read_block(pos - disk_size, disk_size,
+					      compressed,
+					      buf + (from - offset), &size);
+			if (!ret && size != blk_len)
+				ret = -EIO;
+		} else {
+			entry = sqfs_cache_find(&sqfs.blocks, pos - disk_size);
+			if (!entry)
+				entry = sqfs_cache_fill(&sqfs.blocks,
+							pos - disk_size,
+							disk_size, compressed);
+			if (!entry || entry->size != blk_len) {
+				ret = -EIO;
+				break;
+			}
+			memcpy(buf + (from - offset),
+			       entry->data + (from - blk_start), to - from);
+		}
+	}
+
+	if (!ret && run_len)
+		ret = sqfs_disk_read(run_pos, run_len, run_buf);
+	if (ret)
+		return ret;
+
+	blk_start = blocks << sqfs.block_log;
+	if (end > blk_start) {
+		entry = sqfs_get_fragment(inode->fragment);
+		if (!entry)
+			return -EIO;
+		from = max(offset, blk_start);
+		if (inode->frag_offset + (end - blk_start) > entry->size)
+			return -EIO;
+		memcpy(buf + (from - offset),
+		       entry->data + inode->frag_offset + (from - blk_start),
+		       end - from);
+	}
+
+	return 0;
+}
+
+int sqfs_probe(struct blk_desc *fs_dev_desc, disk_partition_t *fs_partition)
+{
+	struct squashfs_super_block sblk;
+	u32 block_size, count;
+	struct sqfs_inode root;
+	u64 frag_table;
+	int ret;
+
+	sqfs_close();
+	sqfs.dev = fs_dev_desc;
+	sqfs.part = *fs_partition;
+
+	ret = sqfs_disk_read(0, sizeof(sblk), &sblk);
+	if (ret || le32_to_cpu(sblk.s_magic) != SQFS_MAGIC) {
+		sqfs.dev = NULL;
+		return -EINVAL;
+	}
+
+	sqfs.block_log = le16_to_cpu(sblk.block_log);
+	block_size = le32_to_cpu(sblk.block_size);
+	if (le16_to_cpu(sblk.s_major) != SQFS_MAJOR ||
+	    sqfs.block_log < SQFS_MIN_BLOCK_LOG ||
+	    sqfs.block_log > SQFS_MAX_BLOCK_LOG ||
+	    block_size != 1U << sqfs.block_log) {
+		printf("SquashFS: unsupported version %d.%d or block size %u\n",
+		       le16_to_cpu(sblk.s_major), le16_to_cpu(sblk.s_minor),
+		       block_size);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	sqfs.comp = le16_to_cpu(sblk.compression);
+	ret = sqfs_decompressor_init(sqfs.comp);
+	if (ret)
+		goto err;
+
+	sqfs.root_inode = le64_to_cpu(sblk.root_inode);
+	sqfs.inode_table = le64_to_cpu(sblk.inode_table_start);
+	sqfs.dir_table = le64_to_cpu(sblk.directory_table_start);
+	sqfs.fragments = le32_to_cpu(sblk.fragments);
+	frag_table = le64_to_cpu(sblk.fragment_table_start);
+
+	ret = -ENOMEM;
+	sqfs.cbuf = malloc(max_t(u32, block_size, SQFS_METADATA_SIZE));
+	if (!sqfs.cbuf ||
+	    sqfs_cache_init(&sqfs.meta, SQFS_META_CACHE, SQFS_METADATA_SIZE) ||
+	    sqfs_cache_init(&sqfs.frags, CONFIG_FS_SQUASHFS_FRAGMENT_CACHE,
+			    block_size) ||
+	    sqfs_cache_init(&sqfs.blocks, CONFIG_FS_SQUASHFS_BLOCK_CACHE,
+			    block_size))
+		goto err;
+
+	if (sqfs.fragments) {
+		count = DIV_ROUND_UP(sqfs.fragments, SQFS_FRAGMENTS_PER_BLOCK);
+		sqfs.frag_index = malloc(count * sizeof(*sqfs.frag_index));
+		if (!sqfs.frag_index)
+			goto err;
+		ret = sqfs_disk_read(frag_table,
+				     count * sizeof(*sqfs.frag_index),
+				     sqfs.frag_index);
+		if (ret)
+			goto err;
+	}
+
+	ret = sqfs_read_inode(sqfs.root_inode, &root);
+	if (!ret && root.type != SQFS_DIR_TYPE)
+		ret = -EIO;
+	if (ret) {
+		printf("SquashFS: cannot read the root directory\n");
+		goto err;
+	}
+
+	return 0;
+
+err:
+	sqfs_close();
+
+	return ret;
+}
+
+int sqfs_opendir(const char *filename, struct fs_dir_stream **dirsp)
+{
+	struct sqfs_dir_stream *dirs;
+	struct sqfs_inode inode;
+	int ret;
+
+	ret = sqfs_lookup(filename, &inode, true);
+	if (ret)
+		return ret;
+	if (inode.type != SQFS_DIR_TYPE)
+		return -ENOTDIR;
+
+	dirs = calloc(1, sizeof(*dirs));
+	if (!dirs)
+		return -ENOMEM;
+	sqfs_dir_open(&inode, &dirs->dir);
+	*dirsp = &dirs->fs_dirs;
+
+	return 0;
+}
+
+int sqfs_readdir(struct fs_dir_stream *fs_dirs, struct fs_dirent **dentp)
+{
+	struct sqfs_dir_stream *dirs = (struct sqfs_dir_stream *)fs_dirs;
+	struct fs_dirent *dent = &dirs->dirent;
+	char name[SQFS_NAME_LEN + 1];
+	struct sqfs_inode inode;
+	int type, ret;
+	u64 ref;
+
+	ret = sqfs_dir_next(&dirs->dir, name, &ref, &type);
+	if (ret <= 0)
+		return ret ? ret : -ENOENT;
+
+	memset(dent, 0, sizeof(*dent));
+	strlcpy(dent->name, name, sizeof(dent->name));
+	switch (type) {
+	case SQFS_DIR_TYPE:
+	case SQFS_LDIR_TYPE:
+		dent->type = FS_DT_DIR;
+		break;
+	case SQFS_SYMLINK_TYPE:
+	case SQFS_LSYMLINK_TYPE:
+		dent->type = FS_DT_LNK;
+		break;
+	default:
+		dent->type = FS_DT_REG;
+		ret = sqfs_read_inode(ref, &inode);
+		if (ret)
+			return ret;
+		dent->size = inode.size;
+		break;
+	}
+	*dentp = dent;
+
+	return 0;
+}
+
+void sqfs_closedir(struct fs_dir_stream *dirs)
+{
+	free(dirs);
+}
+
+int sqfs_exists(const char *filename)
+{
+	struct sqfs_inode inode;
+
+	return sqfs_lookup(filename, &inode, true) == 0;
+}
+
+int sqfs_size(const char *filename, loff_t *size)
+{
+	struct sqfs_inode inode;
+	int ret;
+
+	ret = sqfs_lookup(filename, &inode, true);
+	if (ret) {
+		printf("** File not found %s **\n", filename);
+		return ret;
+	}
+	*size = inode.size;
+
+	return 0;
+}
+
+int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
+	      loff_t *actread)
+{
+	struct sqfs_inode inode;
+	int ret;
+
+	*actread = 0;
+	ret = sqfs_lookup(filename, &inode, true);
+	if (ret) {
+		printf("** File not found %s **\n", filename);
+		return ret;
+	}
+	if (inode.type == SQFS_DIR_TYPE)
+		return -EISDIR;
+	if (inode.type != SQFS_REG_TYPE)
+		return -EINVAL;
+	if (offset >= inode.size)
+		return offset == inode.size ? 0 : -EINVAL;
+
+	if (!len || len > inode.size - offset)
+		len = inode.size - offset;
+	ret = sqfs_read_data(&inode, buf, offset, len);
+	if (ret) {
+		printf("SquashFS: error reading %s\n", filename);
+		return ret;
+	}
+	*actread = len;
+
+	return 0;
+}
+
+void sqfs_close(void)
+{
+	sqfs_cache_free(&sqfs.meta);
+	sqfs_cache_free(&sqfs.frags);
+	sqfs_cache_free(&sqfs.blocks);
+	free(sqfs.frag_index);
+	free(sqfs.cbuf);
+	sqfs_decompressor_cleanup();
+	memset(&sqfs, 0, sizeof(sqfs));
+}
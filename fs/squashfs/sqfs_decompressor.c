@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * SquashFS filesystem implementation for U-Boot
+ *
+ * Decompression of the data and metadata blocks
+ */
+
+#include <common.h>
+#include <errno.h>
+#include <malloc.h>
+
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_GZIP)
+#include <gzip.h>
+#endif
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_LZ4)
+#include <lz4.h>
+#endif
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_LZO)
+#include <linux/lzo.h>
+#endif
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_ZSTD)
+#include <linux/zstd.h>
+#endif
+
+#include "sqfs_filesystem.h"
+
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_ZSTD)
+static void *zstd_workspace;
+static ZSTD_DCtx *zstd_dctx;
+#endif
+
+/*
+ * Get ready to decompress blocks compressed with 'comp'.
+ * Return 0 on success, -EINVAL if it is not supported, -ENOMEM otherwise.
+ */
+int sqfs_decompressor_init(int comp)
+{
+	switch (comp) {
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_GZIP)
+	case SQFS_COMP_GZIP:
+		return 0;
+#endif
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_LZ4)
+	case SQFS_COMP_LZ4:
+		return 0;
+#endif
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_LZO)
+	case SQFS_COMP_LZO:
+		return 0;
+#endif
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_ZSTD)
+	case SQFS_COMP_ZSTD: {
+		size_t wsize = ZSTD_DCtxWorkspaceBound();
+
+		if (zstd_dctx)
+			return 0;
+		zstd_workspace = malloc(wsize);
+		if (!zstd_workspace)
+			return -ENOMEM;
+		zstd_dctx = ZSTD_initDCtx(zstd_workspace, wsize);
+		if (!zstd_dctx) {
+			free(zstd_workspace);
+			zstd_workspace = NULL;
+			return -ENOMEM;
+		}
+		return 0;
+	}
+#endif
+	default:
+		printf("SquashFS: compression %d is not supported\n", comp);
+		return -EINVAL;
+	}
+}
+
+void sqfs_decompressor_cleanup(void)
+{
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_ZSTD)
+	free(zstd_workspace);
+	zstd_workspace = NULL;
+	zstd_dctx = NULL;
+#endif
+}
+
+/*
+ * Decompress 'srclen' bytes from 'src' into 'dst', which has room for
+ * '*dstlen' bytes, and set '*dstlen' to the size of the data.
+ * Return 0 on success, -EIO if the data is corrupted.
+ */
+int sqfs_decompress(int comp, void *dst, u32 *dstlen, void *src, u32 srclen)
+{
+	__maybe_unused unsigned long lenp;
+	__maybe_unused size_t len;
+
+	switch (comp) {
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_GZIP)
+	case SQFS_COMP_GZIP:
+		/* zlib stream: skip the 2-byte header, ignore the checksum */
+		lenp = srclen;
+		if (srclen < 2 || zunzip(dst, *dstlen, src, &lenp, 1, 2))
+			return -EIO;
+		*dstlen = lenp;
+		return 0;
+#endif
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_LZ4)
+	case SQFS_COMP_LZ4:
+		len = *dstlen;
+		if (ulz4_block(src, srclen, dst, &len))
+			return -EIO;
+		*dstlen = len;
+		return 0;
+#endif
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_LZO)
+	case SQFS_COMP_LZO:
+		len = *dstlen;
+		if (lzo1x_decompress_safe(src, srclen, dst, &len) != LZO_E_OK)
+			return -EIO;
+		*dstlen = len;
+		return 0;
+#endif
+#if IS_ENABLED(CONFIG_FS_SQUASHFS_ZSTD)
+	case SQFS_COMP_ZSTD:
+		len = ZSTD_decompressDCtx(zstd_dctx, dst, *dstlen, src, srclen);
+		if (ZSTD_isError(len))
+			return -EIO;
+		*dstlen = len;
+		return 0;
+#endif
+	default:
+		return -EINVAL;
+	}
+}
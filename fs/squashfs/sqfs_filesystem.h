@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * SquashFS filesystem implementation for U-Boot
+ *
+ * On-disk format as described in the Linux kernel's
+ * fs/squashfs/squashfs_fs.h. Everything is little endian.
+ */
+
+#ifndef __SQFS_FILESYSTEM_H__
+#define __SQFS_FILESYSTEM_H__
+
+#include <linux/bitops.h>
+#include <linux/types.h>
+
+#define SQFS_MAGIC			0x73717368
+#define SQFS_MAJOR			4
+
+#define SQFS_METADATA_SIZE		8192
+#define SQFS_METADATA_UNCOMPRESSED	BIT(15)
+#define SQFS_METADATA_SIZE_MASK		(SQFS_METADATA_UNCOMPRESSED - 1)
+
+#define SQFS_BLOCK_UNCOMPRESSED		BIT(24)
+#define SQFS_BLOCK_SIZE_MASK		(SQFS_BLOCK_UNCOMPRESSED - 1)
+#define SQFS_MIN_BLOCK_LOG		12
+#define SQFS_MAX_BLOCK_LOG		20
+
+#define SQFS_NO_FRAGMENT		0xffffffff
+
+/* Superblock flags */
+#define SQFS_COMP_OPTIONS		BIT(10)
+
+/* An inode reference: metadata block in the table and offset in it */
+#define SQFS_REF_BLOCK(ref)		((ref) >> 16)
+#define SQFS_REF_OFFSET(ref)		((ref) & 0xffff)
+
+enum sqfs_compression {
+	SQFS_COMP_GZIP = 1,
+	SQFS_COMP_LZMA = 2,
+	SQFS_COMP_LZO = 3,
+	SQFS_COMP_XZ = 4,
+	SQFS_COMP_LZ4 = 5,
+	SQFS_COMP_ZSTD = 6,
+};
+
+enum sqfs_inode_type {
+	SQFS_DIR_TYPE = 1,
+	SQFS_REG_TYPE,
+	SQFS_SYMLINK_TYPE,
+	SQFS_BLKDEV_TYPE,
+	SQFS_CHRDEV_TYPE,
+	SQFS_FIFO_TYPE,
+	SQFS_SOCKET_TYPE,
+	SQFS_LDIR_TYPE,
+	SQFS_LREG_TYPE,
+	SQFS_LSYMLINK_TYPE,
+	SQFS_LBLKDEV_TYPE,
+	SQFS_LCHRDEV_TYPE,
+	SQFS_LFIFO_TYPE,
+	SQFS_LSOCKET_TYPE,
+};
+
+struct squashfs_super_block {
+	__le32 s_magic;
+	__le32 inodes;
+	__le32 mkfs_time;
+	__le32 block_size;
+	__le32 fragments;
+	__le16 compression;
+	__le16 block_log;
+	__le16 flags;
+	__le16 no_ids;
+	__le16 s_major;
+	__le16 s_minor;
+	__le64 root_inode;
+	__le64 bytes_used;
+	__le64 id_table_start;
+	__le64 xattr_id_table_start;
+	__le64 inode_table_start;
+	__le64 directory_table_start;
+	__le64 fragment_table_start;
+	__le64 lookup_table_start;
+} __packed;
+
+struct squashfs_base_inode {
+	__le16 inode_type;
+	__le16 mode;
+	__le16 uid;
+	__le16 guid;
+	__le32 mtime;
+	__le32 inode_number;
+} __packed;
+
+struct squashfs_dir_inode {
+	__le32 start_block;
+	__le32 nlink;
+	__le16 file_size;
+	__le16 offset;
+	__le32 parent_inode;
+} __packed;
+
+/* Followed by i_count struct squashfs_dir_index */
+struct squashfs_ldir_inode {
+	__le32 nlink;
+	__le32 file_size;
+	__le32 start_block;
+	__le32 parent_inode;
+	__le16 i_count;
+	__le16 offset;
+	__le32 xattr;
+} __packed;
+
+/* Followed by the size of each block, see SQFS_BLOCK_* */
+struct squashfs_reg_inode {
+	__le32 start_block;
+	__le32 fragment;
+	__le32 offset;
+	__le32 file_size;
+} __packed;
+
+struct squashfs_lreg_inode {
+	__le64 start_block;
+	__le64 file_size;
+	__le64 sparse;
+	__le32 nlink;
+	__le32 fragment;
+	__le32 offset;
+	__le32 xattr;
+} __packed;
+
+/* Followed by the target, without a nul */
+struct squashfs_symlink_inode {
+	__le32 nlink;
+	__le32 symlink_size;
+} __packed;
+
+/* Followed by size + 1 bytes of name */
+struct squashfs_dir_index {
+	__le32 index;
+	__le32 start_block;
+	__le32 size;
+} __packed;
+
+/* Followed by count + 1 struct squashfs_dir_entry */
+struct squashfs_dir_header {
+	__le32 count;
+	__le32 start_block;
+	__le32 inode_number;
+} __packed;
+
+/* Followed by size + 1 bytes of name */
+struct squashfs_dir_entry {
+	__le16 offset;
+	__le16 inode_number;
+	__le16 type;
+	__le16 size;
+} __packed;
+
+struct squashfs_fragment_entry {
+	__le64 start_block;
+	__le32 size;
+	__le32 unused;
+} __packed;
+
+#define SQFS_FRAGMENTS_PER_BLOCK	(SQFS_METADATA_SIZE / \
+					 sizeof(struct squashfs_fragment_entry))
+
+/* sqfs_decompressor.c */
+int sqfs_decompressor_init(int comp);
+void sqfs_decompressor_cleanup(void);
+int sqfs_decompress(int comp, void *dst, u32 *dstlen, void *src, u32 srclen);
+
+#endif /* __SQFS_FILESYSTEM_H__ */
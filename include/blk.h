@@ -85,6 +85,7 @@ struct blk_desc {
 		uint32_t mbr_sig;	/* MBR integer signature */
 		efi_guid_t guid_sig;	/* GPT GUID Signature */
 	};
+	bool		discard_zeroes;	/* discarded blocks read as zero */
 #if CONFIG_IS_ENABLED(BLK)
 	/*
 	 * For now we have a few functions which take struct blk_desc as a
@@ -92,6 +93,11 @@ struct blk_desc {
 	 * device. Once these functions are removed we can drop this field.
 	 */
 	struct udevice *bdev;
+	/*
+	 * Number of reads started with blk_submit_read() which the driver
+	 * can hold at once
+	 */
+	unsigned int	queue_depth;
 #else
 	unsigned long	(*block_read)(struct blk_desc *block_dev,
 				      lbaint_t start,
@@ -135,6 +141,31 @@ int blkcache_read(int iftype, int dev,
 		  lbaint_t start, lbaint_t blkcnt,
 		  unsigned long blksz, void *buffer);
 
+/**
+ * blkcache_read_ahead() - widen a read which missed the cache
+ *
+ * The cache keeps blocks in entries of a fixed number of blocks. To make
+ * the most of small reads, such as filesystem metadata, whole entries are
+ * read, and when the reads look sequential, more entries following them.
+ * The read should then be made into the returned buffer, passed on to
+ * blkcache_fill() and the blocks asked for copied from it.
+ *
+ * @param iftype - IF_TYPE_x for type of device
+ * @param dev - device index of particular type
+ * @param start - starting block number
+ * @param blkcnt - number of blocks to read
+ * @param blksz - size in bytes of each block
+ * @param lba - number of blocks of the device
+ * @param firstp - returns the first block to read
+ * @param countp - returns the number of blocks to read
+ *
+ * @return - buffer to read into, or NULL to read the blocks as asked
+ */
+void *blkcache_read_ahead(int iftype, int dev,
+			  lbaint_t start, lbaint_t blkcnt,
+			  unsigned long blksz, lbaint_t lba,
+			  lbaint_t *firstp, lbaint_t *countp);
+
 /**
  * blkcache_fill() - make data read from a block device available
  * to the block cache
@@ -163,10 +194,10 @@ void blkcache_invalidate(int iftype, int dev);
 /**
  * blkcache_configure() - configure block cache
  *
- * @param blocks - maximum blocks per entry
- * @param entries - maximum entries in cache
+ * @param blocks - blocks per entry
+ * @param bytes - maximum memory used by the entries
  */
-void blkcache_configure(unsigned blocks, unsigned entries);
+void blkcache_configure(unsigned blocks, unsigned long bytes);
 
 /*
  * statistics of the block cache
@@ -176,7 +207,9 @@ struct block_cache_stats {
 	unsigned misses;
 	unsigned entries; /* current entry count */
 	unsigned max_blocks_per_entry;
-	unsigned max_entries;
+	unsigned long bytes; /* memory used by the entries */
+	unsigned long max_bytes;
+	unsigned long read_ahead; /* blocks read before being asked for */
 };
 
 /**
@@ -195,6 +228,14 @@ static inline int blkcache_read(int iftype, int dev,
 	return 0;
 }
 
+static inline void *blkcache_read_ahead(int iftype, int dev,
+					lbaint_t start, lbaint_t blkcnt,
+					unsigned long blksz, lbaint_t lba,
+					lbaint_t *firstp, lbaint_t *countp)
+{
+	return NULL;
+}
+
 static inline void blkcache_fill(int iftype, int dev,
 				 lbaint_t start, lbaint_t blkcnt,
 				 unsigned long blksz, void const *buffer) {}
@@ -206,6 +247,23 @@ static inline void blkcache_invalidate(int iftype, int dev) {}
 #if CONFIG_IS_ENABLED(BLK)
 struct udevice;
 
+/**
+ * struct blk_req - a read from a block device made in the background
+ *
+ * @start:	Start block number to read (0=first)
+ * @blkcnt:	Number of blocks to read
+ * @buffer:	Destination buffer for data read
+ * @result:	Number of blocks read, or -ve error number, once done
+ * @done:	true once the request has completed
+ */
+struct blk_req {
+	lbaint_t start;
+	lbaint_t blkcnt;
+	void *buffer;
+	long result;
+	bool done;
+};
+
 /* Operations on block devices */
 struct blk_ops {
 	/**
@@ -246,6 +304,23 @@ struct blk_ops {
 	unsigned long (*erase)(struct udevice *dev, lbaint_t start,
 			       lbaint_t blkcnt);
 
+	/**
+	 * discard() - tell the device that a section holds no data
+	 *
+	 * This is the TRIM of ATA and MMC, which is much faster than writing
+	 * or erasing the blocks. They read back as zero afterwards if the
+	 * device sets discard_zeroes in its struct blk_desc, and as anything
+	 * otherwise.
+	 *
+	 * @dev:	Device to discard blocks of
+	 * @start:	Start block number to discard (0=first)
+	 * @blkcnt:	Number of blocks to discard
+	 * @return number of blocks discarded, or -ve error number (see the
+	 * IS_ERR_VALUE() macro
+	 */
+	unsigned long (*discard)(struct udevice *dev, lbaint_t start,
+				 lbaint_t blkcnt);
+
 	/**
 	 * select_hwpart() - select a particular hardware partition
 	 *
@@ -264,6 +339,31 @@ struct blk_ops {
 	 * @return 0 if OK, -ve on error
 	 */
 	int (*select_hwpart)(struct udevice *dev, int hwpart);
+
+	/**
+	 * submit_read() - start reading from a block device
+	 *
+	 * This starts the transfer and returns without waiting for it. The
+	 * request is completed later from poll(). Drivers which do not
+	 * provide this have their reads made through read() instead.
+	 *
+	 * @dev:	Device to read from
+	 * @req:	Request to start, with start, blkcnt and buffer set
+	 * @return 0 if OK, -EBUSY if the driver already holds as many
+	 * requests as the queue_depth of the device, other -ve on error
+	 */
+	int (*submit_read)(struct udevice *dev, struct blk_req *req);
+
+	/**
+	 * poll() - complete the requests which have finished
+	 *
+	 * This sets the result and done members of each request held by
+	 * the driver which has finished, without waiting for the others.
+	 *
+	 * @dev:	Device to check
+	 * @return 0 if OK, -ve on error
+	 */
+	int (*poll)(struct udevice *dev);
 };
 
 #define blk_get_ops(dev)	((struct blk_ops *)(dev)->driver->ops)
@@ -280,6 +380,50 @@ unsigned long blk_dwrite(struct blk_desc *block_dev, lbaint_t start,
 			 lbaint_t blkcnt, const void *buffer);
 unsigned long blk_derase(struct blk_desc *block_dev, lbaint_t start,
 			 lbaint_t blkcnt);
+unsigned long blk_ddiscard(struct blk_desc *block_dev, lbaint_t start,
+			   lbaint_t blkcnt);
+
+/**
+ * blk_submit_read() - start reading from a block device
+ *
+ * The read goes on in the background, while the caller does something
+ * else, such as checking or decompressing the data read before. Up to
+ * block_dev->queue_depth reads may be in progress at once. With drivers
+ * which cannot read in the background, or when the blocks are in the
+ * block cache, the read is made at once and @req is done on return.
+ *
+ * @block_dev:	Block device to read from
+ * @start:	Start block number to read (0=first)
+ * @blkcnt:	Number of blocks to read
+ * @buffer:	Destination buffer for data read
+ * @req:	Request to fill in, which must stay valid until it is done
+ * @return 0 if OK, -EBUSY if too many reads are in progress, other -ve on
+ * error
+ */
+int blk_submit_read(struct blk_desc *block_dev, lbaint_t start,
+		    lbaint_t blkcnt, void *buffer, struct blk_req *req);
+
+/**
+ * blk_poll() - check whether a read has completed
+ *
+ * This lets the driver complete any reads which have finished, then
+ * checks @req.
+ *
+ * @block_dev:	Block device the read was submitted to
+ * @req:	Request to check
+ * @return number of blocks read if the request is done, -EINPROGRESS if
+ * not, or other -ve on error
+ */
+long blk_poll(struct blk_desc *block_dev, struct blk_req *req);
+
+/**
+ * blk_wait() - wait for a read to complete
+ *
+ * @block_dev:	Block device the read was submitted to
+ * @req:	Request to wait for
+ * @return number of blocks read, or -ve on error
+ */
+long blk_wait(struct blk_desc *block_dev, struct blk_req *req);
 
 /**
  * blk_find_device() - Find a block device
@@ -466,6 +610,12 @@ static inline ulong blk_derase(struct blk_desc *block_dev, lbaint_t start,
 	return block_dev->block_erase(block_dev, start, blkcnt);
 }
 
+static inline ulong blk_ddiscard(struct blk_desc *block_dev, lbaint_t start,
+				 lbaint_t blkcnt)
+{
+	return -ENOSYS;
+}
+
 /**
  * struct blk_driver - Driver for block interface types
  *
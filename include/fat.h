@@ -29,6 +29,13 @@
 #define FAT16BUFSIZE	(FATBUFSIZE/2)
 #define FAT32BUFSIZE	(FATBUFSIZE/4)
 
+/* Number of FATBUFSIZE windows of the FAT kept in memory */
+#if CONFIG_IS_ENABLED(FS_FAT)
+#define FATBUF_WINDOWS	CONFIG_VAL(FS_FAT_FATBUF_WINDOWS)
+#else
+#define FATBUF_WINDOWS	1
+#endif
+
 /* Maximum number of entry for long file name according to spec */
 #define MAX_LFN_SLOT	20
 
@@ -161,7 +168,12 @@ typedef struct dir_slot {
  * (see FAT32 accesses)
  */
 typedef struct {
-	__u8	*fatbuf;	/* Current FAT buffer */
+	__u8	*fatbuf;	/* Current FAT buffer, one of fatbufs */
+	__u8	*fatbufs;	/* FATBUF_WINDOWS windows of the FAT */
+	int	*fatbufnums;	/* Window held by each, or -1, after fatbufs */
+	__u32	*fatbufused;	/* When each was last used, after fatbufs */
+	__u32	fatbuftick;	/* Counts the uses of the windows */
+	__u8	*bounce;	/* A cluster for misaligned reads, or NULL */
 	int	fatsize;	/* Size of FAT in bits */
 	__u32	fatlength;	/* Length of FAT in sectors */
 	__u16	fat_sect;	/* Starting sector of the FAT */
@@ -175,6 +187,8 @@ typedef struct {
 	__u32	root_cluster;	/* First cluster of root dir for FAT32 */
 	u32	total_sect;	/* Number of sectors */
 	int	fats;		/* Number of FATs */
+	__u32	*clustmap;	/* Bit set for each cluster in use */
+	__u32	clustmap_len;	/* Number of FAT entries read into clustmap */
 } fsdata;
 
 static inline u32 clust_to_sect(fsdata *fsdata, u32 clust)
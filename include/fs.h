@@ -13,6 +13,8 @@
 #define FS_TYPE_SANDBOX	3
 #define FS_TYPE_UBIFS	4
 #define FS_TYPE_BTRFS	5
+#define FS_TYPE_SQUASHFS 6
+#define FS_TYPE_EROFS	7
 
 /**
  * do_fat_fsload - Run the fatload command
@@ -71,6 +73,23 @@ int fs_set_blk_dev_with_part(struct blk_desc *desc, int part);
  */
 void fs_close(void);
 
+#if CONFIG_IS_ENABLED(FS_MOUNT_CACHE)
+/**
+ * fs_invalidate() - Stop reusing the filesystem kept mounted on a device
+ *
+ * fs_close() keeps the filesystem last used mounted, so that the next
+ * command on the same partition does not have to probe and mount it again.
+ * This must be called whenever a device may have changed behind the back of
+ * the filesystem code. The mount is dropped when the current command is
+ * done with it.
+ *
+ * @desc: Block device which changed, or NULL for any
+ */
+void fs_invalidate(struct blk_desc *desc);
+#else
+static inline void fs_invalidate(struct blk_desc *desc) {}
+#endif
+
 /**
  * fs_get_type() - Get type of current filesystem
  *
@@ -23,6 +23,16 @@ struct sparse_storage {
 				 lbaint_t blk,
 				 lbaint_t blkcnt);
 
+	/*
+	 * Optional: discard blocks, returning how many were discarded. This
+	 * is done for the "don't care" chunks, and instead of writing fill
+	 * chunks of zeroes when discard_zeroes is set.
+	 */
+	lbaint_t	(*discard)(struct sparse_storage *info,
+				   lbaint_t blk,
+				   lbaint_t blkcnt);
+	bool		discard_zeroes;	/* discarded blocks read as zero */
+
 	void		(*mssg)(const char *str, char *response);
 };
 
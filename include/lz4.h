@@ -21,4 +21,20 @@
  */
 int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn);
 
+/**
+ * ulz4_block() - Decompress a single LZ4 block, without the frame around it
+ *
+ * This is the format used by filesystems such as SquashFS, and by 'lz4 -l'
+ * for each block after the magic number and block size.
+ *
+ * @src: Source data to decompress
+ * @srcn: Length of source data
+ * @dst: Destination for uncompressed data
+ * @dstn: Size of the destination on entry, length of uncompressed data on
+ *	return
+ * @return 0 if OK, -EPROTO if the compressed data causes an error in the
+ *	decompression algorithm or does not fit in the destination
+ */
+int ulz4_block(const void *src, size_t srcn, void *dst, size_t *dstn);
+
 #endif
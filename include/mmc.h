@@ -70,6 +70,7 @@
 #define MMC_CAP_NONREMOVABLE	BIT(14)
 #define MMC_CAP_NEEDS_POLL	BIT(15)
 #define MMC_CAP_CD_ACTIVE_HIGH  BIT(16)
+#define MMC_CAP_CMD23		BIT(17)	/* can do SET_BLOCK_COUNT */
 
 #define MMC_MODE_8BIT		BIT(30)
 #define MMC_MODE_4BIT		BIT(29)
@@ -78,6 +79,8 @@
 
 
 #define SD_DATA_4BIT	0x00040000
+#define SD_DATA_STAT_AFTER_ERASE	0x00800000
+#define SD_CMD23_SUPPORT	0x00000002
 
 #define IS_SD(x)	((x)->version & SD_VERSION_SD)
 #define IS_MMC(x)	((x)->version & MMC_VERSION_MMC)
@@ -173,6 +176,7 @@ static inline bool mmc_is_tuning_cmd(uint cmdidx)
 #define MMC_STATUS_CURR_STATE	(0xf << 9)
 #define MMC_STATUS_ERROR	(1 << 19)
 
+#define MMC_STATE_TRANS		(4 << 9)
 #define MMC_STATE_PRG		(7 << 9)
 
 #define MMC_VDD_165_195		0x00000080	/* VDD voltage 1.65 - 1.95 */
@@ -208,6 +212,8 @@ static inline bool mmc_is_tuning_cmd(uint cmdidx)
 /*
  * EXT_CSD fields
  */
+#define EXT_CSD_FLUSH_CACHE		32	/* W */
+#define EXT_CSD_CACHE_CTRL		33	/* R/W/E_P */
 #define EXT_CSD_ENH_START_ADDR		136	/* R/W */
 #define EXT_CSD_ENH_SIZE_MULT		140	/* R/W */
 #define EXT_CSD_GP_SIZE_MULT		143	/* R/W */
@@ -223,6 +229,7 @@ static inline bool mmc_is_tuning_cmd(uint cmdidx)
 #define EXT_CSD_ERASE_GROUP_DEF		175	/* R/W */
 #define EXT_CSD_BOOT_BUS_WIDTH		177
 #define EXT_CSD_PART_CONF		179	/* R/W */
+#define EXT_CSD_ERASED_MEM_CONT		181	/* RO */
 #define EXT_CSD_BUS_WIDTH		183	/* R/W */
 #define EXT_CSD_STROBE_SUPPORT		184	/* R/W */
 #define EXT_CSD_HS_TIMING		185	/* R/W */
@@ -233,7 +240,10 @@ static inline bool mmc_is_tuning_cmd(uint cmdidx)
 #define EXT_CSD_HC_WP_GRP_SIZE		221	/* RO */
 #define EXT_CSD_HC_ERASE_GRP_SIZE	224	/* RO */
 #define EXT_CSD_BOOT_MULT		226	/* RO */
+#define EXT_CSD_SEC_FEATURE_SUPPORT	231	/* RO */
+#define EXT_CSD_TRIM_MULT		232	/* RO */
 #define EXT_CSD_GENERIC_CMD6_TIME       248     /* RO */
+#define EXT_CSD_CACHE_SIZE		249	/* RO, 4 bytes */
 #define EXT_CSD_BKOPS_SUPPORT		502	/* RO */
 
 /*
@@ -303,6 +313,8 @@ static inline bool mmc_is_tuning_cmd(uint cmdidx)
 #define EXT_CSD_WR_DATA_REL_USR		(1 << 0)	/* user data area WR_REL */
 #define EXT_CSD_WR_DATA_REL_GP(x)	(1 << ((x)+1))	/* GP part (x+1) WR_REL */
 
+#define EXT_CSD_SEC_GB_CL_EN		BIT(4)	/* TRIM is supported */
+
 #define R1_ILLEGAL_COMMAND		(1 << 22)
 #define R1_APP_CMD			(1 << 5)
 
@@ -450,6 +462,27 @@ struct dm_mmc_ops {
 	 * @return 0 if OK, -ve on error
 	 */
 	int (*execute_tuning)(struct udevice *dev, uint opcode);
+
+	/**
+	 * get_tuning() - Read back the result of the last tuning
+	 *
+	 * The value only has a meaning for the host driver, which is given it
+	 * back by set_tuning() to skip tuning again for the same card.
+	 *
+	 * @dev:	Device which was tuned
+	 * @tuning:	Returns the tuning result
+	 * @return 0 if OK, -ve on error
+	 */
+	int (*get_tuning)(struct udevice *dev, u32 *tuning);
+
+	/**
+	 * set_tuning() - Apply the result of an earlier tuning
+	 *
+	 * @dev:	Device to tune
+	 * @tuning:	Tuning result from get_tuning()
+	 * @return 0 if OK, -ve on error
+	 */
+	int (*set_tuning)(struct udevice *dev, u32 tuning);
 #endif
 
 	/**
@@ -487,6 +520,8 @@ int dm_mmc_set_ios(struct udevice *dev);
 int dm_mmc_get_cd(struct udevice *dev);
 int dm_mmc_get_wp(struct udevice *dev);
 int dm_mmc_execute_tuning(struct udevice *dev, uint opcode);
+int dm_mmc_get_tuning(struct udevice *dev, u32 *tuning);
+int dm_mmc_set_tuning(struct udevice *dev, u32 tuning);
 int dm_mmc_wait_dat0(struct udevice *dev, int state, int timeout_us);
 int dm_mmc_host_power_cycle(struct udevice *dev);
 
@@ -495,6 +530,8 @@ int mmc_set_ios(struct mmc *mmc);
 int mmc_getcd(struct mmc *mmc);
 int mmc_getwp(struct mmc *mmc);
 int mmc_execute_tuning(struct mmc *mmc, uint opcode);
+int mmc_get_tuning(struct mmc *mmc, u32 *tuning);
+int mmc_set_tuning(struct mmc *mmc, u32 tuning);
 int mmc_wait_dat0(struct mmc *mmc, int state, int timeout_us);
 int mmc_set_enhanced_strobe(struct mmc *mmc);
 int mmc_host_power_cycle(struct mmc *mmc);
@@ -584,6 +621,61 @@ static inline bool supports_uhs(uint caps)
 #endif
 }
 
+/**
+ * struct mmc_fast_init - bus settings negotiated with a card
+ *
+ * See CONFIG_MMC_FAST_INIT.
+ *
+ * @fingerprint:	CRC32 of the CID and CSD of the card
+ * @mode:		Selected bus mode (enum bus_mode)
+ * @bus_width:		Bus width, in bits
+ * @tuned:		true if @tuning holds a tuning result
+ * @tuning:		Tuning result, from the get_tuning() operation
+ */
+struct mmc_fast_init {
+	u32 fingerprint;
+	u8 mode;
+	u8 bus_width;
+	bool tuned;
+	u32 tuning;
+};
+
+/**
+ * struct mmc_handoff - state of a card left ready by SPL
+ *
+ * See CONFIG_MMC_HANDOFF. This is passed from SPL to U-Boot proper in the
+ * bloblist, so only fixed-size types are used.
+ *
+ * @addr:		Base address of the host controller, 0 if it has none
+ * @cid:		CID of the card
+ * @ocr:		OCR of the card
+ * @version:		Version of the card (SD_VERSION_... or MMC_VERSION_...)
+ * @clock:		Bus clock, in Hz
+ * @tuning:		Tuning result, from the get_tuning() operation
+ * @seq:		Sequence number of the host, used if @addr is 0
+ * @rca:		Relative address of the card
+ * @mode:		Selected bus mode (enum bus_mode)
+ * @bus_width:		Bus width, in bits
+ * @signal_voltage:	Signal voltage (enum mmc_voltage)
+ * @tuned:		1 if @tuning holds a tuning result
+ * @valid:		1 if the card can be taken over, cleared once it is
+ */
+struct mmc_handoff {
+	u64 addr;
+	u32 cid[4];
+	u32 ocr;
+	u32 version;
+	u32 clock;
+	u32 tuning;
+	s32 seq;
+	u16 rca;
+	u8 mode;
+	u8 bus_width;
+	u8 signal_voltage;
+	u8 tuned;
+	u8 valid;
+};
+
 /*
  * With CONFIG_DM_MMC enabled, struct mmc can be accessed from the MMC device
  * with mmc_get_mmc_dev().
@@ -624,6 +716,7 @@ struct mmc {
 #if CONFIG_IS_ENABLED(MMC_WRITE)
 	uint write_bl_len;
 	uint erase_grp_size;	/* in 512-byte sectors */
+	uint trim_timeout;	/* in ms per erase group, 0 if no TRIM */
 #endif
 #if CONFIG_IS_ENABLED(MMC_HW_PARTITIONING)
 	uint hc_wp_grp_size;	/* in 512-byte sectors */
@@ -647,6 +740,12 @@ struct mmc {
 	char init_in_progress;	/* 1 if we have done mmc_start_init() */
 	char preinit;		/* start init as early as possible */
 	int ddr_mode;
+	bool sbc;		/* transfers are sized with SET_BLOCK_COUNT */
+#if CONFIG_IS_ENABLED(MMC_CACHE)
+	bool cache_on;		/* the volatile cache of the card is enabled */
+	bool cache_dirty;	/* writes may be in the cache */
+	bool write_session;	/* see mmc_start_write_session() */
+#endif
 #if CONFIG_IS_ENABLED(DM_MMC)
 	struct udevice *dev;	/* Device for this MMC controller */
 #if CONFIG_IS_ENABLED(DM_REGULATOR)
@@ -664,6 +763,14 @@ struct mmc {
 				  * accessing the boot partitions
 				  */
 	u32 quirks;
+#if CONFIG_IS_ENABLED(MMC_FAST_INIT)
+	struct mmc_fast_init fast_init;	/* settings of the last full init */
+	bool fast_init_valid;	/* fast_init holds usable settings */
+	bool fast_init_try;	/* trying the settings in fast_init */
+#endif
+#if CONFIG_IS_ENABLED(MMC_HANDOFF)
+	struct mmc_handoff *handoff;	/* card being taken over from SPL */
+#endif
 };
 
 struct mmc_hwpart_conf {
@@ -849,6 +956,63 @@ int mmc_start_init(struct mmc *mmc);
  */
 void mmc_set_preinit(struct mmc *mmc, int preinit);
 
+/**
+ * mmc_write_handoff() - Record the state of a card for U-Boot proper
+ *
+ * This writes a struct mmc_handoff to the bloblist, so that U-Boot proper can
+ * take the card over without initialising it again. The card must be left in
+ * the transfer state. See CONFIG_MMC_HANDOFF.
+ *
+ * @mmc:	MMC device, which must be initialised
+ * @return 0 if OK, -EINVAL if the card is not initialised, -ENOSPC if there
+ *	is no space in the bloblist
+ */
+int mmc_write_handoff(struct mmc *mmc);
+
+#if CONFIG_IS_ENABLED(MMC_CACHE)
+/**
+ * mmc_flush_cache() - Write back what is in the volatile cache of an eMMC
+ *
+ * @mmc:	MMC device
+ * @return 0 if OK, -ve on error
+ */
+int mmc_flush_cache(struct mmc *mmc);
+
+/**
+ * mmc_start_write_session() - Let writes stay in the cache of an eMMC
+ *
+ * Outside a write session, mmc_bwrite() flushes the volatile cache of the
+ * device before returning. Within one, the cache is only flushed when the
+ * session ends, so that a series of writes, e.g. of an image, can all go
+ * through the cache. See CONFIG_MMC_CACHE.
+ *
+ * @mmc:	MMC device
+ */
+void mmc_start_write_session(struct mmc *mmc);
+
+/**
+ * mmc_end_write_session() - End a write session and flush the cache
+ *
+ * @mmc:	MMC device
+ * @return 0 if OK, -ve if the cache could not be flushed
+ */
+int mmc_end_write_session(struct mmc *mmc);
+#else
+static inline int mmc_flush_cache(struct mmc *mmc)
+{
+	return 0;
+}
+
+static inline void mmc_start_write_session(struct mmc *mmc)
+{
+}
+
+static inline int mmc_end_write_session(struct mmc *mmc)
+{
+	return 0;
+}
+#endif
+
 #ifdef CONFIG_MMC_SPI
 #define mmc_host_is_spi(mmc)	((mmc)->cfg->host_caps & MMC_MODE_SPI)
 #else
@@ -37,6 +37,10 @@
 
 #define PKTALIGN	ARCH_DMA_MINALIGN
 
+/* Receive ring size of a driver whose own default is @def */
+#define ETH_RX_RING_SIZE(def)	\
+	(CONFIG_ETH_RX_RING_SIZE ? CONFIG_ETH_RX_RING_SIZE : (def))
+
 /* ARP hardware address length */
 #define ARP_HLEN 6
 /*
@@ -123,6 +127,25 @@ enum eth_recv_flags {
 	ETH_RECV_CHECK_DEVICE		= 1 << 0,
 };
 
+/**
+ * struct eth_rx_pkt - A frame returned by the recv_batch() method
+ *
+ * @packet:	Start of the frame
+ * @length:	Length of the frame
+ * @payload:	If not NULL, the frame was split as described by the
+ *		eth_rx_dest in effect when it was received: the first @split
+ *		bytes are at @packet and the rest at @payload. The uclass
+ *		decides whether the payload stays there or is copied back
+ *		behind the headers, to make the frame contiguous again.
+ * @split:	Offset at which the frame was split, if @payload is set
+ */
+struct eth_rx_pkt {
+	uchar *packet;
+	int length;
+	void *payload;
+	int split;
+};
+
 /**
  * struct eth_ops - functions of Ethernet MAC controllers
  *
@@ -133,6 +156,14 @@ enum eth_recv_flags {
  *	 indicate that the hardware receive FIFO is empty. If 0 is returned, the
  *	 network stack will not process the empty packet, but free_pkt() will be
  *	 called if supplied
+ * recv_batch: Like recv() but hand over up to @count frames at once, so that a
+ *	       whole receive ring can be drained in one poll. Returns the number
+ *	       of frames filled in, or an error. free_pkt() is then called for
+ *	       each of them in order, once it has been processed. If the
+ *	       device is stopped meanwhile, free_pkt() is not called for the
+ *	       frame being processed nor the rest of the batch, so stop() or
+ *	       start() must take their buffers back. When provided, it is
+ *	       used instead of recv(), which can then be omitted - optional
  * free_pkt: Give the driver an opportunity to manage its packet buffer memory
  *	     when the network stack is finished processing it. This will only be
  *	     called when no error was returned from recv - optional
@@ -153,6 +184,8 @@ struct eth_ops {
 	int (*start)(struct udevice *dev);
 	int (*send)(struct udevice *dev, void *packet, int length);
 	int (*recv)(struct udevice *dev, int flags, uchar **packetp);
+	int (*recv_batch)(struct udevice *dev, int flags,
+			  struct eth_rx_pkt *pkts, int count);
 	int (*free_pkt)(struct udevice *dev, uchar *packet, int length);
 	void (*stop)(struct udevice *dev);
 	int (*mcast)(struct udevice *dev, const u8 *enetaddr, int join);
@@ -174,6 +207,57 @@ unsigned char *eth_get_ethaddr(void); /* get the current device MAC */
 int eth_is_active(struct udevice *dev); /* Test device for active state */
 int eth_init_state_only(void); /* Set active state */
 void eth_halt_state_only(void); /* Set passive state */
+
+/**
+ * struct eth_rx_dest - Receive packet payloads straight into their destination
+ *
+ * A protocol which stores consecutive packets at a known place, like TFTP
+ * writing blocks to the load address, can register this. Drivers able to
+ * split a received frame over two buffers may then give the hardware receive
+ * buffers whose second part is the destination of a future packet, so that
+ * the payload is not copied again when it arrives in order.
+ *
+ * Since the headers of unrelated frames may also spill into such a buffer,
+ * addr() must only return places which are not in use yet, and a driver must
+ * stop the hardware from using any such buffers left when it is stopped.
+ *
+ * @hdr_len:	Number of bytes in front of the payload of a matching frame,
+ *		counted from the start of the Ethernet header
+ * @max_len:	Maximum payload length of a matching frame. Each area returned
+ *		by addr() must have room for this many bytes
+ * @addr:	Return where to put the payload of the frame that will be
+ *		received @ahead frames after the next one, or NULL to use a
+ *		normal receive buffer for it
+ * @match:	Check whether a received frame, whose first @hdr_len bytes are
+ *		at @pkt and the rest at @payload, is one whose payload belongs
+ *		at @payload. If not, the driver must handle it as a normal,
+ *		contiguous frame. Drivers implementing recv_batch() leave
+ *		this to the uclass, see struct eth_rx_pkt.
+ */
+struct eth_rx_dest {
+	int hdr_len;
+	int max_len;
+	void *(*addr)(int ahead);
+	bool (*match)(uchar *pkt, int len, void *payload);
+};
+
+/**
+ * eth_set_rx_dest() - Set where received payloads should be placed
+ *
+ * This stays in effect until the next eth_halt().
+ *
+ * @dest: Description of the destination, or NULL to receive normally
+ */
+void eth_set_rx_dest(const struct eth_rx_dest *dest);
+
+/**
+ * eth_get_rx_dest() - Get where received payloads should be placed
+ *
+ * This is for use by drivers when adding buffers to their receive ring.
+ *
+ * @return the destination set by eth_set_rx_dest(), or NULL if none
+ */
+const struct eth_rx_dest *eth_get_rx_dest(void);
 #endif
 
 #ifndef CONFIG_DM_ETH
@@ -358,6 +442,7 @@ struct vlan_ethernet_hdr {
 #define PROT_PPP_SES	0x8864		/* PPPoE session messages	*/
 
 #define IPPROTO_ICMP	 1	/* Internet Control Message Protocol	*/
+#define IPPROTO_TCP	 6	/* Transmission Control Protocol	*/
 #define IPPROTO_UDP	17	/* User Datagram Protocol		*/
 
 /*
@@ -531,6 +616,11 @@ extern uchar		*net_tx_packet;		/* THE transmit packet */
 extern uchar		*net_rx_packets[PKTBUFSRX]; /* Receive packets */
 extern uchar		*net_rx_packet;		/* Current receive packet */
 extern int		net_rx_packet_len;	/* Current rx packet length */
+/*
+ * Payload of the current receive packet, if the driver placed it in its
+ * destination apart from the headers (see struct eth_rx_dest)
+ */
+extern uchar		*net_rx_payload;
 extern const u8		net_bcast_ethaddr[ARP_HLEN];	/* Ethernet broadcast address */
 extern const u8		net_null_ethaddr[ARP_HLEN];
 
@@ -543,7 +633,7 @@ extern int		net_restart_wrap;	/* Tried all network devices */
 
 enum proto_t {
 	BOOTP, RARP, ARP, TFTPGET, DHCP, PING, DNS, NFS, CDP, NETCONS, SNTP,
-	TFTPSRV, TFTPPUT, LINKLOCAL, FASTBOOT, WOL
+	TFTPSRV, TFTPPUT, LINKLOCAL, FASTBOOT, WOL, WGET, TFTPMULTI
 };
 
 extern char	net_boot_file_name[1024];/* Boot File name */
@@ -607,12 +697,24 @@ void net_set_udp_header(uchar *pkt, struct in_addr dest, int dport,
 /**
  * compute_ip_checksum() - Compute IP checksum
  *
- * @addr:	Address to check (must be 16-bit aligned)
+ * @addr:	Address to check (any alignment, but faster if 16-bit aligned)
  * @nbytes:	Number of bytes to check (normally a multiple of 2)
  * @return 16-bit IP checksum
  */
 unsigned compute_ip_checksum(const void *addr, unsigned nbytes);
 
+/**
+ * ip_checksum_arch() - Add up a buffer with an architecture-specific kernel
+ *
+ * This is provided by the architecture if CONFIG_USE_ARCH_IP_CHECKSUM is
+ * enabled, and used by compute_ip_checksum() for the bulk of the data.
+ *
+ * @addr:	Address of the data (16-byte aligned)
+ * @nbytes:	Number of bytes to add up (a multiple of 64)
+ * @return sum of the 32-bit words of the data, read in CPU byte order
+ */
+u64 ip_checksum_arch(const void *addr, unsigned nbytes);
+
 /**
  * add_ip_checksums() - add two IP checksums
  *
@@ -640,6 +742,7 @@ void net_set_udp_handler(rxhand_f *);	/* Set UDP RX packet handler */
 rxhand_f *net_get_arp_handler(void);	/* Get ARP RX packet handler */
 void net_set_arp_handler(rxhand_f *);	/* Set ARP RX packet handler */
 bool arp_is_waiting(void);		/* Waiting for ARP reply? */
+void arp_cache_flush(void);		/* Forget all cached neighbours */
 void net_set_icmp_handler(rxhand_icmp_f *f); /* Set ICMP RX handler */
 void net_set_timeout_handler(ulong, thand_f *);/* Set timeout handler */
 
@@ -674,14 +777,18 @@ static inline void net_send_packet(uchar *pkt, int len)
 }
 
 /*
- * Transmit "net_tx_packet" as UDP packet, performing ARP request if needed
- *  (ether will be populated)
+ * Transmit "net_tx_packet" as UDP or TCP packet, performing ARP request if
+ *  needed (ether will be populated)
  *
  * @param ether Raw packet buffer
  * @param dest IP address to send the datagram to
- * @param dport Destination UDP port
- * @param sport Source UDP port
- * @param payload_len Length of data after the UDP header
+ * @param dport Destination UDP/TCP port
+ * @param sport Source UDP/TCP port
+ * @param payload_len Length of data after the UDP/TCP header
+ * @param proto IPPROTO_UDP or IPPROTO_TCP
+ * @param action TCP control flags (TCP_SYN, TCP_ACK, ...)
+ * @param tcp_seq_num TCP sequence number
+ * @param tcp_ack_num TCP acknowledgment number
  */
 int net_send_ip_packet(uchar *ether, struct in_addr dest, int dport, int sport,
 		       int payload_len, int proto, u8 action, u32 tcp_seq_num,
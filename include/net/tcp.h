@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Minimal TCP client
+ */
+
+#ifndef __TCP_H__
+#define __TCP_H__
+
+/*
+ *	Internet Protocol (IP) + TCP header, without TCP options.
+ */
+struct ip_tcp_hdr {
+	u8		ip_hl_v;	/* header length and version	*/
+	u8		ip_tos;		/* type of service		*/
+	u16		ip_len;		/* total length			*/
+	u16		ip_id;		/* identification		*/
+	u16		ip_off;		/* fragment offset field	*/
+	u8		ip_ttl;		/* time to live			*/
+	u8		ip_p;		/* protocol			*/
+	u16		ip_sum;		/* checksum			*/
+	struct in_addr	ip_src;		/* Source IP address		*/
+	struct in_addr	ip_dst;		/* Destination IP address	*/
+	u16		tcp_src;	/* TCP source port		*/
+	u16		tcp_dst;	/* TCP destination port		*/
+	u32		tcp_seq;	/* Sequence number		*/
+	u32		tcp_ack;	/* Acknowledgment number	*/
+	u8		tcp_hlen;	/* Header length in words << 4	*/
+	u8		tcp_flags;	/* Control flags		*/
+	u16		tcp_win;	/* Receive window		*/
+	u16		tcp_xsum;	/* Checksum			*/
+	u16		tcp_ugr;	/* Urgent pointer		*/
+} __attribute__((packed));
+
+#define IP_TCP_HDR_SIZE		(sizeof(struct ip_tcp_hdr))
+#define TCP_HDR_SIZE		(IP_TCP_HDR_SIZE - IP_HDR_SIZE)
+
+/* Control flags, also used as the action of net_send_ip_packet() */
+#define TCP_FIN		0x01
+#define TCP_SYN		0x02
+#define TCP_RST		0x04
+#define TCP_PUSH	0x08
+#define TCP_ACK		0x10
+
+/* Options */
+#define TCP_O_END	0
+#define TCP_O_NOP	1
+#define TCP_O_MSS	2
+#define TCP_O_MSS_LEN	4
+
+/* Largest segment which fits an Ethernet frame */
+#define TCP_MSS		(1500 - IP_TCP_HDR_SIZE)
+
+enum tcp_state {
+	TCP_CLOSED,
+	TCP_SYN_SENT,
+	TCP_ESTABLISHED,
+	TCP_CLOSE_WAIT,		/* the peer has sent all its data */
+};
+
+enum tcp_event {
+	TCP_CONNECTED,		/* the connection is established */
+	TCP_PEER_CLOSED,	/* the peer has sent all its data */
+	TCP_ABORTED,		/* reset by the peer, or it stopped answering */
+};
+
+/**
+ * typedef tcp_rx_handler - Called with data received on the connection
+ *
+ * Data is passed in order and exactly once.
+ *
+ * @data:	The data
+ * @offset:	Position of @data in the stream received
+ * @len:	Number of bytes
+ */
+typedef void tcp_rx_handler(uchar *data, u32 offset, unsigned int len);
+
+/**
+ * typedef tcp_event_handler - Called when the connection changes state
+ *
+ * @event:	What happened
+ */
+typedef void tcp_event_handler(enum tcp_event event);
+
+/**
+ * tcp_connect() - Open a connection
+ *
+ * This starts the handshake; @event is called with TCP_CONNECTED once it is
+ * done. Only one connection can be open at a time. It uses the timeout
+ * handler of the network loop (see net_set_timeout_handler()).
+ *
+ * @dest:	IP address of the server
+ * @dport:	Port to connect to
+ * @rx:		Handler for the data received
+ * @event:	Handler for state changes
+ * @return 0 if OK, -EBUSY if a connection is already open
+ */
+int tcp_connect(struct in_addr dest, int dport, tcp_rx_handler *rx,
+		tcp_event_handler *event);
+
+/**
+ * tcp_send() - Send data on the connection
+ *
+ * The data is copied and retransmitted as needed.
+ *
+ * @data:	Data to send
+ * @len:	Number of bytes
+ * @return 0 if OK, -ENOTCONN if the connection is not established, -ENOSPC
+ * if the data does not fit in the buffer of data not acknowledged yet
+ */
+int tcp_send(const void *data, int len);
+
+/**
+ * tcp_close() - Close the connection
+ *
+ * This sends our FIN but does not wait for the peer to acknowledge it or to
+ * finish its side: nothing is received on the connection afterwards.
+ */
+void tcp_close(void);
+
+/**
+ * tcp_abort() - Reset the connection
+ */
+void tcp_abort(void);
+
+/**
+ * tcp_stop() - Forget about the connection
+ *
+ * This is called when the network loop ends. The peer is not told.
+ */
+void tcp_stop(void);
+
+/**
+ * tcp_get_state() - Get the state of the connection
+ *
+ * @return the state
+ */
+enum tcp_state tcp_get_state(void);
+
+/**
+ * tcp_set_tcp_header() - Fill in the IP and TCP headers of a segment
+ *
+ * This is for use by net_send_ip_packet(). A SYN segment gets our MSS as an
+ * option, and cannot carry data.
+ *
+ * @pkt:	Start of the IP header, with the data following the TCP header
+ *		without options
+ * @dest:	Destination IP address
+ * @dport:	Destination port
+ * @sport:	Source port
+ * @payload_len:	Number of data bytes
+ * @action:	TCP control flags
+ * @tcp_seq_num:	Sequence number
+ * @tcp_ack_num:	Acknowledgment number
+ * @return the size of the IP and TCP headers
+ */
+int tcp_set_tcp_header(uchar *pkt, struct in_addr dest, int dport, int sport,
+		       int payload_len, u8 action, u32 tcp_seq_num,
+		       u32 tcp_ack_num);
+
+/**
+ * tcp_receive() - Process a received TCP segment
+ *
+ * @ip:		The IP header of the segment
+ * @len:	Length of the segment including the IP header
+ */
+void tcp_receive(struct ip_tcp_hdr *ip, unsigned int len);
+
+#endif /* __TCP_H__ */
@@ -22,6 +22,45 @@ void tftp_start(enum proto_t protocol);	/* Begin TFTP get/put */
 void tftp_start_server(void);	/* Wait for incoming TFTP put */
 #endif
 
+/* Most files tftp_get_files() can fetch at once */
+#define TFTP_MAX_FILES	16
+
+/**
+ * struct tftp_file - A file fetched by tftp_get_files()
+ *
+ * @name:	Name of the file, as [hostIPaddr:]filename
+ * @addr:	Address to load the file at
+ * @size:	Returns the size of the file
+ * @err:	Returns 0 if the file was loaded, -ENOENT if the server does
+ *		not have it, or another -ve error
+ */
+struct tftp_file {
+	const char *name;
+	ulong addr;
+	ulong size;
+	int err;
+};
+
+void tftp_multi_start(void);	/* Begin TFTP get of several files */
+
+/**
+ * tftp_get_files() - Fetch several files from the TFTP server at once
+ *
+ * The files are all asked for together, each over its own port, so that the
+ * answer about one need not be waited for before asking for the next.
+ *
+ * With @first set, the files are candidates in order of preference, usually
+ * all for the same address, and only the first one the server has is loaded.
+ *
+ * @files:	Files to fetch
+ * @count:	Number of files, at most TFTP_MAX_FILES
+ * @first:	Only load the first file which exists
+ * @return index of the file loaded if @first is set, else 0 if all the files
+ *	were loaded; -ve on error, which is the error of the first file which
+ *	could not be loaded if @first is not set
+ */
+int tftp_get_files(struct tftp_file *files, int count, bool first);
+
 extern ulong tftp_timeout_ms;
 extern int tftp_timeout_count_max;
 
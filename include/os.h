@@ -51,6 +51,19 @@ off_t os_lseek(int fd, off_t offset, int whence);
 #define OS_SEEK_CUR	1
 #define OS_SEEK_END	2
 
+/**
+ * Access to the OS fallocate() system call, to punch a hole in a file
+ *
+ * The file keeps its size and reads as zero in the hole.
+ *
+ * \param fd	File descriptor as returned by os_open()
+ * \param offset	Offset of the hole in bytes
+ * \param len	Length of the hole in bytes
+ * \return 0 on success, -1 on error, e.g. if the file system of the file
+ * does not support holes
+ */
+int os_punch_hole(int fd, off_t offset, off_t len);
+
 /**
  * Access to the OS open() system call
  *
@@ -6,9 +6,16 @@
 #ifndef __SANDBOX_BLOCK_DEV__
 #define __SANDBOX_BLOCK_DEV__
 
+/* Number of reads which can be submitted to a host device at once */
+#define HOST_QUEUE_DEPTH	4
+
 struct host_block_dev {
 #ifndef CONFIG_BLK
 	struct blk_desc blk_dev;
+#else
+	/* reads submitted, oldest first, made one per poll */
+	struct blk_req *queue[HOST_QUEUE_DEPTH];
+	int queued;
 #endif
 	char *filename;
 	int fd;
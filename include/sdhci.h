@@ -160,6 +160,8 @@
 #define  SDHCI_CTRL_DRV_TYPE_D	0x0030
 #define  SDHCI_CTRL_EXEC_TUNING	0x0040
 #define  SDHCI_CTRL_TUNED_CLK	0x0080
+#define  SDHCI_CTRL_V4_MODE	0x1000
+#define  SDHCI_CTRL_64BIT_ADDR	0x2000
 #define  SDHCI_CTRL_PRESET_VAL_ENABLE	0x8000
 
 #define SDHCI_CAPABILITIES	0x40
@@ -179,6 +181,7 @@
 #define  SDHCI_CAN_VDD_330	BIT(24)
 #define  SDHCI_CAN_VDD_300	BIT(25)
 #define  SDHCI_CAN_VDD_180	BIT(26)
+#define  SDHCI_CAN_64BIT_V4	BIT(27)
 #define  SDHCI_CAN_64BIT	BIT(28)
 
 #define SDHCI_CAPABILITIES_1	0x44
@@ -216,6 +219,7 @@
 #define   SDHCI_SPEC_100	0
 #define   SDHCI_SPEC_200	1
 #define   SDHCI_SPEC_300	2
+#define   SDHCI_SPEC_400	3
 
 #define SDHCI_GET_VERSION(x) (x->version & SDHCI_SPEC_VER_MASK)
 
@@ -243,6 +247,12 @@
 #define SDHCI_QUIRK_WAIT_SEND_CMD	(1 << 6)
 #define SDHCI_QUIRK_USE_WIDE8		(1 << 8)
 #define SDHCI_QUIRK_NO_1_8_V		(1 << 9)
+/*
+ * SDHCI_QUIRK_NO_CMD23
+ * the controller mishandles SET_BLOCK_COUNT (CMD23), so multiple-block
+ * transfers are stopped with STOP_TRANSMISSION instead
+ */
+#define SDHCI_QUIRK_NO_CMD23		(1 << 10)
 
 /* to make gcc happy */
 struct sdhci_host;
@@ -276,8 +286,10 @@ struct sdhci_ops {
 #else
 #define ADMA_DESC_LEN	8
 #endif
-#define ADMA_TABLE_NO_ENTRIES (CONFIG_SYS_MMC_MAX_BLK_COUNT * \
-			       MMC_MAX_BLOCK_LEN) / ADMA_MAX_LEN
+/* Two more for the ends of unaligned buffers, see sdhci_adma_split() */
+#define ADMA_TABLE_NO_ENTRIES \
+	(DIV_ROUND_UP(CONFIG_SYS_MMC_MAX_BLK_COUNT * MMC_MAX_BLOCK_LEN, \
+		      ADMA_MAX_LEN) + 2)
 
 #define ADMA_TABLE_SZ (ADMA_TABLE_NO_ENTRIES * ADMA_DESC_LEN)
 
@@ -331,7 +343,13 @@ struct sdhci_host {
 #if CONFIG_IS_ENABLED(MMC_SDHCI_ADMA)
 	struct sdhci_adma_desc *adma_desc_table;
 	uint desc_slot;
+	void *align_buffer;	/* for the ends of unaligned buffers */
 #endif
+	/*
+	 * Set by the driver before sdhci_setup_cfg() to run a version 4
+	 * controller in version 4 mode, with 128-bit ADMA2 descriptors
+	 */
+	bool v4_mode;
 };
 
 #ifdef CONFIG_MMC_SDHCI_IO_ACCESSORS
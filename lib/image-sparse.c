@@ -171,6 +171,27 @@ int write_sparse_image(struct sparse_storage *info,
 				return -1;
 			}
 
+			fill_val = *(uint32_t *)data;
+			data = (char *)data + sizeof(uint32_t);
+
+			if (blk + blkcnt > info->start + info->size) {
+				printf(
+				    "%s: Request would exceed partition size!\n",
+				    __func__);
+				info->mssg("Request would exceed partition size!",
+					   response);
+				return -1;
+			}
+
+			/* no need to write zeroes if discarding leaves them */
+			if (!fill_val && info->discard_zeroes &&
+			    info->discard(info, blk, blkcnt) == blkcnt) {
+				blk += blkcnt;
+				bytes_written += blkcnt * info->blksz;
+				total_blocks += chunk_header->chunk_sz;
+				break;
+			}
+
 			fill_buf = (uint32_t *)
 				   memalign(ARCH_DMA_MINALIGN,
 					    ROUNDUP(
@@ -182,24 +203,12 @@ int write_sparse_image(struct sparse_storage *info,
 				return -1;
 			}
 
-			fill_val = *(uint32_t *)data;
-			data = (char *)data + sizeof(uint32_t);
-
 			for (i = 0;
 			     i < (info->blksz * fill_buf_num_blks /
 				  sizeof(fill_val));
 			     i++)
 				fill_buf[i] = fill_val;
 
-			if (blk + blkcnt > info->start + info->size) {
-				printf(
-				    "%s: Request would exceed partition size!\n",
-				    __func__);
-				info->mssg("Request would exceed partition size!",
-					   response);
-				return -1;
-			}
-
 			for (i = 0; i < blkcnt;) {
 				j = blkcnt - i;
 				if (j > fill_buf_num_blks)
@@ -225,6 +234,10 @@ int write_sparse_image(struct sparse_storage *info,
 			break;
 
 		case CHUNK_TYPE_DONT_CARE:
+			/* a failure does no harm, the blocks are unused */
+			if (info->discard &&
+			    blk + blkcnt <= info->start + info->size)
+				info->discard(info, blk, blkcnt);
 			blk += info->reserve(info, blk, blkcnt);
 			total_blocks += chunk_header->chunk_sz;
 			break;
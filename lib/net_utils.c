@@ -57,27 +57,95 @@ void string_to_enetaddr(const char *addr, uint8_t *enetaddr)
 	}
 }
 
+/*
+ * The one's complement sum of 16-bit words can be computed on wider words
+ * and folded at the end, since 2^16 equals 1 modulo 0xffff. Wide words are
+ * read once the pointer is aligned for them.
+ */
+#if CONFIG_IS_ENABLED(USE_ARCH_IP_CHECKSUM)
+#define IP_CHECKSUM_ALIGN	16
+#else
+#define IP_CHECKSUM_ALIGN	sizeof(ulong)
+#endif
+
+static inline u64 ip_checksum_long(ulong word)
+{
+	if (sizeof(word) > sizeof(u32))
+		return (u32)word + ((u64)word >> 32);
+
+	return word;
+}
+
 uint compute_ip_checksum(const void *vptr, uint nbytes)
 {
-	int sum, oddbyte;
-	const unsigned short *ptr = vptr;
+	const u8 *ptr = vptr;
+	const ulong *wptr;
+	bool odd = (ulong)ptr & 1;
+	union {
+		u16 word;
+		u8 byte[2];
+	} edge;
+	u64 sum = 0;
+
+	/*
+	 * Start from an even address by summing as if the data began one
+	 * byte later; this swaps the bytes of the result, undone below.
+	 */
+	if (odd && nbytes) {
+		edge.byte[0] = 0;
+		edge.byte[1] = *ptr++;
+		sum = edge.word;
+		nbytes--;
+	}
+
+	while (nbytes >= 2 && ((ulong)ptr & (IP_CHECKSUM_ALIGN - 1))) {
+		sum += *(const u16 *)ptr;
+		ptr += 2;
+		nbytes -= 2;
+	}
+
+#if CONFIG_IS_ENABLED(USE_ARCH_IP_CHECKSUM)
+	if (nbytes >= 64) {
+		uint len = nbytes & ~63;
+
+		sum += ip_checksum_arch(ptr, len);
+		ptr += len;
+		nbytes -= len;
+	}
+#endif
 
-	sum = 0;
+	wptr = (const ulong *)ptr;
+	while (nbytes >= 4 * sizeof(ulong)) {
+		sum += ip_checksum_long(wptr[0]);
+		sum += ip_checksum_long(wptr[1]);
+		sum += ip_checksum_long(wptr[2]);
+		sum += ip_checksum_long(wptr[3]);
+		wptr += 4;
+		nbytes -= 4 * sizeof(ulong);
+	}
+	while (nbytes >= sizeof(ulong)) {
+		sum += ip_checksum_long(*wptr++);
+		nbytes -= sizeof(ulong);
+	}
+
+	ptr = (const u8 *)wptr;
 	while (nbytes > 1) {
-		sum += *ptr++;
+		sum += *(const u16 *)ptr;
+		ptr += 2;
 		nbytes -= 2;
 	}
 	if (nbytes == 1) {
-		oddbyte = 0;
-		((u8 *)&oddbyte)[0] = *(u8 *)ptr;
-		((u8 *)&oddbyte)[1] = 0;
-		sum += oddbyte;
+		edge.byte[0] = *ptr;
+		edge.byte[1] = 0;
+		sum += edge.word;
 	}
-	sum = (sum >> 16) + (sum & 0xffff);
-	sum += (sum >> 16);
-	sum = ~sum & 0xffff;
 
-	return sum;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	if (odd)
+		sum = ((sum >> 8) | (sum << 8)) & 0xffff;
+
+	return ~sum & 0xffff;
 }
 
 uint add_ip_checksums(uint offset, uint sum, uint new)
@@ -27,6 +27,21 @@
 # define ARP_TIMEOUT_COUNT	CONFIG_NET_RETRY_COUNT
 #endif
 
+/* Milliseconds for which a learned Ethernet address is trusted */
+#define ARP_CACHE_AGE		30000UL
+
+struct arp_cache_entry {
+	struct in_addr	ip;		/* 0 if the entry is free */
+	uchar		ethaddr[ARP_HLEN];
+	ulong		learned;	/* get_timer() when it was learned */
+	ulong		used;		/* arp_cache_clock at the last use */
+};
+
+static struct arp_cache_entry arp_cache[CONFIG_NET_ARP_CACHE_SIZE];
+static ulong arp_cache_clock;
+/* Index of the interface the cached addresses were learned on */
+static int arp_cache_dev = -1;
+
 struct in_addr net_arp_wait_packet_ip;
 static struct in_addr net_arp_wait_reply_ip;
 /* MAC address of waiting packet's destination */
@@ -46,6 +61,86 @@ void arp_init(void)
 	arp_wait_tx_packet_size = 0;
 	arp_tx_packet = &arp_tx_packet_buf[0] + (PKTALIGN - 1);
 	arp_tx_packet -= (ulong)arp_tx_packet % PKTALIGN;
+	arp_cache_flush();
+	arp_cache_dev = -1;
+}
+
+void arp_cache_flush(void)
+{
+	memset(arp_cache, 0, sizeof(arp_cache));
+}
+
+/* Entries learned on another interface mean nothing on this one */
+static void arp_cache_check_dev(void)
+{
+	int dev = eth_get_dev_index();
+
+	if (dev != arp_cache_dev) {
+		arp_cache_flush();
+		arp_cache_dev = dev;
+	}
+}
+
+static void arp_cache_add(struct in_addr ip, const uchar *ethaddr)
+{
+	struct arp_cache_entry *entry, *victim = NULL;
+	int i;
+
+	if (!ARRAY_SIZE(arp_cache) || !ip.s_addr)
+		return;
+
+	arp_cache_check_dev();
+	/* Refresh the same address, else fill a free or the LRU entry */
+	for (i = 0; i < ARRAY_SIZE(arp_cache); i++) {
+		entry = &arp_cache[i];
+		if (entry->ip.s_addr == ip.s_addr) {
+			victim = entry;
+			break;
+		}
+		if (!victim || (victim->ip.s_addr &&
+				(!entry->ip.s_addr ||
+				 entry->used < victim->used)))
+			victim = entry;
+	}
+
+	victim->ip = ip;
+	memcpy(victim->ethaddr, ethaddr, ARP_HLEN);
+	victim->learned = get_timer(0);
+	victim->used = ++arp_cache_clock;
+}
+
+/* The address to resolve to reach @dest: @dest itself or the gateway */
+static struct in_addr arp_next_hop(struct in_addr dest)
+{
+	if ((dest.s_addr & net_netmask.s_addr) !=
+	    (net_ip.s_addr & net_netmask.s_addr) && net_gateway.s_addr)
+		return net_gateway;
+
+	return dest;
+}
+
+int arp_cache_lookup(struct in_addr dest, uchar *ethaddr)
+{
+	struct in_addr ip = arp_next_hop(dest);
+	struct arp_cache_entry *entry;
+	int i;
+
+	arp_cache_check_dev();
+	for (i = 0; i < ARRAY_SIZE(arp_cache); i++) {
+		entry = &arp_cache[i];
+		if (entry->ip.s_addr != ip.s_addr)
+			continue;
+
+		if (get_timer(entry->learned) > ARP_CACHE_AGE) {
+			entry->ip.s_addr = 0;
+			break;
+		}
+		entry->used = ++arp_cache_clock;
+		memcpy(ethaddr, entry->ethaddr, ARP_HLEN);
+		return 0;
+	}
+
+	return -ENOENT;
 }
 
 void arp_raw_request(struct in_addr source_ip, const uchar *target_ethaddr,
@@ -81,17 +176,10 @@ void arp_raw_request(struct in_addr source_ip, const uchar *target_ethaddr,
 void arp_request(void)
 {
 	if ((net_arp_wait_packet_ip.s_addr & net_netmask.s_addr) !=
-	    (net_ip.s_addr & net_netmask.s_addr)) {
-		if (net_gateway.s_addr == 0) {
-			puts("## Warning: gatewayip needed but not set\n");
-			net_arp_wait_reply_ip = net_arp_wait_packet_ip;
-		} else {
-			net_arp_wait_reply_ip = net_gateway;
-		}
-	} else {
-		net_arp_wait_reply_ip = net_arp_wait_packet_ip;
-	}
+	    (net_ip.s_addr & net_netmask.s_addr) && net_gateway.s_addr == 0)
+		puts("## Warning: gatewayip needed but not set\n");
 
+	net_arp_wait_reply_ip = arp_next_hop(net_arp_wait_packet_ip);
 	arp_raw_request(net_ip, net_null_ethaddr, net_arp_wait_reply_ip);
 }
 
@@ -158,6 +246,9 @@ void arp_receive(struct ethernet_hdr *et, struct ip_udp_hdr *ip, int len)
 	if (net_read_ip(&arp->ar_tpa).s_addr != net_ip.s_addr)
 		return;
 
+	/* Whoever asks for us or answers us is a neighbour worth keeping */
+	arp_cache_add(net_read_ip(&arp->ar_spa), &arp->ar_sha);
+
 	switch (ntohs(arp->ar_op)) {
 	case ARPOP_REQUEST:
 		/* reply with our IP address */
@@ -23,6 +23,16 @@ extern int arp_wait_try;
 extern uchar *arp_tx_packet;
 
 void arp_init(void);
+/**
+ * arp_cache_lookup() - Look up the Ethernet address to use to reach @dest
+ *
+ * This resolves the gateway instead when @dest is not on the local subnet.
+ *
+ * @dest:	IP address the packet is sent to
+ * @ethaddr:	Set to the Ethernet address if it is known
+ * @return 0 if found, -ENOENT if an ARP request is needed
+ */
+int arp_cache_lookup(struct in_addr dest, uchar *ethaddr);
 void arp_request(void);
 void arp_raw_request(struct in_addr source_ip, const uchar *targetEther,
 	struct in_addr target_ip);
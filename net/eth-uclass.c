@@ -20,18 +20,22 @@ DECLARE_GLOBAL_DATA_PTR;
  * struct eth_device_priv - private structure for each Ethernet device
  *
  * @state: The state of the Ethernet MAC driver (defined by enum eth_state_t)
+ * @stops: Number of times the driver has been stopped
  */
 struct eth_device_priv {
 	enum eth_state_t state;
+	unsigned int stops;
 };
 
 /**
  * struct eth_uclass_priv - The structure attached to the uclass itself
  *
  * @current: The Ethernet device that the network functions are using
+ * @rx_dest: Where received payloads should be placed, if known
  */
 struct eth_uclass_priv {
 	struct udevice *current;
+	const struct eth_rx_dest *rx_dest;
 };
 
 /* eth_errno - This stores the most recent failure code from DM functions */
@@ -307,14 +311,19 @@ void eth_halt(void)
 	struct udevice *current;
 	struct eth_device_priv *priv;
 
+	/* The stop() below takes back any buffers placed for it */
+	eth_get_uclass_priv()->rx_dest = NULL;
+
 	current = eth_get_dev();
 	if (!current || !eth_is_active(current))
 		return;
 
 	eth_get_ops(current)->stop(current);
 	priv = current->uclass_priv;
-	if (priv)
+	if (priv) {
 		priv->state = ETH_STATE_PASSIVE;
+		priv->stops++;
+	}
 }
 
 int eth_is_active(struct udevice *dev)
@@ -352,6 +361,52 @@ int eth_send(void *packet, int length)
 	return ret;
 }
 
+/* Drain the receive ring of a driver which can return several frames */
+static int eth_rx_batch(struct udevice *current)
+{
+	struct eth_device_priv *priv = dev_get_uclass_priv(current);
+	struct eth_ops *ops = eth_get_ops(current);
+	struct eth_rx_pkt pkts[ETH_RX_RING_SIZE(32)];
+	const struct eth_rx_dest *dest;
+	unsigned int stops = priv->stops;
+	struct eth_rx_pkt *pkt;
+	int ret;
+	int i;
+
+	ret = ops->recv_batch(current, ETH_RECV_CHECK_DEVICE, pkts,
+			      ARRAY_SIZE(pkts));
+	for (i = 0; i < ret; i++) {
+		pkt = &pkts[i];
+		if (pkt->payload) {
+			/*
+			 * Whether the payload is where it belongs depends on
+			 * the frames processed before, so check it only now
+			 */
+			dest = eth_get_rx_dest();
+			if (dest && dest->hdr_len == pkt->split &&
+			    dest->match(pkt->packet, pkt->length,
+					pkt->payload))
+				net_rx_payload = pkt->payload;
+			else
+				memcpy(pkt->packet + pkt->split, pkt->payload,
+				       pkt->length - pkt->split);
+		}
+		net_process_received_packet(pkt->packet, pkt->length);
+		net_rx_payload = NULL;
+		/*
+		 * A frame may end the transfer and stop the device. The rest
+		 * of the batch then belongs to the old session: drop it and
+		 * leave its buffers to the driver, which took them back.
+		 */
+		if (eth_get_dev() != current || priv->stops != stops)
+			break;
+		if (ops->free_pkt)
+			ops->free_pkt(current, pkt->packet, pkt->length);
+	}
+
+	return ret;
+}
+
 int eth_rx(void)
 {
 	struct udevice *current;
@@ -367,6 +422,11 @@ int eth_rx(void)
 	if (!eth_is_active(current))
 		return -EINVAL;
 
+	if (eth_get_ops(current)->recv_batch) {
+		ret = eth_rx_batch(current);
+		goto out;
+	}
+
 	/* Process up to 32 packets at one time */
 	flags = ETH_RECV_CHECK_DEVICE;
 	for (i = 0; i < 32; i++) {
@@ -374,11 +434,13 @@ int eth_rx(void)
 		flags = 0;
 		if (ret > 0)
 			net_process_received_packet(packet, ret);
+		net_rx_payload = NULL;
 		if (ret >= 0 && eth_get_ops(current)->free_pkt)
 			eth_get_ops(current)->free_pkt(current, packet, ret);
 		if (ret <= 0)
 			break;
 	}
+out:
 	if (ret == -EAGAIN)
 		ret = 0;
 	if (ret < 0) {
@@ -388,6 +450,20 @@ int eth_rx(void)
 	return ret;
 }
 
+void eth_set_rx_dest(const struct eth_rx_dest *dest)
+{
+	eth_get_uclass_priv()->rx_dest = dest;
+}
+
+const struct eth_rx_dest *eth_get_rx_dest(void)
+{
+	/* Captured packets must be contiguous */
+	if (IS_ENABLED(CONFIG_CMD_PCAP) && pcap_active())
+		return NULL;
+
+	return eth_get_uclass_priv()->rx_dest;
+}
+
 int eth_initialize(void)
 {
 	int num_devices = 0;
@@ -502,6 +578,8 @@ static int eth_post_probe(struct udevice *dev)
 			ops->send += gd->reloc_off;
 		if (ops->recv)
 			ops->recv += gd->reloc_off;
+		if (ops->recv_batch)
+			ops->recv_batch += gd->reloc_off;
 		if (ops->free_pkt)
 			ops->free_pkt += gd->reloc_off;
 		if (ops->stop)
@@ -572,6 +650,9 @@ static int eth_pre_remove(struct udevice *dev)
 	/* clear the MAC address */
 	memset(pdata->enetaddr, 0, ARP_HLEN);
 
+	/* A device probed later may reuse this index on another network */
+	arp_cache_flush();
+
 	return 0;
 }
 
@@ -100,6 +100,12 @@
 #if defined(CONFIG_CMD_PCAP)
 #include <net/pcap.h>
 #endif
+#if defined(CONFIG_PROT_TCP)
+#include <net/tcp.h>
+#endif
+#if defined(CONFIG_CMD_WGET)
+#include <net/wget.h>
+#endif
 #if defined(CONFIG_LED_STATUS)
 #include <miiphy.h>
 #include <status_led.h>
@@ -150,6 +156,8 @@ struct in_addr	net_server_ip;
 uchar *net_rx_packet;
 /* Current rx packet length */
 int		net_rx_packet_len;
+/* Payload of the current receive packet, if placed apart from its headers */
+uchar *net_rx_payload;
 /* IP packet ID */
 static unsigned	net_ip_id;
 /* Ethernet bcast address */
@@ -369,6 +377,9 @@ static void net_clear_handlers(void)
 static void net_cleanup_loop(void)
 {
 	net_clear_handlers();
+#if defined(CONFIG_PROT_TCP)
+	tcp_stop();
+#endif
 }
 
 void net_init(void)
@@ -466,6 +477,11 @@ restart:
 			tftp_start_server();
 			break;
 #endif
+#ifdef CONFIG_TFTP_PARALLEL
+		case TFTPMULTI:
+			tftp_multi_start();
+			break;
+#endif
 #ifdef CONFIG_UDP_FUNCTION_FASTBOOT
 		case FASTBOOT:
 			fastboot_start_server();
@@ -502,6 +518,11 @@ restart:
 			nfs_start();
 			break;
 #endif
+#if defined(CONFIG_CMD_WGET)
+		case WGET:
+			wget_start();
+			break;
+#endif
 #if defined(CONFIG_CMD_CDP)
 		case CDP:
 			cdp_start();
@@ -652,6 +673,8 @@ restart:
 
 		case NETLOOP_FAIL:
 			net_cleanup_loop();
+			/* A stale ARP entry may be why the peer went quiet */
+			arp_cache_flush();
 			/* Invalidate the last protocol */
 			eth_set_last_protocol(BOOTP);
 			debug_cond(DEBUG_INT_STATE, "--- net_loop Fail!\n");
@@ -839,6 +862,10 @@ int net_send_ip_packet(uchar *ether, struct in_addr dest, int dport, int sport,
 	if (dest.s_addr == 0xFFFFFFFF)
 		ether = (uchar *)net_bcast_ethaddr;
 
+	/* a neighbour resolved recently needs no ARP request */
+	if (memcmp(ether, net_null_ethaddr, 6) == 0)
+		arp_cache_lookup(dest, ether);
+
 	pkt = (uchar *)net_tx_packet;
 
 	eth_hdr_size = net_set_ether(pkt, ether, PROT_IP);
@@ -849,6 +876,14 @@ int net_send_ip_packet(uchar *ether, struct in_addr dest, int dport, int sport,
 				   payload_len);
 		pkt_hdr_size = eth_hdr_size + IP_UDP_HDR_SIZE;
 		break;
+#if defined(CONFIG_PROT_TCP)
+	case IPPROTO_TCP:
+		pkt_hdr_size = eth_hdr_size +
+			tcp_set_tcp_header(pkt + eth_hdr_size, dest, dport,
+					   sport, payload_len, action,
+					   tcp_seq_num, tcp_ack_num);
+		break;
+#endif
 	default:
 		return -EINVAL;
 	}
@@ -870,8 +905,8 @@ int net_send_ip_packet(uchar *ether, struct in_addr dest, int dport, int sport,
 		arp_request();
 		return 1;	/* waiting */
 	} else {
-		debug_cond(DEBUG_DEV_PKT, "sending UDP to %pI4/%pM\n",
-			   &dest, ether);
+		debug_cond(DEBUG_DEV_PKT, "sending IP (%d) to %pI4/%pM\n",
+			   proto, &dest, ether);
 		net_send_packet(net_tx_packet, pkt_hdr_size + payload_len);
 		return 0;	/* transmitted */
 	}
@@ -883,9 +918,6 @@ int net_send_ip_packet(uchar *ether, struct in_addr dest, int dport, int sport,
  * to the algorithm in RFC815. It returns NULL or the pointer to
  * a complete packet, in static storage
  */
-#ifndef CONFIG_NET_MAXDEFRAG
-#define CONFIG_NET_MAXDEFRAG 16384
-#endif
 #define IP_PKTSIZE (CONFIG_NET_MAXDEFRAG)
 
 #define IP_MAXUDP (IP_PKTSIZE - IP_HDR_SIZE)
@@ -1019,6 +1051,11 @@ static struct ip_udp_hdr *__net_defragment(struct ip_udp_hdr *ip, int *lenp)
 
 	localip->ip_len = htons(total_len);
 	*lenp = total_len + IP_HDR_SIZE;
+	/*
+	 * The hole list is gone: a late duplicate of a fragment must start
+	 * a new packet rather than walk it
+	 */
+	total_len = 0;
 	return localip;
 }
 
@@ -1258,6 +1295,11 @@ void net_process_received_packet(uchar *in_packet, int len)
 		if (ip->ip_p == IPPROTO_ICMP) {
 			receive_icmp(ip, len, src_ip, et);
 			return;
+#if defined(CONFIG_PROT_TCP)
+		} else if (ip->ip_p == IPPROTO_TCP) {
+			tcp_receive((struct ip_tcp_hdr *)ip, len);
+			return;
+#endif
 		} else if (ip->ip_p != IPPROTO_UDP) {	/* Only UDP packets */
 			return;
 		}
@@ -1271,34 +1313,41 @@ void net_process_received_packet(uchar *in_packet, int len)
 
 #ifdef CONFIG_UDP_CHECKSUM
 		if (ip->udp_xsum != 0) {
-			ulong   xsum;
-			u8 *sumptr;
-			ushort  sumlen;
-
-			xsum  = ip->ip_p;
-			xsum += (ntohs(ip->udp_len));
-			xsum += (ntohl(ip->ip_src.s_addr) >> 16) & 0x0000ffff;
-			xsum += (ntohl(ip->ip_src.s_addr) >>  0) & 0x0000ffff;
-			xsum += (ntohl(ip->ip_dst.s_addr) >> 16) & 0x0000ffff;
-			xsum += (ntohl(ip->ip_dst.s_addr) >>  0) & 0x0000ffff;
-
-			sumlen = ntohs(ip->udp_len);
-			sumptr = (u8 *)&ip->udp_src;
-
-			while (sumlen > 1) {
-				/* inlined ntohs() to avoid alignment errors */
-				xsum += (sumptr[0] << 8) + sumptr[1];
-				sumptr += 2;
-				sumlen -= 2;
-			}
-			if (sumlen > 0)
-				xsum += (sumptr[0] << 8) + sumptr[0];
-			while ((xsum >> 16) != 0) {
-				xsum = (xsum & 0x0000ffff) +
-				       ((xsum >> 16) & 0x0000ffff);
-			}
-			if ((xsum != 0x00000000) && (xsum != 0x0000ffff)) {
-				printf(" UDP wrong checksum %08lx %08x\n",
+			struct {
+				struct in_addr src;
+				struct in_addr dst;
+				u8 zero;
+				u8 proto;
+				u16 len;
+			} __attribute__((packed)) ph;
+			u8 *sumptr = (u8 *)&ip->udp_src;
+			uint sumlen = ntohs(ip->udp_len);
+			uint len1 = sumlen;
+			uint xsum;
+
+			net_copy_ip(&ph.src, &ip->ip_src);
+			net_copy_ip(&ph.dst, &ip->ip_dst);
+			ph.zero = 0;
+			ph.proto = ip->ip_p;
+			ph.len = ip->udp_len;
+#ifdef CONFIG_DM_ETH
+			/* The payload may have been placed apart (even offset) */
+			if (net_rx_payload && eth_get_rx_dest())
+				len1 = min(sumlen, (uint)(in_packet +
+					   eth_get_rx_dest()->hdr_len - sumptr));
+#endif
+
+			xsum = add_ip_checksums(sizeof(ph),
+						compute_ip_checksum(&ph,
+								    sizeof(ph)),
+						compute_ip_checksum(sumptr,
+								    len1));
+			if (len1 < sumlen)
+				xsum = add_ip_checksums(sizeof(ph) + len1, xsum,
+						compute_ip_checksum(net_rx_payload,
+								    sumlen - len1));
+			if (xsum != 0 && xsum != 0xffff) {
+				printf(" UDP wrong checksum %04x %04x\n",
 				       xsum, ntohs(ip->udp_xsum));
 				return;
 			}
@@ -1361,10 +1410,14 @@ static int net_check_prereq(enum proto_t protocol)
 #endif
 #if defined(CONFIG_CMD_NFS)
 	case NFS:
+#endif
+#if defined(CONFIG_CMD_WGET)
+	case WGET:
 #endif
 		/* Fall through */
 	case TFTPGET:
 	case TFTPPUT:
+	case TFTPMULTI:
 		if (net_server_ip.s_addr == 0 && !is_serverip_in_cmd()) {
 			puts("*** ERROR: `serverip' not set\n");
 			return 1;
@@ -33,6 +33,7 @@
 #include <net.h>
 #include <malloc.h>
 #include <mapmem.h>
+#include <linux/log2.h>
 #include "nfs.h"
 #include "bootp.h"
 #include <time.h>
@@ -48,12 +49,36 @@
 #define NFS_RPC_ERR	1
 #define NFS_RPC_DROP	124
 
+/* Room taken by the headers of a READ reply */
+#define NFS_READ_OVERHEAD	(IP_UDP_HDR_SIZE + \
+				 (6 + NFS_MAX_ATTRS) * sizeof(uint32_t))
+#ifdef CONFIG_IP_DEFRAG
+#define NFS_MAX_READ_SIZE	(CONFIG_NET_MAXDEFRAG - NFS_READ_OVERHEAD)
+#else
+#define NFS_MAX_READ_SIZE	NFS_READ_SIZE
+#endif
+
 static int fs_mounted;
 static unsigned long rpc_id;
-static int nfs_offset = -1;
-static int nfs_len;
 static ulong nfs_timeout = NFS_TIMEOUT;
 
+/*
+ * A READ request in flight. Requests cover the file in order up to
+ * nfs_offset; the replies can come back in any order.
+ */
+struct nfs_read {
+	unsigned long id;	/* RPC id, 0 if the slot is free */
+	int offset;
+	int len;
+};
+
+static struct nfs_read nfs_reads[CONFIG_NFS_READ_WINDOW];
+static int nfs_offset = -1;	/* first byte not asked for yet */
+static int nfs_eof;		/* size of the file, once known */
+static int nfs_read_size;	/* bytes asked for by each request */
+static ulong nfs_read_bytes;	/* bytes received so far */
+static int nfs_num_hash;
+
 static char dirfh[NFS_FHSIZE];	/* NFSv2 / NFSv3 file handle of directory */
 static char filefh[NFS3_FHSIZE]; /* NFSv2 / NFSv3 file handle */
 static int filefh3_length;	/* (variable) length of filefh when NFSv3 */
@@ -72,6 +97,7 @@ static int nfs_state;
 #define STATE_LOOKUP_REQ		5
 #define STATE_READ_REQ			6
 #define STATE_READLINK_REQ		7
+#define STATE_FSINFO_REQ		8
 
 static char *nfs_filename;
 static char *nfs_path;
@@ -79,7 +105,12 @@ static char nfs_path_buff[2048];
 
 #define NFSV2_FLAG 1
 #define NFSV3_FLAG 1 << 1
+#if CONFIG_NFS_READ_SIZE > NFS2_MAXDATA
+/* NFSv2 cannot read that much at once, so start with NFSv3 */
+static char supported_nfs_versions = NFSV3_FLAG;
+#else
 static char supported_nfs_versions = NFSV2_FLAG | NFSV3_FLAG;
+#endif
 
 static inline int store_block(uchar *src, unsigned offset, unsigned len)
 {
@@ -174,7 +205,8 @@ static uint32_t *rpc_add_credentials(uint32_t *p)
 /**************************************************************************
 RPC_LOOKUP - Lookup RPC Port numbers
 **************************************************************************/
-static void rpc_req(int rpc_prog, int rpc_proc, uint32_t *data, int datalen)
+static unsigned long rpc_req(int rpc_prog, int rpc_proc, uint32_t *data,
+			     int datalen)
 {
 	struct rpc_t rpc_pkt;
 	unsigned long id;
@@ -219,6 +251,8 @@ static void rpc_req(int rpc_prog, int rpc_proc, uint32_t *data, int datalen)
 
 	net_send_udp_packet(net_server_ethaddr, nfs_server_ip, sport,
 			    nfs_our_port, pktlen);
+
+	return id;
 }
 
 /**************************************************************************
@@ -357,10 +391,31 @@ static void nfs_lookup_req(char *fname)
 	}
 }
 
+/**************************************************************************
+NFS3PROC_FSINFO - Get the Limits of the NFSv3 Server
+**************************************************************************/
+static void nfs_fsinfo_req(void)
+{
+	uint32_t data[1024];
+	uint32_t *p;
+	int len;
+
+	p = &(data[0]);
+	p = rpc_add_credentials(p);
+
+	*p++ = htonl(filefh3_length);
+	memcpy(p, filefh, filefh3_length);
+	p += (filefh3_length / 4);
+
+	len = (uint32_t *)p - (uint32_t *)&(data[0]);
+
+	rpc_req(PROG_NFS, NFS3PROC_FSINFO, data, len);
+}
+
 /**************************************************************************
 NFS_READ - Read File on NFS Server
 **************************************************************************/
-static void nfs_read_req(int offset, int readlen)
+static void nfs_read_req(struct nfs_read *rd)
 {
 	uint32_t data[1024];
 	uint32_t *p;
@@ -372,22 +427,61 @@ static void nfs_read_req(int offset, int readlen)
 	if (supported_nfs_versions & NFSV2_FLAG) {
 		memcpy(p, filefh, NFS_FHSIZE);
 		p += (NFS_FHSIZE / 4);
-		*p++ = htonl(offset);
-		*p++ = htonl(readlen);
+		*p++ = htonl(rd->offset);
+		*p++ = htonl(rd->len);
 		*p++ = 0;
 	} else { /* NFSV3_FLAG */
 		*p++ = htonl(filefh3_length);
 		memcpy(p, filefh, filefh3_length);
 		p += (filefh3_length / 4);
 		*p++ = htonl(0); /* offset is 64-bit long, so fill with 0 */
-		*p++ = htonl(offset);
-		*p++ = htonl(readlen);
+		*p++ = htonl(rd->offset);
+		*p++ = htonl(rd->len);
 		*p++ = 0;
 	}
 
 	len = (uint32_t *)p - (uint32_t *)&(data[0]);
 
-	rpc_req(PROG_NFS, NFS_READ, data, len);
+	rd->id = rpc_req(PROG_NFS, NFS_READ, data, len);
+}
+
+/*
+ * Send the requests in flight again, then ask for more of the file until
+ * CONFIG_NFS_READ_WINDOW requests are in flight
+ */
+static void nfs_read_send(bool again)
+{
+	struct nfs_read *rd;
+
+	for (rd = nfs_reads; rd < nfs_reads + ARRAY_SIZE(nfs_reads); rd++) {
+		if (rd->id) {
+			if (again)
+				nfs_read_req(rd);
+			continue;
+		}
+		if (nfs_offset >= nfs_eof)
+			continue;
+		rd->offset = nfs_offset;
+		rd->len = min(nfs_read_size, nfs_eof - nfs_offset);
+		nfs_offset += rd->len;
+		nfs_read_req(rd);
+	}
+}
+
+/* Check whether the whole file has been received */
+static bool nfs_read_done(void)
+{
+	struct nfs_read *rd;
+
+	if (nfs_offset < nfs_eof)
+		return false;
+
+	for (rd = nfs_reads; rd < nfs_reads + ARRAY_SIZE(nfs_reads); rd++) {
+		if (rd->id && rd->offset < nfs_eof)
+			return false;
+	}
+
+	return true;
 }
 
 /**************************************************************************
@@ -419,8 +513,11 @@ static void nfs_send(void)
 	case STATE_LOOKUP_REQ:
 		nfs_lookup_req(nfs_filename);
 		break;
+	case STATE_FSINFO_REQ:
+		nfs_fsinfo_req();
+		break;
 	case STATE_READ_REQ:
-		nfs_read_req(nfs_offset, nfs_len);
+		nfs_read_send(true);
 		break;
 	case STATE_READLINK_REQ:
 		nfs_readlink_req();
@@ -534,6 +631,12 @@ static int nfs_lookup_reply(uchar *pkt, unsigned len)
 			break;
 		case NFS_RPC_PROG_MISMATCH:
 			/* Remote can't support NFS version */
+			if (!(supported_nfs_versions & NFSV2_FLAG) &&
+			    ntohl(rpc_pkt.u.reply.data[1]) == 2) {
+				debug("*** Warning: NFSv3 not supported, will retry with NFSv2\n");
+				supported_nfs_versions = NFSV2_FLAG;
+				return -NFS_RPC_PROG_MISMATCH;
+			}
 			switch (ntohl(rpc_pkt.u.reply.data[0])) {
 			/* Minimal supported NFS version */
 			case 3:
@@ -613,6 +716,40 @@ static int nfs3_get_attributes_offset(uint32_t *data)
 	}
 }
 
+static int nfs_fsinfo_reply(uchar *pkt, unsigned len)
+{
+	struct rpc_t rpc_pkt;
+	int nfsv3_data_offset;
+	int rtmax;
+
+	debug("%s\n", __func__);
+
+	memcpy(&rpc_pkt.u.data[0], pkt, len);
+
+	if (ntohl(rpc_pkt.u.reply.id) > rpc_id)
+		return -NFS_RPC_ERR;
+	else if (ntohl(rpc_pkt.u.reply.id) < rpc_id)
+		return -NFS_RPC_DROP;
+
+	if (rpc_pkt.u.reply.rstatus  ||
+	    rpc_pkt.u.reply.verifier ||
+	    rpc_pkt.u.reply.astatus  ||
+	    rpc_pkt.u.reply.data[0])
+		return -1;
+
+	nfsv3_data_offset = nfs3_get_attributes_offset(rpc_pkt.u.reply.data);
+	if (((uchar *)&rpc_pkt.u.reply.data[2 + nfsv3_data_offset] -
+	     (uchar *)&rpc_pkt) > len)
+		return -NFS_RPC_DROP;
+
+	/* Largest read the server allows */
+	rtmax = ntohl(rpc_pkt.u.reply.data[1 + nfsv3_data_offset]);
+	if (rtmax >= NFS_READ_SIZE && rtmax < nfs_read_size)
+		nfs_read_size = rounddown_pow_of_two(rtmax);
+
+	return 0;
+}
+
 static int nfs_readlink_reply(uchar *pkt, unsigned len)
 {
 	struct rpc_t rpc_pkt;
@@ -663,19 +800,41 @@ static int nfs_readlink_reply(uchar *pkt, unsigned len)
 	return 0;
 }
 
+static void nfs_show_progress(int len)
+{
+	/* One hash per 5KiB */
+	nfs_read_bytes += len;
+	while (nfs_num_hash < nfs_read_bytes / (NFS_READ_SIZE / 2 * 10)) {
+		if (nfs_num_hash && !(nfs_num_hash % HASHES_PER_LINE))
+			puts("\n\t ");
+		putc('#');
+		nfs_num_hash++;
+	}
+}
+
 static int nfs_read_reply(uchar *pkt, unsigned len)
 {
 	struct rpc_t rpc_pkt;
+	struct nfs_read *rd;
 	int rlen;
 	uchar *data_ptr;
+	uint32_t size_hi, size;
+	bool eof = false;
 
 	debug("%s\n", __func__);
 
-	memcpy(&rpc_pkt.u.data[0], pkt, sizeof(rpc_pkt.u.reply));
+	/*
+	 * Only take an aligned copy of the header and attributes; the file
+	 * data is stored straight from the packet.
+	 */
+	memcpy(&rpc_pkt.u.data[0], pkt,
+	       sizeof(rpc_pkt.u.data) - NFS_READ_SIZE);
 
-	if (ntohl(rpc_pkt.u.reply.id) > rpc_id)
-		return -NFS_RPC_ERR;
-	else if (ntohl(rpc_pkt.u.reply.id) < rpc_id)
+	for (rd = nfs_reads; rd < nfs_reads + ARRAY_SIZE(nfs_reads); rd++) {
+		if (rd->id && rd->id == ntohl(rpc_pkt.u.reply.id))
+			break;
+	}
+	if (rd == nfs_reads + ARRAY_SIZE(nfs_reads))
 		return -NFS_RPC_DROP;
 
 	if (rpc_pkt.u.reply.rstatus  ||
@@ -689,34 +848,54 @@ static int nfs_read_reply(uchar *pkt, unsigned len)
 		return -ntohl(rpc_pkt.u.reply.data[0]);
 	}
 
-	if ((nfs_offset != 0) && !((nfs_offset) %
-			(NFS_READ_SIZE / 2 * 10 * HASHES_PER_LINE)))
-		puts("\n\t ");
-	if (!(nfs_offset % ((NFS_READ_SIZE / 2) * 10)))
-		putc('#');
-
 	if (supported_nfs_versions & NFSV2_FLAG) {
+		size_hi = 0;
+		size = ntohl(rpc_pkt.u.reply.data[6]);
 		rlen = ntohl(rpc_pkt.u.reply.data[18]);
 		data_ptr = (uchar *)&(rpc_pkt.u.reply.data[19]);
 	} else {  /* NFSV3_FLAG */
 		int nfsv3_data_offset =
 			nfs3_get_attributes_offset(rpc_pkt.u.reply.data);
 
+		if (rpc_pkt.u.reply.data[1]) {
+			size_hi = ntohl(rpc_pkt.u.reply.data[7]);
+			size = ntohl(rpc_pkt.u.reply.data[8]);
+		} else {
+			size_hi = ~0;
+			size = 0;
+		}
 		/* count value */
 		rlen = ntohl(rpc_pkt.u.reply.data[1 + nfsv3_data_offset]);
+		eof = rpc_pkt.u.reply.data[2 + nfsv3_data_offset];
 		/* Skip unused values :
-			EOF:		32 bits value,
 			data_size:	32 bits value,
 		*/
 		data_ptr = (uchar *)
 			&(rpc_pkt.u.reply.data[4 + nfsv3_data_offset]);
 	}
 
-	if (((uchar *)&(rpc_pkt.u.reply.data[0]) - (uchar *)(&rpc_pkt) + rlen) > len)
-			return -9999;
+	/* The data itself is still in the packet */
+	data_ptr = pkt + (data_ptr - (uchar *)&rpc_pkt);
+	if (rlen < 0 || rlen > rd->len || data_ptr + rlen > pkt + len)
+		return -9999;
 
-	if (store_block(data_ptr, nfs_offset, rlen))
-			return -9999;
+	if (store_block(data_ptr, rd->offset, rlen))
+		return -9999;
+
+	nfs_show_progress(rlen);
+
+	/* Do not ask for more than the file holds */
+	if (!size_hi && size < nfs_eof)
+		nfs_eof = size;
+	if (eof || !rlen)
+		nfs_eof = min(nfs_eof, rd->offset + rlen);
+
+	rd->offset += rlen;
+	rd->len -= rlen;
+	if (rd->len && rd->offset < nfs_eof)
+		nfs_read_req(rd);	/* short read: ask for the rest */
+	else
+		rd->id = 0;
 
 	return rlen;
 }
@@ -738,6 +917,19 @@ static void nfs_timeout_handler(void)
 	}
 }
 
+static void nfs_read_start(void)
+{
+	debug("NFS read size %d\n", nfs_read_size);
+	memset(nfs_reads, 0, sizeof(nfs_reads));
+	nfs_offset = 0;
+	nfs_eof = INT_MAX;
+	nfs_read_bytes = 0;
+	nfs_num_hash = 0;
+
+	nfs_state = STATE_READ_REQ;
+	nfs_send();
+}
+
 static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			unsigned src, unsigned len)
 {
@@ -746,7 +938,8 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 
 	debug("%s\n", __func__);
 
-	if (len > sizeof(struct rpc_t))
+	/* READ replies are not copied, so they can be bigger */
+	if (nfs_state != STATE_READ_REQ && len > sizeof(struct rpc_t))
 		return;
 
 	if (dest != nfs_our_port)
@@ -812,13 +1005,26 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			nfs_state = STATE_PRCLOOKUP_PROG_MOUNT_REQ;
 			nfs_send();
 		} else {
-			nfs_state = STATE_READ_REQ;
-			nfs_offset = 0;
-			nfs_len = NFS_READ_SIZE;
-			nfs_send();
+			nfs_read_size = min_t(int, CONFIG_NFS_READ_SIZE,
+				rounddown_pow_of_two(NFS_MAX_READ_SIZE));
+			if (supported_nfs_versions & NFSV2_FLAG) {
+				nfs_read_size = min(nfs_read_size,
+						    NFS2_MAXDATA);
+				nfs_read_start();
+			} else {
+				nfs_state = STATE_FSINFO_REQ;
+				nfs_send();
+			}
 		}
 		break;
 
+	case STATE_FSINFO_REQ:
+		/* Without the limits of the server, try our read size */
+		if (nfs_fsinfo_reply(pkt, len) == -NFS_RPC_DROP)
+			break;
+		nfs_read_start();
+		break;
+
 	case STATE_READLINK_REQ:
 		reply = nfs_readlink_reply(pkt, len);
 		if (reply == -NFS_RPC_DROP) {
@@ -841,16 +1047,16 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 		rlen = nfs_read_reply(pkt, len);
 		if (rlen == -NFS_RPC_DROP)
 			break;
+		nfs_timeout_count = 0;
 		net_set_timeout_handler(nfs_timeout, nfs_timeout_handler);
-		if (rlen > 0) {
-			nfs_offset += rlen;
-			nfs_send();
+		if (rlen >= 0 && !nfs_read_done()) {
+			nfs_read_send(false);
 		} else if ((rlen == -NFSERR_ISDIR) || (rlen == -NFSERR_INVAL)) {
 			/* symbolic link */
 			nfs_state = STATE_READLINK_REQ;
 			nfs_send();
 		} else {
-			if (!rlen)
+			if (rlen >= 0)
 				nfs_download_state = NETLOOP_SUCCESS;
 			if (rlen < 0)
 				debug("NFS READ error (%d)\n", rlen);
@@ -0,0 +1,467 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Minimal TCP client
+ *
+ * This handles one connection opened by us, which is enough to fetch a file.
+ * Data received in order is handed over at once, so we do not need to buffer
+ * it and the receive window we advertise stays the same. A segment which
+ * arrives out of order is dropped and answered by a duplicate ACK at once, so
+ * that the sender retransmits the missing one without waiting for its timer
+ * (fast retransmit, RFC 5681). We do the same for our own data when we see
+ * three duplicate ACKs. There is no SACK and no window scaling.
+ */
+
+#include <common.h>
+#include <net.h>
+#include <net/tcp.h>
+
+/* Initial retransmission timeout in ms, doubled on each retry */
+#define TCP_RTO			500UL
+#define TCP_RTO_MAX		4000UL
+/* Number of timeouts in a row before giving up */
+#define TCP_RETRIES		8
+/* How long we may hold back the ACK for a single segment, in ms */
+#define TCP_DELACK		2UL
+
+#ifdef CONFIG_TCP_WINDOW_SIZE
+#define TCP_WINDOW		CONFIG_TCP_WINDOW_SIZE
+#else
+#define TCP_WINDOW		(16 * TCP_MSS)
+#endif
+
+/* Data we sent which has not been acknowledged yet */
+#define TCP_TX_SIZE		2048
+
+static enum tcp_state tcp_state;
+static struct in_addr tcp_remote_ip;
+static uchar tcp_remote_ethaddr[ARP_HLEN];
+static int tcp_remote_port;
+static int tcp_local_port;
+
+/* oldest sequence number we sent which is not acknowledged */
+static u32 tcp_snd_una;
+/* next sequence number we send */
+static u32 tcp_snd_nxt;
+/* window and segment size the peer can take */
+static u32 tcp_snd_wnd;
+static int tcp_snd_mss;
+/* next sequence number we expect */
+static u32 tcp_rcv_nxt;
+/* initial sequence number of the peer */
+static u32 tcp_irs;
+
+/* data from tcp_snd_una up to the end of what tcp_send() gave us */
+static uchar tcp_tx_buf[TCP_TX_SIZE];
+static int tcp_tx_len;
+
+static int tcp_dup_acks;
+/* number of segments received which we did not acknowledge yet */
+static int tcp_rx_unacked;
+static int tcp_retries;
+static ulong tcp_rto;
+
+static tcp_rx_handler *tcp_rx;
+static tcp_event_handler *tcp_event;
+
+static void tcp_timeout_handler(void);
+
+/* Sequence number comparisons, valid across wrap-around */
+static inline bool tcp_seq_before(u32 a, u32 b)
+{
+	return (s32)(a - b) < 0;
+}
+
+static inline bool tcp_seq_after(u32 a, u32 b)
+{
+	return (s32)(a - b) > 0;
+}
+
+/* Checksum of the segment and the pseudo header in front of it */
+static unsigned int tcp_checksum(struct ip_tcp_hdr *ip, int tcp_len)
+{
+	struct {
+		struct in_addr src;
+		struct in_addr dst;
+		u8 zero;
+		u8 proto;
+		u16 len;
+	} __attribute__((packed)) ph;
+	unsigned int sum;
+
+	net_copy_ip(&ph.src, &ip->ip_src);
+	net_copy_ip(&ph.dst, &ip->ip_dst);
+	ph.zero = 0;
+	ph.proto = IPPROTO_TCP;
+	ph.len = htons(tcp_len);
+
+	sum = compute_ip_checksum(&ph, sizeof(ph));
+
+	return add_ip_checksums(sizeof(ph), sum,
+				compute_ip_checksum(&ip->tcp_src, tcp_len));
+}
+
+int tcp_set_tcp_header(uchar *pkt, struct in_addr dest, int dport, int sport,
+		       int payload_len, u8 action, u32 tcp_seq_num,
+		       u32 tcp_ack_num)
+{
+	struct ip_tcp_hdr *ip = (struct ip_tcp_hdr *)pkt;
+	int hdr_len = IP_TCP_HDR_SIZE;
+
+	if (action & TCP_SYN) {
+		uchar *opt = pkt + IP_TCP_HDR_SIZE;
+
+		/* Tell the peer how much it may send in one segment */
+		opt[0] = TCP_O_MSS;
+		opt[1] = TCP_O_MSS_LEN;
+		opt[2] = TCP_MSS >> 8;
+		opt[3] = TCP_MSS & 0xff;
+		hdr_len += TCP_O_MSS_LEN;
+		payload_len = 0;
+	}
+
+	net_set_ip_header(pkt, dest, net_ip, hdr_len + payload_len,
+			  IPPROTO_TCP);
+
+	ip->tcp_src = htons(sport);
+	ip->tcp_dst = htons(dport);
+	ip->tcp_seq = htonl(tcp_seq_num);
+	ip->tcp_ack = htonl(tcp_ack_num);
+	ip->tcp_hlen = ((hdr_len - IP_HDR_SIZE) / 4) << 4;
+	ip->tcp_flags = action;
+	ip->tcp_win = htons(TCP_WINDOW);
+	ip->tcp_xsum = 0;
+	ip->tcp_ugr = 0;
+	ip->tcp_xsum = tcp_checksum(ip, hdr_len - IP_HDR_SIZE + payload_len);
+
+	return hdr_len;
+}
+
+static void tcp_send_segment(u8 action, u32 seq, const uchar *data, int len)
+{
+	uchar *pkt = net_tx_packet + net_eth_hdr_size() + IP_TCP_HDR_SIZE;
+
+	if (len)
+		memcpy(pkt, data, len);
+	if (action & TCP_ACK)
+		tcp_rx_unacked = 0;
+
+	net_send_ip_packet(tcp_remote_ethaddr, tcp_remote_ip, tcp_remote_port,
+			   tcp_local_port, len, IPPROTO_TCP, action, seq,
+			   tcp_rcv_nxt);
+}
+
+static void tcp_send_ack(void)
+{
+	tcp_send_segment(TCP_ACK, tcp_snd_nxt, NULL, 0);
+}
+
+/* Send what the peer has room for, starting at @seq */
+static void tcp_output(u32 seq)
+{
+	u32 end = tcp_snd_una + tcp_tx_len;
+	int len;
+
+	while (tcp_seq_before(seq, end) &&
+	    tcp_seq_before(seq, tcp_snd_una + tcp_snd_wnd)) {
+		len = min(end - seq, tcp_snd_una + tcp_snd_wnd - seq);
+		len = min(len, tcp_snd_mss);
+		tcp_send_segment(TCP_ACK | TCP_PUSH, seq,
+				 tcp_tx_buf + (seq - tcp_snd_una), len);
+		seq += len;
+	}
+
+	if (tcp_seq_after(seq, tcp_snd_nxt))
+		tcp_snd_nxt = seq;
+}
+
+static void tcp_set_timer(void)
+{
+	net_set_timeout_handler(tcp_rx_unacked ? TCP_DELACK : tcp_rto,
+				tcp_timeout_handler);
+}
+
+static void tcp_reset_state(void)
+{
+	tcp_state = TCP_CLOSED;
+	net_set_timeout_handler(0, NULL);
+}
+
+static void tcp_aborted(void)
+{
+	tcp_reset_state();
+	tcp_event(TCP_ABORTED);
+}
+
+static void tcp_timeout_handler(void)
+{
+	/* Time to acknowledge a lonely segment */
+	if (tcp_rx_unacked) {
+		tcp_send_ack();
+		tcp_set_timer();
+		return;
+	}
+
+	if (++tcp_retries > TCP_RETRIES) {
+		puts("\nTCP: connection timed out\n");
+		tcp_send_segment(TCP_RST | TCP_ACK, tcp_snd_nxt, NULL, 0);
+		tcp_aborted();
+		return;
+	}
+	puts("T ");
+	tcp_rto = min(tcp_rto * 2, TCP_RTO_MAX);
+
+	if (tcp_state == TCP_SYN_SENT)
+		tcp_send_segment(TCP_SYN, tcp_snd_una, NULL, 0);
+	else if (tcp_tx_len)
+		tcp_output(tcp_snd_una);
+	else
+		/* Our last ACK may have been lost; repeat it */
+		tcp_send_ack();
+	tcp_set_timer();
+}
+
+static void tcp_parse_options(struct ip_tcp_hdr *ip, int hdr_len)
+{
+	uchar *opt = (uchar *)&ip->tcp_src + TCP_HDR_SIZE;
+	uchar *end = (uchar *)&ip->tcp_src + hdr_len;
+
+	while (opt < end && *opt != TCP_O_END) {
+		if (*opt == TCP_O_NOP) {
+			opt++;
+			continue;
+		}
+		if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end)
+			break;
+		if (opt[0] == TCP_O_MSS && opt[1] == TCP_O_MSS_LEN)
+			tcp_snd_mss = min_t(int, (opt[2] << 8) | opt[3],
+					    TCP_MSS);
+		opt += opt[1];
+	}
+}
+
+static void tcp_process_ack(u32 ack, u32 wnd, bool has_data)
+{
+	int acked;
+
+	/* Ignore acknowledgments for what we did not send */
+	if (tcp_seq_after(ack, tcp_snd_nxt))
+		return;
+
+	if (tcp_seq_after(ack, tcp_snd_una)) {
+		acked = ack - tcp_snd_una;
+		tcp_tx_len -= acked;
+		memmove(tcp_tx_buf, tcp_tx_buf + acked, tcp_tx_len);
+		tcp_snd_una = ack;
+		tcp_snd_wnd = wnd;
+		tcp_dup_acks = 0;
+		tcp_retries = 0;
+		tcp_rto = TCP_RTO;
+		/* The window may have opened */
+		tcp_output(tcp_snd_nxt);
+	} else if (ack == tcp_snd_una) {
+		tcp_snd_wnd = wnd;
+		/* Three times the same: the segment at ack was lost */
+		if (tcp_tx_len && !has_data && ++tcp_dup_acks == 3)
+			tcp_output(tcp_snd_una);
+	}
+}
+
+static void tcp_process_data(u32 seq, uchar *data, int len, bool fin)
+{
+	u32 skip;
+
+	/* Drop what we have had already */
+	if (tcp_seq_before(seq, tcp_rcv_nxt)) {
+		skip = tcp_rcv_nxt - seq;
+		if (skip > len || (skip == len && !fin)) {
+			tcp_send_ack();
+			return;
+		}
+		seq += skip;
+		data += skip;
+		len -= skip;
+	}
+
+	/* Something went missing; ask for it again */
+	if (seq != tcp_rcv_nxt) {
+		tcp_send_ack();
+		return;
+	}
+
+	if (len) {
+		tcp_rcv_nxt += len;
+		tcp_retries = 0;
+		tcp_rto = TCP_RTO;
+		tcp_rx(data, seq - tcp_irs - 1, len);
+		/* The handler may have closed the connection */
+		if (tcp_state == TCP_CLOSED)
+			return;
+	}
+
+	if (fin) {
+		tcp_rcv_nxt++;
+		tcp_send_ack();
+		if (tcp_state == TCP_ESTABLISHED) {
+			tcp_state = TCP_CLOSE_WAIT;
+			tcp_set_timer();
+			tcp_event(TCP_PEER_CLOSED);
+		}
+		return;
+	}
+
+	/* Acknowledge every other segment, the timer takes care of the rest */
+	if (++tcp_rx_unacked >= 2)
+		tcp_send_ack();
+	tcp_set_timer();
+}
+
+void tcp_receive(struct ip_tcp_hdr *ip, unsigned int len)
+{
+	int hdr_len, data_len;
+	u32 seq, ack, wnd;
+	u8 flags;
+
+	if (tcp_state == TCP_CLOSED || len < IP_TCP_HDR_SIZE)
+		return;
+
+	hdr_len = (ip->tcp_hlen >> 4) * 4;
+	if (hdr_len < TCP_HDR_SIZE || IP_HDR_SIZE + hdr_len > len)
+		return;
+	data_len = len - IP_HDR_SIZE - hdr_len;
+
+	if (ntohs(ip->tcp_dst) != tcp_local_port ||
+	    ntohs(ip->tcp_src) != tcp_remote_port ||
+	    net_read_ip(&ip->ip_src).s_addr != tcp_remote_ip.s_addr)
+		return;
+
+	if (tcp_checksum(ip, len - IP_HDR_SIZE)) {
+		debug("TCP: checksum bad\n");
+		return;
+	}
+
+	seq = ntohl(ip->tcp_seq);
+	ack = ntohl(ip->tcp_ack);
+	wnd = ntohs(ip->tcp_win);
+	flags = ip->tcp_flags;
+
+	if (flags & TCP_RST) {
+		/* Only believe it if it belongs to this connection */
+		if (tcp_state == TCP_SYN_SENT ?
+		    (flags & TCP_ACK) && ack == tcp_snd_nxt :
+		    seq == tcp_rcv_nxt) {
+			puts("\nTCP: connection reset\n");
+			tcp_aborted();
+		}
+		return;
+	}
+
+	if (tcp_state == TCP_SYN_SENT) {
+		if ((flags & (TCP_SYN | TCP_ACK)) != (TCP_SYN | TCP_ACK) ||
+		    ack != tcp_snd_nxt)
+			return;
+
+		tcp_irs = seq;
+		tcp_rcv_nxt = seq + 1;
+		tcp_snd_una = ack;
+		tcp_snd_wnd = wnd;
+		tcp_parse_options(ip, hdr_len);
+		tcp_state = TCP_ESTABLISHED;
+		tcp_retries = 0;
+		tcp_rto = TCP_RTO;
+		tcp_send_ack();
+		tcp_set_timer();
+		tcp_event(TCP_CONNECTED);
+		return;
+	}
+
+	if (!(flags & TCP_ACK))
+		return;
+
+	/* Our ACK of the SYN got lost */
+	if (flags & TCP_SYN) {
+		tcp_send_ack();
+		return;
+	}
+
+	tcp_process_ack(ack, wnd, data_len || (flags & TCP_FIN));
+
+	if (data_len || (flags & TCP_FIN))
+		tcp_process_data(seq, (uchar *)&ip->tcp_src + hdr_len,
+				 data_len, flags & TCP_FIN);
+}
+
+int tcp_connect(struct in_addr dest, int dport, tcp_rx_handler *rx,
+		tcp_event_handler *event)
+{
+	if (tcp_state != TCP_CLOSED)
+		return -EBUSY;
+
+	tcp_remote_ip = dest;
+	tcp_remote_port = dport;
+	/* Not reusing the port of an earlier connection */
+	tcp_local_port = 1024 + ((u32)get_ticks() % 64512);
+	memset(tcp_remote_ethaddr, 0, ARP_HLEN);
+	tcp_rx = rx;
+	tcp_event = event;
+
+	tcp_snd_una = get_ticks();
+	tcp_snd_nxt = tcp_snd_una + 1;
+	tcp_snd_wnd = 0;
+	tcp_snd_mss = 536;	/* RFC 1122 default if the peer says nothing */
+	tcp_tx_len = 0;
+	tcp_dup_acks = 0;
+	tcp_rx_unacked = 0;
+	tcp_retries = 0;
+	tcp_rto = TCP_RTO;
+	tcp_state = TCP_SYN_SENT;
+
+	tcp_send_segment(TCP_SYN, tcp_snd_una, NULL, 0);
+	tcp_set_timer();
+
+	return 0;
+}
+
+int tcp_send(const void *data, int len)
+{
+	if (tcp_state != TCP_ESTABLISHED && tcp_state != TCP_CLOSE_WAIT)
+		return -ENOTCONN;
+	if (tcp_tx_len + len > TCP_TX_SIZE)
+		return -ENOSPC;
+
+	memcpy(tcp_tx_buf + tcp_tx_len, data, len);
+	tcp_tx_len += len;
+	tcp_output(tcp_snd_nxt);
+
+	return 0;
+}
+
+void tcp_close(void)
+{
+	if (tcp_state == TCP_CLOSED)
+		return;
+
+	if (tcp_state == TCP_SYN_SENT)
+		tcp_send_segment(TCP_RST, tcp_snd_nxt, NULL, 0);
+	else
+		tcp_send_segment(TCP_FIN | TCP_ACK, tcp_snd_nxt, NULL, 0);
+	tcp_reset_state();
+}
+
+void tcp_abort(void)
+{
+	if (tcp_state == TCP_CLOSED)
+		return;
+
+	tcp_send_segment(TCP_RST | TCP_ACK, tcp_snd_nxt, NULL, 0);
+	tcp_reset_state();
+}
+
+void tcp_stop(void)
+{
+	tcp_state = TCP_CLOSED;
+}
+
+enum tcp_state tcp_get_state(void)
+{
+	return tcp_state;
+}
@@ -46,7 +46,6 @@ DECLARE_GLOBAL_DATA_PTR;
 
 static ulong timeout_ms = TIMEOUT;
 static int timeout_count_max = TIMEOUT_COUNT;
-static ulong time_start;   /* Record time we started tftp */
 
 /*
  * These globals govern the timeout behavior when attempting a connection to a
@@ -70,31 +69,6 @@ enum {
 	TFTP_ERR_FILE_ALREADY_EXISTS = 6,
 };
 
-static struct in_addr tftp_remote_ip;
-/* The UDP port at their end */
-static int	tftp_remote_port;
-/* The UDP port at our end */
-static int	tftp_our_port;
-static int	timeout_count;
-/* packet sequence number */
-static ulong	tftp_cur_block;
-/* last packet sequence number received */
-static ulong	tftp_prev_block;
-/* count of sequence number wraparounds */
-static ulong	tftp_block_wrap;
-/* memory offset due to wrapping */
-static ulong	tftp_block_wrap_offset;
-static int	tftp_state;
-static ulong	tftp_load_addr;
-#ifdef CONFIG_LMB
-static ulong	tftp_load_size;
-#endif
-#ifdef CONFIG_TFTP_TSIZE
-/* The file size reported by the server */
-static int	tftp_tsize;
-/* The number of hashes we printed */
-static short	tftp_tsize_num_hash;
-#endif
 #ifdef CONFIG_CMD_TFTPPUT
 /* 1 if writing, else 0 */
 static int	tftp_put_active;
@@ -111,6 +85,10 @@ static int	tftp_put_final_block_sent;
 #define STATE_OACK	5
 #define STATE_RECV_WRQ	6
 #define STATE_SEND_WRQ	7
+/* The file exists but another one is wanted first, see tftp_get_files() */
+#define STATE_DEFERRED	8
+/* The transfer of a file for tftp_get_files() has ended */
+#define STATE_DONE	9
 
 /* default TFTP block size */
 #define TFTP_BLOCK_SIZE		512
@@ -126,7 +104,76 @@ static char default_filename[DEFAULT_NAME_LEN];
 #define MAX_LEN CONFIG_TFTP_FILE_NAME_MAX_LEN
 #endif
 
-static char tftp_filename[MAX_LEN];
+/*
+ * The state of one transfer. tftp_get_files() runs several of them at once,
+ * told apart by the port at our end; the other commands just one.
+ */
+struct tftp_session {
+	struct in_addr remote_ip;
+	/* MAC address of the server, or of the gateway to it */
+	uchar ethaddr[ARP_HLEN];
+	/* The UDP port at their end */
+	int remote_port;
+	/* The UDP port at our end */
+	int our_port;
+	int timeout_count;
+	/* packet sequence number */
+	ulong cur_block;
+	/* last packet sequence number received */
+	ulong prev_block;
+	/* block number which completes the current window and must be acked */
+	ulong next_ack;
+	/* last block we sent a repeated ack for, to restart the window */
+	ulong last_nack;
+	/* count of sequence number wraparounds */
+	ulong block_wrap;
+	/* memory offset due to wrapping */
+	ulong block_wrap_offset;
+	int state;
+	ulong load_addr;
+	/* room there is at load_addr, or 0 if there is no limit */
+	ulong load_size;
+#ifdef CONFIG_TFTP_TSIZE
+	/* The file size reported by the server */
+	int tsize;
+	/* The number of hashes we printed */
+	short tsize_num_hash;
+#endif
+	unsigned short block_size;
+	unsigned short windowsize;
+	char filename[MAX_LEN];
+	/* Record time we started tftp */
+	ulong time_start;
+#ifdef CONFIG_TFTP_PARALLEL
+	/* The file fetched for tftp_get_files(), else NULL */
+	struct tftp_file *file;
+	/* when the timeout was last restarted */
+	ulong time;
+	/* our last packet is still to be sent */
+	bool unsent;
+#endif
+};
+
+#ifdef CONFIG_TFTP_PARALLEL
+#define TFTP_SESSIONS	TFTP_MAX_FILES
+#else
+#define TFTP_SESSIONS	1
+#endif
+
+static struct tftp_session tftp_sessions[TFTP_SESSIONS];
+/* The session of the packet or timeout being handled */
+static struct tftp_session *tftp = tftp_sessions;
+/* The session whose data blocks the driver may receive in place */
+static struct tftp_session *tftp_rx;
+
+#ifdef CONFIG_TFTP_PARALLEL
+static struct tftp_file *tftp_multi_files;
+static int tftp_multi_count;
+static bool tftp_multi_first;
+static int tftp_multi_next_port;
+/* Number of blocks received for all the files, for the progress */
+static ulong tftp_multi_blocks;
+#endif
 
 /* 512 is poor choice for ethernet, MTU is typically 1500.
  * Minus eth.hdrs thats 1468.  Can get 2x better throughput with
@@ -139,14 +186,26 @@ static char tftp_filename[MAX_LEN];
 #define TFTP_MTU_BLOCKSIZE 1468
 #endif
 
-static unsigned short tftp_block_size = TFTP_BLOCK_SIZE;
 static unsigned short tftp_block_size_option = TFTP_MTU_BLOCKSIZE;
 
+/*
+ * Number of blocks the server may send before waiting for an ack (RFC 7440).
+ * A window of 1 is the classic lock-step protocol and is what we fall back
+ * to if the server does not acknowledge the option.
+ */
+#ifdef CONFIG_TFTP_WINDOWSIZE
+#define TFTP_WINDOWSIZE CONFIG_TFTP_WINDOWSIZE
+#else
+#define TFTP_WINDOWSIZE 1
+#endif
+
+static unsigned short tftp_window_size_option = TFTP_WINDOWSIZE;
+
 static inline int store_block(int block, uchar *src, unsigned int len)
 {
-	ulong offset = block * tftp_block_size + tftp_block_wrap_offset;
+	ulong offset = block * tftp->block_size + tftp->block_wrap_offset;
 	ulong newsize = offset + len;
-	ulong store_addr = tftp_load_addr + offset;
+	ulong store_addr = tftp->load_addr + offset;
 #ifdef CONFIG_SYS_DIRECT_FLASH_TFTP
 	int i, rc = 0;
 
@@ -170,25 +229,31 @@ static inline int store_block(int block, uchar *src, unsigned int len)
 #endif /* CONFIG_SYS_DIRECT_FLASH_TFTP */
 	{
 		void *ptr;
+		ulong end_addr = tftp->load_addr + tftp->load_size;
 
-#ifdef CONFIG_LMB
-		ulong end_addr = tftp_load_addr + tftp_load_size;
-
-		if (!end_addr)
+		if (!tftp->load_size || !end_addr)
 			end_addr = ULONG_MAX;
 
-		if (store_addr < tftp_load_addr ||
+		if (store_addr < tftp->load_addr ||
 		    store_addr + len > end_addr) {
 			puts("\nTFTP error: ");
 			puts("trying to overwrite reserved memory...\n");
 			return -1;
 		}
-#endif
 		ptr = map_sysmem(store_addr, len);
-		memcpy(ptr, src, len);
+		/* The driver may have received the data in place already */
+		if (ptr != src)
+			memcpy(ptr, src, len);
 		unmap_sysmem(ptr);
 	}
 
+#ifdef CONFIG_TFTP_PARALLEL
+	if (tftp->file) {
+		if (tftp->file->size < newsize)
+			tftp->file->size = newsize;
+		return 0;
+	}
+#endif
 	if (net_boot_file_size < newsize)
 		net_boot_file_size = newsize;
 
@@ -198,9 +263,11 @@ static inline int store_block(int block, uchar *src, unsigned int len)
 /* Clear our state ready for a new transfer */
 static void new_transfer(void)
 {
-	tftp_prev_block = 0;
-	tftp_block_wrap = 0;
-	tftp_block_wrap_offset = 0;
+	tftp->prev_block = 0;
+	tftp->block_wrap = 0;
+	tftp->block_wrap_offset = 0;
+	tftp->next_ack = tftp->windowsize;
+	tftp->last_nack = TFTP_SEQUENCE_SIZE;
 #ifdef CONFIG_CMD_TFTPPUT
 	tftp_put_final_block_sent = 0;
 #endif
@@ -218,7 +285,7 @@ static void new_transfer(void)
 static int load_block(unsigned block, uchar *dst, unsigned len)
 {
 	/* We may want to get the final block from the previous set */
-	ulong offset = ((int)block - 1) * len + tftp_block_wrap_offset;
+	ulong offset = ((int)block - 1) * len + tftp->block_wrap_offset;
 	ulong tosend = len;
 
 	tosend = min(net_boot_file_size - offset, tosend);
@@ -232,27 +299,191 @@ static int load_block(unsigned block, uchar *dst, unsigned len)
 static void tftp_send(void);
 static void tftp_timeout_handler(void);
 
+/* (Re)start the timeout of the current session */
+static void tftp_set_timeout(void)
+{
+#ifdef CONFIG_TFTP_PARALLEL
+	if (tftp->file) {
+		tftp->time = get_timer(0);
+		return;
+	}
+#endif
+	net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
+}
+
+#if defined(CONFIG_DM_ETH) && !defined(CONFIG_SYS_DIRECT_FLASH_TFTP)
+/* Where the data of the DATA packet @ahead packets after the next one goes */
+static void *tftp_rx_addr(int ahead)
+{
+	ulong offset;
+	ulong end = 0;
+
+	if (!tftp_rx || tftp_rx->state != STATE_DATA)
+		return NULL;
+
+	offset = (tftp_rx->prev_block + ahead) * tftp_rx->block_size +
+		tftp_rx->block_wrap_offset;
+
+	/*
+	 * Other packets may spill into the area we give out, so it must lie
+	 * within the file and not beyond: we need to know its size.
+	 */
+#ifdef CONFIG_TFTP_TSIZE
+	end = tftp_rx->tsize;
+#endif
+	if (tftp_rx->load_size && tftp_rx->load_size < end)
+		end = tftp_rx->load_size;
+	if (offset + tftp_rx->block_size > end)
+		return NULL;
+
+	return map_sysmem(tftp_rx->load_addr + offset, tftp_rx->block_size);
+}
+
+static bool tftp_rx_match(uchar *pkt, int len, void *payload)
+{
+	struct ethernet_hdr *et = (struct ethernet_hdr *)pkt;
+	struct ip_udp_hdr *ip = (struct ip_udp_hdr *)(pkt + ETHER_HDR_SIZE);
+	__be16 *s = (__be16 *)(ip + 1);
+	void *ptr;
+
+	if (!tftp_rx || len < ETHER_HDR_SIZE + IP_UDP_HDR_SIZE + 4 ||
+	    ntohs(et->et_protlen) != PROT_IP || ip->ip_hl_v != 0x45 ||
+	    ip->ip_p != IPPROTO_UDP ||
+	    (ntohs(ip->ip_off) & (IP_OFFS | IP_FLAGS_MFRAG)) ||
+	    ntohs(ip->udp_dst) != tftp_rx->our_port ||
+	    ntohs(ip->udp_src) != tftp_rx->remote_port ||
+	    ntohs(s[0]) != TFTP_DATA ||
+	    ntohs(s[1]) != (unsigned short)(tftp_rx->prev_block + 1))
+		return false;
+
+	ptr = map_sysmem(tftp_rx->load_addr +
+			 tftp_rx->prev_block * tftp_rx->block_size +
+			 tftp_rx->block_wrap_offset, 0);
+	unmap_sysmem(ptr);
+
+	return ptr == payload;
+}
+
+static struct eth_rx_dest tftp_rx_dest = {
+	.hdr_len = ETHER_HDR_SIZE + IP_UDP_HDR_SIZE + 4,
+	.addr = tftp_rx_addr,
+	.match = tftp_rx_match,
+};
+
+/*
+ * Let the driver receive data blocks straight into the load buffer. This
+ * lasts until the device is halted at the end of the transfer or to restart it.
+ * Of several sessions, only one at a time can do this: blocks of the others
+ * landing there are copied back by the uclass.
+ */
+static void tftp_set_rx_dest(void)
+{
+	if (tftp_put_active || tftp_rx == tftp ||
+	    (tftp_rx && tftp_rx->state == STATE_DATA))
+		return;
+
+	tftp_rx = tftp;
+	tftp_rx_dest.max_len = tftp->block_size;
+	eth_set_rx_dest(&tftp_rx_dest);
+}
+#else
+static inline void tftp_set_rx_dest(void)
+{
+}
+#endif
+
 /**********************************************************************/
 
+#ifdef CONFIG_TFTP_PARALLEL
+/* The transfer of the file of the current session has ended */
+static void tftp_multi_done(int err)
+{
+	tftp->state = STATE_DONE;
+	tftp->file->err = err;
+	/* Only the ack of the last block may still need to go out */
+	if (err)
+		tftp->unsent = false;
+	debug("%s: %s: %d\n", __func__, tftp->filename, err);
+}
+
+/*
+ * Check whether the file of the current session should be loaded. When
+ * looking for the first file that exists, only the first one not known to
+ * be missing is.
+ */
+static bool tftp_multi_wanted(void)
+{
+	struct tftp_session *prev;
+
+	if (!tftp_multi_first)
+		return true;
+
+	for (prev = tftp_sessions; prev < tftp; prev++) {
+		if (prev->state != STATE_DONE)
+			return false;
+	}
+
+	return true;
+}
+#endif
+
+/* Give up on the transfer of the current session */
+static void tftp_fail(int err)
+{
+#ifdef CONFIG_TFTP_PARALLEL
+	if (tftp->file) {
+		tftp_multi_done(err);
+		return;
+	}
+#endif
+	eth_halt();
+	net_set_state(NETLOOP_FAIL);
+}
+
+/*
+ * Start the transfer of the current session again, if it is the only one.
+ * With several of them, its file is given up on instead.
+ */
+static void tftp_start_again(int err)
+{
+#ifdef CONFIG_TFTP_PARALLEL
+	if (tftp->file) {
+		tftp_multi_done(err);
+		return;
+	}
+#endif
+	net_start_again();
+}
+
 static void show_block_marker(void)
 {
+#ifdef CONFIG_TFTP_PARALLEL
+	/* The progress of all the files goes on one line */
+	if (tftp->file) {
+		if (++tftp_multi_blocks % 10 == 0)
+			putc('#');
+		if (tftp_multi_blocks % (10 * HASHES_PER_LINE) == 0)
+			puts("\n\t ");
+		return;
+	}
+#endif
 #ifdef CONFIG_TFTP_TSIZE
-	if (tftp_tsize) {
-		ulong pos = tftp_cur_block * tftp_block_size +
-			tftp_block_wrap_offset;
-		if (pos > tftp_tsize)
-			pos = tftp_tsize;
+	if (tftp->tsize) {
+		ulong pos = tftp->cur_block * tftp->block_size +
+			tftp->block_wrap_offset;
+		if (pos > tftp->tsize)
+			pos = tftp->tsize;
 
-		while (tftp_tsize_num_hash < pos * 50 / tftp_tsize) {
+		while (tftp->tsize_num_hash < pos * 50 / tftp->tsize) {
 			putc('#');
-			tftp_tsize_num_hash++;
+			tftp->tsize_num_hash++;
 		}
 	} else
 #endif
 	{
-		if (((tftp_cur_block - 1) % 10) == 0)
+		if (((tftp->cur_block - 1) % 10) == 0)
 			putc('#');
-		else if ((tftp_cur_block % (10 * HASHES_PER_LINE)) == 0)
+		else if ((tftp->cur_block % (10 * HASHES_PER_LINE)) == 0)
 			puts("\n\t ");
 	}
 }
@@ -264,14 +495,19 @@ static void show_block_marker(void)
  */
 static void restart(const char *msg)
 {
+#ifdef CONFIG_TFTP_PARALLEL
+	if (tftp->file) {
+		printf("\nTFTP error: %s: %s\n", tftp->filename, msg);
+		tftp_multi_done(-ETIMEDOUT);
+		return;
+	}
+#endif
 	printf("\n%s; starting again\n", msg);
 	net_start_again();
 }
 
 /*
  * Check if the block number has wrapped, and update progress
- *
- * TODO: The egregious use of global variables in this file should be tidied.
  */
 static void update_block_number(void)
 {
@@ -281,32 +517,57 @@ static void update_block_number(void)
 	 * number of 0 this means that there was a wrap
 	 * around of the (16 bit) counter.
 	 */
-	if (tftp_cur_block == 0 && tftp_prev_block != 0) {
-		tftp_block_wrap++;
-		tftp_block_wrap_offset += tftp_block_size * TFTP_SEQUENCE_SIZE;
-		timeout_count = 0; /* we've done well, reset the timeout */
+	if (tftp->cur_block == 0 && tftp->prev_block != 0) {
+		tftp->block_wrap++;
+		tftp->block_wrap_offset += tftp->block_size *
+			TFTP_SEQUENCE_SIZE;
+		/* we've done well, reset the timeout */
+		tftp->timeout_count = 0;
 	} else {
 		show_block_marker();
 	}
 }
 
+/*
+ * A block was lost or arrived out of order: acknowledge the last block we
+ * received in sequence so that the server restarts the window from there
+ * (RFC 7440). The rest of the window that is still in flight will also be
+ * out of order, so only do this once per lost block to avoid flooding the
+ * server with duplicate acks.
+ */
+static void tftp_window_restart(void)
+{
+	if (tftp->last_nack == tftp->cur_block)
+		return;
+
+	tftp->last_nack = tftp->cur_block;
+	tftp->next_ack = (unsigned short)(tftp->cur_block + tftp->windowsize);
+	tftp_send();
+}
+
 /* The TFTP get or put is complete */
 static void tftp_complete(void)
 {
+#ifdef CONFIG_TFTP_PARALLEL
+	if (tftp->file) {
+		tftp_multi_done(0);
+		return;
+	}
+#endif
 #ifdef CONFIG_TFTP_TSIZE
 	/* Print hash marks for the last packet received */
-	while (tftp_tsize && tftp_tsize_num_hash < 49) {
+	while (tftp->tsize && tftp->tsize_num_hash < 49) {
 		putc('#');
-		tftp_tsize_num_hash++;
+		tftp->tsize_num_hash++;
 	}
 	puts("  ");
-	print_size(tftp_tsize, "");
+	print_size(tftp->tsize, "");
 #endif
-	time_start = get_timer(time_start);
-	if (time_start > 0) {
+	tftp->time_start = get_timer(tftp->time_start);
+	if (tftp->time_start > 0) {
 		puts("\n\t ");	/* Line up with "Loading: " */
 		print_size(net_boot_file_size /
-			time_start * 1000, "/s");
+			tftp->time_start * 1000, "/s");
 	}
 	puts("\ndone\n");
 	net_set_state(NETLOOP_SUCCESS);
@@ -319,26 +580,36 @@ static void tftp_send(void)
 	int len = 0;
 	ushort *s;
 
+#ifdef CONFIG_TFTP_PARALLEL
+	/*
+	 * While an ARP request is pending the packet buffer is taken by the
+	 * packet waiting for the reply; send ours once it is free again.
+	 */
+	tftp->unsent = tftp->file && arp_is_waiting();
+	if (tftp->unsent)
+		return;
+#endif
+
 	/*
 	 *	We will always be sending some sort of packet, so
 	 *	cobble together the packet headers now.
 	 */
 	pkt = net_tx_packet + net_eth_hdr_size() + IP_UDP_HDR_SIZE;
 
-	switch (tftp_state) {
+	switch (tftp->state) {
 	case STATE_SEND_RRQ:
 	case STATE_SEND_WRQ:
 		xp = pkt;
 		s = (ushort *)pkt;
 #ifdef CONFIG_CMD_TFTPPUT
-		*s++ = htons(tftp_state == STATE_SEND_RRQ ? TFTP_RRQ :
+		*s++ = htons(tftp->state == STATE_SEND_RRQ ? TFTP_RRQ :
 			TFTP_WRQ);
 #else
 		*s++ = htons(TFTP_RRQ);
 #endif
 		pkt = (uchar *)s;
-		strcpy((char *)pkt, tftp_filename);
-		pkt += strlen(tftp_filename) + 1;
+		strcpy((char *)pkt, tftp->filename);
+		pkt += strlen(tftp->filename) + 1;
 		strcpy((char *)pkt, "octet");
 		pkt += 5 /*strlen("octet")*/ + 1;
 		strcpy((char *)pkt, "timeout");
@@ -353,6 +624,11 @@ static void tftp_send(void)
 		/* try for more effic. blk size */
 		pkt += sprintf((char *)pkt, "blksize%c%d%c",
 				0, tftp_block_size_option, 0);
+		/* and for several blocks in flight per ack */
+		if (tftp->state == STATE_SEND_RRQ &&
+		    tftp_window_size_option > 1)
+			pkt += sprintf((char *)pkt, "windowsize%c%d%c",
+					0, tftp_window_size_option, 0);
 		len = pkt - xp;
 		break;
 
@@ -360,15 +636,16 @@ static void tftp_send(void)
 
 	case STATE_RECV_WRQ:
 	case STATE_DATA:
+	case STATE_DONE:
 		xp = pkt;
 		s = (ushort *)pkt;
 		s[0] = htons(TFTP_ACK);
-		s[1] = htons(tftp_cur_block);
+		s[1] = htons(tftp->cur_block);
 		pkt = (uchar *)(s + 2);
 #ifdef CONFIG_CMD_TFTPPUT
 		if (tftp_put_active) {
-			int toload = tftp_block_size;
-			int loaded = load_block(tftp_cur_block, pkt, toload);
+			int toload = tftp->block_size;
+			int loaded = load_block(tftp->cur_block, pkt, toload);
 
 			s[0] = htons(TFTP_DATA);
 			pkt += loaded;
@@ -400,10 +677,21 @@ static void tftp_send(void)
 		pkt += 18 /*strlen("File has bad magic")*/ + 1;
 		len = pkt - xp;
 		break;
+
+	case STATE_DEFERRED:
+		xp = pkt;
+		s = (ushort *)pkt;
+		*s++ = htons(TFTP_ERROR);
+		*s++ = htons(TFTP_ERR_UNDEFINED);
+		pkt = (uchar *)s;
+		strcpy((char *)pkt, "Not wanted");
+		pkt += 10 /*strlen("Not wanted")*/ + 1;
+		len = pkt - xp;
+		break;
 	}
 
-	net_send_udp_packet(net_server_ethaddr, tftp_remote_ip,
-			    tftp_remote_port, tftp_our_port, len);
+	net_send_udp_packet(tftp->ethaddr, tftp->remote_ip,
+			    tftp->remote_port, tftp->our_port, len);
 }
 
 #ifdef CONFIG_CMD_TFTPPUT
@@ -423,13 +711,14 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 {
 	__be16 proto;
 	__be16 *s;
+	uchar *data;
+	int block;
 	int i;
 
-	if (dest != tftp_our_port) {
-			return;
-	}
-	if (tftp_state != STATE_SEND_RRQ && src != tftp_remote_port &&
-	    tftp_state != STATE_RECV_WRQ && tftp_state != STATE_SEND_WRQ)
+	if (dest != tftp->our_port)
+		return;
+	if (tftp->state != STATE_SEND_RRQ && src != tftp->remote_port &&
+	    tftp->state != STATE_RECV_WRQ && tftp->state != STATE_SEND_WRQ)
 		return;
 
 	if (len < 2)
@@ -439,6 +728,19 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 	s = (__be16 *)pkt;
 	proto = *s++;
 	pkt = (uchar *)s;
+
+#ifdef CONFIG_TFTP_PARALLEL
+	/* The file exists, but those before it may have to be waited for */
+	if (tftp->file && tftp->state == STATE_SEND_RRQ &&
+	    (ntohs(proto) == TFTP_OACK || ntohs(proto) == TFTP_DATA) &&
+	    !tftp_multi_wanted()) {
+		tftp->remote_port = src;
+		tftp->state = STATE_DEFERRED;
+		tftp_send();
+		return;
+	}
+#endif
+
 	switch (ntohs(proto)) {
 	case TFTP_RRQ:
 		break;
@@ -454,9 +756,9 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 				 * count to wrap just like the other end!
 				 */
 				int block = ntohs(*s);
-				int ack_ok = (tftp_cur_block == block);
+				int ack_ok = (tftp->cur_block == block);
 
-				tftp_cur_block = (unsigned short)(block + 1);
+				tftp->cur_block = (unsigned short)(block + 1);
 				update_block_number();
 				if (ack_ok)
 					tftp_send(); /* Send next data block */
@@ -471,9 +773,9 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 #ifdef CONFIG_CMD_TFTPSRV
 	case TFTP_WRQ:
 		debug("Got WRQ\n");
-		tftp_remote_ip = sip;
-		tftp_remote_port = src;
-		tftp_our_port = 1024 + (get_timer(0) % 3072);
+		tftp->remote_ip = sip;
+		tftp->remote_port = src;
+		tftp->our_port = 1024 + (get_timer(0) % 3072);
 		new_transfer();
 		tftp_send(); /* Send ACK(0) */
 		break;
@@ -482,8 +784,8 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 	case TFTP_OACK:
 		debug("Got OACK: %s %s\n",
 		      pkt, pkt + strlen((char *)pkt) + 1);
-		tftp_state = STATE_OACK;
-		tftp_remote_port = src;
+		tftp->state = STATE_OACK;
+		tftp->remote_port = src;
 		/*
 		 * Check for 'blksize' option.
 		 * Careful: "i" is signed, "len" is unsigned, thus
@@ -491,26 +793,38 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 		 */
 		for (i = 0; i+8 < len; i++) {
 			if (strcmp((char *)pkt + i, "blksize") == 0) {
-				tftp_block_size = (unsigned short)
+				tftp->block_size = (unsigned short)
 					simple_strtoul((char *)pkt + i + 8,
 						       NULL, 10);
 				debug("Blocksize ack: %s, %d\n",
-				      (char *)pkt + i + 8, tftp_block_size);
+				      (char *)pkt + i + 8, tftp->block_size);
+			}
+			if (strcmp((char *)pkt + i, "windowsize") == 0) {
+				tftp->windowsize = (unsigned short)
+					simple_strtoul((char *)pkt + i + 11,
+						       NULL, 10);
+				/* the server may only make it smaller */
+				tftp->windowsize =
+					clamp(tftp->windowsize,
+					      (unsigned short)1,
+					      tftp_window_size_option);
+				debug("Windowsize ack: %s, %d\n",
+				      (char *)pkt + i + 11, tftp->windowsize);
 			}
 #ifdef CONFIG_TFTP_TSIZE
 			if (strcmp((char *)pkt+i, "tsize") == 0) {
-				tftp_tsize = simple_strtoul((char *)pkt + i + 6,
-							   NULL, 10);
+				tftp->tsize = simple_strtoul((char *)pkt +
+							     i + 6, NULL, 10);
 				debug("size = %s, %d\n",
-				      (char *)pkt + i + 6, tftp_tsize);
+				      (char *)pkt + i + 6, tftp->tsize);
 			}
 #endif
 		}
 #ifdef CONFIG_CMD_TFTPPUT
 		if (tftp_put_active) {
 			/* Get ready to send the first block */
-			tftp_state = STATE_DATA;
-			tftp_cur_block++;
+			tftp->state = STATE_DATA;
+			tftp->cur_block++;
 		}
 #endif
 		tftp_send(); /* Send ACK or first data block */
@@ -519,56 +833,90 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 		if (len < 2)
 			return;
 		len -= 2;
-		tftp_cur_block = ntohs(*(__be16 *)pkt);
-
-		update_block_number();
+		block = ntohs(*(__be16 *)pkt);
+		data = net_rx_payload ? net_rx_payload : pkt + 2;
 
-		if (tftp_state == STATE_SEND_RRQ)
+		if (tftp->state == STATE_SEND_RRQ)
 			debug("Server did not acknowledge timeout option!\n");
 
-		if (tftp_state == STATE_SEND_RRQ || tftp_state == STATE_OACK ||
-		    tftp_state == STATE_RECV_WRQ) {
+		if (tftp->state == STATE_OACK && block != 1 &&
+		    tftp->windowsize > 1) {
+			/* Start of the first window was lost; ack the OACK again */
+			tftp_window_restart();
+			break;
+		}
+
+		if (tftp->state == STATE_SEND_RRQ ||
+		    tftp->state == STATE_OACK ||
+		    tftp->state == STATE_RECV_WRQ) {
 			/* first block received */
-			tftp_state = STATE_DATA;
-			tftp_remote_port = src;
+			tftp->state = STATE_DATA;
+			tftp->remote_port = src;
 			new_transfer();
 
-			if (tftp_cur_block != 1) {	/* Assertion */
+			if (block != 1) {	/* Assertion */
 				puts("\nTFTP error: ");
-				printf("First block is not block 1 (%ld)\n",
-				       tftp_cur_block);
+				printf("First block is not block 1 (%d)\n",
+				       block);
 				puts("Starting again\n\n");
-				net_start_again();
+				tftp_start_again(-EIO);
 				break;
 			}
-		}
-
-		if (tftp_cur_block == tftp_prev_block) {
-			/* Same block again; ignore it. */
+		} else if (block != (unsigned short)(tftp->prev_block + 1)) {
+			/* Same block again or a gap in the window; ignore it. */
+			if (tftp->windowsize > 1)
+				tftp_window_restart();
 			break;
 		}
 
-		tftp_prev_block = tftp_cur_block;
+		tftp_set_rx_dest();
+		tftp->cur_block = block;
+		update_block_number();
+		tftp->prev_block = tftp->cur_block;
 		timeout_count_max = tftp_timeout_count_max;
-		net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
+		tftp_set_timeout();
 
-		if (store_block(tftp_cur_block - 1, pkt + 2, len)) {
-			eth_halt();
-			net_set_state(NETLOOP_FAIL);
+		if (store_block(tftp->cur_block - 1, data, len)) {
+			tftp_fail(-E2BIG);
+			break;
+		}
+
+		if (len < tftp->block_size) {
+			tftp_send();
+			tftp_complete();
 			break;
 		}
 
 		/*
-		 *	Acknowledge the block just received, which will prompt
-		 *	the remote for the next one.
+		 *	Acknowledge the last block of the window just received,
+		 *	which will prompt the remote for the next window.
 		 */
-		tftp_send();
-
-		if (len < tftp_block_size)
-			tftp_complete();
+		if (tftp->cur_block == tftp->next_ack) {
+			tftp_send();
+			tftp->next_ack = (unsigned short)(tftp->cur_block +
+							  tftp->windowsize);
+		}
 		break;
 
 	case TFTP_ERROR:
+#ifdef CONFIG_TFTP_PARALLEL
+		if (tftp->file) {
+			int code = ntohs(*(__be16 *)pkt);
+
+			/* Most candidates are not expected to exist */
+			if (!tftp_multi_first ||
+			    code != TFTP_ERR_FILE_NOT_FOUND)
+				printf("\nTFTP error: %s: '%s' (%d)\n",
+				       tftp->filename, pkt + 2, code);
+			if (code == TFTP_ERR_FILE_NOT_FOUND)
+				tftp_multi_done(-ENOENT);
+			else if (code == TFTP_ERR_ACCESS_DENIED)
+				tftp_multi_done(-EACCES);
+			else
+				tftp_multi_done(-EIO);
+			break;
+		}
+#endif
 		printf("\nTFTP error: '%s' (%d)\n",
 		       pkt + 2, ntohs(*(__be16 *)pkt));
 
@@ -596,17 +944,41 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 
 static void tftp_timeout_handler(void)
 {
-	if (++timeout_count > timeout_count_max) {
+	if (++tftp->timeout_count > timeout_count_max) {
 		restart("Retry count exceeded");
 	} else {
 		puts("T ");
-		net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
-		if (tftp_state != STATE_RECV_WRQ)
+		tftp_set_timeout();
+		/*
+		 * Resend the last ack; the server restarts the window from it.
+		 * A loss in the new window must be acknowledged again.
+		 */
+		tftp->last_nack = TFTP_SEQUENCE_SIZE;
+		tftp->next_ack = (unsigned short)(tftp->cur_block +
+						  tftp->windowsize);
+		if (tftp->state != STATE_RECV_WRQ)
 			tftp_send();
 	}
 }
 
-/* Initialize tftp_load_addr and tftp_load_size from image_load_addr and lmb */
+/* Get the current session ready to send its request from @our_port */
+static void tftp_new_request(int our_port)
+{
+	tftp->remote_port = WELL_KNOWN_PORT;
+	tftp->our_port = our_port;
+	tftp->timeout_count = 0;
+	tftp->cur_block = 0;
+	tftp->last_nack = TFTP_SEQUENCE_SIZE;
+	/* Revert the block size and window size to dflt */
+	tftp->block_size = TFTP_BLOCK_SIZE;
+	tftp->windowsize = 1;
+#ifdef CONFIG_TFTP_TSIZE
+	tftp->tsize = 0;
+	tftp->tsize_num_hash = 0;
+#endif
+}
+
+/* Initialize load_addr and load_size from image_load_addr and lmb */
 static int tftp_init_load_addr(void)
 {
 #ifdef CONFIG_LMB
@@ -619,13 +991,14 @@ static int tftp_init_load_addr(void)
 	if (!max_size)
 		return -1;
 
-	tftp_load_size = max_size;
+	tftp->load_size = max_size;
 #endif
-	tftp_load_addr = image_load_addr;
+	tftp->load_addr = image_load_addr;
 	return 0;
 }
 
-void tftp_start(enum proto_t protocol)
+/* Read the TFTP settings the user may have put in the environment */
+static void tftp_get_env(void)
 {
 #if CONFIG_NET_TFTP_VARS
 	char *ep;             /* Environment pointer */
@@ -639,6 +1012,13 @@ void tftp_start(enum proto_t protocol)
 	if (ep != NULL)
 		tftp_block_size_option = simple_strtol(ep, NULL, 10);
 
+	ep = env_get("tftpwindowsize");
+	if (ep != NULL) {
+		/* RFC 7440 allows windows of 1 to 65535 blocks */
+		tftp_window_size_option = clamp(simple_strtoul(ep, NULL, 10),
+						1UL, 65535UL);
+	}
+
 	ep = env_get("tftptimeout");
 	if (ep != NULL)
 		timeout_ms = simple_strtol(ep, NULL, 10);
@@ -659,23 +1039,35 @@ void tftp_start(enum proto_t protocol)
 		tftp_timeout_count_max = 0;
 	}
 #endif
+}
+
+void tftp_start(enum proto_t protocol)
+{
+#ifdef CONFIG_TFTP_PORT
+	char *ep;             /* Environment pointer */
+#endif
+
+	tftp = tftp_sessions;
+	memset(tftp, '\0', sizeof(*tftp));
+	tftp_rx = NULL;
+	tftp_get_env();
 
-	debug("TFTP blocksize = %i, timeout = %ld ms\n",
-	      tftp_block_size_option, timeout_ms);
+	debug("TFTP blocksize = %i, windowsize = %i, timeout = %ld ms\n",
+	      tftp_block_size_option, tftp_window_size_option, timeout_ms);
 
-	tftp_remote_ip = net_server_ip;
-	if (!net_parse_bootfile(&tftp_remote_ip, tftp_filename, MAX_LEN)) {
+	tftp->remote_ip = net_server_ip;
+	if (!net_parse_bootfile(&tftp->remote_ip, tftp->filename, MAX_LEN)) {
 		sprintf(default_filename, "%02X%02X%02X%02X.img",
 			net_ip.s_addr & 0xFF,
 			(net_ip.s_addr >>  8) & 0xFF,
 			(net_ip.s_addr >> 16) & 0xFF,
 			(net_ip.s_addr >> 24) & 0xFF);
 
-		strncpy(tftp_filename, default_filename, DEFAULT_NAME_LEN);
-		tftp_filename[DEFAULT_NAME_LEN - 1] = 0;
+		strncpy(tftp->filename, default_filename, DEFAULT_NAME_LEN);
+		tftp->filename[DEFAULT_NAME_LEN - 1] = 0;
 
 		printf("*** Warning: no boot file name; using '%s'\n",
-		       tftp_filename);
+		       tftp->filename);
 	}
 
 	printf("Using %s device\n", eth_get_name());
@@ -685,7 +1077,7 @@ void tftp_start(enum proto_t protocol)
 #else
 	       "from",
 #endif
-	       &tftp_remote_ip, &net_ip);
+	       &tftp->remote_ip, &net_ip);
 
 	/* Check if we need to send across this subnet */
 	if (net_gateway.s_addr && net_netmask.s_addr) {
@@ -693,13 +1085,13 @@ void tftp_start(enum proto_t protocol)
 		struct in_addr remote_net;
 
 		our_net.s_addr = net_ip.s_addr & net_netmask.s_addr;
-		remote_net.s_addr = tftp_remote_ip.s_addr & net_netmask.s_addr;
+		remote_net.s_addr = tftp->remote_ip.s_addr & net_netmask.s_addr;
 		if (our_net.s_addr != remote_net.s_addr)
 			printf("; sending through gateway %pI4", &net_gateway);
 	}
 	putc('\n');
 
-	printf("Filename '%s'.", tftp_filename);
+	printf("Filename '%s'.", tftp->filename);
 
 	if (net_boot_file_expected_size_in_blocks) {
 		printf(" Size is 0x%x Bytes = ",
@@ -715,7 +1107,7 @@ void tftp_start(enum proto_t protocol)
 		printf("Save size:    0x%lx\n", image_save_size);
 		net_boot_file_size = image_save_size;
 		puts("Saving: *\b");
-		tftp_state = STATE_SEND_WRQ;
+		tftp->state = STATE_SEND_WRQ;
 		new_transfer();
 	} else
 #endif
@@ -727,15 +1119,15 @@ void tftp_start(enum proto_t protocol)
 			puts("trying to overwrite reserved memory...\n");
 			return;
 		}
-		printf("Load address: 0x%lx\n", tftp_load_addr);
+		printf("Load address: 0x%lx\n", tftp->load_addr);
 		puts("Loading: *\b");
-		tftp_state = STATE_SEND_RRQ;
+		tftp->state = STATE_SEND_RRQ;
 #ifdef CONFIG_CMD_BOOTEFI
-		efi_set_bootdev("Net", "", tftp_filename);
+		efi_set_bootdev("Net", "", tftp->filename);
 #endif
 	}
 
-	time_start = get_timer(0);
+	tftp->time_start = get_timer(0);
 	timeout_count_max = tftp_timeout_count_max;
 
 	net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
@@ -743,37 +1135,223 @@ void tftp_start(enum proto_t protocol)
 #ifdef CONFIG_CMD_TFTPPUT
 	net_set_icmp_handler(icmp_handler);
 #endif
-	tftp_remote_port = WELL_KNOWN_PORT;
-	timeout_count = 0;
 	/* Use a pseudo-random port unless a specific port is set */
-	tftp_our_port = 1024 + (get_timer(0) % 3072);
+	tftp_new_request(1024 + (get_timer(0) % 3072));
 
 #ifdef CONFIG_TFTP_PORT
 	ep = env_get("tftpdstp");
 	if (ep != NULL)
-		tftp_remote_port = simple_strtol(ep, NULL, 10);
+		tftp->remote_port = simple_strtol(ep, NULL, 10);
 	ep = env_get("tftpsrcp");
 	if (ep != NULL)
-		tftp_our_port = simple_strtol(ep, NULL, 10);
+		tftp->our_port = simple_strtol(ep, NULL, 10);
 #endif
-	tftp_cur_block = 0;
 
-	/* zero out server ether in case the server ip has changed */
-	memset(net_server_ethaddr, 0, 6);
-	/* Revert tftp_block_size to dflt */
-	tftp_block_size = TFTP_BLOCK_SIZE;
-#ifdef CONFIG_TFTP_TSIZE
-	tftp_tsize = 0;
-	tftp_tsize_num_hash = 0;
+	tftp_send();
+}
+
+#ifdef CONFIG_TFTP_PARALLEL
+/*
+ * Fetching several files at once: each file has its own session, told apart
+ * by the port at our end. A timer ticking every few milliseconds looks after
+ * the timeouts of all of them, and sends the packets which had to wait for
+ * an ARP reply.
+ */
+#define TFTP_MULTI_TICK	10UL
+
+/* (Re)start the current session by sending a request from a new port */
+static void tftp_multi_request(void)
+{
+	tftp_new_request(tftp_multi_next_port++);
+	tftp->state = STATE_SEND_RRQ;
+	tftp->time = get_timer(0);
+	tftp->unsent = true;
+}
+
+/* Send the packets which could not go out while an ARP request was pending */
+static void tftp_multi_kick(void)
+{
+	int i;
+
+	for (i = 0; i < tftp_multi_count && !arp_is_waiting(); i++) {
+		tftp = &tftp_sessions[i];
+		if (tftp->unsent)
+			tftp_send();
+	}
+}
+
+/*
+ * See if we are done, and restart a deferred session which is now wanted.
+ * The loop fails if a file could not be loaded or, when looking for the
+ * first one that exists, if none could.
+ */
+static void tftp_multi_check(void)
+{
+	bool ok = !tftp_multi_first;
+	int i;
+
+	for (i = 0; i < tftp_multi_count; i++) {
+		tftp = &tftp_sessions[i];
+		if (tftp->state == STATE_DEFERRED)
+			tftp_multi_request();
+		if (tftp->state != STATE_DONE)
+			return;
+		if (tftp_multi_first && !tftp->file->err) {
+			net_boot_file_size = tftp->file->size;
+			image_load_addr = tftp->file->addr;
+			ok = true;
+			break;
+		}
+		if (tftp->file->err)
+			ok = false;
+	}
+
+	if (!ok) {
+		eth_halt();
+		net_set_state(NETLOOP_FAIL);
+		return;
+	}
+	puts("\ndone\n");
+	net_set_state(NETLOOP_SUCCESS);
+}
+
+static void tftp_multi_handler(uchar *pkt, unsigned dest, struct in_addr sip,
+			       unsigned src, unsigned len)
+{
+	int i;
+
+	for (i = 0; i < tftp_multi_count; i++) {
+		tftp = &tftp_sessions[i];
+		if (tftp->our_port == dest && tftp->state != STATE_DONE &&
+		    tftp->state != STATE_DEFERRED)
+			break;
+	}
+	if (i == tftp_multi_count || sip.s_addr != tftp->remote_ip.s_addr)
+		return;
+
+	tftp_handler(pkt, dest, sip, src, len);
+	tftp_multi_check();
+	tftp_multi_kick();
+}
+
+static void tftp_multi_timeout_handler(void)
+{
+	int i;
+
+	for (i = 0; i < tftp_multi_count; i++) {
+		tftp = &tftp_sessions[i];
+		if (tftp->state != STATE_DONE &&
+		    tftp->state != STATE_DEFERRED &&
+		    get_timer(tftp->time) >= timeout_ms)
+			tftp_timeout_handler();
+	}
+
+	net_set_timeout_handler(TFTP_MULTI_TICK, tftp_multi_timeout_handler);
+	tftp_multi_check();
+	tftp_multi_kick();
+}
+
+void tftp_multi_start(void)
+{
+#ifdef CONFIG_LMB
+	struct lmb lmb;
 #endif
+	int i, j;
 
-	tftp_send();
+	tftp_get_env();
+#ifdef CONFIG_CMD_TFTPPUT
+	tftp_put_active = 0;
+#endif
+	tftp_rx = NULL;
+
+	printf("Using %s device\n", eth_get_name());
+	printf("TFTP from server %pI4; our IP address is %pI4\n",
+	       &net_server_ip, &net_ip);
+	puts("Loading: *\b");
+
+#ifdef CONFIG_LMB
+	lmb_init_and_reserve(&lmb, gd->bd, (void *)gd->fdt_blob);
+#endif
+	tftp_multi_next_port = 1024 + (get_timer(0) % 3072);
+	tftp_multi_blocks = 0;
+	for (i = 0; i < tftp_multi_count; i++) {
+		struct tftp_file *file = &tftp_multi_files[i];
+		const char *colon = strchr(file->name, ':');
+
+		tftp = &tftp_sessions[i];
+		memset(tftp, '\0', sizeof(*tftp));
+		tftp->file = file;
+		tftp->remote_ip = net_server_ip;
+		if (colon)
+			tftp->remote_ip = string_to_ip(file->name);
+		strlcpy(tftp->filename, colon ? colon + 1 : file->name,
+			MAX_LEN);
+		tftp->load_addr = file->addr;
+		tftp->time_start = get_timer(0);
+		file->size = 0;
+		file->err = -EINPROGRESS;
+		tftp_multi_request();
+
+		/* Do not run into reserved memory or the next file */
+#ifdef CONFIG_LMB
+		tftp->load_size = lmb_get_free_size(&lmb, file->addr);
+		if (!tftp->load_size) {
+			printf("\nTFTP error: %s: ", tftp->filename);
+			puts("trying to overwrite reserved memory...\n");
+			tftp_multi_done(-E2BIG);
+		}
+#endif
+		for (j = 0; j < tftp_multi_count; j++) {
+			ulong addr = tftp_multi_files[j].addr;
+
+			if (addr > file->addr &&
+			    (!tftp->load_size ||
+			     addr - file->addr < tftp->load_size))
+				tftp->load_size = addr - file->addr;
+		}
+		if (!tftp->remote_ip.s_addr)
+			tftp_multi_done(-EINVAL);
+	}
+
+	timeout_count_max = tftp_timeout_count_max;
+	net_set_timeout_handler(TFTP_MULTI_TICK, tftp_multi_timeout_handler);
+	net_set_udp_handler(tftp_multi_handler);
+	tftp_multi_check();
+	tftp_multi_kick();
 }
 
+int tftp_get_files(struct tftp_file *files, int count, bool first)
+{
+	int i, ret;
+
+	if (count > TFTP_MAX_FILES)
+		return -E2BIG;
+
+	tftp_multi_files = files;
+	tftp_multi_count = count;
+	tftp_multi_first = first;
+	ret = net_loop(TFTPMULTI);
+
+	for (i = 0; i < count; i++) {
+		/* The loop was stopped before this file was done with */
+		if (files[i].err == -EINPROGRESS)
+			return ret < 0 ? ret : -EINTR;
+		if (first && !files[i].err)
+			return i;
+		if (!first && files[i].err)
+			return files[i].err;
+	}
+
+	return first ? -ENOENT : 0;
+}
+#endif /* CONFIG_TFTP_PARALLEL */
+
 #ifdef CONFIG_CMD_TFTPSRV
 void tftp_start_server(void)
 {
-	tftp_filename[0] = 0;
+	tftp = tftp_sessions;
+	memset(tftp, '\0', sizeof(*tftp));
+	tftp_rx = NULL;
 
 	if (tftp_init_load_addr()) {
 		eth_halt();
@@ -783,30 +1361,17 @@ void tftp_start_server(void)
 	}
 	printf("Using %s device\n", eth_get_name());
 	printf("Listening for TFTP transfer on %pI4\n", &net_ip);
-	printf("Load address: 0x%lx\n", tftp_load_addr);
+	printf("Load address: 0x%lx\n", tftp->load_addr);
 
 	puts("Loading: *\b");
 
 	timeout_count_max = tftp_timeout_count_max;
-	timeout_count = 0;
 	timeout_ms = TIMEOUT;
 	net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
 
-	/* Revert tftp_block_size to dflt */
-	tftp_block_size = TFTP_BLOCK_SIZE;
-	tftp_cur_block = 0;
-	tftp_our_port = WELL_KNOWN_PORT;
-
-#ifdef CONFIG_TFTP_TSIZE
-	tftp_tsize = 0;
-	tftp_tsize_num_hash = 0;
-#endif
-
-	tftp_state = STATE_RECV_WRQ;
+	tftp_new_request(WELL_KNOWN_PORT);
+	tftp->state = STATE_RECV_WRQ;
 	net_set_udp_handler(tftp_handler);
-
-	/* zero out server ether in case the server ip has changed */
-	memset(net_server_ethaddr, 0, 6);
 }
 #endif /* CONFIG_CMD_TFTPSRV */
 
@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * HTTP/1.1 download over TCP
+ *
+ * The file is written to the load address as the data arrives.
+ */
+
+#include <common.h>
+#include <div64.h>
+#include <env.h>
+#include <image.h>
+#include <lmb.h>
+#include <mapmem.h>
+#include <net.h>
+#include <net/tcp.h>
+#include <net/wget.h>
+
+DECLARE_GLOBAL_DATA_PTR;
+
+#define HTTP_PORT		80
+/* Room for the status line and the response headers */
+#define WGET_HDR_SIZE		1024
+/* Number of "loading" hashes per line, or per file if the size is known */
+#define HASHES_PER_LINE		65
+#define HASHES_PER_FILE		50
+
+static struct in_addr wget_server_ip;
+static int wget_server_port;
+static char wget_path[1024];
+
+static ulong wget_load_addr;
+#ifdef CONFIG_LMB
+static ulong wget_load_size;
+#endif
+static ulong time_start;
+
+static char wget_hdr[WGET_HDR_SIZE + 1];
+static int wget_hdr_len;
+static bool wget_in_body;
+/* value of Content-Length, or -1 if there was none */
+static long wget_content_len;
+static ulong wget_body_len;
+static int wget_num_hash;
+
+static void wget_fail(const char *msg)
+{
+	printf("\nwget error: %s\n", msg);
+	tcp_abort();
+	eth_halt();
+	net_set_state(NETLOOP_FAIL);
+}
+
+static void wget_complete(void)
+{
+	tcp_close();
+
+	while (wget_content_len > 0 && wget_num_hash < HASHES_PER_FILE) {
+		putc('#');
+		wget_num_hash++;
+	}
+	time_start = get_timer(time_start);
+	if (time_start > 0) {
+		puts("\n\t ");	/* Line up with "Loading: " */
+		print_size(net_boot_file_size / time_start * 1000, "/s");
+	}
+	puts("\ndone\n");
+	net_set_state(NETLOOP_SUCCESS);
+}
+
+static void show_progress(void)
+{
+	if (wget_content_len > 0) {
+		while (wget_num_hash < lldiv((u64)wget_body_len *
+					     HASHES_PER_FILE,
+					     wget_content_len)) {
+			putc('#');
+			wget_num_hash++;
+		}
+	} else {
+		/* One hash per 64KiB */
+		while (wget_num_hash < wget_body_len >> 16) {
+			putc('#');
+			if (!(++wget_num_hash % HASHES_PER_LINE))
+				puts("\n\t ");
+		}
+	}
+}
+
+static int store_block(uchar *src, unsigned int len)
+{
+	ulong store_addr = wget_load_addr + wget_body_len;
+	void *ptr;
+
+#ifdef CONFIG_LMB
+	ulong end_addr = wget_load_addr + wget_load_size;
+
+	if (!end_addr)
+		end_addr = ULONG_MAX;
+
+	if (store_addr + len > end_addr) {
+		puts("\nwget error: ");
+		puts("trying to overwrite reserved memory...\n");
+		return -1;
+	}
+#endif
+	ptr = map_sysmem(store_addr, len);
+	memcpy(ptr, src, len);
+	unmap_sysmem(ptr);
+
+	wget_body_len += len;
+	net_boot_file_size = wget_body_len;
+
+	return 0;
+}
+
+/* Find a response header field and return its value, or NULL */
+static const char *wget_get_header(const char *name)
+{
+	int len = strlen(name);
+	char *p;
+
+	for (p = strstr(wget_hdr, "\r\n"); p; p = strstr(p + 2, "\r\n")) {
+		if (!strncasecmp(p + 2, name, len) && p[2 + len] == ':')
+			return p + 3 + len;
+	}
+
+	return NULL;
+}
+
+/* Check the response headers; return 0 if the body can follow */
+static int wget_parse_headers(void)
+{
+	const char *val;
+	int status;
+
+	if (strncmp(wget_hdr, "HTTP/1.", 7)) {
+		wget_fail("not an HTTP response");
+		return -1;
+	}
+
+	status = simple_strtoul(wget_hdr + 9, NULL, 10);
+	if (status != 200) {
+		*strstr(wget_hdr, "\r\n") = '\0';
+		printf("\nwget error: server says '%s'\n", wget_hdr + 9);
+		tcp_abort();
+		eth_halt();
+		net_set_state(NETLOOP_FAIL);
+		return -1;
+	}
+
+	val = wget_get_header("Transfer-Encoding");
+	if (val && strncasecmp(skip_spaces(val), "identity", 8)) {
+		wget_fail("transfer encoding is not supported");
+		return -1;
+	}
+
+	val = wget_get_header("Content-Length");
+	if (val) {
+		val = skip_spaces(val);
+		wget_content_len = simple_strtoul(val, NULL, 10);
+	}
+
+	return 0;
+}
+
+static void wget_rx(uchar *data, u32 offset, unsigned int len)
+{
+	char *end;
+	int n;
+
+	if (!wget_in_body) {
+		/* Collect the headers, up to the empty line */
+		n = min(len, (unsigned int)(WGET_HDR_SIZE - wget_hdr_len));
+		memcpy(wget_hdr + wget_hdr_len, data, n);
+		wget_hdr[wget_hdr_len + n] = '\0';
+
+		end = strstr(wget_hdr, "\r\n\r\n");
+		if (!end) {
+			wget_hdr_len += n;
+			if (wget_hdr_len == WGET_HDR_SIZE)
+				wget_fail("response headers too long");
+			return;
+		}
+
+		/* Whatever follows the headers is the start of the body */
+		n = end + 4 - (wget_hdr + wget_hdr_len);
+		end[2] = '\0';
+		data += n;
+		len -= n;
+		wget_in_body = true;
+		if (wget_parse_headers())
+			return;
+	}
+
+	if (wget_content_len >= 0 &&
+	    wget_body_len + len > (ulong)wget_content_len)
+		len = wget_content_len - wget_body_len;
+
+	if (len && store_block(data, len)) {
+		tcp_abort();
+		eth_halt();
+		net_set_state(NETLOOP_FAIL);
+		return;
+	}
+	show_progress();
+
+	if (wget_content_len >= 0 && wget_body_len == (ulong)wget_content_len)
+		wget_complete();
+}
+
+static void wget_event(enum tcp_event event)
+{
+	char req[sizeof(wget_path) + 128];
+	int len;
+
+	switch (event) {
+	case TCP_CONNECTED:
+		len = sprintf(req,
+			      "GET %s HTTP/1.1\r\n"
+			      "Host: %pI4:%d\r\n"
+			      "User-Agent: U-Boot\r\n"
+			      "Connection: close\r\n"
+			      "\r\n",
+			      wget_path, &wget_server_ip, wget_server_port);
+		if (tcp_send(req, len))
+			wget_fail("request too long");
+		break;
+	case TCP_PEER_CLOSED:
+		if (!wget_in_body)
+			wget_fail("no response");
+		else if (wget_content_len >= 0)
+			wget_fail("connection closed early");
+		else
+			wget_complete();
+		break;
+	case TCP_ABORTED:
+		eth_halt();
+		net_set_state(NETLOOP_FAIL);
+		break;
+	}
+}
+
+/* Initialize wget_load_addr and wget_load_size from image_load_addr and lmb */
+static int wget_init_load_addr(void)
+{
+#ifdef CONFIG_LMB
+	struct lmb lmb;
+	phys_size_t max_size;
+
+	lmb_init_and_reserve(&lmb, gd->bd, (void *)gd->fdt_blob);
+
+	max_size = lmb_get_free_size(&lmb, image_load_addr);
+	if (!max_size)
+		return -1;
+
+	wget_load_size = max_size;
+#endif
+	wget_load_addr = image_load_addr;
+	return 0;
+}
+
+void wget_start(void)
+{
+	char *ep;
+
+	wget_server_ip = net_server_ip;
+	if (!net_parse_bootfile(&wget_server_ip, wget_path + 1,
+				sizeof(wget_path) - 1)) {
+		puts("\nwget error: no file name given\n");
+		net_set_state(NETLOOP_FAIL);
+		return;
+	}
+	/* Allow the path to be given with or without the leading slash */
+	if (wget_path[1] == '/')
+		memmove(wget_path, wget_path + 1, strlen(wget_path + 1) + 1);
+	else
+		wget_path[0] = '/';
+
+	wget_server_port = HTTP_PORT;
+	ep = env_get("httpdstp");
+	if (ep)
+		wget_server_port = simple_strtol(ep, NULL, 10);
+
+	printf("Using %s device\n", eth_get_name());
+	printf("HTTP from server %pI4:%d; our IP address is %pI4\n",
+	       &wget_server_ip, wget_server_port, &net_ip);
+	printf("Filename '%s'.\n", wget_path);
+
+	if (wget_init_load_addr()) {
+		eth_halt();
+		net_set_state(NETLOOP_FAIL);
+		puts("\nwget error: ");
+		puts("trying to overwrite reserved memory...\n");
+		return;
+	}
+	printf("Load address: 0x%lx\n", wget_load_addr);
+	puts("Loading: *\b");
+
+	wget_hdr_len = 0;
+	wget_in_body = false;
+	wget_content_len = -1;
+	wget_body_len = 0;
+	wget_num_hash = 0;
+	time_start = get_timer(0);
+
+	tcp_connect(wget_server_ip, wget_server_port, wget_rx, wget_event);
+}
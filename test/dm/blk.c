@@ -5,6 +5,9 @@
 
 #include <common.h>
 #include <dm.h>
+#include <hexdump.h>
+#include <os.h>
+#include <sandboxblockdev.h>
 #include <usb.h>
 #include <asm/state.h>
 #include <dm/test.h>
@@ -162,3 +165,162 @@ static int dm_test_blk_get_from_parent(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_blk_get_from_parent, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+
+/* Test that reads can be made in the background */
+static int dm_test_blk_submit_read(struct unit_test_state *uts)
+{
+	const char *fname = "blk_submit_read.img";
+	char data[HOST_QUEUE_DEPTH * 4 * 512], buf[sizeof(data)];
+	struct blk_req req[HOST_QUEUE_DEPTH + 1];
+	struct blk_desc *desc;
+	struct udevice *dev;
+	int fd, i;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i / 512;
+	fd = os_open(fname, OS_O_RDWR | OS_O_CREAT | OS_O_TRUNC);
+	ut_assert(fd >= 0);
+	ut_asserteq(sizeof(data), os_write(fd, data, sizeof(data)));
+	os_close(fd);
+
+	ut_assertok(host_dev_bind(0, (char *)fname));
+	ut_assertok(blk_get_device(IF_TYPE_HOST, 0, &dev));
+	desc = dev_get_uclass_platdata(dev);
+	ut_asserteq(HOST_QUEUE_DEPTH, desc->queue_depth);
+	/* the partition scan leaves blocks in the cache */
+	blkcache_invalidate(desc->if_type, desc->devnum);
+
+	/* the queue fills up, then each poll completes the oldest read */
+	memset(buf, '\0', sizeof(buf));
+	for (i = 0; i < HOST_QUEUE_DEPTH; i++)
+		ut_assertok(blk_submit_read(desc, i * 4, 4, buf + i * 4 * 512,
+					    &req[i]));
+	ut_asserteq(-EBUSY, blk_submit_read(desc, 0, 1, buf, &req[i]));
+	ut_asserteq(4, blk_poll(desc, &req[0]));
+	ut_asserteq(-EINPROGRESS, blk_poll(desc, &req[HOST_QUEUE_DEPTH - 1]));
+	ut_asserteq(4, blk_poll(desc, &req[1]));
+	ut_asserteq(4, blk_wait(desc, &req[HOST_QUEUE_DEPTH - 1]));
+	for (i = 0; i < HOST_QUEUE_DEPTH; i++)
+		ut_assert(req[i].done);
+	ut_asserteq_mem(data, buf, sizeof(data));
+
+	ut_assertok(host_dev_bind(0, NULL));
+	os_unlink(fname);
+
+	return 0;
+}
+DM_TEST(dm_test_blk_submit_read, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+
+/* Test that discarded blocks read as zero */
+static int dm_test_blk_discard(struct unit_test_state *uts)
+{
+	const char *fname = "blk_discard.img";
+	char data[16 * 512], buf[sizeof(data)];
+	struct blk_desc *desc;
+	struct udevice *dev;
+	int fd;
+
+	memset(data, 0xa5, sizeof(data));
+	fd = os_open(fname, OS_O_RDWR | OS_O_CREAT | OS_O_TRUNC);
+	ut_assert(fd >= 0);
+	ut_asserteq(sizeof(data), os_write(fd, data, sizeof(data)));
+	os_close(fd);
+
+	ut_assertok(host_dev_bind(0, (char *)fname));
+	ut_assertok(blk_get_device(IF_TYPE_HOST, 0, &dev));
+	desc = dev_get_uclass_platdata(dev);
+	ut_assert(desc->discard_zeroes);
+
+	/* the cached blocks go too, so that they are read again */
+	ut_asserteq(16, blk_dread(desc, 0, 16, buf));
+	ut_asserteq(5, blk_ddiscard(desc, 3, 5));
+	memset(data + 3 * 512, '\0', 5 * 512);
+	ut_asserteq(16, blk_dread(desc, 0, 16, buf));
+	ut_asserteq_mem(data, buf, sizeof(data));
+
+	ut_assertok(host_dev_bind(0, NULL));
+	os_unlink(fname);
+
+	return 0;
+}
+DM_TEST(dm_test_blk_discard, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+
+#if CONFIG_IS_ENABLED(BLOCK_CACHE)
+/* Test that small reads are widened to cache entries and read ahead */
+static int dm_test_blk_cache(struct unit_test_state *uts)
+{
+	struct block_cache_stats stats;
+	struct blk_desc *desc;
+	struct udevice *dev;
+	char buf[16 * 512];
+
+	ut_assertok(blk_get_device(IF_TYPE_MMC, 0, &dev));
+	desc = dev_get_uclass_platdata(dev);
+	blkcache_invalidate(desc->if_type, desc->devnum);
+	blkcache_configure(8, 64 << 10);
+
+	/* the whole entry is read and kept */
+	ut_asserteq(1, blk_dread(desc, 1, 1, buf));
+	blkcache_stats(&stats);
+	ut_asserteq(0, stats.hits);
+	ut_asserteq(1, stats.misses);
+	ut_asserteq(1, stats.entries);
+	ut_asserteq(8 * 512, stats.bytes);
+
+	ut_asserteq(1, blk_dread(desc, 2, 1, buf));
+	blkcache_stats(&stats);
+	ut_asserteq(1, stats.hits);
+	ut_asserteq(0, stats.misses);
+
+	/*
+	 * The block comes from the multi-block read of the entry, so holds
+	 * the test string which a single-block read does not return
+	 */
+	ut_asserteq(1, blk_dread(desc, 0, 1, buf));
+	ut_asserteq_str("this is a test", buf);
+
+	/* sequential reads which miss bring in the next entries too */
+	ut_asserteq(7, blk_dread(desc, 1, 7, buf));
+	ut_asserteq(8, blk_dread(desc, 8, 8, buf));
+	blkcache_stats(&stats);
+	ut_asserteq(2, stats.hits);
+	ut_asserteq(1, stats.misses);
+	ut_asserteq(0, stats.read_ahead);
+	ut_asserteq(8, blk_dread(desc, 16, 8, buf));
+	blkcache_stats(&stats);
+	ut_asserteq(0, stats.hits);
+	ut_asserteq(1, stats.misses);
+	ut_asserteq(8, stats.read_ahead);
+	ut_asserteq(4, stats.entries);
+	ut_asserteq(8, blk_dread(desc, 24, 8, buf));
+	blkcache_stats(&stats);
+	ut_asserteq(1, stats.hits);
+
+	/* entries are dropped to stay within the budget */
+	blkcache_configure(8, 8 * 512 * 2);
+	ut_asserteq(8, blk_dread(desc, 0, 8, buf));
+	ut_asserteq(8, blk_dread(desc, 8, 8, buf));
+	ut_asserteq(8, blk_dread(desc, 16, 8, buf));
+	blkcache_stats(&stats);
+	ut_asserteq(2, stats.entries);
+	ut_asserteq(8 * 512 * 2, stats.bytes);
+
+	/* bulk reads bypass the cache and leave its entries alone */
+	ut_asserteq(16, blk_dread(desc, 32, 16, buf));
+	ut_asserteq(1, blk_dread(desc, 16, 1, buf));
+	blkcache_stats(&stats);
+	ut_asserteq(1, stats.hits);
+	ut_asserteq(0, stats.misses);
+	ut_asserteq(2, stats.entries);
+
+	/* writing invalidates the cache */
+	ut_asserteq(1, blk_dwrite(desc, 0, 1, buf));
+	blkcache_stats(&stats);
+	ut_asserteq(0, stats.entries);
+
+	blkcache_configure(8, CONFIG_BLOCK_CACHE_SIZE << 10);
+
+	return 0;
+}
+DM_TEST(dm_test_blk_cache, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+#endif
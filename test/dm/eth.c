@@ -10,8 +10,11 @@
 #include <dm.h>
 #include <env.h>
 #include <fdtdec.h>
+#include <image.h>
 #include <malloc.h>
+#include <mapmem.h>
 #include <net.h>
+#include <net/tftp.h>
 #include <dm/test.h>
 #include <dm/device-internal.h>
 #include <dm/uclass-internal.h>
@@ -429,3 +432,393 @@ static int dm_test_eth_async_ping_reply(struct unit_test_state *uts)
 }
 
 DM_TEST(dm_test_eth_async_ping_reply, DM_TESTF_SCAN_FDT);
+
+static int dm_test_eth_arp_cache(struct unit_test_state *uts)
+{
+	struct eth_sandbox_priv *priv;
+	uchar ethaddr[ARP_HLEN];
+
+	net_ping_ip = string_to_ip("1.1.2.2");
+
+	/* The reply to the ARP request sent by ping is cached... */
+	env_set("ethact", "eth@10002000");
+	ut_assertok(net_loop(PING));
+
+	/* ...so a packet to the same host goes out without asking again */
+	ut_assertok(eth_init());
+	priv = dev_get_priv(eth_get_dev());
+	memset(ethaddr, 0, ARP_HLEN);
+	ut_asserteq(0, net_send_udp_packet(ethaddr, net_ping_ip, 1234, 1235,
+					   0));
+	ut_assertok(memcmp(priv->fake_host_hwaddr, ethaddr, ARP_HLEN));
+	eth_halt();
+
+	/* Later tests expect to see an ARP request go out */
+	arp_cache_flush();
+
+	return 0;
+}
+
+DM_TEST(dm_test_eth_arp_cache, DM_TESTF_SCAN_FDT);
+
+/*
+ * A TFTP server for the tests below. It ignores the options of requests, so
+ * blocks are always 512 bytes, and serves each transfer from its own port.
+ */
+#define SB_TFTP_PORT		69
+#define SB_TFTP_XFER_PORT	3000
+#define SB_TFTP_BLOCK		512
+
+enum {
+	SB_TFTP_RRQ	= 1,
+	SB_TFTP_DATA	= 3,
+	SB_TFTP_ACK	= 4,
+	SB_TFTP_ERROR	= 5,
+};
+
+static const struct {
+	const char *name;
+	int size;
+} sb_tftp_files[] = {
+	{ "small", 100 },
+	{ "even", 2 * SB_TFTP_BLOCK },
+	{ "big", 1300 },
+};
+
+/**
+ * struct sb_tftp_server - state of the TFTP server
+ *
+ * @uts: Test state, used by the ut_assert macros in the tx_handler
+ * @client_port: Port of the client for each transfer, by server port
+ * @file: File sent by each transfer
+ * @xfers: Number of transfers started
+ * @rejected: Number of transfers the client turned down
+ * @late_errors: Only say that a file is missing after answering the next
+ *	packet the client sends, so that it sees other files first
+ * @late_port: Client port still waiting for such an answer, or 0
+ */
+struct sb_tftp_server {
+	struct unit_test_state *uts;
+	int client_port[8];
+	int file[8];
+	int xfers;
+	int rejected;
+	bool late_errors;
+	int late_port;
+};
+
+static u8 sb_tftp_byte(int file, int offset)
+{
+	return offset * 3 + file * 41;
+}
+
+static int sb_tftp_reply(struct udevice *dev, int dport, int sport,
+			 u16 op, u16 arg, const void *data, int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct ethernet_hdr *eth;
+	struct ip_udp_hdr *ip;
+	__be16 *s;
+
+	if (priv->recv_packets >= PKTBUFSRX)
+		return -EOVERFLOW;
+
+	eth = (void *)priv->recv_packet_buffer[priv->recv_packets];
+	memcpy(eth->et_dest, net_ethaddr, ARP_HLEN);
+	memcpy(eth->et_src, priv->fake_host_hwaddr, ARP_HLEN);
+	eth->et_protlen = htons(PROT_IP);
+
+	ip = (void *)eth + ETHER_HDR_SIZE;
+	ip->ip_hl_v = 0x45;
+	ip->ip_tos = 0;
+	ip->ip_len = htons(IP_UDP_HDR_SIZE + 4 + len);
+	ip->ip_id = 0;
+	ip->ip_off = htons(IP_FLAGS_DFRAG);
+	ip->ip_ttl = 255;
+	ip->ip_p = IPPROTO_UDP;
+	ip->ip_sum = 0;
+	net_write_ip(&ip->ip_src, net_server_ip);
+	net_write_ip(&ip->ip_dst, net_ip);
+	ip->ip_sum = compute_ip_checksum(ip, IP_HDR_SIZE);
+	ip->udp_src = htons(sport);
+	ip->udp_dst = htons(dport);
+	ip->udp_len = htons(UDP_HDR_SIZE + 4 + len);
+	ip->udp_xsum = 0;
+
+	s = (__be16 *)(ip + 1);
+	s[0] = htons(op);
+	s[1] = htons(arg);
+	memcpy(s + 2, data, len);
+
+	priv->recv_packet_length[priv->recv_packets] =
+		ETHER_HDR_SIZE + IP_UDP_HDR_SIZE + 4 + len;
+	++priv->recv_packets;
+
+	return 0;
+}
+
+/* Send data block @block of transfer @xfer, the first block being 1 */
+static int sb_tftp_send_block(struct udevice *dev, struct sb_tftp_server *srv,
+			      int xfer, int block)
+{
+	int file = srv->file[xfer];
+	int offset = (block - 1) * SB_TFTP_BLOCK;
+	u8 data[SB_TFTP_BLOCK];
+	int i, len;
+
+	len = min(sb_tftp_files[file].size - offset, SB_TFTP_BLOCK);
+	for (i = 0; i < len; i++)
+		data[i] = sb_tftp_byte(file, offset + i);
+
+	return sb_tftp_reply(dev, srv->client_port[xfer],
+			     SB_TFTP_XFER_PORT + xfer, SB_TFTP_DATA, block,
+			     data, len);
+}
+
+static int sb_tftp_not_found(struct udevice *dev, int port)
+{
+	static const char msg[] = "File not found";
+
+	return sb_tftp_reply(dev, port, SB_TFTP_PORT, SB_TFTP_ERROR, 1, msg,
+			     sizeof(msg));
+}
+
+static int sb_tftp_handler(struct udevice *dev, void *packet,
+			   unsigned int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct sb_tftp_server *srv = priv->priv;
+	struct ethernet_hdr *eth = packet;
+	struct ip_udp_hdr *ip = packet + ETHER_HDR_SIZE;
+	__be16 *s = (__be16 *)(ip + 1);
+	/* Used by all of the ut_assert macros */
+	struct unit_test_state *uts = srv->uts;
+	int late_port = srv->late_port;
+	int sport, dport, xfer, file;
+	u16 block;
+
+	if (!sandbox_eth_arp_req_to_reply(dev, packet, len))
+		return 0;
+
+	if (ntohs(eth->et_protlen) != PROT_IP || ip->ip_p != IPPROTO_UDP)
+		return 0;
+
+	sport = ntohs(ip->udp_src);
+	dport = ntohs(ip->udp_dst);
+	xfer = dport - SB_TFTP_XFER_PORT;
+	srv->late_port = 0;
+
+	if (dport == SB_TFTP_PORT && ntohs(s[0]) == SB_TFTP_RRQ) {
+		for (file = 0; file < ARRAY_SIZE(sb_tftp_files); file++) {
+			if (!strcmp((char *)(s + 1), sb_tftp_files[file].name))
+				break;
+		}
+
+		if (file == ARRAY_SIZE(sb_tftp_files)) {
+			if (srv->late_errors)
+				srv->late_port = sport;
+			else
+				ut_assertok(sb_tftp_not_found(dev, sport));
+		} else {
+			ut_assert(srv->xfers < ARRAY_SIZE(srv->file));
+			xfer = srv->xfers++;
+			srv->client_port[xfer] = sport;
+			srv->file[xfer] = file;
+			ut_assertok(sb_tftp_send_block(dev, srv, xfer, 1));
+		}
+	} else if (xfer >= 0 && xfer < srv->xfers) {
+		ut_asserteq(srv->client_port[xfer], sport);
+
+		switch (ntohs(s[0])) {
+		case SB_TFTP_ACK:
+			block = ntohs(s[1]);
+			file = srv->file[xfer];
+			/* A file of whole blocks ends with an empty one */
+			if (block * SB_TFTP_BLOCK <= sb_tftp_files[file].size)
+				ut_assertok(sb_tftp_send_block(dev, srv, xfer,
+							       block + 1));
+			break;
+		case SB_TFTP_ERROR:
+			srv->rejected++;
+			break;
+		}
+	}
+
+	if (late_port)
+		ut_assertok(sb_tftp_not_found(dev, late_port));
+
+	return 0;
+}
+
+static int sb_tftp_start(struct unit_test_state *uts,
+			 struct sb_tftp_server *srv)
+{
+	memset(srv, '\0', sizeof(*srv));
+	srv->uts = uts;
+	sandbox_eth_set_tx_handler(0, sb_tftp_handler);
+	sandbox_eth_set_priv(0, srv);
+
+	env_set("ethact", "eth@10002000");
+	net_server_ip = string_to_ip("1.1.2.2");
+
+	return 0;
+}
+
+static void sb_tftp_stop(void)
+{
+	sandbox_eth_set_tx_handler(0, NULL);
+	net_server_ip.s_addr = 0;
+	/* Later tests expect to see an ARP request go out */
+	arp_cache_flush();
+}
+
+/* Check that file @file was loaded at @addr, and nothing after it */
+static int sb_tftp_check(struct unit_test_state *uts, ulong addr, int file)
+{
+	int size = sb_tftp_files[file].size;
+	u8 *buf = map_sysmem(addr, size + 1);
+	int i;
+
+	for (i = 0; i < size; i++)
+		ut_asserteq(sb_tftp_byte(file, i), buf[i]);
+	ut_asserteq(0, buf[size]);
+	unmap_sysmem(buf);
+
+	return 0;
+}
+
+static void sb_tftp_clear(ulong addr)
+{
+	void *buf = map_sysmem(addr, 0x1000);
+
+	memset(buf, '\0', 0x1000);
+	unmap_sysmem(buf);
+}
+
+static int dm_test_eth_tftp(struct unit_test_state *uts)
+{
+	struct sb_tftp_server srv;
+	ulong load_addr = image_load_addr;
+	int ret;
+
+	ut_assertok(sb_tftp_start(uts, &srv));
+	image_load_addr = 0x100000;
+	sb_tftp_clear(image_load_addr);
+
+	copy_filename(net_boot_file_name, "big", sizeof(net_boot_file_name));
+	ret = net_loop(TFTPGET);
+	image_load_addr = load_addr;
+	sb_tftp_stop();
+	ut_asserteq(1300, ret);
+	ut_assertok(sb_tftp_check(uts, 0x100000, 2));
+	ut_asserteq(1, srv.xfers);
+
+	ut_assertok(sb_tftp_start(uts, &srv));
+	copy_filename(net_boot_file_name, "missing",
+		      sizeof(net_boot_file_name));
+	ret = net_loop(TFTPGET);
+	sb_tftp_stop();
+	ut_assert(ret < 0);
+	ut_asserteq(0, srv.xfers);
+
+	return 0;
+}
+
+DM_TEST(dm_test_eth_tftp, DM_TESTF_SCAN_FDT);
+
+#ifdef CONFIG_TFTP_PARALLEL
+static int dm_test_eth_tftp_files(struct unit_test_state *uts)
+{
+	struct tftp_file files[] = {
+		{ .name = "big", .addr = 0x100000 },
+		{ .name = "small", .addr = 0x101000 },
+		{ .name = "even", .addr = 0x102000 },
+	};
+	struct sb_tftp_server srv;
+	int ret, i;
+
+	for (i = 0; i < ARRAY_SIZE(files); i++)
+		sb_tftp_clear(files[i].addr);
+
+	ut_assertok(sb_tftp_start(uts, &srv));
+	ret = tftp_get_files(files, ARRAY_SIZE(files), false);
+	sb_tftp_stop();
+	ut_assertok(ret);
+	ut_asserteq(3, srv.xfers);
+	ut_asserteq(0, srv.rejected);
+
+	ut_assertok(files[0].err);
+	ut_asserteq(1300, files[0].size);
+	ut_assertok(sb_tftp_check(uts, 0x100000, 2));
+	ut_assertok(files[1].err);
+	ut_asserteq(100, files[1].size);
+	ut_assertok(sb_tftp_check(uts, 0x101000, 0));
+	ut_assertok(files[2].err);
+	ut_asserteq(1024, files[2].size);
+	ut_assertok(sb_tftp_check(uts, 0x102000, 1));
+
+	/* One missing file fails the lot */
+	files[1].name = "missing";
+	ut_assertok(sb_tftp_start(uts, &srv));
+	ret = tftp_get_files(files, ARRAY_SIZE(files), false);
+	sb_tftp_stop();
+	ut_asserteq(-ENOENT, ret);
+	ut_asserteq(-ENOENT, files[1].err);
+
+	return 0;
+}
+
+DM_TEST(dm_test_eth_tftp_files, DM_TESTF_SCAN_FDT);
+
+static int dm_test_eth_tftp_first(struct unit_test_state *uts)
+{
+	struct tftp_file files[] = {
+		{ .name = "missing", .addr = 0x100000 },
+		{ .name = "even", .addr = 0x100000 },
+		{ .name = "big", .addr = 0x100000 },
+	};
+	struct sb_tftp_server srv;
+	ulong load_addr = image_load_addr;
+	int ret;
+
+	/* The first file that exists is loaded, the ones after are not */
+	sb_tftp_clear(0x100000);
+	ut_assertok(sb_tftp_start(uts, &srv));
+	ret = tftp_get_files(files, ARRAY_SIZE(files), true);
+	sb_tftp_stop();
+	ut_asserteq(1, ret);
+	ut_asserteq(-ENOENT, files[0].err);
+	ut_assertok(files[1].err);
+	ut_asserteq(1024, files[1].size);
+	ut_assertok(sb_tftp_check(uts, 0x100000, 1));
+	ut_asserteq(0x100000, image_load_addr);
+	ut_asserteq(1, srv.rejected);
+
+	/*
+	 * Hear about the second file before the first is known to be
+	 * missing: it must be given up and asked for again
+	 */
+	sb_tftp_clear(0x100000);
+	ut_assertok(sb_tftp_start(uts, &srv));
+	srv.late_errors = true;
+	ret = tftp_get_files(files, 2, true);
+	sb_tftp_stop();
+	image_load_addr = load_addr;
+	ut_asserteq(1, ret);
+	ut_asserteq(2, srv.xfers);
+	ut_asserteq(1, srv.rejected);
+	ut_assertok(sb_tftp_check(uts, 0x100000, 1));
+
+	/* None of the files exists */
+	files[1].name = "missing";
+	files[2].name = "missing";
+	ut_assertok(sb_tftp_start(uts, &srv));
+	ret = tftp_get_files(files, ARRAY_SIZE(files), true);
+	sb_tftp_stop();
+	ut_asserteq(-ENOENT, ret);
+
+	return 0;
+}
+
+DM_TEST(dm_test_eth_tftp_first, DM_TESTF_SCAN_FDT);
+#endif
@@ -4,7 +4,9 @@
  */
 
 #include <common.h>
+#include <bloblist.h>
 #include <dm.h>
+#include <env.h>
 #include <mmc.h>
 #include <dm/test.h>
 #include <test/ut.h>
@@ -41,3 +43,163 @@ static int dm_test_mmc_blk(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_mmc_blk, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+
+/* Test that multiple-block transfers are announced with SET_BLOCK_COUNT */
+static int dm_test_mmc_sbc(struct unit_test_state *uts)
+{
+	struct blk_desc *dev_desc;
+	struct udevice *dev;
+	struct mmc *mmc;
+	char cmp[1536];
+
+	ut_assertok(uclass_get_device(UCLASS_MMC, 0, &dev));
+	mmc = mmc_get_mmc_dev(dev);
+	ut_assert(mmc->sbc);
+
+	/* The emulation rejects a wrong count, and a stop after a count */
+	ut_assertok(blk_get_device_by_str("mmc", "0", &dev_desc));
+	memset(cmp, '\0', sizeof(cmp));
+	ut_asserteq(3, blk_dread(dev_desc, 0, 3, cmp));
+	ut_assertok(strcmp(cmp, "this is a test"));
+
+	/* Otherwise transfers are stopped */
+	mmc->sbc = false;
+	blkcache_invalidate(dev_desc->if_type, dev_desc->devnum);
+	memset(cmp, '\0', sizeof(cmp));
+	ut_asserteq(3, blk_dread(dev_desc, 0, 3, cmp));
+	ut_assertok(strcmp(cmp, "this is a test"));
+	mmc->sbc = true;
+
+	return 0;
+}
+DM_TEST(dm_test_mmc_sbc, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+
+/* Test that SD cards discard blocks by erasing them */
+static int dm_test_mmc_discard(struct unit_test_state *uts)
+{
+	struct blk_desc *dev_desc;
+	struct udevice *dev;
+
+	ut_assertok(uclass_get_device(UCLASS_MMC, 0, &dev));
+	ut_assertok(blk_get_device_by_str("mmc", "0", &dev_desc));
+	ut_assert(dev_desc->discard_zeroes);
+	ut_asserteq(100, blk_ddiscard(dev_desc, 10, 100));
+
+	return 0;
+}
+DM_TEST(dm_test_mmc_discard, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+
+#if CONFIG_IS_ENABLED(MMC_FAST_INIT)
+/* Test that a card is set up again with the settings it had last time */
+static int dm_test_mmc_fast_init(struct unit_test_state *uts)
+{
+	struct udevice *dev;
+	struct mmc *mmc;
+	char name[20], val[40], best[40];
+	u32 fp;
+
+	ut_assertok(uclass_get_device(UCLASS_MMC, 0, &dev));
+	mmc = mmc_get_mmc_dev(dev);
+	snprintf(name, sizeof(name), "mmc%d_fastinit",
+		 mmc_get_blk_desc(mmc)->devnum);
+
+	/* The settings are kept in the environment */
+	env_set(name, NULL);
+	mmc->has_init = 0;
+	ut_assertok(mmc_init(mmc));
+	ut_assert(mmc->fast_init_valid);
+	fp = mmc->fast_init.fingerprint;
+	snprintf(best, sizeof(best), "%x,%x,%x", fp, mmc->selected_mode,
+		 mmc->bus_width);
+	ut_asserteq_str(best, env_get(name));
+
+	/* Settings found for this card are used as they are */
+	snprintf(val, sizeof(val), "%s,5", best);
+	env_set(name, val);
+	mmc->fast_init_valid = false;
+	mmc->has_init = 0;
+	ut_assertok(mmc_init(mmc));
+	ut_assert(mmc->fast_init.tuned);
+	ut_asserteq(5, mmc->fast_init.tuning);
+	ut_asserteq_str(val, env_get(name));
+
+	/* Settings for another card are replaced */
+	snprintf(val, sizeof(val), "%x,%x,%x,5", ~fp, mmc->selected_mode,
+		 mmc->bus_width);
+	env_set(name, val);
+	mmc->fast_init_valid = false;
+	mmc->has_init = 0;
+	ut_assertok(mmc_init(mmc));
+	ut_assert(!mmc->fast_init.tuned);
+	ut_asserteq_str(best, env_get(name));
+
+	/* So are settings the card cannot use */
+	snprintf(val, sizeof(val), "%x,%x,8", fp, MMC_HS_400);
+	env_set(name, val);
+	mmc->fast_init_valid = false;
+	mmc->has_init = 0;
+	ut_assertok(mmc_init(mmc));
+	ut_asserteq_str(best, env_get(name));
+
+	/* And settings which cannot be parsed */
+	env_set(name, "1,2");
+	mmc->fast_init_valid = false;
+	mmc->has_init = 0;
+	ut_assertok(mmc_init(mmc));
+	ut_asserteq_str(best, env_get(name));
+
+	env_set(name, NULL);
+
+	return 0;
+}
+DM_TEST(dm_test_mmc_fast_init, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+#endif
+
+#if CONFIG_IS_ENABLED(MMC_HANDOFF)
+/* Test that a card left ready by SPL is taken over */
+static int dm_test_mmc_handoff(struct unit_test_state *uts)
+{
+	struct mmc_handoff *ho;
+	struct udevice *dev;
+	struct mmc *mmc;
+
+	ut_assertok(uclass_get_device(UCLASS_MMC, 0, &dev));
+	mmc = mmc_get_mmc_dev(dev);
+
+	/* Use an address which a full init would not give the card */
+	ut_assertok(mmc_write_handoff(mmc));
+	ho = bloblist_find(BLOBLISTT_MMC_HANDOFF, sizeof(*ho));
+	ut_assertnonnull(ho);
+	ut_asserteq(1, ho->valid);
+	ho->rca = 0x1234;
+	mmc->has_init = 0;
+	ut_assertok(mmc_init(mmc));
+	ut_asserteq(0x1234, mmc->rca);
+	ut_asserteq(0, ho->valid);
+
+	/* It is only taken over once */
+	mmc->has_init = 0;
+	ut_assertok(mmc_init(mmc));
+	ut_asserteq(0, mmc->rca);
+
+	/* Not if it is another card */
+	ut_assertok(mmc_write_handoff(mmc));
+	ho->rca = 0x1234;
+	ho->cid[0] ^= 1;
+	mmc->has_init = 0;
+	ut_assertok(mmc_init(mmc));
+	ut_asserteq(0, mmc->rca);
+
+	/* Nor for another host */
+	ut_assertok(mmc_write_handoff(mmc));
+	ho->rca = 0x1234;
+	ho->seq++;
+	mmc->has_init = 0;
+	ut_assertok(mmc_init(mmc));
+	ut_asserteq(0, mmc->rca);
+	ho->valid = 0;
+
+	return 0;
+}
+DM_TEST(dm_test_mmc_handoff, DM_TESTF_SCAN_PDATA | DM_TESTF_SCAN_FDT);
+#endif
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Unit tests for the IP checksum
+ *
+ * compute_ip_checksum() handles unaligned heads and odd tails separately
+ * and may hand the bulk of the data to an architecture-specific kernel, so
+ * it is checked against a simple reference for many alignments and lengths.
+ */
+
+#include <common.h>
+#include <malloc.h>
+#include <net.h>
+#include <test/lib.h>
+#include <test/test.h>
+#include <test/ut.h>
+
+/* Number of different alignment values */
+#define SWEEP 16
+/* Longest buffer checked at every alignment and length */
+#define MAXLEN 520
+#define BUFLEN (SWEEP + MAXLEN)
+/* Enough 0xff bytes to carry out of a 32-bit sum many times over */
+#define BIGLEN 0x40000
+
+/**
+ * ref_checksum() - reference IP checksum, as in RFC 1071
+ *
+ * @buf:	data
+ * @len:	length of data
+ * Return:	checksum in network byte order, as stored in a header
+ */
+static u16 ref_checksum(const u8 *buf, uint len)
+{
+	ulong sum = 0;
+	uint i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += (buf[i] << 8) | buf[i + 1];
+	if (len & 1)
+		sum += buf[len - 1] << 8;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return htons(~sum & 0xffff);
+}
+
+static void init_buffer(u8 buf[], uint len)
+{
+	u32 seed = 0x12345678;
+	uint i;
+
+	for (i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+static int lib_ip_checksum(struct unit_test_state *uts)
+{
+	u8 buf[BUFLEN];
+	uint offset, len;
+
+	init_buffer(buf, BUFLEN);
+	for (offset = 0; offset < SWEEP; offset++) {
+		for (len = 0; len <= MAXLEN; len++)
+			ut_asserteq(ref_checksum(buf + offset, len),
+				    compute_ip_checksum(buf + offset, len));
+	}
+
+	return 0;
+}
+
+LIB_TEST(lib_ip_checksum, 0);
+
+static int lib_ip_checksum_carry(struct unit_test_state *uts)
+{
+	uint offset;
+	u8 *buf;
+
+	buf = malloc(BIGLEN + SWEEP);
+	ut_assertnonnull(buf);
+	memset(buf, 0xff, BIGLEN + SWEEP);
+	for (offset = 0; offset < SWEEP; offset++) {
+		ut_asserteq(ref_checksum(buf + offset, BIGLEN),
+			    compute_ip_checksum(buf + offset, BIGLEN));
+		ut_asserteq(ref_checksum(buf + offset, BIGLEN - 1),
+			    compute_ip_checksum(buf + offset, BIGLEN - 1));
+	}
+	free(buf);
+
+	return 0;
+}
+
+LIB_TEST(lib_ip_checksum_carry, 0);
+
+static int lib_ip_checksum_add(struct unit_test_state *uts)
+{
+	u8 buf[BUFLEN];
+	uint sum, split;
+	u16 check;
+
+	init_buffer(buf, BUFLEN);
+	/* Sums of two parts, split at even and odd offsets, add up */
+	for (split = 0; split <= MAXLEN; split++) {
+		sum = add_ip_checksums(split,
+				       compute_ip_checksum(buf, split),
+				       compute_ip_checksum(buf + split,
+							   MAXLEN - split));
+		ut_asserteq(ref_checksum(buf, MAXLEN), sum);
+	}
+
+	/* A checksum stored in the data makes it sum up to zero */
+	buf[0] = 0;
+	buf[1] = 0;
+	check = compute_ip_checksum(buf, MAXLEN);
+	memcpy(buf, &check, sizeof(check));
+	ut_assert(ip_checksum_ok(buf, MAXLEN));
+	buf[MAXLEN - 1] ^= 1;
+	ut_assert(!ip_checksum_ok(buf, MAXLEN));
+
+	return 0;
+}
+
+LIB_TEST(lib_ip_checksum_add, 0);
@@ -14,6 +14,10 @@ supported_fs_ext = ['fat16', 'fat32']
 supported_fs_mkdir = ['fat16', 'fat32']
 supported_fs_unlink = ['fat16', 'fat32']
 supported_fs_symlink = ['ext4']
+supported_fs_erofs = ['erofs']
+supported_fs_squashfs = ['squashfs']
+supported_fs_mount_cache = ['ext4']
+supported_fs_htree = ['ext4']
 
 #
 # Filesystem test specific setup
@@ -50,6 +54,10 @@ def pytest_configure(config):
     global supported_fs_mkdir
     global supported_fs_unlink
     global supported_fs_symlink
+    global supported_fs_erofs
+    global supported_fs_squashfs
+    global supported_fs_mount_cache
+    global supported_fs_htree
 
     def intersect(listA, listB):
         return  [x for x in listA if x in listB]
@@ -62,6 +70,12 @@ def pytest_configure(config):
         supported_fs_mkdir =  intersect(supported_fs, supported_fs_mkdir)
         supported_fs_unlink =  intersect(supported_fs, supported_fs_unlink)
         supported_fs_symlink =  intersect(supported_fs, supported_fs_symlink)
+        supported_fs_erofs =  intersect(supported_fs, supported_fs_erofs)
+        supported_fs_squashfs =  intersect(supported_fs,
+                                           supported_fs_squashfs)
+        supported_fs_mount_cache =  intersect(supported_fs,
+                                              supported_fs_mount_cache)
+        supported_fs_htree =  intersect(supported_fs, supported_fs_htree)
 
 def pytest_generate_tests(metafunc):
     """Parametrize fixtures, fs_obj_xxx
@@ -90,6 +104,18 @@ def pytest_generate_tests(metafunc):
     if 'fs_obj_symlink' in metafunc.fixturenames:
         metafunc.parametrize('fs_obj_symlink', supported_fs_symlink,
             indirect=True, scope='module')
+    if 'fs_obj_erofs' in metafunc.fixturenames:
+        metafunc.parametrize('fs_obj_erofs', supported_fs_erofs,
+            indirect=True, scope='module')
+    if 'fs_obj_squashfs' in metafunc.fixturenames:
+        metafunc.parametrize('fs_obj_squashfs', supported_fs_squashfs,
+            indirect=True, scope='module')
+    if 'fs_obj_mount_cache' in metafunc.fixturenames:
+        metafunc.parametrize('fs_obj_mount_cache', supported_fs_mount_cache,
+            indirect=True, scope='module')
+    if 'fs_obj_htree' in metafunc.fixturenames:
+        metafunc.parametrize('fs_obj_htree', supported_fs_htree,
+            indirect=True, scope='module')
 
 #
 # Helper functions
@@ -600,3 +626,335 @@ def fs_obj_symlink(request, u_boot_config):
         call('rmdir %s' % mount_dir, shell=True)
         if fs_img:
             call('rm -f %s' % fs_img, shell=True)
+
+#
+# Fixture for erofs test
+#
+# NOTE: yield_fixture was deprecated since pytest-3.0
+@pytest.yield_fixture()
+def fs_obj_erofs(request, u_boot_config):
+    """Set up read-only EROFS images to be used in erofs test.
+
+    EROFS images are built from a directory by mkfs.erofs, so one image
+    is made with uncompressed files and another one with LZ4 clusters.
+
+    Args:
+        request: Pytest request object.
+        u_boot_config: U-boot configuration.
+
+    Return:
+        A fixture for erofs test, i.e. a triplet of file system type,
+        a list of volume file names and a list of MD5 hashes.
+    """
+    fs_type = request.param
+    fs_imgs = []
+
+    if not u_boot_config.buildconfig.get('config_fs_erofs', None):
+        pytest.skip('.config feature "FS_EROFS" not enabled')
+    if not tool_is_in_path('mkfs.erofs'):
+        pytest.skip('mkfs.erofs not found')
+
+    src_dir = u_boot_config.persistent_data_dir + '/erofs_src'
+
+    small_file = src_dir + '/' + SMALL_FILE
+    text_file = src_dir + '/' + TEXT_FILE
+
+    try:
+        check_call('rm -rf %s' % src_dir, shell=True)
+        check_call('mkdir -p %s/SUBDIR' % src_dir, shell=True)
+
+        # Create a small file which does not compress.
+        check_call('dd if=/dev/urandom of=%s bs=1M count=1'
+                   % small_file, shell=True)
+
+        # Create a text file which does.
+        check_call('seq 1 200000 > %s' % text_file, shell=True)
+
+        # A file in the subdirectory and a link to it
+        check_call('echo erofs > %s/SUBDIR/%s' % (src_dir, MIN_FILE),
+                   shell=True)
+        check_call('ln -s SUBDIR/%s %s/%s.link'
+                   % (MIN_FILE, src_dir, MIN_FILE), shell=True)
+
+        for comp in ['', '-zlz4']:
+            fs_img = '%s/%s%s.img' % (u_boot_config.persistent_data_dir,
+                                      fs_type, comp)
+            check_call('rm -f %s' % fs_img, shell=True)
+            fs_imgs.append(fs_img)
+            check_call('mkfs.erofs %s %s %s' % (comp, fs_img, src_dir),
+                       shell=True)
+
+        # Generate the md5sums of the whole files and of a partial read
+        # of the text file
+        out = check_output('md5sum %s' % small_file, shell=True).decode()
+        md5val = [out.split()[0]]
+        out = check_output('md5sum %s' % text_file, shell=True).decode()
+        md5val.extend([out.split()[0]])
+        out = check_output(
+            'dd if=%s bs=1 skip=%d count=%d 2> /dev/null | md5sum'
+            % (text_file, TEXT_OFFSET, TEXT_LENGTH), shell=True).decode()
+        md5val.extend([out.split()[0]])
+    except CalledProcessError:
+        pytest.skip('Setup failed for filesystem: ' + fs_type)
+        return
+    else:
+        yield [fs_type, fs_imgs, md5val]
+    finally:
+        call('rm -rf %s' % src_dir, shell=True)
+        for fs_img in fs_imgs:
+            call('rm -f %s' % fs_img, shell=True)
+
+#
+# Fixture for squashfs test
+#
+# NOTE: yield_fixture was deprecated since pytest-3.0
+@pytest.yield_fixture()
+def fs_obj_squashfs(request, u_boot_config):
+    """Set up read-only SquashFS images to be used in squashfs test.
+
+    SquashFS images are built from a directory by mksquashfs, one for each
+    compressor enabled in U-Boot which mksquashfs supports. The files take
+    whole blocks, compressed or not, sparse blocks and fragments.
+
+    Args:
+        request: Pytest request object.
+        u_boot_config: U-boot configuration.
+
+    Return:
+        A fixture for squashfs test, i.e. a triplet of file system type,
+        a list of volume file names and a list of MD5 hashes.
+    """
+    fs_type = request.param
+    fs_imgs = []
+
+    if not u_boot_config.buildconfig.get('config_fs_squashfs', None):
+        pytest.skip('.config feature "FS_SQUASHFS" not enabled')
+    if not tool_is_in_path('mksquashfs'):
+        pytest.skip('mksquashfs not found')
+
+    src_dir = u_boot_config.persistent_data_dir + '/squashfs_src'
+
+    small_file = src_dir + '/' + SMALL_FILE
+    medium_file = src_dir + '/' + MEDIUM_FILE
+    text_file = src_dir + '/' + TEXT_FILE
+
+    try:
+        check_call('rm -rf %s' % src_dir, shell=True)
+        check_call('mkdir -p %s/SUBDIR %s/%s'
+                   % (src_dir, src_dir, MANY_DIR), shell=True)
+
+        # Create a small file which does not compress.
+        check_call('dd if=/dev/urandom of=%s bs=1M count=1'
+                   % small_file, shell=True)
+
+        # Create a text file which does, with its tail in a fragment,
+        # and a hard link to it, which takes an extended inode.
+        check_call('seq 1 200000 > %s' % text_file, shell=True)
+        check_call('ln %s %s/SUBDIR/%s.hard' % (text_file, src_dir, TEXT_FILE),
+                   shell=True)
+
+        # Create a medium file of random data, a hole, text and a hole
+        check_call('dd if=/dev/urandom of=%s bs=1M count=4'
+                   % medium_file, shell=True)
+        check_call('dd if=%s of=%s bs=1M seek=8 conv=notrunc'
+                   % (text_file, medium_file), shell=True)
+        check_call('truncate -s 10M %s' % medium_file, shell=True)
+
+        # A file in the subdirectory, a link to it and one to the
+        # subdirectory
+        check_call('echo squashfs > %s/SUBDIR/%s' % (src_dir, MIN_FILE),
+                   shell=True)
+        check_call('ln -s SUBDIR/%s %s/%s.link'
+                   % (MIN_FILE, src_dir, MIN_FILE), shell=True)
+        check_call('ln -s SUBDIR %s/LINKDIR' % src_dir, shell=True)
+
+        # A directory large enough to be indexed
+        for i in range(MANY_FILES):
+            with open('%s/%s/file%03d' % (src_dir, MANY_DIR, i), 'w') as f:
+                f.write('%d\n' % i)
+
+        for comp in ['gzip', 'lz4', 'lzo', 'zstd']:
+            if comp != 'gzip' and not u_boot_config.buildconfig.get(
+                    'config_fs_squashfs_' + comp, None):
+                continue
+            fs_img = '%s/%s-%s.img' % (u_boot_config.persistent_data_dir,
+                                       fs_type, comp)
+            check_call('rm -f %s' % fs_img, shell=True)
+            # mksquashfs may be built without this compressor
+            if call('mksquashfs %s %s -comp %s -noappend -no-progress'
+                    % (src_dir, fs_img, comp), shell=True):
+                continue
+            fs_imgs.append(fs_img)
+        if not fs_imgs:
+            pytest.skip('mksquashfs supports no compressor enabled')
+
+        # Generate the md5sums of the whole files and of partial reads
+        # of the text and medium files
+        md5val = []
+        for f in [small_file, text_file, medium_file]:
+            out = check_output('md5sum %s' % f, shell=True).decode()
+            md5val.extend([out.split()[0]])
+        out = check_output(
+            'dd if=%s bs=1 skip=%d count=%d 2> /dev/null | md5sum'
+            % (text_file, TEXT_OFFSET, TEXT_LENGTH), shell=True).decode()
+        md5val.extend([out.split()[0]])
+        out = check_output(
+            'dd if=%s bs=1 skip=%d count=%d 2> /dev/null | md5sum'
+            % (medium_file, MEDIUM_OFFSET, MEDIUM_LENGTH),
+            shell=True).decode()
+        md5val.extend([out.split()[0]])
+    except CalledProcessError:
+        pytest.skip('Setup failed for filesystem: ' + fs_type)
+        return
+    else:
+        yield [fs_type, fs_imgs, md5val]
+    finally:
+        call('rm -rf %s' % src_dir, shell=True)
+        for fs_img in fs_imgs:
+            call('rm -f %s' % fs_img, shell=True)
+
+#
+# Fixture for mount cache test
+#
+# NOTE: yield_fixture was deprecated since pytest-3.0
+@pytest.yield_fixture()
+def fs_obj_mount_cache(request, u_boot_config):
+    """Set up a disk image to be used in mount cache test.
+
+    The image is left without a partition table, for the test to write one
+    describing a partition at MOUNT_CACHE_PART_START, which already holds
+    a file system made by mkfs from a directory.
+
+    Args:
+        request: Pytest request object.
+        u_boot_config: U-boot configuration.
+
+    Return:
+        A fixture for mount cache test, i.e. a triplet of file system type,
+        a volume file name and a list of MD5 hashes.
+    """
+    fs_type = request.param
+    fs_img = '%s/mount_cache.%s.img' % (u_boot_config.persistent_data_dir,
+                                        fs_type)
+    part_img = fs_img + '.part'
+    src_dir = u_boot_config.persistent_data_dir + '/mount_cache_src'
+
+    if not u_boot_config.buildconfig.get('config_fs_mount_cache', None):
+        pytest.skip('.config feature "FS_MOUNT_CACHE" not enabled')
+    if not u_boot_config.buildconfig.get('config_cmd_gpt', None):
+        pytest.skip('.config feature "CMD_GPT" not enabled')
+    check_ubconfig(u_boot_config, fs_type)
+
+    try:
+        check_call('rm -rf %s' % src_dir, shell=True)
+        check_call('mkdir -p %s' % src_dir, shell=True)
+        check_call('dd if=/dev/urandom of=%s/%s bs=1K count=20'
+                   % (src_dir, MIN_FILE), shell=True)
+
+        check_call('rm -f %s %s' % (fs_img, part_img), shell=True)
+        check_call('mkfs.%s -q -O ^metadata_csum -d %s %s %dK'
+                   % (fs_type, src_dir, part_img,
+                      MOUNT_CACHE_PART_SIZE // 1024), shell=True)
+        check_call('dd if=/dev/zero of=%s bs=1M count=%d'
+                   % (fs_img, MOUNT_CACHE_DISK_SIZE // 1048576), shell=True)
+        check_call('dd if=%s of=%s bs=1K seek=%d conv=notrunc'
+                   % (part_img, fs_img, MOUNT_CACHE_PART_START // 1024),
+                   shell=True)
+
+        out = check_output('md5sum %s/%s' % (src_dir, MIN_FILE),
+                           shell=True).decode()
+        md5val = [out.split()[0]]
+    except CalledProcessError:
+        pytest.skip('Setup failed for filesystem: ' + fs_type)
+        return
+    else:
+        yield [fs_type, fs_img, md5val]
+    finally:
+        call('rm -rf %s %s' % (src_dir, part_img), shell=True)
+        call('rm -f %s' % fs_img, shell=True)
+
+#
+# Fixture for htree test
+#
+# NOTE: yield_fixture was deprecated since pytest-3.0
+@pytest.yield_fixture()
+def fs_obj_htree(request, u_boot_config):
+    """Set up ext4 images with directories indexed by a hash tree.
+
+    mkfs does not index the directories it fills from a source directory,
+    so e2fsck -D indexes them afterwards, in one image for each hash
+    function the index may use, signed and unsigned. The index of MANY_DIR
+    has one level and that of DEEP_DIR two. MANY_DIR also holds a name
+    with non-ASCII characters, whose hash depends on the signedness; the
+    console only takes ASCII, so it is reached through a symbolic link.
+
+    Args:
+        request: Pytest request object.
+        u_boot_config: U-boot configuration.
+
+    Return:
+        A fixture for htree test, i.e. a triplet of file system type,
+        a list of volume file names and the content of the file with the
+        non-ASCII name.
+    """
+    fs_type = request.param
+    fs_imgs = []
+    utf8_name = 'fich\u00e9s-\u00e0-\u00e9t\u00e9'
+
+    check_ubconfig(u_boot_config, fs_type)
+    for tool in ['mkfs.ext4', 'tune2fs', 'debugfs', 'e2fsck']:
+        if not tool_is_in_path(tool):
+            pytest.skip('%s not found' % tool)
+
+    src_dir = u_boot_config.persistent_data_dir + '/htree_src'
+
+    try:
+        check_call('rm -rf %s' % src_dir, shell=True)
+        check_call('mkdir -p %s/%s %s/%s'
+                   % (src_dir, MANY_DIR, src_dir, DEEP_DIR), shell=True)
+        for i in range(MANY_FILES):
+            with open('%s/%s/file%03d' % (src_dir, MANY_DIR, i), 'w') as f:
+                f.write('%d\n' % i)
+        with open('%s/%s/%s' % (src_dir, MANY_DIR, utf8_name), 'w',
+                  encoding='utf-8') as f:
+            f.write('%s\n' % utf8_name)
+        os.symlink('%s/%s' % (MANY_DIR, utf8_name), '%s/utf8.link' % src_dir)
+        for i in range(DEEP_FILES):
+            with open('%s/%s/%s%04d' % (src_dir, DEEP_DIR, DEEP_PREFIX, i),
+                      'w') as f:
+                f.write('%d\n' % i)
+
+        for hash_alg in ['legacy', 'half_md4', 'tea']:
+            for signedness in ['signed', 'unsigned']:
+                fs_img = '%s/htree-%s-%s.%s.img' % (
+                    u_boot_config.persistent_data_dir, hash_alg, signedness,
+                    fs_type)
+                check_call('rm -f %s' % fs_img, shell=True)
+                check_call('mkfs.%s -q -b 1024 -O ^metadata_csum -d %s %s 16M'
+                           % (fs_type, src_dir, fs_img), shell=True)
+                fs_imgs.append(fs_img)
+                # EXT2_FLAGS_SIGNED_HASH or EXT2_FLAGS_UNSIGNED_HASH
+                check_call('debugfs -w -R "ssv flags %d" %s'
+                           % (1 if signedness == 'signed' else 2, fs_img),
+                           shell=True)
+                check_call('tune2fs -E hash_alg=%s %s'
+                           % (hash_alg, fs_img), shell=True)
+                # e2fsck exits with 1 when it has changed the file system
+                if call('e2fsck -fyD %s' % fs_img, shell=True) not in [0, 1]:
+                    raise CalledProcessError(1, 'e2fsck')
+
+                # Make sure the index is there, with the levels expected
+                for d, levels in [(MANY_DIR, 0), (DEEP_DIR, 1)]:
+                    out = check_output('debugfs -R "htree %s" %s 2> /dev/null'
+                                       % (d, fs_img), shell=True).decode()
+                    if 'Indirect levels: %d' % levels not in out:
+                        pytest.skip('e2fsck did not index %s' % d)
+    except CalledProcessError:
+        pytest.skip('Setup failed for filesystem: ' + fs_type)
+        return
+    else:
+        yield [fs_type, fs_imgs, ('%s\n' % utf8_name).encode()]
+    finally:
+        call('rm -rf %s' % src_dir, shell=True)
+        for fs_img in fs_imgs:
+            call('rm -f %s' % fs_img, shell=True)
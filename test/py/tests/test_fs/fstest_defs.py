@@ -14,3 +14,32 @@ BIG_FILE='2.5GB.file'
 
 ADDR=0x01000008
 LENGTH=0x00100000
+
+# $TEXT_FILE is the name of a compressible text file in the EROFS and
+# SquashFS images; TEXT_OFFSET and TEXT_LENGTH are an unaligned part of it
+# read on its own
+TEXT_FILE='text.file'
+TEXT_OFFSET=0x12345
+TEXT_LENGTH=0x23456
+
+# MEDIUM_OFFSET and MEDIUM_LENGTH are a part of $MEDIUM_FILE in the SquashFS
+# images which goes from random data into a hole
+MEDIUM_OFFSET=0x3ff123
+MEDIUM_LENGTH=0x2000
+
+# $MANY_DIR is a directory of the SquashFS and htree images holding
+# MANY_FILES files, enough for the directory to have an index
+MANY_DIR='MANYDIR'
+MANY_FILES=300
+
+# $DEEP_DIR is a directory of the htree images holding DEEP_FILES files
+# with long names, enough for its index to take two levels
+DEEP_DIR='DEEPDIR'
+DEEP_FILES=3000
+DEEP_PREFIX='f' * 40
+
+# The disk image of the mount cache test holds a partition of
+# MOUNT_CACHE_PART_SIZE bytes at MOUNT_CACHE_PART_START
+MOUNT_CACHE_DISK_SIZE=8 * 1024 * 1024
+MOUNT_CACHE_PART_START=1024 * 1024
+MOUNT_CACHE_PART_SIZE=4 * 1024 * 1024
@@ -0,0 +1,100 @@
+# SPDX-License-Identifier:      GPL-2.0+
+#
+# U-Boot File System:EROFS Test
+
+"""
+This test verifies read access to EROFS images, uncompressed and with
+LZ4 compressed files.
+"""
+
+import pytest
+from fstest_defs import *
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.slow
+class TestErofs(object):
+    def test_erofs1(self, u_boot_console, fs_obj_erofs):
+        """
+        Test Case 1 - ls command, listing a root directory and a sub one
+        """
+        fs_type, fs_imgs, md5val = fs_obj_erofs
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 1 - ls %s' % fs_img):
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'ls host 0:0'])
+                assert(SMALL_FILE in ''.join(output))
+                assert(TEXT_FILE in ''.join(output))
+                assert('SUBDIR/' in ''.join(output))
+
+                output = u_boot_console.run_command(
+                    'ls host 0:0 /SUBDIR')
+                assert(MIN_FILE in output)
+
+    def test_erofs2(self, u_boot_console, fs_obj_erofs):
+        """
+        Test Case 2 - size command for files
+        """
+        fs_type, fs_imgs, md5val = fs_obj_erofs
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 2 - size %s' % fs_img):
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'size host 0:0 /%s' % SMALL_FILE,
+                    'printenv filesize'])
+                assert('filesize=100000' in ''.join(output))
+
+    def test_erofs3(self, u_boot_console, fs_obj_erofs):
+        """
+        Test Case 3 - load whole files
+        """
+        fs_type, fs_imgs, md5val = fs_obj_erofs
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 3 - load %s' % fs_img):
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'load host 0:0 %x /%s' % (ADDR, SMALL_FILE),
+                    'md5sum %x $filesize' % ADDR,
+                    'setenv filesize'])
+                assert(md5val[0] in ''.join(output))
+
+                output = u_boot_console.run_command_list([
+                    'load host 0:0 %x /%s' % (ADDR, TEXT_FILE),
+                    'md5sum %x $filesize' % ADDR,
+                    'setenv filesize'])
+                assert(md5val[1] in ''.join(output))
+
+    def test_erofs4(self, u_boot_console, fs_obj_erofs):
+        """
+        Test Case 4 - load a part of a file at an unaligned offset
+        """
+        fs_type, fs_imgs, md5val = fs_obj_erofs
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 4 - load part %s'
+                                            % fs_img):
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'load host 0:0 %x /%s %x %x'
+                        % (ADDR, TEXT_FILE, TEXT_LENGTH, TEXT_OFFSET),
+                    'printenv filesize',
+                    'md5sum %x $filesize' % ADDR,
+                    'setenv filesize'])
+                assert('filesize=%x' % TEXT_LENGTH in ''.join(output))
+                assert(md5val[2] in ''.join(output))
+
+    def test_erofs5(self, u_boot_console, fs_obj_erofs):
+        """
+        Test Case 5 - follow a symbolic link and fail on a missing file
+        """
+        fs_type, fs_imgs, md5val = fs_obj_erofs
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 5 - link %s' % fs_img):
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'load host 0:0 %x /%s.link' % (ADDR, MIN_FILE),
+                    'printenv filesize'])
+                assert('filesize=6' in ''.join(output))
+
+                output = u_boot_console.run_command(
+                    'load host 0:0 %x /nonexistent' % ADDR)
+                assert('File not found' in output)
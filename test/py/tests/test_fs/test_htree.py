@@ -0,0 +1,87 @@
+# SPDX-License-Identifier:      GPL-2.0+
+#
+# U-Boot File System:ext4 Hash Tree Test
+
+"""
+This test verifies name lookups in ext4 directories indexed by a hash
+tree, with each hash function, signed and unsigned, and with one and two
+levels of index.
+"""
+
+import pytest
+import re
+from fstest_defs import *
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.slow
+class TestHtree(object):
+    def test_htree1(self, u_boot_console, fs_obj_htree):
+        """
+        Test Case 1 - ls command, listing an indexed directory
+        """
+        fs_type, fs_imgs, utf8_data = fs_obj_htree
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 1 - ls %s' % fs_img):
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'ls host 0:0 /%s' % MANY_DIR])
+                assert(len(re.findall(r' file\d{3}\b', ''.join(output)))
+                       == MANY_FILES)
+
+    def test_htree2(self, u_boot_console, fs_obj_htree):
+        """
+        Test Case 2 - size command, looking names up through the index
+        """
+        fs_type, fs_imgs, utf8_data = fs_obj_htree
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 2 - size %s' % fs_img):
+                output = u_boot_console.run_command(
+                    'host bind 0 %s' % fs_img)
+                for i in range(0, MANY_FILES, 37):
+                    output = u_boot_console.run_command_list([
+                        'size host 0:0 /%s/file%03d' % (MANY_DIR, i),
+                        'printenv filesize'])
+                    assert('filesize=%x' % len('%d\n' % i)
+                           in ''.join(output))
+
+                for i in range(0, DEEP_FILES, 299):
+                    output = u_boot_console.run_command_list([
+                        'size host 0:0 /%s/%s%04d'
+                            % (DEEP_DIR, DEEP_PREFIX, i),
+                        'printenv filesize'])
+                    assert('filesize=%x' % len('%d\n' % i)
+                           in ''.join(output))
+
+                # The link leads to the name with non-ASCII characters
+                output = u_boot_console.run_command_list([
+                    'size host 0:0 /utf8.link',
+                    'printenv filesize'])
+                assert('filesize=%x' % len(utf8_data) in ''.join(output))
+
+    def test_htree3(self, u_boot_console, fs_obj_htree):
+        """
+        Test Case 3 - load files found through the index, and fail on
+        missing names
+        """
+        fs_type, fs_imgs, utf8_data = fs_obj_htree
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 3 - load %s' % fs_img):
+                i = DEEP_FILES - 1
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'mw.b %x 00 10' % ADDR,
+                    'load host 0:0 %x /%s/%s%04d'
+                        % (ADDR, DEEP_DIR, DEEP_PREFIX, i),
+                    'md.b %x 5' % ADDR])
+                assert('%d bytes read' % len('%d\n' % i) in ''.join(output))
+                assert('32 39 39 39 0a' in ''.join(output))
+
+                output = u_boot_console.run_command(
+                    'load host 0:0 %x /%s/file%03d || echo not found'
+                        % (ADDR, MANY_DIR, MANY_FILES))
+                assert('not found' in output)
+
+                output = u_boot_console.run_command(
+                    'load host 0:0 %x /%s/%s%04d || echo not found'
+                        % (ADDR, DEEP_DIR, DEEP_PREFIX, DEEP_FILES))
+                assert('not found' in output)
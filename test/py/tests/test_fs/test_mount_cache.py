@@ -0,0 +1,137 @@
+# SPDX-License-Identifier:      GPL-2.0+
+#
+# U-Boot File System:Mount Cache Test
+
+"""
+This test verifies that the file system last used stays mounted for the
+next command on the same partition, and that it is mounted again once the
+device may have changed.
+
+Whether the mount is reused is told by wiping the superblock behind the
+back of U-Boot: a kept mount goes on working, while mounting again fails.
+The block cache would hide the change, so it is disabled meanwhile.
+"""
+
+import pytest
+from fstest_defs import *
+
+# The ext4 superblock is 1024 bytes long and 1024 bytes into the volume
+SB_OFFSET = MOUNT_CACHE_PART_START + 1024
+SB_SIZE = 1024
+
+def wipe_sb(fs_img):
+    """Zero the superblock in the image, returning what it held"""
+    with open(fs_img, 'r+b') as f:
+        f.seek(SB_OFFSET)
+        sb = f.read(SB_SIZE)
+        f.seek(SB_OFFSET)
+        f.write(b'\x00' * SB_SIZE)
+    return sb
+
+def restore_sb(fs_img, sb):
+    with open(fs_img, 'r+b') as f:
+        f.seek(SB_OFFSET)
+        f.write(sb)
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_block_cache')
+@pytest.mark.slow
+class TestMountCache(object):
+    def setup_disk(self, u_boot_console, fs_img):
+        """Bind the image and give it a partition table"""
+        parts = 'name=fs,start=%d,size=%d' % (MOUNT_CACHE_PART_START,
+                                              MOUNT_CACHE_PART_SIZE)
+        u_boot_console.run_command_list([
+            'blkcache configure 0 0',
+            'host bind 0 %s' % fs_img,
+            'setenv mc_parts "%s"' % parts,
+            'gpt write host 0 "$mc_parts"',
+            # read the new partition table
+            'host bind 0 %s' % fs_img])
+
+    def test_mount_cache1(self, u_boot_console, fs_obj_mount_cache):
+        """
+        Test Case 1 - the mount is reused by ls, load and size
+        """
+        fs_type, fs_img, md5val = fs_obj_mount_cache
+        with u_boot_console.log.section('Test Case 1 - reuse'):
+            self.setup_disk(u_boot_console, fs_img)
+            output = u_boot_console.run_command('ls host 0:1 /')
+            assert(MIN_FILE in output)
+
+            sb = wipe_sb(fs_img)
+            output = u_boot_console.run_command('ls host 0:1 /')
+            assert(MIN_FILE in output)
+            output = u_boot_console.run_command_list([
+                'load host 0:1 %x /%s' % (ADDR, MIN_FILE),
+                'md5sum %x $filesize' % ADDR,
+                'size host 0:1 /%s' % MIN_FILE,
+                'printenv filesize'])
+            assert(md5val[0] in ''.join(output))
+            assert('filesize=5000' in ''.join(output))
+            restore_sb(fs_img, sb)
+
+    def test_mount_cache2(self, u_boot_console, fs_obj_mount_cache):
+        """
+        Test Case 2 - writing to the device drops the mount
+        """
+        fs_type, fs_img, md5val = fs_obj_mount_cache
+        with u_boot_console.log.section('Test Case 2 - block write'):
+            self.setup_disk(u_boot_console, fs_img)
+            output = u_boot_console.run_command('ls host 0:1 /')
+            assert(MIN_FILE in output)
+
+            # Only the partition table is written, not the file system
+            sb = wipe_sb(fs_img)
+            output = u_boot_console.run_command_list([
+                'gpt write host 0 "$mc_parts"',
+                'ls host 0:1 /'])
+            assert(MIN_FILE not in ''.join(output))
+            restore_sb(fs_img, sb)
+
+            output = u_boot_console.run_command('ls host 0:1 /')
+            assert(MIN_FILE in output)
+
+    def test_mount_cache3(self, u_boot_console, fs_obj_mount_cache):
+        """
+        Test Case 3 - writing a file drops the mount
+        """
+        fs_type, fs_img, md5val = fs_obj_mount_cache
+        with u_boot_console.log.section('Test Case 3 - file write'):
+            self.setup_disk(u_boot_console, fs_img)
+            output = u_boot_console.run_command_list([
+                'load host 0:1 %x /%s' % (ADDR, MIN_FILE),
+                '%swrite host 0:1 %x /%s.w $filesize'
+                    % (fs_type, ADDR, MIN_FILE)])
+            assert('20480 bytes written' in ''.join(output))
+
+            sb = wipe_sb(fs_img)
+            output = u_boot_console.run_command('ls host 0:1 /')
+            assert(MIN_FILE not in output)
+            restore_sb(fs_img, sb)
+
+            output = u_boot_console.run_command('ls host 0:1 /')
+            assert('%s.w' % MIN_FILE in output)
+
+    def test_mount_cache4(self, u_boot_console, fs_obj_mount_cache):
+        """
+        Test Case 4 - binding the device again drops the mount
+        """
+        fs_type, fs_img, md5val = fs_obj_mount_cache
+        with u_boot_console.log.section('Test Case 4 - rescan'):
+            self.setup_disk(u_boot_console, fs_img)
+            output = u_boot_console.run_command('ls host 0:1 /')
+            assert(MIN_FILE in output)
+
+            sb = wipe_sb(fs_img)
+            output = u_boot_console.run_command_list([
+                'host bind 0 %s' % fs_img,
+                'ls host 0:1 /'])
+            assert(MIN_FILE not in ''.join(output))
+            restore_sb(fs_img, sb)
+
+            # The new device mounts the file system afresh
+            output = u_boot_console.run_command_list([
+                'ls host 0:1 /',
+                'blkcache configure 8 %d' % (256 * 1024)])
+            assert(MIN_FILE in ''.join(output))
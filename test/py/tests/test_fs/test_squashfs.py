@@ -0,0 +1,156 @@
+# SPDX-License-Identifier:      GPL-2.0+
+#
+# U-Boot File System:SquashFS Test
+
+"""
+This test verifies read access to SquashFS images made with each of the
+gzip, LZ4, LZO and Zstandard compressors.
+"""
+
+import pytest
+from fstest_defs import *
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.slow
+class TestSquashfs(object):
+    def test_squashfs1(self, u_boot_console, fs_obj_squashfs):
+        """
+        Test Case 1 - ls command, listing a root directory and a sub one
+        """
+        fs_type, fs_imgs, md5val = fs_obj_squashfs
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 1 - ls %s' % fs_img):
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'ls host 0:0'])
+                assert(SMALL_FILE in ''.join(output))
+                assert(MEDIUM_FILE in ''.join(output))
+                assert(TEXT_FILE in ''.join(output))
+                assert('SUBDIR/' in ''.join(output))
+
+                output = u_boot_console.run_command(
+                    'ls host 0:0 /SUBDIR')
+                assert(MIN_FILE in output)
+                assert('%s.hard' % TEXT_FILE in output)
+
+    def test_squashfs2(self, u_boot_console, fs_obj_squashfs):
+        """
+        Test Case 2 - size command for files
+        """
+        fs_type, fs_imgs, md5val = fs_obj_squashfs
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 2 - size %s' % fs_img):
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'size host 0:0 /%s' % SMALL_FILE,
+                    'printenv filesize'])
+                assert('filesize=100000' in ''.join(output))
+
+                output = u_boot_console.run_command_list([
+                    'size host 0:0 /%s' % MEDIUM_FILE,
+                    'printenv filesize'])
+                assert('filesize=a00000' in ''.join(output))
+
+    def test_squashfs3(self, u_boot_console, fs_obj_squashfs):
+        """
+        Test Case 3 - load whole files, with blocks stored as they are,
+        compressed, sparse and in fragments
+        """
+        fs_type, fs_imgs, md5val = fs_obj_squashfs
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 3 - load %s' % fs_img):
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'load host 0:0 %x /%s' % (ADDR, SMALL_FILE),
+                    'md5sum %x $filesize' % ADDR,
+                    'setenv filesize'])
+                assert(md5val[0] in ''.join(output))
+
+                output = u_boot_console.run_command_list([
+                    'load host 0:0 %x /%s' % (ADDR, TEXT_FILE),
+                    'md5sum %x $filesize' % ADDR,
+                    'setenv filesize'])
+                assert(md5val[1] in ''.join(output))
+
+                output = u_boot_console.run_command_list([
+                    'load host 0:0 %x /SUBDIR/%s.hard' % (ADDR, TEXT_FILE),
+                    'md5sum %x $filesize' % ADDR,
+                    'setenv filesize'])
+                assert(md5val[1] in ''.join(output))
+
+                output = u_boot_console.run_command_list([
+                    'load host 0:0 %x /%s' % (ADDR, MEDIUM_FILE),
+                    'md5sum %x $filesize' % ADDR,
+                    'setenv filesize'])
+                assert(md5val[2] in ''.join(output))
+
+    def test_squashfs4(self, u_boot_console, fs_obj_squashfs):
+        """
+        Test Case 4 - load parts of files at unaligned offsets
+        """
+        fs_type, fs_imgs, md5val = fs_obj_squashfs
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 4 - load part %s'
+                                            % fs_img):
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'load host 0:0 %x /%s %x %x'
+                        % (ADDR, TEXT_FILE, TEXT_LENGTH, TEXT_OFFSET),
+                    'printenv filesize',
+                    'md5sum %x $filesize' % ADDR,
+                    'setenv filesize'])
+                assert('filesize=%x' % TEXT_LENGTH in ''.join(output))
+                assert(md5val[3] in ''.join(output))
+
+                output = u_boot_console.run_command_list([
+                    'load host 0:0 %x /%s %x %x'
+                        % (ADDR, MEDIUM_FILE, MEDIUM_LENGTH, MEDIUM_OFFSET),
+                    'printenv filesize',
+                    'md5sum %x $filesize' % ADDR,
+                    'setenv filesize'])
+                assert('filesize=%x' % MEDIUM_LENGTH in ''.join(output))
+                assert(md5val[4] in ''.join(output))
+
+    def test_squashfs5(self, u_boot_console, fs_obj_squashfs):
+        """
+        Test Case 5 - follow symbolic links to a file and through a
+        directory, and fail on a missing file
+        """
+        fs_type, fs_imgs, md5val = fs_obj_squashfs
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 5 - link %s' % fs_img):
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'load host 0:0 %x /%s.link' % (ADDR, MIN_FILE),
+                    'printenv filesize'])
+                assert('filesize=9' in ''.join(output))
+
+                output = u_boot_console.run_command_list([
+                    'load host 0:0 %x /LINKDIR/%s' % (ADDR, MIN_FILE),
+                    'printenv filesize'])
+                assert('filesize=9' in ''.join(output))
+
+                output = u_boot_console.run_command(
+                    'load host 0:0 %x /nonexistent' % ADDR)
+                assert('File not found' in output)
+
+    def test_squashfs6(self, u_boot_console, fs_obj_squashfs):
+        """
+        Test Case 6 - look files up in a directory with an index
+        """
+        fs_type, fs_imgs, md5val = fs_obj_squashfs
+        for fs_img in fs_imgs:
+            with u_boot_console.log.section('Test Case 6 - lookup %s'
+                                            % fs_img):
+                output = u_boot_console.run_command(
+                    'host bind 0 %s' % fs_img)
+                for i in [0, MANY_FILES // 2, MANY_FILES - 1]:
+                    output = u_boot_console.run_command_list([
+                        'size host 0:0 /%s/file%03d' % (MANY_DIR, i),
+                        'printenv filesize'])
+                    assert('filesize=%x' % len('%d\n' % i)
+                           in ''.join(output))
+
+                output = u_boot_console.run_command(
+                    'ls host 0:0 /%s' % MANY_DIR)
+                assert('%d file(s)' % MANY_FILES in output)